@@ -0,0 +1,125 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <string.h>
+#include <tchar.h>
+#include "util/fmt.h"
+#include "tapeio/crc32.h"
+#include "tapeio/fastcopy.h"
+#include "cmdbench.h"
+#include "config.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+struct copy_bench_result
+{
+	double copy_seconds;
+	double crc_seconds;
+	unsigned int crc;
+};
+
+/* Copy blocks to ring and checksum working buffer after each block */
+static void copy_bench_pass(struct copy_bench_result *res, int use_stream,
+	BYTE *ring, const BYTE *block, const BYTE *crc_buf)
+{
+	LARGE_INTEGER t0, t1, t2;
+	size_t pos;
+
+	res->copy_seconds = 0;
+	res->crc_seconds = 0;
+	res->crc = 0;
+
+	for(pos = 0; pos < BENCH_RING_SIZE; pos += BENCH_BLOCK_SIZE)
+	{
+		QueryPerformanceCounter(&t0);
+		if(use_stream)
+			copy_stream(ring + pos, block, BENCH_BLOCK_SIZE);
+		else
+			memcpy(ring + pos, block, BENCH_BLOCK_SIZE);
+		QueryPerformanceCounter(&t1);
+		res->crc = crc32_update(res->crc, crc_buf, BENCH_CRC_SIZE);
+		QueryPerformanceCounter(&t2);
+
+		res->copy_seconds += (double)(t1.QuadPart - t0.QuadPart);
+		res->crc_seconds += (double)(t2.QuadPart - t1.QuadPart);
+	}
+}
+
+/* Print throughput of copy and checksum */
+static void copy_bench_print(struct msg_filter *mf, const TCHAR *name,
+	const struct copy_bench_result *res, double freq)
+{
+	TCHAR fmt_buf1[64], fmt_buf2[64];
+	double copied, checksummed;
+
+	copied = (double)BENCH_RING_SIZE * BENCH_PASSES;
+	checksummed = (double)BENCH_CRC_SIZE * (BENCH_RING_SIZE / BENCH_BLOCK_SIZE) * BENCH_PASSES;
+
+	msg_print(mf, MSG_MESSAGE, _T("%-12s copy %s/s, CRC after copy %s/s\n"), name,
+		fmt_block_size(fmt_buf1, (unsigned __int64)(copied * freq / res->copy_seconds), 0),
+		fmt_block_size(fmt_buf2, (unsigned __int64)(checksummed * freq / res->crc_seconds), 0));
+}
+
+/* Compare ring buffer copy methods */
+int run_copy_benchmark(struct msg_filter *mf)
+{
+	struct copy_bench_result total[2], res;
+	LARGE_INTEGER freq;
+	BYTE *ring, *block, *crc_buf;
+	TCHAR fmt_buf1[64], fmt_buf2[64], fmt_buf3[64];
+	unsigned int pass, method;
+	size_t i;
+
+	if(!QueryPerformanceFrequency(&freq)) {
+		msg_print(mf, MSG_ERROR, _T("High resolution timer not available.\n"));
+		return 0;
+	}
+
+	ring = VirtualAlloc(NULL, BENCH_RING_SIZE, MEM_COMMIT, PAGE_READWRITE);
+	block = VirtualAlloc(NULL, BENCH_BLOCK_SIZE + BENCH_CRC_SIZE, MEM_COMMIT, PAGE_READWRITE);
+	if((ring == NULL) || (block == NULL))
+	{
+		DWORD error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't allocate benchmark buffers: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		if(ring != NULL)
+			VirtualFree(ring, 0U, MEM_RELEASE);
+		if(block != NULL)
+			VirtualFree(block, 0U, MEM_RELEASE);
+		return 0;
+	}
+	crc_buf = block + BENCH_BLOCK_SIZE;
+
+	/* Fill source and fault in ring pages */
+	for(i = 0; i < BENCH_BLOCK_SIZE + BENCH_CRC_SIZE; i++)
+		block[i] = (BYTE)(i * 7 + (i >> 12));
+	memset(ring, 0, BENCH_RING_SIZE);
+
+	msg_print(mf, MSG_MESSAGE,
+		_T("Copying %s blocks to %s buffer, checksumming %s after each block (%u passes).\n"),
+		fmt_block_size(fmt_buf1, BENCH_BLOCK_SIZE, 1), fmt_block_size(fmt_buf2, BENCH_RING_SIZE, 1),
+		fmt_block_size(fmt_buf3, BENCH_CRC_SIZE, 1), BENCH_PASSES);
+	if(!copy_stream_supported())
+		msg_print(mf, MSG_WARNING, _T("SSE2 not supported, non-temporal copy uses memcpy.\n"));
+
+	/* Alternate methods, so both see same system load */
+	memset(total, 0, sizeof(total));
+	for(pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		for(method = 0; method < 2; method++)
+		{
+			copy_bench_pass(&res, method, ring, block, crc_buf);
+			total[method].copy_seconds += res.copy_seconds;
+			total[method].crc_seconds += res.crc_seconds;
+		}
+	}
+
+	copy_bench_print(mf, _T("memcpy:"), &(total[0]), (double)freq.QuadPart);
+	copy_bench_print(mf, _T("streaming:"), &(total[1]), (double)freq.QuadPart);
+
+	VirtualFree(ring, 0U, MEM_RELEASE);
+	VirtualFree(block, 0U, MEM_RELEASE);
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
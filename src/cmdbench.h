@@ -0,0 +1,19 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include "util/msgfilt.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Compare ring buffer copy using memcpy and non-temporal copy (tapectl --bench).
+ *
+ * Each pass copies I/O blocks into large buffer (as reading thread does) and checksums
+ * small working buffer after each block (as CRC thread does). Slower checksumming after
+ * memcpy shows cache lines evicted by copied data. */
+
+int run_copy_benchmark(
+	struct msg_filter *mf				/* message buffer */
+	);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -1,7 +1,13 @@
 /* ---------------------------------------------------------------------------------------------- */
 
+#include <process.h>
+#include <stdlib.h>
 #include "util/fmt.h"
 #include "util/prompt.h"
+#include "tapeio/datagen.h"
+#include "tapeio/ingest.h"
+#include "tapeio/pack.h"
+#include "tapeio/stdstrm.h"
 #include "cmdinfo.h"
 #include "cmdcheck.h"
 #include "config.h"
@@ -31,6 +37,17 @@
 #define ST_WARNING			0x2000	/* give warning message */
 #define ST_ERROR			0x4000	/* give error message and terminate */
 
+/* File system query result (taken in advance for long file lists) */
+struct file_probe
+{
+	const TCHAR *filename;
+	int is_dest;
+	DWORD error;						/* Source open or destination attributes error */
+	DWORD size_error;					/* Source size error */
+	DWORD attr;							/* Destination attributes */
+	unsigned __int64 size;				/* Source size */
+};
+
 struct cmd_sim_state
 {
 	unsigned int flags;
@@ -39,23 +56,208 @@ struct cmd_sim_state
 	unsigned __int64 position;
 	TAPE_GET_DRIVE_PARAMETERS *drive;
 	TAPE_GET_MEDIA_PARAMETERS *media;
+
+	/* Prefetched file queries in operation order */
+	struct file_probe *probes;
+	unsigned int probe_count;
+	unsigned int probe_next;
 };
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Query source file size or destination file attributes */
+static void probe_file(struct file_probe *fp)
+{
+	HANDLE h_file;
+	ULARGE_INTEGER file_size;
+
+	fp->error = NO_ERROR;
+	fp->size_error = NO_ERROR;
+
+	if(fp->is_dest)
+	{
+		fp->attr = GetFileAttributes(fp->filename);
+		if(fp->attr == INVALID_FILE_ATTRIBUTES)
+			fp->error = GetLastError();
+		return;
+	}
+
+	/* Try open file for reading */
+	h_file = CreateFile(fp->filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if(h_file == INVALID_HANDLE_VALUE) {
+		fp->error = GetLastError();
+		return;
+	}
+
+	/* Get size of file */
+	file_size.LowPart = GetFileSize(h_file, &(file_size.HighPart));
+	if(file_size.LowPart == INVALID_FILE_SIZE)
+		fp->size_error = GetLastError();
+	fp->size = file_size.QuadPart;
+
+	CloseHandle(h_file);
+}
+
+/* Get prefetched query of file (NULL if not prefetched) */
+static struct file_probe *find_probe(struct cmd_sim_state *st, const TCHAR *filename, int is_dest)
+{
+	unsigned int i;
+
+	for(i = st->probe_next; i < st->probe_count; i++)
+	{
+		if((st->probes[i].filename == filename) && (st->probes[i].is_dest == is_dest)) {
+			st->probe_next = i + 1;
+			return &(st->probes[i]);
+		}
+	}
+
+	return NULL;
+}
+
+/* Parallel file queries */
+struct probe_pool
+{
+	struct file_probe *probes;
+	unsigned int count;
+	volatile LONG next;
+};
+
+static unsigned int __stdcall probe_thread(struct probe_pool *pool)
+{
+	LONG index;
+
+	while((index = InterlockedIncrement(&(pool->next)) - 1) < (LONG)(pool->count))
+		probe_file(&(pool->probes[index]));
+
+	return 0;
+}
+
+/* Operation reads or writes regular file checked by check_src_file / check_dest_file */
+static int is_file_operation(struct tape_operation *op, int check_src, int check_dest)
+{
+	if((op->code == OP_WRITE_DATA) || (op->code == OP_WRITE_DATA_AND_FMK)) {
+		return check_src &&
+			!is_datagen_name(op->filename) && !is_ingest_name(op->filename) &&
+			!is_std_stream_name(op->filename) && !is_pack_name(op->filename);
+	}
+	if(op->code == OP_READ_DATA) {
+		return check_dest &&
+			!is_null_sink_name(op->filename) && !is_std_stream_name(op->filename) &&
+			!is_pack_name(op->filename);
+	}
+	return 0;
+}
+
+/* Query files of operation list by pool of threads, so checking long lists of files on
+ * network shares doesn't wait for each file in turn. Messages are printed later by checks
+ * in operation order. */
+static void prefetch_files(struct cmd_line_args *cmd_line, struct cmd_sim_state *st,
+	int check_src, int check_dest)
+{
+	struct probe_pool pool;
+	HANDLE h_threads[CHECK_MAX_THREADS];
+	unsigned int i, count, thread_count, thread_id;
+	struct tape_operation *op;
+
+	/* Count regular files */
+	count = 0;
+	for(op = cmd_line->op_list; op != NULL; op = op->next)
+	{
+		if(is_file_operation(op, check_src, check_dest))
+			count++;
+	}
+	if(count < CHECK_PARALLEL_MIN)
+		return;
+
+	if( (pool.probes = malloc(count * sizeof(struct file_probe))) == NULL )
+		return;
+	pool.count = 0;
+	pool.next = 0;
+
+	for(op = cmd_line->op_list; op != NULL; op = op->next)
+	{
+		if(is_file_operation(op, check_src, check_dest))
+		{
+			pool.probes[pool.count].filename = op->filename;
+			pool.probes[pool.count].is_dest = (op->code == OP_READ_DATA);
+			pool.count++;
+		}
+	}
+
+	/* Start workers, this thread works too */
+	thread_count = 0;
+	for(i = 0; (i < CHECK_MAX_THREADS) && (i < count - 1); i++)
+	{
+		h_threads[thread_count] = (HANDLE) _beginthreadex(NULL, 0,
+			probe_thread, &pool, 0, &thread_id);
+		if(h_threads[thread_count] == NULL)
+			break;
+		thread_count++;
+	}
+	probe_thread(&pool);
+
+	if(thread_count != 0)
+		WaitForMultipleObjects(thread_count, h_threads, TRUE, INFINITE);
+	for(i = 0; i < thread_count; i++)
+		CloseHandle(h_threads[i]);
+
+	st->probes = pool.probes;
+	st->probe_count = pool.count;
+	st->probe_next = 0;
+}
+
 /* Check source file exists and available */
 static int check_src_file(struct msg_filter *mf, struct cmd_sim_state *st,
 	const TCHAR *filename, unsigned __int64 *p_filesize)
 {
-	HANDLE h_file;
+	struct file_probe probe, *fp;
 	DWORD error;
-	ULARGE_INTEGER file_size;
+	struct data_gen gen;
 
-	/* Try open file for reading */
-	h_file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if(h_file == INVALID_HANDLE_VALUE)
+	/* Check synthetic data source */
+	if(is_datagen_name(filename))
+	{
+		if(!datagen_parse(&gen, filename)) {
+			msg_print(mf, MSG_ERROR, _T("Invalid data generator \"%s\". ")
+				_T("Required: gen:<zero/random/comp<N>>:<size>.\n"), filename);
+			st->flags |= ST_ERROR;
+			return 0;
+		}
+		*p_filesize = gen.size;
+		return 1;
+	}
+
+	/* Get data size announced by ingest ring producer */
+	if(is_ingest_name(filename))
+	{
+		if(!ingest_ring_query(filename, p_filesize, &error)) {
+			msg_print(mf, MSG_ERROR, _T("Can't open ingest ring \"%s\": %s (%u).\n"),
+				filename, msg_winerr(mf, error), error);
+			st->flags |= ST_ERROR;
+			return 0;
+		}
+		return (*p_filesize != 0);
+	}
+
+	/* Size of standard input not known */
+	if(is_std_stream_name(filename))
+		return 0;
+
+	/* Container files are checked when list is loaded */
+	if(is_pack_name(filename))
+		return 0;
+
+	/* Open file and get its size (unless queried in advance) */
+	if( (fp = find_probe(st, filename, 0)) == NULL ) {
+		probe.filename = filename;
+		probe.is_dest = 0;
+		probe_file(&probe);
+		fp = &probe;
+	}
+
+	if(fp->error != NO_ERROR)
 	{
-		error = GetLastError();
+		error = fp->error;
 		switch(error)
 		{
 		case ERROR_FILE_NOT_FOUND:
@@ -85,19 +287,14 @@ static int check_src_file(struct msg_filter *mf, struct cmd_sim_state *st,
 		return 0;
 	}
 
-	/* Get size of file */
-	file_size.LowPart = GetFileSize(h_file, &(file_size.HighPart));
-	if((file_size.LowPart == INVALID_FILE_SIZE) && ((error = GetLastError()) != NO_ERROR)) {
+	if((error = fp->size_error) != NO_ERROR) {
 		msg_print(mf, MSG_ERROR, _T("Can't check size of \"%s\": %s (%u).\n"),
 			filename, msg_winerr(mf, error), error);
 		st->flags |= ST_ERROR;
-		CloseHandle(h_file);
 		return 0;
 	}
 
-	CloseHandle(h_file);
-
-	*p_filesize = file_size.QuadPart;
+	*p_filesize = fp->size;
 	return 1;
 }
 
@@ -105,12 +302,23 @@ static int check_src_file(struct msg_filter *mf, struct cmd_sim_state *st,
 static void check_dest_file(struct msg_filter *mf, struct cmd_sim_state *st,
 	const TCHAR *filename, int overwrite_check)
 {
+	struct file_probe probe, *fp;
 	DWORD attr;
 
-	/* Check file attributes */
-	attr = GetFileAttributes(filename);
+	/* Data discarded, written to standard output or extracted to directory */
+	if(is_null_sink_name(filename) || is_std_stream_name(filename) || is_pack_name(filename))
+		return;
+
+	/* Check file attributes (unless queried in advance) */
+	if( (fp = find_probe(st, filename, 1)) == NULL ) {
+		probe.filename = filename;
+		probe.is_dest = 1;
+		probe_file(&probe);
+		fp = &probe;
+	}
+	attr = fp->attr;
 	if(attr == INVALID_FILE_ATTRIBUTES) {
-		DWORD error = GetLastError();
+		DWORD error = fp->error;
 		switch(error)
 		{
 		case ERROR_FILE_NOT_FOUND: /* file not found, this is okay */
@@ -623,11 +831,40 @@ static void tape_operation_check(struct msg_filter *mf, struct cmd_line_args *cm
 		st->flags |= ST_AT_END_OF_DATA;
 		*p_media_required = st->flags & ST_UNLOADED;
 		break;
+	case OP_FLUSH_BUFFER: /* Flush drive buffer to media */
+		if( !(cmd_line->flags & MODE_NO_EXTRA_CHECKS) &&
+			!check_feature(st, TAPE_DRIVE_WRITE_FILEMARKS) )
+		{
+			msg_print(mf, MSG_ERROR, _T("Drive does not support flushing buffer.\n"));
+			st->flags |= ST_ERROR;
+		}
+		*p_media_required = st->flags & ST_UNLOADED;
+		break;
 	}
 }
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Ask user for confirmation */
+static int confirm_operations(struct msg_filter *mf, struct cmd_line_args *cmd_line, int yes_default)
+{
+	/* Answer can't be read when standard input carries data */
+	if(cmd_line->flags & MODE_STDIN_DATA) {
+		msg_print(mf, MSG_ERROR,
+			_T("Can't ask for confirmation while data is read from standard input.\n"));
+		return 0;
+	}
+
+	/* Daemon and scheduled jobs have no console */
+	if(cmd_line->flags & MODE_UNATTENDED) {
+		msg_print(mf, MSG_ERROR,
+			_T("Can't ask for confirmation in unattended job. Use -Y to confirm overwriting.\n"));
+		return 0;
+	}
+
+	return prompt(_T("Would you like to continue?"), yes_default);
+}
+
 /* Check operations list before execution and show details to the user */
 int check_tape_operations(
 	struct msg_filter *mf, struct cmd_line_args *cmd_line, HANDLE h_tape,
@@ -692,6 +929,9 @@ int check_tape_operations(
 		st.flags |= ST_UNLOADED;
 	}
 
+	/* Query files of long lists in parallel */
+	prefetch_files(cmd_line, &st, !(cmd_line->flags & MODE_NO_EXTRA_CHECKS), 1);
+
 	/* Display operation list and validate operations */
 	op_index = 0;
 	if((cmd_line->flags & MODE_SHOW_OPERATIONS) && (cmd_line->op_count != 0)) {
@@ -742,6 +982,7 @@ int check_tape_operations(
 
 		op_index++;
 	}
+	free(st.probes);
 
 	/* Output simulation result */
 	if(!(cmd_line->flags & MODE_TEST)) {
@@ -749,9 +990,11 @@ int check_tape_operations(
 			msg_print(mf, MSG_VERBOSE, _T("You can skip some checks with -y if you sure...\n"));
 			success = 0;
 		} else if( (st.flags & ST_WARNING) || ((st.flags & ST_OVERWRITE) && (cmd_line->flags & MODE_PROMPT_OVERWRITE)) ) {
-			success = prompt(_T("Would you like to continue?"), !(st.flags & ST_WARNING));
-		} else if(cmd_line->flags & MODE_SHOW_OPERATIONS) {
-			success = prompt(_T("Would you like to continue?"), 1);
+			success = confirm_operations(mf, cmd_line, !(st.flags & ST_WARNING));
+		} else if((cmd_line->flags & MODE_SHOW_OPERATIONS) && !(cmd_line->flags & MODE_UNATTENDED)) {
+			success = confirm_operations(mf, cmd_line, 1);
+		} else if((st.flags & ST_OVERWRITE) && (cmd_line->flags & MODE_UNATTENDED)) {
+			success = confirm_operations(mf, cmd_line, 1);
 		} else if(st.flags & ST_OVERWRITE) {
 			success = prompt_with_countdown(_T("Would you like to continue?"));
 		}
@@ -768,3 +1011,36 @@ int check_tape_operations(
 }
 
 /* ---------------------------------------------------------------------------------------------- */
+
+/* Get total size of data written by operation list */
+int get_written_data_size(struct msg_filter *mf, struct cmd_line_args *cmd_line,
+	unsigned __int64 *p_size)
+{
+	struct cmd_sim_state st;
+	struct tape_operation *op;
+	unsigned __int64 file_size;
+
+	memset(&st, 0, sizeof(st));
+	*p_size = 0;
+
+	prefetch_files(cmd_line, &st, 1, 0);
+
+	for(op = cmd_line->op_list; op != NULL; op = op->next)
+	{
+		if((op->code == OP_WRITE_DATA) || (op->code == OP_WRITE_DATA_AND_FMK))
+		{
+			file_size = 0;
+			if(check_src_file(mf, &st, op->filename, &file_size))
+				*p_size += file_size;
+			if(st.flags & ST_ERROR) {
+				free(st.probes);
+				return 0;
+			}
+		}
+	}
+	free(st.probes);
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -18,3 +18,13 @@ int check_tape_operations(
 	);
 
 /* ---------------------------------------------------------------------------------------------- */
+
+/* Get total size of data written by operation list (sizes of streams not known are skipped) */
+
+int get_written_data_size(
+	struct msg_filter *mf,					/* message buffer */
+	struct cmd_line_args *cmd_line,		/* operation list */
+	unsigned __int64 *p_size			/* receives total data size */
+	);
+
+/* ---------------------------------------------------------------------------------------------- */
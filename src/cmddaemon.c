@@ -0,0 +1,586 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tchar.h>
+#include <io.h>
+#include <fcntl.h>
+#include <process.h>
+#include "cmddaemon.h"
+#include "tapelib.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Job received from client */
+struct daemon_job
+{
+	struct daemon_job *next;
+	HANDLE h_pipe;
+	TCHAR *cwd;
+	TCHAR *args;
+};
+
+/* Queue of received jobs */
+struct daemon_queue
+{
+	TCHAR pipe_name[64];
+	HANDLE h_first_pipe;				/* Pipe instance created before starting daemon */
+
+	CRITICAL_SECTION lock;
+	HANDLE h_job_sem;					/* Released for each queued job and on accept error */
+	struct daemon_job *head;
+	struct daemon_job **tail;
+	unsigned int job_count;
+
+	DWORD accept_error;					/* Error stopping accept thread */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Get pipe name of daemon serving tape device (\\.\Tape<N> -> \\.\pipe\tapectl-Tape<N>) */
+static void get_daemon_pipe_name(TCHAR *buf, const TCHAR *tape_device)
+{
+	_tcscpy(buf, DAEMON_PIPE_PREFIX);
+	if(_tcsncmp(tape_device, _T("\\\\.\\"), 4) == 0)
+		tape_device += 4;
+	_tcscat(buf, tape_device);
+}
+
+/* Read exactly size bytes from pipe until DAEMON_REQUEST_TIMEOUT after begin tick.
+ * Pipe is polled, so client not sending request doesn't block accepting other clients. */
+static int pipe_read_all(HANDLE h_pipe, void *buf, DWORD size, DWORD begin, DWORD *p_error)
+{
+	DWORD avail, done;
+
+	while(size != 0)
+	{
+		if(!PeekNamedPipe(h_pipe, NULL, 0, NULL, &avail, NULL)) {
+			*p_error = GetLastError();
+			return 0;
+		}
+		if(avail == 0) {
+			if(GetTickCount() - begin >= DAEMON_REQUEST_TIMEOUT) {
+				*p_error = ERROR_TIMEOUT;
+				return 0;
+			}
+			Sleep(DAEMON_POLL_INTERVAL);
+			continue;
+		}
+
+		/* Read available data only */
+		if(!ReadFile(h_pipe, buf, (avail < size) ? avail : size, &done, NULL)) {
+			*p_error = GetLastError();
+			return 0;
+		}
+		if(done == 0) {
+			*p_error = ERROR_HANDLE_EOF;
+			return 0;
+		}
+		buf = (BYTE*)buf + done;
+		size -= done;
+	}
+
+	return 1;
+}
+
+/* Write exactly size bytes to pipe */
+static int pipe_write_all(HANDLE h_pipe, const void *buf, DWORD size, DWORD *p_error)
+{
+	DWORD done;
+
+	while(size != 0)
+	{
+		if(!WriteFile(h_pipe, buf, size, &done, NULL)) {
+			*p_error = GetLastError();
+			return 0;
+		}
+		buf = (const BYTE*)buf + done;
+		size -= done;
+	}
+
+	return 1;
+}
+
+/* Read zero-terminated string of given length from pipe */
+static TCHAR *pipe_read_string(HANDLE h_pipe, DWORD length, DWORD begin, DWORD *p_error)
+{
+	TCHAR *str;
+
+	if( (str = malloc((length + 1) * sizeof(TCHAR))) == NULL ) {
+		*p_error = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+
+	if(!pipe_read_all(h_pipe, str, length * sizeof(TCHAR), begin, p_error)) {
+		free(str);
+		return NULL;
+	}
+
+	str[length] = 0;
+	return str;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Free job and close its pipe */
+static void free_daemon_job(struct daemon_job *job)
+{
+	if(job->h_pipe != INVALID_HANDLE_VALUE)
+		CloseHandle(job->h_pipe);
+	free(job->cwd);
+	free(job->args);
+	free(job);
+}
+
+/* Receive job request from connected client (dropped if not received in time) */
+static struct daemon_job *receive_daemon_job(HANDLE h_pipe)
+{
+	struct daemon_request req;
+	struct daemon_job *job;
+	DWORD error, begin;
+
+	/* Read and check request header */
+	begin = GetTickCount();
+	if(!pipe_read_all(h_pipe, &req, sizeof(req), begin, &error))
+		return NULL;
+	if( (req.magic != DAEMON_REQUEST_MAGIC) || (req.char_size != sizeof(TCHAR)) ||
+		(req.cwd_length > DAEMON_MAX_STRING) || (req.args_length > DAEMON_MAX_STRING) )
+	{
+		return NULL;
+	}
+
+	if( (job = malloc(sizeof(struct daemon_job))) == NULL )
+		return NULL;
+	memset(job, 0, sizeof(struct daemon_job));
+	job->h_pipe = INVALID_HANDLE_VALUE;
+
+	/* Read current directory and arguments */
+	if( ((job->cwd = pipe_read_string(h_pipe, req.cwd_length, begin, &error)) == NULL) ||
+		((job->args = pipe_read_string(h_pipe, req.args_length, begin, &error)) == NULL) )
+	{
+		free_daemon_job(job);
+		return NULL;
+	}
+
+	job->h_pipe = h_pipe;
+	return job;
+}
+
+/* Accept clients and queue received jobs */
+static unsigned int __stdcall daemon_accept_thread(void *arg)
+{
+	struct daemon_queue *queue = arg;
+	struct daemon_job *job;
+	HANDLE h_pipe;
+	unsigned int failures = 0;
+	DWORD error;
+
+	h_pipe = queue->h_first_pipe;
+	queue->h_first_pipe = INVALID_HANDLE_VALUE;
+
+	for(;;)
+	{
+		/* Create next pipe instance */
+		if(h_pipe == INVALID_HANDLE_VALUE)
+		{
+			h_pipe = CreateNamedPipe(queue->pipe_name, PIPE_ACCESS_DUPLEX,
+				PIPE_TYPE_BYTE|PIPE_READMODE_BYTE|PIPE_WAIT, PIPE_UNLIMITED_INSTANCES,
+				DAEMON_PIPE_BUFFER, DAEMON_PIPE_BUFFER, 0, NULL);
+			if(h_pipe == INVALID_HANDLE_VALUE) {
+				error = GetLastError();
+				break;
+			}
+		}
+
+		/* Wait for client. Client closing pipe before it was accepted is dropped,
+		 * other errors stop accept thread after repeated failures (daemon reports
+		 * last error) */
+		if( !ConnectNamedPipe(h_pipe, NULL) &&
+			((error = GetLastError()) != ERROR_PIPE_CONNECTED) )
+		{
+			if(error == ERROR_NO_DATA) {
+				DisconnectNamedPipe(h_pipe);
+				continue;
+			}
+			CloseHandle(h_pipe);
+			h_pipe = INVALID_HANDLE_VALUE;
+			if(++failures == DAEMON_MAX_ACCEPT_ERRORS)
+				break;
+			Sleep(DAEMON_ACCEPT_RETRY_DELAY);
+			continue;
+		}
+		failures = 0;
+
+		/* Receive request, drop connection if request is invalid */
+		if( (job = receive_daemon_job(h_pipe)) == NULL ) {
+			CloseHandle(h_pipe);
+			h_pipe = INVALID_HANDLE_VALUE;
+			continue;
+		}
+		h_pipe = INVALID_HANDLE_VALUE;
+
+		/* Append job to queue */
+		EnterCriticalSection(&(queue->lock));
+		*(queue->tail) = job;
+		queue->tail = &(job->next);
+		queue->job_count++;
+		LeaveCriticalSection(&(queue->lock));
+
+		ReleaseSemaphore(queue->h_job_sem, 1, NULL);
+	}
+
+	/* Wake up daemon to report error */
+	queue->accept_error = error;
+	ReleaseSemaphore(queue->h_job_sem, 1, NULL);
+
+	return 0;
+}
+
+/* Take next job from queue (NULL if accept thread failed) */
+static struct daemon_job *dequeue_daemon_job(struct daemon_queue *queue)
+{
+	struct daemon_job *job;
+
+	WaitForSingleObject(queue->h_job_sem, INFINITE);
+
+	EnterCriticalSection(&(queue->lock));
+	if( (job = queue->head) != NULL )
+	{
+		queue->head = job->next;
+		if(queue->head == NULL)
+			queue->tail = &(queue->head);
+		queue->job_count--;
+		job->next = NULL;
+	}
+	LeaveCriticalSection(&(queue->lock));
+
+	return job;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Parse, check and execute job with output sent to client */
+static int execute_daemon_job(struct tape_session *s, struct msg_filter *job_mf,
+	struct daemon_job *job)
+{
+	struct cmd_line_args job_args;
+	int success = 1;
+
+	init_cmd_line_args(&job_args);
+
+	/* Parse job arguments */
+	if(!parse_job_arguments(job_mf, &job_args, job->args))
+		success = 0;
+	set_report_level(job_mf, job_args.flags);
+	msg_flush(job_mf);
+
+	if(success && (job_args.flags & MODE_SHOW_HELP))
+		usage_help(job_mf);
+
+	if(success && (job_args.flags & (MODE_DAEMON|MODE_MONITOR))) {
+		msg_print(job_mf, MSG_ERROR, _T("--daemon and --monitor can't be used in daemon job.\n"));
+		success = 0;
+	}
+	if(success && (job_args.flags & (MODE_STDIN_DATA|MODE_STDOUT_DATA))) {
+		msg_print(job_mf, MSG_ERROR, _T("Standard input/output can't be used in daemon job.\n"));
+		success = 0;
+	}
+
+	if(success && !(job_args.flags & MODE_EXIT))
+	{
+		job_args.flags |= MODE_UNATTENDED;
+
+		/* Relative file names are specified from client directory */
+		if(!SetCurrentDirectory(job->cwd)) {
+			DWORD error = GetLastError();
+			msg_print(job_mf, MSG_ERROR, _T("Can't set current directory \"%s\": %s (%u).\n"),
+				job->cwd, msg_winerr(job_mf, error), error);
+			success = 0;
+		}
+
+		/* Media can be changed since previous job */
+		if( success &&
+			( !(job_args.flags & MODE_NO_EXTRA_CHECKS) ||
+			  (job_args.flags & MODE_LIST_DRIVE_INFO) ) )
+		{
+			success = tape_session_query_media(s);
+		}
+
+		if(success && (job_args.flags & MODE_LIST_DRIVE_INFO))
+			tape_session_list_info(s, &job_args);
+
+		/* Check and execute operations */
+		success = success && tape_session_check(s, &job_args);
+		if(success && (job_args.op_count != 0) && !(job_args.flags & MODE_TEST))
+			success = tape_session_run(s, &job_args);
+	}
+
+	free_cmd_line_args(&job_args);
+	return success;
+}
+
+/* Run job and send its output and completion status to client */
+static int serve_daemon_job(struct tape_session *s, struct msg_filter *mf,
+	struct daemon_job *job, unsigned int job_number)
+{
+	struct msg_filter job_mf;
+	BYTE status[2];
+	FILE *stream;
+	int fd, success;
+	DWORD error;
+
+	msg_print(mf, MSG_INFO, _T("Job %u: %s\n"), job_number, job->args);
+
+	/* Open stream writing to client pipe (takes pipe handle) */
+	fd = _open_osfhandle((intptr_t)(job->h_pipe), _O_WRONLY|_O_TEXT);
+	if( (fd == -1) || ((stream = _tfdopen(fd, _T("w"))) == NULL) ) {
+		msg_print(mf, MSG_ERROR, _T("Job %u: can't open output stream.\n"), job_number);
+		if(fd != -1)
+			_close(fd);
+		job->h_pipe = INVALID_HANDLE_VALUE;
+		return 0;
+	}
+	setvbuf(stream, NULL, _IONBF, 0);
+
+	/* Execute job */
+	msg_init(&job_mf);
+	job_mf.stream = stream;
+	tape_session_set_output(s, &job_mf);
+
+	success = execute_daemon_job(s, &job_mf, job);
+
+	tape_session_set_output(s, mf);
+	msg_free(&job_mf);
+
+	/* Send completion status after messages */
+	fflush(stream);
+	status[0] = 0;
+	status[1] = success ? DAEMON_JOB_SUCCEEDED : DAEMON_JOB_FAILED;
+	if(pipe_write_all(job->h_pipe, status, sizeof(status), &error))
+		FlushFileBuffers(job->h_pipe);
+
+	fclose(stream);
+	job->h_pipe = INVALID_HANDLE_VALUE;
+
+	msg_print(mf, MSG_INFO, _T("Job %u %s.\n"), job_number, success ? _T("completed") : _T("failed"));
+	return success;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Open drive and execute jobs submitted by other processes */
+int run_tape_daemon(struct msg_filter *mf, struct cmd_line_args *cmd_line)
+{
+	struct daemon_queue queue;
+	struct tape_session session;
+	struct daemon_job *job;
+	TCHAR daemon_cwd[MAX_PATH];
+	HANDLE h_thread = NULL;
+	unsigned int job_number;
+	DWORD error;
+	int success = 0;
+
+	if(cmd_line->op_count != 0) {
+		msg_print(mf, MSG_ERROR, _T("Operations can't be combined with --daemon, use --submit.\n"));
+		return 0;
+	}
+
+	if(!check_cmd_line_settings(mf, cmd_line))
+		return 0;
+
+	memset(&queue, 0, sizeof(queue));
+	InitializeCriticalSection(&(queue.lock));
+	queue.tail = &(queue.head);
+	queue.h_first_pipe = INVALID_HANDLE_VALUE;
+	get_daemon_pipe_name(queue.pipe_name, cmd_line->tape_device);
+
+	if(!GetCurrentDirectory(MAX_PATH, daemon_cwd))
+		daemon_cwd[0] = 0;
+
+	/* Open drive */
+	tape_session_init(&session, mf, cmd_line);
+	if(!tape_session_open(&session) || !tape_session_query_info(&session))
+		goto cleanup;
+
+	/* Create first pipe instance (fails if daemon for drive is already running) */
+	queue.h_first_pipe = CreateNamedPipe(queue.pipe_name,
+		PIPE_ACCESS_DUPLEX|FILE_FLAG_FIRST_PIPE_INSTANCE,
+		PIPE_TYPE_BYTE|PIPE_READMODE_BYTE|PIPE_WAIT, PIPE_UNLIMITED_INSTANCES,
+		DAEMON_PIPE_BUFFER, DAEMON_PIPE_BUFFER, 0, NULL);
+	if(queue.h_first_pipe == INVALID_HANDLE_VALUE) {
+		error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't create pipe \"%s\": %s (%u).\n"),
+			queue.pipe_name, msg_winerr(mf, error), error);
+		goto cleanup;
+	}
+
+	/* Start accepting clients */
+	if( (queue.h_job_sem = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL)) == NULL ) {
+		error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't create semaphore: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		goto cleanup;
+	}
+	h_thread = (HANDLE)_beginthreadex(NULL, 0, daemon_accept_thread, &queue, 0, NULL);
+	if(h_thread == NULL) {
+		msg_print(mf, MSG_ERROR, _T("Can't create accept thread.\n"));
+		goto cleanup;
+	}
+
+	msg_print(mf, MSG_INFO, _T("Waiting for jobs on \"%s\". Press Ctrl+C to stop.\n"),
+		queue.pipe_name);
+
+	/* Execute jobs in order of arrival */
+	for(job_number = 1; ; job_number++)
+	{
+		if( (job = dequeue_daemon_job(&queue)) == NULL )
+		{
+			msg_print(mf, MSG_ERROR, _T("Can't accept jobs: %s (%u).\n"),
+				msg_winerr(mf, queue.accept_error), queue.accept_error);
+			break;
+		}
+
+		serve_daemon_job(&session, mf, job, job_number);
+		free_daemon_job(job);
+
+		if(daemon_cwd[0] != 0)
+			SetCurrentDirectory(daemon_cwd);
+	}
+
+cleanup:
+	/* Accept thread exits only after error */
+	if(h_thread != NULL) {
+		WaitForSingleObject(h_thread, INFINITE);
+		CloseHandle(h_thread);
+	}
+	while( (job = queue.head) != NULL ) {
+		queue.head = job->next;
+		free_daemon_job(job);
+	}
+	if(queue.h_first_pipe != INVALID_HANDLE_VALUE)
+		CloseHandle(queue.h_first_pipe);
+	if(queue.h_job_sem != NULL)
+		CloseHandle(queue.h_job_sem);
+	DeleteCriticalSection(&(queue.lock));
+
+	tape_session_close(&session);
+	return success;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Connect to daemon pipe, waiting while all instances are busy */
+static HANDLE connect_daemon_pipe(struct msg_filter *mf, const TCHAR *pipe_name)
+{
+	HANDLE h_pipe;
+	DWORD error;
+
+	for(;;)
+	{
+		h_pipe = CreateFile(pipe_name, GENERIC_READ|GENERIC_WRITE, 0, NULL,
+			OPEN_EXISTING, 0, NULL);
+		if(h_pipe != INVALID_HANDLE_VALUE)
+			return h_pipe;
+
+		error = GetLastError();
+		if(error == ERROR_PIPE_BUSY) {
+			WaitNamedPipe(pipe_name, NMPWAIT_WAIT_FOREVER);
+			continue;
+		}
+
+		if(error == ERROR_FILE_NOT_FOUND) {
+			msg_print(mf, MSG_ERROR, _T("No tape daemon running (\"%s\" not found).\n"),
+				pipe_name);
+		} else {
+			msg_print(mf, MSG_ERROR, _T("Can't connect to \"%s\": %s (%u).\n"),
+				pipe_name, msg_winerr(mf, error), error);
+		}
+		return INVALID_HANDLE_VALUE;
+	}
+}
+
+/* Send command line to daemon and display job output */
+int submit_daemon_job(struct msg_filter *mf, struct cmd_line_args *cmd_line)
+{
+	struct daemon_request req;
+	TCHAR pipe_name[64], *cwd = NULL;
+	const TCHAR *args;
+	BYTE buf[DAEMON_PIPE_BUFFER], *zero_ptr;
+	HANDLE h_pipe, h_output;
+	DWORD done, error, written;
+	int success = 0, have_status = 0, status_next = 0;
+
+	get_daemon_pipe_name(pipe_name, cmd_line->tape_device);
+
+	/* Get current directory and arguments */
+	args = get_command_line_args();
+	req.cwd_length = GetCurrentDirectory(0, NULL);
+	if( (req.cwd_length == 0) || ((cwd = malloc(req.cwd_length * sizeof(TCHAR))) == NULL) ||
+		((req.cwd_length = GetCurrentDirectory(req.cwd_length, cwd)) == 0) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Can't get current directory.\n"));
+		free(cwd);
+		return 0;
+	}
+	req.magic = DAEMON_REQUEST_MAGIC;
+	req.char_size = sizeof(TCHAR);
+	req.args_length = (DWORD)_tcslen(args);
+	if((req.cwd_length > DAEMON_MAX_STRING) || (req.args_length > DAEMON_MAX_STRING)) {
+		msg_print(mf, MSG_ERROR, _T("Command line too long for daemon job.\n"));
+		free(cwd);
+		return 0;
+	}
+
+	if( (h_pipe = connect_daemon_pipe(mf, pipe_name)) == INVALID_HANDLE_VALUE ) {
+		free(cwd);
+		return 0;
+	}
+
+	/* Send request */
+	if( !pipe_write_all(h_pipe, &req, sizeof(req), &error) ||
+		!pipe_write_all(h_pipe, cwd, req.cwd_length * sizeof(TCHAR), &error) ||
+		!pipe_write_all(h_pipe, args, req.args_length * sizeof(TCHAR), &error) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Can't send job to daemon: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		goto cleanup;
+	}
+
+	msg_print(mf, MSG_VERBOSE, _T("Job submitted to \"%s\".\n"), pipe_name);
+	fflush(mf->stream);
+
+	/* Copy job messages to output until completion status received */
+	h_output = (mf->stream == stderr) ?
+		GetStdHandle(STD_ERROR_HANDLE) : GetStdHandle(STD_OUTPUT_HANDLE);
+	while(!have_status && ReadFile(h_pipe, buf, sizeof(buf), &done, NULL) && (done != 0))
+	{
+		if(status_next) {
+			success = (buf[0] == DAEMON_JOB_SUCCEEDED);
+			have_status = 1;
+			break;
+		}
+		if( (zero_ptr = memchr(buf, 0, done)) != NULL ) {
+			if(zero_ptr + 1 < buf + done) {
+				success = (zero_ptr[1] == DAEMON_JOB_SUCCEEDED);
+				have_status = 1;
+			} else {
+				status_next = 1;
+			}
+			done = (DWORD)(zero_ptr - buf);
+		}
+		WriteFile(h_output, buf, done, &written, NULL);
+	}
+
+	if(!have_status)
+		msg_print(mf, MSG_ERROR, _T("Connection to tape daemon lost.\n"));
+
+cleanup:
+	CloseHandle(h_pipe);
+	free(cwd);
+
+	return success;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,53 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "util/msgfilt.h"
+#include "cmdline.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Tape daemon (tapectl --daemon) keeps drive open, data buffer allocated and executes jobs
+ * submitted by "tapectl --submit" one after another. Jobs are accepted on named pipe
+ * "\\.\pipe\tapectl-Tape<N>" and queued in order of arrival.
+ *
+ * Client sends daemon_request header followed by current directory and arguments
+ * (both without terminating zero). Daemon sends back job messages as text and after
+ * job completion single zero byte followed by DAEMON_JOB_SUCCEEDED or DAEMON_JOB_FAILED. */
+
+#define DAEMON_PIPE_PREFIX			_T("\\\\.\\pipe\\tapectl-")
+#define DAEMON_REQUEST_MAGIC		0x424F4A54	/* 'TJOB' */
+#define DAEMON_MAX_STRING			32768		/* Max. length of directory and arguments */
+#define DAEMON_PIPE_BUFFER			4096
+#define DAEMON_REQUEST_TIMEOUT		10000		/* Time for client to send request (ms) */
+#define DAEMON_POLL_INTERVAL		50
+#define DAEMON_ACCEPT_RETRY_DELAY	1000		/* Delay after failed connection (ms) */
+#define DAEMON_MAX_ACCEPT_ERRORS	10			/* Failed connections in row stop daemon */
+
+#define DAEMON_JOB_SUCCEEDED		'0'
+#define DAEMON_JOB_FAILED			'1'
+
+struct daemon_request
+{
+	DWORD magic;						/* DAEMON_REQUEST_MAGIC */
+	DWORD char_size;					/* sizeof(TCHAR) */
+	DWORD cwd_length;					/* Current directory length (chars) */
+	DWORD args_length;					/* Arguments length (chars) */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Open drive and execute jobs submitted by other processes */
+int run_tape_daemon(
+	struct msg_filter *mf,				/* message buffer */
+	struct cmd_line_args *cmd_line		/* device name, buffer and I/O settings */
+	);
+
+/* Send command line to daemon and display job output */
+int submit_daemon_job(
+	struct msg_filter *mf,				/* message buffer */
+	struct cmd_line_args *cmd_line		/* device name */
+	);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -6,6 +6,17 @@
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Check feature support by the drive (unknown drive supports nothing) */
+static int exec_feature(TAPE_GET_DRIVE_PARAMETERS *drive, DWORD value)
+{
+	if(drive == NULL)
+		return 0;
+
+	return ((value & 0x80000000) ? 
+		(drive->FeaturesHigh & value) : 
+		(drive->FeaturesLow & value)) != 0;
+}
+
 /* Initialize TAPE_SET_DRIVE_PARAMETERS with current settings */
 static int get_tape_parameters(
 	struct msg_filter *mf, HANDLE h_tape, TAPE_SET_DRIVE_PARAMETERS *p_tsdp)
@@ -32,14 +43,22 @@ static int get_tape_parameters(
 }
 
 /* List current position command */
-static int list_current_position(
-	struct msg_filter *mf, HANDLE h_tape, TAPE_GET_DRIVE_PARAMETERS *drive)
+static int list_current_position(struct msg_filter *mf, HANDLE h_tape,
+	TAPE_GET_DRIVE_PARAMETERS *drive, struct tape_state *state)
 {
 	DWORD partition = 0, error = ERROR_NOT_SUPPORTED;
 	int have_absolute_pos = 0, have_logical_pos = 0;
 	unsigned __int64 pos_absolute = 0, pos_logical = 0;
 
-	/* Query absolute position if supported */
+	/* Use position tracked since last query */
+	if((state != NULL) && state->have_position)
+	{
+		partition = state->partition;
+		pos_logical = state->block;
+		have_logical_pos = 1;
+	}
+
+	/* Query absolute position if supported (not tracked, shown with logical position) */
 	if((drive == NULL) || (drive->FeaturesLow & TAPE_DRIVE_GET_ABSOLUTE_BLK))
 	{
 		DWORD dw, pos_low, pos_high;
@@ -57,7 +76,8 @@ static int list_current_position(
 	}
 
 	/* Query logical position if supported */
-	if((drive == NULL) || (drive->FeaturesLow & TAPE_DRIVE_GET_LOGICAL_BLK))
+	if( !have_logical_pos &&
+		((drive == NULL) || (drive->FeaturesLow & TAPE_DRIVE_GET_LOGICAL_BLK)) )
 	{
 		DWORD pos_low, pos_high;
 		error = GetTapePosition(h_tape, TAPE_LOGICAL_POSITION, &partition, &pos_low, &pos_high);
@@ -70,6 +90,13 @@ static int list_current_position(
 		} else {
 			pos_logical = (unsigned __int64)pos_low | ((unsigned __int64)pos_high << 32);
 			have_logical_pos = 1;
+
+			/* Track position from here */
+			if(state != NULL) {
+				state->partition = partition;
+				state->block = pos_logical;
+				state->have_position = 1;
+			}
 		}
 	}
 
@@ -105,12 +132,102 @@ static int list_current_position(
 	return 1;
 }
 
+/* Update cached drive state with result of operation */
+static void update_tape_state(struct tape_state *state, struct tape_operation *op,
+	TAPE_GET_DRIVE_PARAMETERS *drive, int success)
+{
+	/* State after failed operation is unknown */
+	if(!success) {
+		state->have_info = 0;
+		state->have_position = 0;
+		return;
+	}
+
+	switch(op->code)
+	{
+	/* Drive settings changed */
+	case OP_SET_COMPRESSION:
+	case OP_SET_DATA_PADDING:
+	case OP_SET_ECC:
+	case OP_SET_REPORT_SETMARKS:
+	case OP_SET_EOT_WARNING_ZONE:
+		state->have_info = 0;
+		break;
+	case OP_SET_BLOCK_SIZE:
+		state->media.BlockSize = (DWORD)(op->size);
+		break;
+
+	/* No change */
+	case OP_LOCK_TAPE_EJECT:
+	case OP_UNLOCK_TAPE_EJECT:
+	case OP_LIST_TAPE_CAPACITY:
+	case OP_LIST_CURRENT_POSITION:
+	case OP_TRUNCATE:
+	case OP_FLUSH_BUFFER:
+		break;
+
+	/* Beginning of current partition (only one on some drives) */
+	case OP_MOVE_TO_ORIGIN:
+		if(!state->have_position && (drive != NULL) && (drive->MaximumPartitionCount <= 1)) {
+			state->partition = 0;
+			state->have_position = 1;
+		}
+		state->block = 0;
+		break;
+
+	/* Block in given or current partition */
+	case OP_SET_TAPE_POSITION:
+		if(op->partition != 0) {
+			state->partition = op->partition;
+			state->have_position = 1;
+		} else if(!state->have_position && (drive != NULL) && (drive->MaximumPartitionCount <= 1)) {
+			state->partition = 0;
+			state->have_position = 1;
+		}
+		state->block = op->count;
+		break;
+
+	/* Relative moves and marks */
+	case OP_MOVE_BLOCK_NEXT:
+	case OP_WRITE_FILEMARK:
+	case OP_WRITE_SETMARK:
+		state->block += op->count;
+		break;
+	case OP_MOVE_BLOCK_PREV:
+		state->block = (state->block > op->count) ? (state->block - op->count) : 0;
+		break;
+
+	/* Data blocks are counted by tape I/O, filemark follows */
+	case OP_READ_DATA:
+	case OP_WRITE_DATA:
+		break;
+	case OP_WRITE_DATA_AND_FMK:
+		state->block++;
+		break;
+
+	/* Media changed (or its partitions) or position depends on tape contents */
+	case OP_LOAD_MEDIA:
+	case OP_UNLOAD_MEDIA:
+	case OP_ERASE_TAPE:
+	case OP_TAPE_TENSION:
+	case OP_MAKE_PARTITION:
+		state->have_info = 0;
+		state->have_position = 0;
+		break;
+	default:
+		state->have_position = 0;
+		break;
+	}
+}
+
 int tape_operation_execute(
 	struct msg_filter *mf,
 	struct tape_io_ctx *io_ctx,
 	struct tape_operation *op,
 	HANDLE h_tape,
-	TAPE_GET_DRIVE_PARAMETERS *drive)
+	TAPE_GET_DRIVE_PARAMETERS *drive,
+	struct tape_state *state,
+	int immediate)
 {
 	int success = 0;
 
@@ -260,12 +377,16 @@ int tape_operation_execute(
 		case OP_LOAD_MEDIA: /* Load media */
 		{
 			DWORD error, begin, elapsed;
+			BOOL immed = immediate && exec_feature(drive, TAPE_DRIVE_LOAD_UNLD_IMMED);
 			msg_print(mf, MSG_INFO, _T("Loading media into the drive..."));
 			begin = GetTickCount();
-			if( (error = PrepareTape(h_tape, TAPE_LOAD, FALSE)) != NO_ERROR ) {
+			if( (error = PrepareTape(h_tape, TAPE_LOAD, immed)) != NO_ERROR ) {
 				msg_print(mf, MSG_INFO, _T("\n"));
 				msg_print(mf, MSG_ERROR, _T("Can't load media: %s (%u).\n"),
 					msg_winerr(mf, error), error);
+			} else if(immed) {
+				msg_print(mf, MSG_INFO, _T(" started\n"));
+				success = 1;
 			} else {
 				TCHAR elapsed_str[64];
 				elapsed = (GetTickCount() - begin + 500UL) / 1000UL;
@@ -277,12 +398,16 @@ int tape_operation_execute(
 		case OP_UNLOAD_MEDIA: /* Unload media */
 		{
 			DWORD error, begin, elapsed;
+			BOOL immed = immediate && exec_feature(drive, TAPE_DRIVE_LOAD_UNLD_IMMED);
 			msg_print(mf, MSG_INFO, _T("Unloading media from the drive..."));
 			begin = GetTickCount();
-			if( (error = PrepareTape(h_tape, TAPE_UNLOAD, FALSE)) != NO_ERROR ) {
+			if( (error = PrepareTape(h_tape, TAPE_UNLOAD, immed)) != NO_ERROR ) {
 				msg_print(mf, MSG_INFO, _T("\n"));
 				msg_print(mf, MSG_ERROR, _T("Can't unload media: %s (%u).\n"),
 					msg_winerr(mf, error), error);
+			} else if(immed) {
+				msg_print(mf, MSG_INFO, _T(" started\n"));
+				success = 1;
 			} else {
 				TCHAR elapsed_str[64];
 				elapsed = (GetTickCount() - begin + 500UL) / 1000UL;
@@ -374,18 +499,22 @@ int tape_operation_execute(
 		/* Navigation */
 		case OP_LIST_CURRENT_POSITION: /* List current position */
 		{
-			success = list_current_position(mf, h_tape, drive);
+			success = list_current_position(mf, h_tape, drive, state);
 			break;
 		}
 		case OP_MOVE_TO_ORIGIN: /* Move to origin (rewind tape) */
 		{
 			DWORD error, begin, elapsed;
+			BOOL immed = immediate && exec_feature(drive, TAPE_DRIVE_REWIND_IMMEDIATE);
 			msg_print(mf, MSG_INFO, _T("Rewinding..."));
 			begin = GetTickCount();
-			if( (error = SetTapePosition(h_tape, TAPE_REWIND, 0, 0, 0, FALSE)) != NO_ERROR ) {
+			if( (error = SetTapePosition(h_tape, TAPE_REWIND, 0, 0, 0, immed)) != NO_ERROR ) {
 				msg_print(mf, MSG_INFO, _T("\n"));
 				msg_print(mf, MSG_ERROR, _T("Can't rewind: %s (%u).\n"),
 					msg_winerr(mf, error), error);
+			} else if(immed) {
+				msg_print(mf, MSG_INFO, _T(" started\n"));
+				success = 1;
 			} else {
 				TCHAR elapsed_str[64];
 				elapsed = (GetTickCount() - begin + 500UL) / 1000UL;
@@ -546,13 +675,16 @@ int tape_operation_execute(
 			success = tape_file_write(mf, io_ctx, h_tape, op->filename);
 			if(success && (op->code == OP_WRITE_DATA_AND_FMK)) {
 				DWORD error, begin, elapsed;
+				BOOL immed = immediate && exec_feature(drive, TAPE_DRIVE_WRITE_MARK_IMMED);
 				msg_print(mf, MSG_INFO, _T("Writing filemark..."));
 				begin = GetTickCount();
-				if((error = WriteTapemark(h_tape, TAPE_FILEMARKS, 1, FALSE)) != NO_ERROR) {
+				if((error = WriteTapemark(h_tape, TAPE_FILEMARKS, 1, immed)) != NO_ERROR) {
 					msg_print(mf, MSG_INFO, _T("\n"));
 					msg_print(mf, MSG_ERROR, _T("Can't write filemark: %s (%u).\n"),
 						msg_winerr(mf, error), error);
 					success = 0;
+				} else if(immed) {
+					msg_print(mf, MSG_INFO, _T(" queued\n"));
 				} else {
 					TCHAR elapsed_str[64];
 					elapsed = (GetTickCount() - begin + 500UL) / 1000UL;
@@ -566,6 +698,7 @@ int tape_operation_execute(
 		case OP_WRITE_SETMARK: /* Write setmarks */
 		{
 			DWORD operation, error, begin, elapsed;
+			BOOL immed = immediate && exec_feature(drive, TAPE_DRIVE_WRITE_MARK_IMMED);
 			if(op->count == 1) {
 				msg_print(mf, MSG_INFO, _T("Writing %s..."),
 					(op->code == OP_WRITE_FILEMARK) ? _T("filemark") : _T("setmark"));
@@ -575,11 +708,14 @@ int tape_operation_execute(
 			}
 			begin = GetTickCount();
 			operation = (op->code == OP_WRITE_FILEMARK) ? TAPE_FILEMARKS : TAPE_SETMARKS;
-			if((error = WriteTapemark(h_tape, operation, (DWORD)(op->count), FALSE)) != NO_ERROR) {
+			if((error = WriteTapemark(h_tape, operation, (DWORD)(op->count), immed)) != NO_ERROR) {
 				msg_print(mf, MSG_INFO, _T("\n"));
 				msg_print(mf, MSG_ERROR, _T("Can't write %s: %s (%u).\n"),
 					(op->code == OP_WRITE_FILEMARK) ? _T("filemark") : _T("setmark"),
 					msg_winerr(mf, error), error);
+			} else if(immed) {
+				msg_print(mf, MSG_INFO, _T(" queued\n"));
+				success = 1;
 			} else {
 				TCHAR elapsed_str[64];
 				elapsed = (GetTickCount() - begin + 500UL) / 1000UL;
@@ -605,6 +741,24 @@ int tape_operation_execute(
 			}
 			break;
 		}
+		case OP_FLUSH_BUFFER: /* Flush drive buffer to media */
+		{
+			DWORD error, begin, elapsed;
+			msg_print(mf, MSG_INFO, _T("Flushing drive buffer..."));
+			begin = GetTickCount();
+			/* Writing zero filemarks in non-immediate mode writes buffered data and marks */
+			if((error = WriteTapemark(h_tape, TAPE_FILEMARKS, 0, FALSE)) != NO_ERROR) {
+				msg_print(mf, MSG_INFO, _T("\n"));
+				msg_print(mf, MSG_ERROR, _T("Can't flush drive buffer: %s (%u).\n"),
+					msg_winerr(mf, error), error);
+			} else {
+				TCHAR elapsed_str[64];
+				elapsed = (GetTickCount() - begin + 500UL) / 1000UL;
+				msg_print(mf, MSG_INFO, _T(" %s OK\n"), fmt_elapsed_time(elapsed_str, elapsed, 0));
+				success = 1;
+			}
+			break;
+		}
 
 		default:
 		{
@@ -612,6 +766,10 @@ int tape_operation_execute(
 			break;
 		}
 	}
+
+	if(state != NULL)
+		update_tape_state(state, op, drive, success);
+
 	return success;
 }
 
@@ -15,7 +15,9 @@ int tape_operation_execute(
 	struct tape_io_ctx *io_ctx,			/* Buffer for reading/writing tape */
 	struct tape_operation *op,			/* Operation to execute */
 	HANDLE h_tape,						/* Drive handle */
-	TAPE_GET_DRIVE_PARAMETERS *drive	/* Drive parameters or NULL */
+	TAPE_GET_DRIVE_PARAMETERS *drive,	/* Drive parameters or NULL */
+	struct tape_state *state,			/* Cached drive state updated by operation or NULL */
+	int immediate						/* Return before filemarks, rewind and load complete */
 	);
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -128,6 +128,9 @@ void tape_operation_info(struct msg_filter *mf, struct tape_operation *op)
 	case OP_TRUNCATE: /* Truncate data at current position */
 		msg_print(mf, MSG_MESSAGE, _T("Truncate at current position.\n"));
 		break;
+	case OP_FLUSH_BUFFER: /* Flush drive buffer to media */
+		msg_print(mf, MSG_MESSAGE, _T("Flush drive buffer.\n"));
+		break;
 	}
 }
 
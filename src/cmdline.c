@@ -9,6 +9,8 @@
 #include "util/fmt.h"
 #include "util/getpath.h"
 #include "cmdline.h"
+#include "config.h"
+#include "tapeio/fec.h"
 
 /* ---------------------------------------------------------------------------------------------- */
 /* Command line parse function */
@@ -299,14 +301,34 @@ static int parse_number_parameter(unsigned int *p_value,
 /* ---------------------------------------------------------------------------------------------- */
 /* Command line parameter apply functions */
 
+/* Parse tape device number (Tape<N> or \\.\Tape<N>) */
+static int parse_tape_number(const TCHAR *tape_str, unsigned int *p_number)
+{
+	const TCHAR *tape_n_str;
+	TCHAR *ep;
+	unsigned long n;
+
+	tape_n_str = tape_str;
+	if(_tcsnicmp(tape_n_str, _T("\\\\.\\Tape"), 8) == 0) {
+		tape_n_str += 8;
+	} else if(_tcsnicmp(tape_n_str, _T("Tape"), 4) == 0) {
+		tape_n_str += 4;
+	}
+	n = _tcstoul(tape_n_str, &ep, 10);
+	if((tape_n_str == ep) || (*ep != 0) || (n > 255))
+		return 0;
+
+	*p_number = (unsigned int)n;
+	return 1;
+}
+
 /* Check and parse tape device name */
 static void set_tape_device_name(TCHAR *device_name_buf,
 	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
 	struct msg_filter *mf)
 {
-	const TCHAR *tape_str, *tape_n_str;
-	TCHAR *ep;
-	unsigned long n;
+	const TCHAR *tape_str;
+	unsigned int n;
 
 	/* Tape name must be specified and parameters not being used previously */
 	if(!is_command_param(**p_arg_cur) || *p_param_used)
@@ -322,14 +344,7 @@ static void set_tape_device_name(TCHAR *device_name_buf,
 	*p_param_used = 1;
 
 	/* Parse tape device name */
-	tape_n_str = tape_str;
-	if(_tcsnicmp(tape_n_str, _T("\\\\.\\Tape"), 8) == 0) {
-		tape_n_str += 8;
-	} else if(_tcsnicmp(tape_n_str, _T("Tape"), 4) == 0) {
-		tape_n_str += 4;
-	}
-	n = _tcstoul(tape_n_str, &ep, 10);
-	if((tape_n_str == ep) || (*ep != 0) || (n > 255)) {
+	if(!parse_tape_number(tape_str, &n)) {
 		msg_append(mf, MSG_ERROR,
 			_T("-d : Invalid tape device name \"%s\". Required: Tape<0..255>.\n"), tape_str);
 		*p_success = 0;
@@ -340,6 +355,225 @@ static void set_tape_device_name(TCHAR *device_name_buf,
 	_stprintf(device_name_buf, _T("\\\\.\\Tape%u"), n);
 }
 
+/* Parse list of tape devices for scheduler (Tape<N>,Tape<N>,...) */
+static void set_drive_list(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	TCHAR name_buf[32], *name_end;
+	const TCHAR *list_str, *name;
+	size_t name_len;
+	unsigned int n;
+
+	if(!is_command_param(**p_arg_cur) || *p_param_used)
+	{
+		msg_append(mf, MSG_ERROR,
+			_T("--drives : No tape devices specified. Required: Tape<N>,Tape<N>,...\n"));
+		*p_success = 0;
+		return;
+	}
+
+	list_str = *((*p_arg_cur)++);
+	*p_param_used = 1;
+
+	cmd_line->drive_count = 0;
+	for(name = list_str; ; name = name_end + 1)
+	{
+		/* Get next name from list */
+		if( (name_end = _tcschr(name, _T(','))) == NULL )
+			name_end = (TCHAR*)name + _tcslen(name);
+		name_len = name_end - name;
+		if(name_len >= 32)
+			name_len = 31;
+		memcpy(name_buf, name, name_len * sizeof(TCHAR));
+		name_buf[name_len] = 0;
+
+		if(!parse_tape_number(name_buf, &n)) {
+			msg_append(mf, MSG_ERROR,
+				_T("--drives : Invalid tape device name \"%s\". Required: Tape<0..255>.\n"), name_buf);
+			*p_success = 0;
+			return;
+		}
+		if(cmd_line->drive_count == MAX_SCHEDULE_DRIVES) {
+			msg_append(mf, MSG_ERROR,
+				_T("--drives : Too many tape devices (%u max).\n"), MAX_SCHEDULE_DRIVES);
+			*p_success = 0;
+			return;
+		}
+		cmd_line->drive_numbers[cmd_line->drive_count++] = n;
+
+		if(*name_end == 0)
+			break;
+	}
+}
+
+/* Set job list file for scheduler */
+static void set_schedule_file(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	if(!is_command_param(**p_arg_cur) || *p_param_used)
+	{
+		msg_append(mf, MSG_ERROR, _T("--schedule : No job list file specified.\n"));
+		*p_success = 0;
+		return;
+	}
+
+	free(cmd_line->schedule_file);
+	if( (cmd_line->schedule_file = _tcsdup(*((*p_arg_cur)++))) == NULL ) {
+		mf->out_of_memory = 1;
+		*p_success = 0;
+	}
+	*p_param_used = 1;
+
+	cmd_line->flags |= MODE_SCHEDULE;
+}
+
+/* Set data file to check against its manifest */
+static void set_check_manifest_file(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	if(!is_command_param(**p_arg_cur) || *p_param_used)
+	{
+		msg_append(mf, MSG_ERROR, _T("--check-manifest : No file specified.\n"));
+		*p_success = 0;
+		return;
+	}
+
+	free(cmd_line->check_manifest_file);
+	if( (cmd_line->check_manifest_file = _tcsdup(*((*p_arg_cur)++))) == NULL ) {
+		mf->out_of_memory = 1;
+		*p_success = 0;
+	}
+	*p_param_used = 1;
+
+	cmd_line->flags |= MODE_CHECK_MANIFEST;
+}
+
+/* Set key file for tape data encryption */
+static void set_key_file(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	if(!is_command_param(**p_arg_cur) || *p_param_used)
+	{
+		msg_append(mf, MSG_ERROR, _T("--encrypt : No key file specified.\n"));
+		*p_success = 0;
+		return;
+	}
+
+	free(cmd_line->key_file);
+	if( (cmd_line->key_file = _tcsdup(*((*p_arg_cur)++))) == NULL ) {
+		mf->out_of_memory = 1;
+		*p_success = 0;
+	}
+	*p_param_used = 1;
+}
+
+/* Set container index file */
+static void set_pack_index_file(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	if(!is_command_param(**p_arg_cur) || *p_param_used)
+	{
+		msg_append(mf, MSG_ERROR, _T("--pack-index : No index file specified.\n"));
+		*p_success = 0;
+		return;
+	}
+
+	free(cmd_line->pack_index_file);
+	if( (cmd_line->pack_index_file = _tcsdup(*((*p_arg_cur)++))) == NULL ) {
+		mf->out_of_memory = 1;
+		*p_success = 0;
+	}
+	*p_param_used = 1;
+}
+
+/* Set container member to read */
+static void set_pack_member(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	if(!is_command_param(**p_arg_cur) || *p_param_used)
+	{
+		msg_append(mf, MSG_ERROR, _T("--member : No member name specified.\n"));
+		*p_success = 0;
+		return;
+	}
+
+	free(cmd_line->pack_member);
+	if( (cmd_line->pack_member = _tcsdup(*((*p_arg_cur)++))) == NULL ) {
+		mf->out_of_memory = 1;
+		*p_success = 0;
+	}
+	*p_param_used = 1;
+}
+
+/* Set total memory for buffers (--mem-budget <N>[k/M/G]|auto) */
+static void set_mem_budget(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	if(is_command_param(**p_arg_cur) && !(*p_param_used) &&
+		(_tcsicmp(**p_arg_cur, _T("auto")) == 0))
+	{
+		cmd_line->mem_budget = MEM_BUDGET_AUTO;
+		(*p_arg_cur)++;
+		*p_param_used = 1;
+		return;
+	}
+
+	parse_size_parameter(&(cmd_line->mem_budget), _T("--mem-budget"), _T("memory budget"),
+		p_arg_cur, p_success, p_param_used, mf);
+}
+
+/* Set forward error correction layout (--fec <N>,<K>) */
+static void set_fec_layout(struct cmd_line_args *cmd_line,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	const TCHAR *str;
+	unsigned long n, k;
+	TCHAR *ep;
+
+	if(!is_command_param(**p_arg_cur) || *p_param_used)
+	{
+		msg_append(mf, MSG_ERROR, _T("--fec : No block counts specified.\n"));
+		*p_success = 0;
+		return;
+	}
+
+	str = *((*p_arg_cur)++);
+	*p_param_used = 1;
+
+	n = _tcstoul(str, &ep, 10);
+	if((ep == str) || (*ep != _T(',')) || (n == 0)) {
+		msg_append(mf, MSG_ERROR,
+			_T("--fec : Invalid value \"%s\". Required: <data blocks>,<parity blocks>.\n"), str);
+		*p_success = 0;
+		return;
+	}
+	str = ep + 1;
+	k = _tcstoul(str, &ep, 10);
+	if((ep == str) || (*ep != 0) || (k == 0)) {
+		msg_append(mf, MSG_ERROR,
+			_T("--fec : Invalid value \"%s\". Required: <data blocks>,<parity blocks>.\n"), str);
+		*p_success = 0;
+		return;
+	}
+	if((n > FEC_MAX_BLOCKS) || (k > FEC_MAX_BLOCKS) || (n + k > FEC_MAX_BLOCKS)) {
+		msg_append(mf, MSG_ERROR,
+			_T("--fec : Too many blocks in group (%u max).\n"), FEC_MAX_BLOCKS);
+		*p_success = 0;
+		return;
+	}
+
+	cmd_line->fec_data_blocks = n;
+	cmd_line->fec_parity_blocks = k;
+}
+
 /* Add tape operation with parameters to operation list */
 static int insert_tape_operation(struct cmd_line_args *cmd_line,
 	enum tape_operation_code code, int enable, unsigned int partition,
@@ -484,11 +718,95 @@ static void insert_filename_operation(struct cmd_line_args *cmd_line,
 	*p_param_used = 1;
 }
 
+/* Process long command line option (--name) */
+static void parse_long_option(struct cmd_line_args *cmd_line, const TCHAR *name,
+	const TCHAR ***p_arg_cur, int *p_success, int *p_param_used,
+	struct msg_filter *mf)
+{
+	if(_tcscmp(name, _T("monitor")) == 0) /* Show running transfers */
+	{
+		cmd_line->flags |= MODE_MONITOR;
+	}
+	else if(_tcscmp(name, _T("bench")) == 0) /* Compare buffer copy methods */
+	{
+		cmd_line->flags |= MODE_BENCH;
+	}
+	else if(_tcscmp(name, _T("prefault")) == 0) /* Fault in buffer pages in background */
+	{
+		cmd_line->flags |= MODE_PREFAULT;
+	}
+	else if(_tcscmp(name, _T("mem-budget")) == 0) /* Size buffers from total memory */
+	{
+		set_mem_budget(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else if(_tcscmp(name, _T("manifest")) == 0) /* Write chunk digests next to files */
+	{
+		cmd_line->flags |= MODE_MANIFEST;
+	}
+	else if(_tcscmp(name, _T("check-manifest")) == 0) /* Check file against its manifest */
+	{
+		set_check_manifest_file(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else if(_tcscmp(name, _T("fec")) == 0) /* Add parity blocks to data written to tape */
+	{
+		set_fec_layout(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else if(_tcscmp(name, _T("encrypt")) == 0) /* Encrypt data written to tape */
+	{
+		set_key_file(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else if(_tcscmp(name, _T("sparse")) == 0) /* Store holes of files as extent records */
+	{
+		cmd_line->flags |= MODE_SPARSE;
+	}
+	else if(_tcscmp(name, _T("pack-index")) == 0) /* Map container members to tape blocks */
+	{
+		set_pack_index_file(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else if(_tcscmp(name, _T("member")) == 0) /* Read single container member */
+	{
+		set_pack_member(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else if(_tcscmp(name, _T("probe-block")) == 0) /* Learn block size from tape on read */
+	{
+		cmd_line->flags |= MODE_PROBE_BLOCK;
+	}
+	else if(_tcscmp(name, _T("optimize")) == 0) /* Merge and drop redundant positioning */
+	{
+		cmd_line->flags |= MODE_OPTIMIZE;
+	}
+	else if(_tcscmp(name, _T("immediate")) == 0) /* Don't wait for filemarks, rewind and load */
+	{
+		cmd_line->flags |= MODE_IMMEDIATE;
+	}
+	else if(_tcscmp(name, _T("daemon")) == 0) /* Serve jobs submitted by other processes */
+	{
+		cmd_line->flags |= MODE_DAEMON;
+	}
+	else if(_tcscmp(name, _T("submit")) == 0) /* Send operations to tape daemon */
+	{
+		cmd_line->flags |= MODE_SUBMIT;
+	}
+	else if(_tcscmp(name, _T("schedule")) == 0) /* Run job list on several drives */
+	{
+		set_schedule_file(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else if(_tcscmp(name, _T("drives")) == 0) /* Set drives used by scheduler */
+	{
+		set_drive_list(cmd_line, p_arg_cur, p_success, p_param_used, mf);
+	}
+	else /* Unknown option */
+	{
+		msg_append(mf, MSG_ERROR, _T("Unknown command line option \"--%s\".\n"), name);
+		*p_success = 0;
+	}
+}
+
 /* ---------------------------------------------------------------------------------------------- */
 
 void usage_help(struct msg_filter *mf)
 {
-	/* Unassigned: j g z A O */
+	/* Unassigned: j g A O */
 	msg_print(mf, MSG_MESSAGE,
 		_T("Usage: tapectl [<switch> [param] ...]   Navigation commands:                  \n")
 		_T("Output control:                         -l             List current position  \n")
@@ -509,13 +827,33 @@ void usage_help(struct msg_filter *mf)
 		_T("-Z <N>[k/M/G]  Set EOT warning zone     -m [count]     Write filemark         \n")
 		_T("-k <N>[k/M/G]  Set block size           -M [count]     Write setmark          \n")
 		_T("-x             Lock media ejection      -t             Truncate at current pos\n")
-		_T("-u             Unlock media ejection    Input/Output settings:                \n")
-		_T("Tape commands:                          -G <N>[k/M/G]  Set buffer size        \n")
-		_T("-L             Load media               -I <N>[k/M/G]  Set I/O block size     \n")
-		_T("-J             Eject media              -Q <N>         Set I/O queue length   \n")
-		_T("-K <type,cnt,size> Create partition     -U             Use windows buffering  \n")
-		_T("-c             Show media capacity      Test mode (check commands and exit):  \n")
-		_T("-T             Tension tape             -N             Enable test mode       \n")
+		_T("-u             Unlock media ejection    -z             Flush drive buffer     \n")
+		_T("Tape commands:                          Input/Output settings:                \n")
+		_T("-L             Load media               -G <N>[k/M/G]  Set buffer size        \n")
+		_T("-J             Eject media              -I <N>[k/M/G]  Set I/O block size     \n")
+		_T("-K <type,cnt,size> Create partition     -Q <N>         Set I/O queue length   \n")
+		_T("-c             Show media capacity      -U             Use windows buffering  \n")
+		_T("-T             Tension tape             Test mode (check commands and exit):  \n")
+		_T("                                        -N             Enable test mode       \n")
+		_T("Long options:                                                                 \n")
+		_T("--monitor      Show progress of transfers running in other tapectl processes  \n")
+		_T("--prefault     Fault in buffer pages in background before data reaches them    \n")
+		_T("--mem-budget <N>[k/M/G]|auto  Split memory between buffer, I/O and CRC         \n")
+		_T("--bench        Compare memcpy and non-temporal copy into data buffer           \n")
+		_T("--manifest     Write SHA-256 digests of 1 MB chunks to <file>.manifest         \n")
+		_T("--check-manifest <file>  Check file against manifest, show damaged ranges      \n")
+		_T("--fec <N>,<K>  Add K Reed-Solomon parity blocks per N tape blocks (read: same) \n")
+		_T("--encrypt <keyfile>  AES-256-GCM encrypt tape data (key: 32 bytes or 64 hex)   \n")
+		_T("--sparse       Store holes and zero ranges of files as records (read: same)    \n")
+		_T("--pack-index <file>  Save/use tape block index of pack:<list> container        \n")
+		_T("--member <name>  Read only this member of pack:<dir> (seeks using --pack-index)\n")
+		_T("--probe-block  Read: detect block size from first block, set it before reading \n")
+		_T("--optimize     Merge spacing commands, drop positioning overridden by locate   \n")
+		_T("--immediate    Don't wait for filemarks, rewind and load; flush at end of job  \n")
+		_T("--daemon       Keep drive open and execute jobs submitted with --submit       \n")
+		_T("--submit       Send operations to tapectl --daemon running for the drive      \n")
+		_T("--schedule <f> Run job list on several drives, -G sets total buffer memory     \n")
+		_T("--drives <list> Drives for --schedule (Tape<N>,Tape<N>,...; default: -d)       \n")
 	);
 }
 
@@ -545,8 +883,14 @@ static int cmd_parse(
 		/* Get next argument */
 		arg = *(arg_cur++);
 
+		/* Check for long option */
+		if(is_command_switch(arg) && (arg[1] == _T('-')))
+		{
+			param_used = 0;
+			parse_long_option(cmd_line, arg + 2, &arg_cur, &success, &param_used, mf);
+		}
 		/* Check for command line switch */
-		if(is_command_switch(arg))
+		else if(is_command_switch(arg))
 		{
 			/* Process switch group */
 			param_used = 0; /* Next parameter can be used once by switch group */
@@ -744,6 +1088,10 @@ static int cmd_parse(
 					if(!insert_tape_operation(cmd_line, OP_TRUNCATE, 0, 0, 0, 0, NULL, mf))
 						success = 0;
 					break;
+				case _T('z'): /* Flush drive buffer to media */
+					if(!insert_tape_operation(cmd_line, OP_FLUSH_BUFFER, 0, 0, 0, 0, NULL, mf))
+						success = 0;
+					break;
 
 				/* Test mode */
 				case _T('N'): /* Don't execute any commands */
@@ -818,6 +1166,134 @@ static int load_config_file(struct msg_filter *mf, struct cmd_line_args *cmd_lin
 	return success;
 }
 
+/* Check usage of standard input/output for data ("-" as filename) */
+static int check_std_streams(struct msg_filter *mf, struct cmd_line_args *cmd_line)
+{
+	struct tape_operation *op;
+	unsigned int stdin_count = 0;
+
+	for(op = cmd_line->op_list; op != NULL; op = op->next)
+	{
+		if((op->filename == NULL) || (_tcscmp(op->filename, _T("-")) != 0))
+			continue;
+
+		if(op->code == OP_READ_DATA) {
+			cmd_line->flags |= MODE_STDOUT_DATA;
+		} else {
+			cmd_line->flags |= MODE_STDIN_DATA;
+			stdin_count++;
+		}
+	}
+
+	if(stdin_count > 1) {
+		msg_append(mf, MSG_ERROR, _T("Standard input can be written to media only once.\n"));
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Initialize parameters with default settings */
+void init_cmd_line_args(struct cmd_line_args *cmd_line)
+{
+	memset(cmd_line, 0, sizeof(struct cmd_line_args));
+
+	_tcscpy(cmd_line->tape_device, DEFAULT_TAPE_NAME);
+	cmd_line->buffer_size = DEFAULT_BUFFER_SIZE;
+	cmd_line->io_block_size = DEFAULT_IO_BLOCK_SIZE;
+	cmd_line->io_queue_size = DEFAULT_IO_QUEUE_SIZE;
+	cmd_line->next_op_ptr = &(cmd_line->op_list);
+}
+
+/* Check buffer and I/O settings */
+int check_cmd_line_settings(struct msg_filter *mf, struct cmd_line_args *cmd_line)
+{
+	int success = 1;
+
+	/* Check buffer size (sized from memory budget when it is set) */
+	if((cmd_line->mem_budget == 0) && (cmd_line->buffer_size < MIN_BUFFER_SIZE)) {
+		msg_print(mf, MSG_ERROR, _T("Buffer too small. Use a few megabytes at least!\n"));
+		success = 0;
+	}
+	if( (cmd_line->mem_budget == 0) &&
+		(cmd_line->buffer_size < MIN_BUFFER_BLOCKS * cmd_line->io_block_size) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Buffer too small. Use 4X I/O block size at least!\n"));
+		success = 0;
+	}
+
+	/* Check I/O queue size */
+	if(cmd_line->io_block_size < MIN_IO_BLOCK_SIZE) {
+		msg_print(mf, MSG_ERROR, _T("I/O block too small. Use a few kilobytes at least!\n"));
+		success = 0;
+	}
+	if(cmd_line->io_block_size > MAX_IO_BLOCK_SIZE) {
+		msg_print(mf, MSG_ERROR, _T("I/O block too big. Choose some reasonable value!\n"));
+		success = 0;
+	}
+
+	/* Check memory budget */
+	if( (cmd_line->mem_budget != 0) && (cmd_line->mem_budget != MEM_BUDGET_AUTO) &&
+		(cmd_line->mem_budget < MIN_BUFFER_SIZE) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Memory budget too small. Use a few megabytes at least!\n"));
+		success = 0;
+	}
+
+	/* Check queue length */
+	if(cmd_line->io_queue_size > MAX_IO_QUEUE_SIZE) {
+		msg_print(mf, MSG_ERROR, _T("I/O queue too big. Choose some realistic value!\n"));
+		success = 0;
+	}
+
+	return success;
+}
+
+/* Parse job arguments (same syntax as command line without program name) */
+int parse_job_arguments(struct msg_filter *mf, struct cmd_line_args *cmd_line, const TCHAR *args)
+{
+	if(!cmd_parse(mf, cmd_line, args, 1))
+		return 0;
+
+	return check_std_streams(mf, cmd_line);
+}
+
+/* Set message filter verbosity level from -v/-V/-q flags */
+void set_report_level(struct msg_filter *mf, unsigned int flags)
+{
+	if(flags & MODE_VERY_VERBOSE) {
+		mf->report_level = MSG_VERY_VERBOSE;
+	} else if(flags & MODE_VERBOSE) {
+		mf->report_level = MSG_VERBOSE;
+	} else if(flags & MODE_QUIET) {
+		mf->report_level = MSG_WARNING;
+	} else {
+		mf->report_level = MSG_INFO;
+	}
+}
+
+/* Get program command line without program name */
+const TCHAR *get_command_line_args(void)
+{
+	const TCHAR *pcur = GetCommandLine();
+
+	/* Skip quoted or unquoted program name */
+	if(pcur[0] == _T('\"')) {
+		if( (pcur = _tcschr(pcur + 1, _T('\"'))) == NULL )
+			return _T("");
+		pcur++;
+	} else {
+		while((pcur[0] != 0) && (pcur[0] != _T(' ')) && (pcur[0] != _T('\t')))
+			pcur++;
+	}
+
+	/* Skip whitespace before arguments */
+	while((pcur[0] == _T(' ')) || (pcur[0] == _T('\t')))
+		pcur++;
+
+	return pcur;
+}
+
 /* Parse and fill program invokation parameters */
 int parse_command_line(struct msg_filter *mf, struct cmd_line_args *cmd_line)
 {
@@ -829,6 +1305,9 @@ int parse_command_line(struct msg_filter *mf, struct cmd_line_args *cmd_line)
 	if(!cmd_parse(mf, cmd_line, GetCommandLine(), 0))
 		success = 0;
 
+	if(success && !check_std_streams(mf, cmd_line))
+		success = 0;
+
 	/* Print error message */
 	if(!success)
 	{
@@ -838,23 +1317,14 @@ int parse_command_line(struct msg_filter *mf, struct cmd_line_args *cmd_line)
 
 	/* Check for any commands */
 	if( success && !(cmd_line->flags & MODE_EXIT) &&
-		(cmd_line->op_count == 0) && !(cmd_line->flags & MODE_LIST_DRIVE_INFO))
+		(cmd_line->op_count == 0) && !(cmd_line->flags & (MODE_LIST_DRIVE_INFO|MODE_MONITOR|MODE_DAEMON|MODE_SCHEDULE)))
 	{
 		msg_append(mf, MSG_INFO,
 			_T("No commands specified. Run tapectl -h for usage reference.\n"));
 		cmd_line->flags |= MODE_EXIT;
 	}
 
-	/* Set verbosity level */
-	if(cmd_line->flags & MODE_VERY_VERBOSE) {
-		mf->report_level = MSG_VERY_VERBOSE;
-	} else if(cmd_line->flags & MODE_VERBOSE) {
-		mf->report_level = MSG_VERBOSE;
-	} else if(cmd_line->flags & MODE_QUIET) {
-		mf->report_level = MSG_WARNING;
-	} else {
-		mf->report_level = MSG_INFO;
-	}
+	set_report_level(mf, cmd_line->flags);
 
 	return success;
 }
@@ -871,8 +1341,20 @@ void free_cmd_line_args(struct cmd_line_args *cmd_line)
 		free(op);
 	}
 
+	free(cmd_line->schedule_file);
+	cmd_line->schedule_file = NULL;
+	free(cmd_line->check_manifest_file);
+	cmd_line->check_manifest_file = NULL;
+	free(cmd_line->key_file);
+	cmd_line->key_file = NULL;
+	free(cmd_line->pack_index_file);
+	cmd_line->pack_index_file = NULL;
+	free(cmd_line->pack_member);
+	cmd_line->pack_member = NULL;
+
 	cmd_line->flags = 0;
 	cmd_line->op_list = NULL;
+	cmd_line->next_op_ptr = &(cmd_line->op_list);
 	cmd_line->op_count = 0;
 }
 
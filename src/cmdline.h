@@ -4,6 +4,7 @@
 
 #include <tchar.h>
 #include "util/msgfilt.h"
+#include "config.h"
 
 /* ---------------------------------------------------------------------------------------------- */
 
@@ -49,7 +50,8 @@ enum tape_operation_code
 	OP_WRITE_DATA_AND_FMK,			/* -W <file> */
 	OP_WRITE_FILEMARK,				/* -m [count] */
 	OP_WRITE_SETMARK,				/* -M [count] */
-	OP_TRUNCATE						/* -t */
+	OP_TRUNCATE,					/* -t */
+	OP_FLUSH_BUFFER					/* -z */
 };
 
 struct tape_operation
@@ -77,6 +79,21 @@ struct tape_operation
 #define MODE_TEST					0x0200
 #define MODE_LIST_DRIVE_INFO		0x0400
 #define MODE_WINDOWS_BUFFERING		0x0800
+#define MODE_MONITOR				0x1000
+#define MODE_STDIN_DATA				0x2000
+#define MODE_STDOUT_DATA			0x4000
+#define MODE_DAEMON					0x8000
+#define MODE_SUBMIT					0x10000
+#define MODE_UNATTENDED				0x20000
+#define MODE_SCHEDULE				0x40000
+#define MODE_PREFAULT				0x80000
+#define MODE_BENCH					0x100000
+#define MODE_MANIFEST				0x200000
+#define MODE_CHECK_MANIFEST			0x400000
+#define MODE_SPARSE					0x800000
+#define MODE_PROBE_BLOCK			0x1000000
+#define MODE_OPTIMIZE				0x2000000
+#define MODE_IMMEDIATE				0x4000000
 
 struct cmd_line_args
 {
@@ -84,9 +101,20 @@ struct cmd_line_args
 
 	TCHAR tape_device[16];
 
+	TCHAR *schedule_file;
+	TCHAR *check_manifest_file;
+	TCHAR *key_file;					/* Encryption key (--encrypt) */
+	TCHAR *pack_index_file;				/* Container index (--pack-index) */
+	TCHAR *pack_member;					/* Container member to read (--member) */
+	unsigned int drive_count;
+	unsigned int drive_numbers[MAX_SCHEDULE_DRIVES];
+
 	unsigned __int64 buffer_size;
 	unsigned int io_block_size;
 	unsigned int io_queue_size;
+	unsigned __int64 mem_budget;		/* 0 = not used, MEM_BUDGET_AUTO = from free memory */
+	unsigned int fec_data_blocks;		/* Data blocks per FEC group (0 = no FEC) */
+	unsigned int fec_parity_blocks;		/* Parity blocks per FEC group */
 	
 	struct tape_operation *op_list;
 	struct tape_operation **next_op_ptr;
@@ -97,6 +125,21 @@ struct cmd_line_args
 
 void usage_help(struct msg_filter *mf);
 
+/* Initialize parameters with default settings */
+void init_cmd_line_args(struct cmd_line_args *cmd_line);
+
+/* Check buffer and I/O settings */
+int check_cmd_line_settings(struct msg_filter *mf, struct cmd_line_args *cmd_line);
+
+/* Parse job arguments (same syntax as command line without program name) */
+int parse_job_arguments(struct msg_filter *mf, struct cmd_line_args *cmd_line, const TCHAR *args);
+
+/* Set message filter verbosity level from -v/-V/-q flags */
+void set_report_level(struct msg_filter *mf, unsigned int flags);
+
+/* Get program command line without program name */
+const TCHAR *get_command_line_args(void);
+
 /* Parse and fill program invokation parameters */
 int parse_command_line(struct msg_filter *mf, struct cmd_line_args *cmd_line);
 
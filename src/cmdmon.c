@@ -0,0 +1,197 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tchar.h>
+#include "util/fmt.h"
+#include "tapeio/filethrd.h"
+#include "tapeio/statshm.h"
+#include "cmdmon.h"
+#include "config.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Format status line of one transfer */
+static void format_slot_status(TCHAR *buf, struct stats_slot *slot)
+{
+	TCHAR fmt_buf1[64], fmt_buf2[64], *msg_ptr;
+
+	msg_ptr = buf;
+
+	/* Display transferred data size */
+	msg_ptr += _stprintf(msg_ptr, _T("  %s"), fmt_block_size(fmt_buf1, slot->written_bytes, 0));
+
+	/* Display total data size and progress if known */
+	if(slot->total_size != 0) {
+		msg_ptr += _stprintf(msg_ptr, _T(" / %s (%.1f%%)"),
+			fmt_block_size(fmt_buf1, slot->total_size, 0),
+			100.0 * slot->written_bytes / slot->total_size);
+	}
+
+	/* Display buffering mode and speed */
+	if(slot->write_flags & WRITE_THREAD_FLUSHING) {
+		msg_ptr += _stprintf(msg_ptr, _T(" Flushing:%s/s"),
+			fmt_block_size(fmt_buf1, slot->write_rate, 0));
+	} else if(slot->write_flags & WRITE_THREAD_BUFFERING) {
+		msg_ptr += _stprintf(msg_ptr, _T(" Buffering:%s/s"),
+			fmt_block_size(fmt_buf1, slot->read_rate, 0));
+	} else if(slot->read_flags & READ_THREAD_DEBUFFERING) {
+		msg_ptr += _stprintf(msg_ptr, _T(" Debuffering:%s/s"),
+			fmt_block_size(fmt_buf1, slot->write_rate, 0));
+	} else {
+		msg_ptr += _stprintf(msg_ptr, _T(" R:%s/s W:%s/s"),
+			fmt_block_size(fmt_buf1, slot->read_rate, 0),
+			fmt_block_size(fmt_buf2, slot->write_rate, 0));
+	}
+
+	/* Display buffer status */
+	msg_ptr += _stprintf(msg_ptr, _T(" Buf:%s/%s"),
+		fmt_block_size(fmt_buf1, slot->buf_data, 0),
+		fmt_block_size(fmt_buf2, slot->buf_size, 0));
+
+	/* Display ETA */
+	if( (slot->write_rate != 0) && (slot->total_size != 0) &&
+		(slot->total_size > slot->written_bytes) )
+	{
+		unsigned __int64 eta = (slot->total_size - slot->written_bytes) / slot->write_rate;
+		if(eta < 31536000ULL) { /* don't display yearwise times */
+			msg_ptr += _stprintf(msg_ptr, _T(" ETA %s"),
+				fmt_elapsed_time(fmt_buf1, (unsigned int)eta, 0));
+		}
+	}
+}
+
+/* Print status of all running transfers, returns number of lines printed */
+static unsigned int display_slots(struct msg_filter *mf, struct stats_shm *shm)
+{
+	struct stats_slot *slots, *slot;
+	const TCHAR *device, *state_str;
+	TCHAR fmt_buf[64], line_buf[512];
+	unsigned int i, lines;
+
+	slot = malloc(sizeof(struct stats_slot));
+	if(slot == NULL)
+		return 0;
+
+	slots = (struct stats_slot *)(shm->hdr + 1);
+	lines = 0;
+
+	for(i = 0; i < shm->hdr->slot_count; i++)
+	{
+		if(!stats_slot_snapshot(slots + i, slot))
+			continue;
+
+		/* Strip device namespace prefix */
+		device = slot->device;
+		if(_tcsncmp(device, _T("\\\\.\\"), 4) == 0)
+			device += 4;
+
+		switch(slot->state)
+		{
+		case STATS_STATE_WRITING:
+			state_str = _T("Writing");
+			break;
+		case STATS_STATE_READING:
+			state_str = _T("Reading");
+			break;
+		case STATS_STATE_EXECUTING:
+			state_str = _T("Executing operation");
+			break;
+		default:
+			state_str = _T("Idle");
+			break;
+		}
+
+		/* Display device, process and current operation */
+		_stprintf(line_buf, _T("%s (pid %u) [%u/%u] %s"), device, slot->owner_pid,
+			slot->op_index + 1, slot->op_count, state_str);
+		if(slot->filename[0] != 0) {
+			_tcscat(line_buf, _T(" \""));
+			_tcscat(line_buf, slot->filename);
+			_tcscat(line_buf, _T("\""));
+		}
+		if(slot->state == STATS_STATE_EXECUTING) {
+			_tcscat(line_buf, _T(" "));
+			_tcscat(line_buf, fmt_elapsed_time(fmt_buf,
+				(slot->update_tick - slot->start_tick) / 1000UL, 0));
+		}
+		msg_print(mf, MSG_MESSAGE, _T("%-79.79s\n"), line_buf);
+		lines++;
+
+		/* Display transfer status */
+		if((slot->state == STATS_STATE_WRITING) || (slot->state == STATS_STATE_READING)) {
+			format_slot_status(line_buf, slot);
+			msg_print(mf, MSG_MESSAGE, _T("%-79.79s\n"), line_buf);
+			lines++;
+		}
+	}
+
+	free(slot);
+	return lines;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Display progress of transfers running in other tapectl processes */
+
+int monitor_transfers(struct msg_filter *mf)
+{
+	struct stats_shm shm;
+	CONSOLE_SCREEN_BUFFER_INFO csbi;
+	HANDLE h_console;
+	unsigned int lines, lines_printed, lines_prev;
+	int is_console;
+	DWORD error;
+
+	if(!stats_shm_attach(&shm, &error))
+	{
+		if(error == ERROR_FILE_NOT_FOUND) {
+			msg_print(mf, MSG_MESSAGE, _T("No running transfers.\n"));
+			return 1;
+		}
+		msg_print(mf, MSG_ERROR, _T("Can't open statistics segment: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		return 0;
+	}
+
+	/* Refresh continuously only when writing to console */
+	h_console = GetStdHandle(STD_OUTPUT_HANDLE);
+	is_console = GetConsoleScreenBufferInfo(h_console, &csbi);
+
+	lines_prev = 0;
+	for(;;)
+	{
+		lines = display_slots(mf, &shm);
+
+		/* Clear lines left from previous refresh */
+		for(lines_printed = lines; lines_printed < lines_prev; lines_printed++)
+			msg_print(mf, MSG_MESSAGE, _T("%-79s\n"), _T(""));
+
+		if(lines == 0) {
+			msg_print(mf, MSG_MESSAGE, _T("No running transfers.\n"));
+			break;
+		}
+
+		if(!is_console)
+			break;
+
+		/* Move cursor back to redraw status */
+		fflush(mf->stream);
+		if(GetConsoleScreenBufferInfo(h_console, &csbi)) {
+			csbi.dwCursorPosition.X = 0;
+			csbi.dwCursorPosition.Y -= (SHORT)lines_printed;
+			if(csbi.dwCursorPosition.Y < 0)
+				csbi.dwCursorPosition.Y = 0;
+			SetConsoleCursorPosition(h_console, csbi.dwCursorPosition);
+		}
+		lines_prev = lines;
+
+		Sleep(STATS_REFRESH_INTERVAL);
+	}
+
+	stats_shm_close(&shm);
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,15 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include "util/msgfilt.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Display progress of transfers running in other tapectl processes */
+
+int monitor_transfers(
+	struct msg_filter *mf				/* message buffer */
+	);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,158 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include "cmdplan.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check feature support by the drive (unknown drive supports nothing) */
+static int plan_feature(TAPE_GET_DRIVE_PARAMETERS *drive, DWORD value)
+{
+	if(drive == NULL)
+		return 0;
+
+	return ((value & 0x80000000) ? 
+		(drive->FeaturesHigh & value) : 
+		(drive->FeaturesLow & value)) != 0;
+}
+
+/* Operation moves to position not depending on current one */
+static int is_locate_op(struct tape_operation *op)
+{
+	return (op->code == OP_MOVE_TO_ORIGIN) || (op->code == OP_MOVE_TO_EOD) ||
+		(op->code == OP_SET_ABS_POSITION) || (op->code == OP_SET_TAPE_POSITION);
+}
+
+/* Operation moves without reading or writing data */
+static int is_positioning_op(struct tape_operation *op)
+{
+	switch(op->code)
+	{
+	case OP_MOVE_TO_ORIGIN:
+	case OP_MOVE_TO_EOD:
+	case OP_SET_ABS_POSITION:
+	case OP_SET_TAPE_POSITION:
+	case OP_MOVE_BLOCK_NEXT:
+	case OP_MOVE_BLOCK_PREV:
+	case OP_MOVE_FILE_NEXT:
+	case OP_MOVE_FILE_PREV:
+	case OP_MOVE_SMK_NEXT:
+	case OP_MOVE_SMK_PREV:
+		return 1;
+	}
+	return 0;
+}
+
+/* Remove operation from list */
+static void remove_op(struct cmd_line_args *cmd_line, struct tape_operation **p_op)
+{
+	struct tape_operation *op = *p_op;
+
+	*p_op = op->next;
+	free(op->filename);
+	free(op);
+	cmd_line->op_count--;
+}
+
+/* Rewrite operation and next one, returns nonzero if list changed */
+static int plan_pair(struct cmd_line_args *cmd_line, TAPE_GET_DRIVE_PARAMETERS *drive,
+	struct tape_operation **p_op)
+{
+	struct tape_operation *op = *p_op, *next = op->next;
+
+	/* Spacing in same direction */
+	if( (op->code == next->code) &&
+		((op->code == OP_MOVE_BLOCK_NEXT) || (op->code == OP_MOVE_BLOCK_PREV) ||
+		 (op->code == OP_MOVE_FILE_NEXT) || (op->code == OP_MOVE_FILE_PREV) ||
+		 (op->code == OP_MOVE_SMK_NEXT) || (op->code == OP_MOVE_SMK_PREV)) )
+	{
+		op->count += next->count;
+		remove_op(cmd_line, &(op->next));
+		return 1;
+	}
+
+	/* Blocks forward and backward */
+	if( ((op->code == OP_MOVE_BLOCK_NEXT) && (next->code == OP_MOVE_BLOCK_PREV)) ||
+		((op->code == OP_MOVE_BLOCK_PREV) && (next->code == OP_MOVE_BLOCK_NEXT)) )
+	{
+		if(op->count == next->count) {
+			remove_op(cmd_line, &(op->next));
+			remove_op(cmd_line, p_op);
+		} else {
+			if(op->count < next->count) {
+				op->code = next->code;
+				op->count = next->count - op->count;
+			} else {
+				op->count -= next->count;
+			}
+			remove_op(cmd_line, &(op->next));
+		}
+		return 1;
+	}
+
+	/* Positioning before locate (unless it selects partition for it) */
+	if( is_positioning_op(op) && is_locate_op(next) &&
+		!((op->code == OP_SET_TAPE_POSITION) && (op->partition != 0) &&
+		  ((next->code != OP_SET_TAPE_POSITION) || (next->partition == 0))) )
+	{
+		remove_op(cmd_line, p_op);
+		return 1;
+	}
+
+	/* Rewind and blocks forward */
+	if( (op->code == OP_MOVE_TO_ORIGIN) && (next->code == OP_MOVE_BLOCK_NEXT) &&
+		plan_feature(drive, TAPE_DRIVE_LOGICAL_BLK) )
+	{
+		next->code = OP_SET_TAPE_POSITION;
+		next->partition = 0;
+		remove_op(cmd_line, p_op);
+		return 1;
+	}
+
+	/* Locate and relative blocks */
+	if( (op->code == OP_SET_TAPE_POSITION) &&
+		((next->code == OP_MOVE_BLOCK_NEXT) ||
+		 ((next->code == OP_MOVE_BLOCK_PREV) && (next->count <= op->count))) )
+	{
+		if(next->code == OP_MOVE_BLOCK_NEXT)
+			op->count += next->count;
+		else
+			op->count -= next->count;
+		remove_op(cmd_line, &(op->next));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Optimize positioning operations before execution */
+void plan_tape_operations(struct msg_filter *mf, struct cmd_line_args *cmd_line,
+	TAPE_GET_DRIVE_PARAMETERS *drive)
+{
+	struct tape_operation **p_op;
+	unsigned int op_count = cmd_line->op_count;
+	int changed;
+
+	do {
+		changed = 0;
+		p_op = &(cmd_line->op_list);
+		while((*p_op != NULL) && ((*p_op)->next != NULL))
+		{
+			if(plan_pair(cmd_line, drive, p_op))
+				changed = 1;
+			else
+				p_op = &((*p_op)->next);
+		}
+	} while(changed);
+
+	/* Operations are added after last one */
+	for(p_op = &(cmd_line->op_list); *p_op != NULL; p_op = &((*p_op)->next));
+	cmd_line->next_op_ptr = p_op;
+
+	if(cmd_line->op_count != op_count) {
+		msg_print(mf, MSG_VERBOSE, _T("Positioning optimized: %u operation%s instead of %u.\n"),
+			cmd_line->op_count, (cmd_line->op_count == 1) ? _T("") : _T("s"), op_count);
+	}
+}
+
+/* ---------------------------------------------------------------------------------------------- */
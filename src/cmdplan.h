@@ -0,0 +1,29 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "cmdline.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Optimize positioning operations before execution (tapectl --optimize).
+ *
+ * Adjacent operations are rewritten until nothing changes:
+ *
+ *   -f 3 -f 2        spacing in same direction merged (-f 5), also -n/-p and -F/-B
+ *   -n 5 -p 2        relative blocks merged into net count (-n 3)
+ *   -f 3 -s 100      positioning followed by locate or rewind is dropped
+ *   -o -n 10         rewind and block spacing replaced by locate (-s 10)
+ *   -s 1.100 -n 10   block spacing after locate added to block address (-s 1.110)
+ *
+ * Filemark spacing in opposite directions is not merged, -f 1 -b 1 stops before the filemark
+ * instead of staying in place. Spacing across filemark fails, locate does not. */
+
+void plan_tape_operations(
+	struct msg_filter *mf,					/* message buffer */
+	struct cmd_line_args *cmd_line,		/* operation list */
+	TAPE_GET_DRIVE_PARAMETERS *drive	/* drive information or NULL */
+	);
+
+/* ---------------------------------------------------------------------------------------------- */
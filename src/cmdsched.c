@@ -0,0 +1,445 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tchar.h>
+#include <process.h>
+#include "util/fmt.h"
+#include "cmdcheck.h"
+#include "cmdsched.h"
+#include "tapelib.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Job from job list file */
+struct sched_job
+{
+	unsigned int number;				/* Line number in job list */
+	int priority;
+	unsigned __int64 size;				/* Size of written data */
+	TCHAR *args;
+	struct cmd_line_args ops;
+};
+
+struct job_scheduler;
+
+/* Drive executing jobs */
+struct sched_drive
+{
+	struct job_scheduler *sched;
+	TCHAR name[16];
+	TCHAR prefix[24];
+	struct msg_filter mf;
+	struct tape_session session;
+	int is_open;
+	HANDLE h_thread;
+};
+
+/* Job list shared by drives */
+struct job_scheduler
+{
+	struct msg_filter *mf;				/* Output shared by drive threads (locked) */
+	CRITICAL_SECTION lock;
+
+	struct sched_job **jobs;			/* Jobs in order of execution */
+	unsigned int job_count;
+	unsigned int job_cap;
+	unsigned int next_job;
+
+	unsigned int completed_count;
+	unsigned int failed_count;
+
+	unsigned int check_flags;			/* -y/-Y flags applied to all jobs */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Free job */
+static void free_sched_job(struct sched_job *job)
+{
+	free_cmd_line_args(&(job->ops));
+	free(job->args);
+	free(job);
+}
+
+/* Parse job list line (<priority> <operations>) and add job to list */
+static int add_sched_job(struct job_scheduler *sched, const TCHAR *line,
+	const TCHAR *filename, unsigned int line_number)
+{
+	struct msg_filter *mf = sched->mf;
+	struct sched_job *job, **jobs;
+	const TCHAR *args;
+	TCHAR *ep;
+	long priority;
+
+	/* Parse priority */
+	priority = _tcstol(line, &ep, 10);
+	if((ep == line) || ((*ep != _T(' ')) && (*ep != _T('\t')))) {
+		msg_print(mf, MSG_ERROR, _T("%s(%u): job priority and operations required.\n"),
+			filename, line_number);
+		return 0;
+	}
+	for(args = ep; (*args == _T(' ')) || (*args == _T('\t')); args++)
+		;
+
+	/* Allocate job */
+	if( (job = malloc(sizeof(struct sched_job))) == NULL ) {
+		mf->out_of_memory = 1;
+		return 0;
+	}
+	memset(job, 0, sizeof(struct sched_job));
+	init_cmd_line_args(&(job->ops));
+	job->number = line_number;
+	job->priority = (int)priority;
+	if( (job->args = _tcsdup(args)) == NULL ) {
+		mf->out_of_memory = 1;
+		free_sched_job(job);
+		return 0;
+	}
+
+	/* Parse operations */
+	if(!parse_job_arguments(mf, &(job->ops), args)) {
+		msg_append(mf, MSG_INFO, _T("%s(%u): job operations invalid.\n"), filename, line_number);
+		msg_flush(mf);
+		free_sched_job(job);
+		return 0;
+	}
+	msg_flush(mf);
+
+	if(job->ops.op_count == 0) {
+		msg_print(mf, MSG_ERROR, _T("%s(%u): no operations specified.\n"),
+			filename, line_number);
+		free_sched_job(job);
+		return 0;
+	}
+	if(job->ops.flags & (MODE_DAEMON|MODE_SUBMIT|MODE_SCHEDULE|MODE_MONITOR|
+		MODE_STDIN_DATA|MODE_STDOUT_DATA))
+	{
+		msg_print(mf, MSG_ERROR,
+			_T("%s(%u): long options and standard input/output can't be used in job.\n"),
+			filename, line_number);
+		free_sched_job(job);
+		return 0;
+	}
+
+	/* Get size of written data for balancing */
+	if(!get_written_data_size(mf, &(job->ops), &(job->size))) {
+		free_sched_job(job);
+		return 0;
+	}
+
+	/* Append job to list */
+	if(sched->job_count == sched->job_cap)
+	{
+		if( (jobs = realloc(sched->jobs, (sched->job_cap + 16) * sizeof(struct sched_job*))) == NULL ) {
+			mf->out_of_memory = 1;
+			free_sched_job(job);
+			return 0;
+		}
+		sched->jobs = jobs;
+		sched->job_cap += 16;
+	}
+	sched->jobs[sched->job_count++] = job;
+
+	return 1;
+}
+
+/* Load job list file */
+static int load_job_list(struct job_scheduler *sched, const TCHAR *filename)
+{
+	struct msg_filter *mf = sched->mf;
+	TCHAR *buf;
+	char *mb_buf, *str, *p;
+	size_t bufsize;
+	unsigned int line_number;
+	FILE *fp;
+	int success = 1;
+
+	if( (fp = _tfopen(filename, _T("rt"))) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Can't open job list \"%s\".\n"), filename);
+		return 0;
+	}
+
+	bufsize = 4096;
+	buf = malloc(bufsize * sizeof(TCHAR));
+	mb_buf = malloc(bufsize);
+
+	if((buf != NULL) && (mb_buf != NULL))
+	{
+		line_number = 0;
+		while(fgets(mb_buf, (int)bufsize, fp) != NULL)
+		{
+			line_number++;
+			for(str = mb_buf; (*str == ' ') || (*str == '\t'); str++)
+				;
+			if((p = strchr(str, '\n')) != NULL)
+				*p = 0;
+			if((*str == ';') || (*str == '#') || (*str == 0))
+				continue;
+#ifdef _UNICODE
+			if((int)mbstowcs(buf, str, bufsize - 1) <= 0)
+				continue;
+			buf[bufsize - 1] = 0;
+#else
+			strcpy(buf, str);
+#endif
+			if(!add_sched_job(sched, buf, filename, line_number))
+				success = 0;
+		}
+	}
+	else
+	{
+		mf->out_of_memory = 1;
+		success = 0;
+	}
+
+	fclose(fp);
+	free(mb_buf);
+	free(buf);
+
+	return success;
+}
+
+/* Order jobs by priority, then longest first, then by position in list */
+static int compare_sched_jobs(const void *p1, const void *p2)
+{
+	const struct sched_job *job1 = *(const struct sched_job * const *)p1;
+	const struct sched_job *job2 = *(const struct sched_job * const *)p2;
+
+	if(job1->priority != job2->priority)
+		return (job1->priority > job2->priority) ? -1 : 1;
+	if(job1->size != job2->size)
+		return (job1->size > job2->size) ? -1 : 1;
+	return (job1->number < job2->number) ? -1 : 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check and execute job on drive */
+static int run_sched_job(struct sched_drive *drive, struct sched_job *job)
+{
+	struct tape_session *s = &(drive->session);
+	int success = 1;
+
+	job->ops.flags |= MODE_UNATTENDED | drive->sched->check_flags;
+
+	/* Media can be changed by previous job */
+	if(!(job->ops.flags & MODE_NO_EXTRA_CHECKS))
+		success = tape_session_query_media(s);
+
+	success = success && tape_session_check(s, &(job->ops));
+	success = success && tape_session_run(s, &(job->ops));
+
+	return success;
+}
+
+/* Take jobs from list until it is empty */
+static unsigned int __stdcall sched_drive_thread(void *arg)
+{
+	struct sched_drive *drive = arg;
+	struct job_scheduler *sched = drive->sched;
+	struct sched_job *job;
+	TCHAR size_buf[64], time_buf[64];
+	DWORD start_tick;
+	int success;
+
+	for(;;)
+	{
+		/* Take next job */
+		EnterCriticalSection(&(sched->lock));
+		if(sched->next_job == sched->job_count) {
+			LeaveCriticalSection(&(sched->lock));
+			break;
+		}
+		job = sched->jobs[sched->next_job++];
+		msg_print(sched->mf, MSG_INFO, _T("%s: job %u started (%s): %s\n"), drive->name,
+			job->number, fmt_block_size(size_buf, job->size, 1), job->args);
+		LeaveCriticalSection(&(sched->lock));
+
+		/* Execute job */
+		start_tick = GetTickCount();
+		success = run_sched_job(drive, job);
+
+		/* Report result */
+		EnterCriticalSection(&(sched->lock));
+		if(success) {
+			sched->completed_count++;
+		} else {
+			sched->failed_count++;
+		}
+		msg_print(sched->mf, success ? MSG_INFO : MSG_ERROR, _T("%s: job %u %s in %s.\n"),
+			drive->name, job->number, success ? _T("completed") : _T("failed"),
+			fmt_elapsed_time(time_buf, (GetTickCount() - start_tick) / 1000UL, 1));
+		if(!success) {
+			msg_print(sched->mf, MSG_WARNING,
+				_T("%s: drive stopped, remaining jobs go to other drives.\n"), drive->name);
+		}
+		LeaveCriticalSection(&(sched->lock));
+
+		if(!success)
+			break;
+	}
+
+	return 0;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Run job list on several drives */
+int run_job_schedule(struct msg_filter *mf, struct cmd_line_args *cmd_line)
+{
+	struct job_scheduler sched;
+	struct sched_drive *drives = NULL;
+	struct cmd_line_args settings;
+	HANDLE threads[MAX_SCHEDULE_DRIVES];
+	TCHAR size_buf[64], time_buf[64];
+	unsigned __int64 drive_buffer_size, drive_mem_budget;
+	unsigned int drive_count, open_count, active_count, thread_count, i;
+	DWORD start_tick;
+	int success = 0;
+
+	if(cmd_line->op_count != 0) {
+		msg_print(mf, MSG_ERROR, _T("Operations can't be combined with --schedule, use job list.\n"));
+		return 0;
+	}
+
+	if(!check_cmd_line_settings(mf, cmd_line))
+		return 0;
+
+	memset(&sched, 0, sizeof(sched));
+	InitializeCriticalSection(&(sched.lock));
+	sched.mf = mf;
+	sched.check_flags = cmd_line->flags & (MODE_NO_EXTRA_CHECKS|MODE_NO_OVERWRITE_CHECK);
+
+	/* Load and order jobs */
+	if(!load_job_list(&sched, cmd_line->schedule_file))
+		goto cleanup;
+	if(sched.job_count == 0) {
+		msg_print(mf, MSG_INFO, _T("No jobs in job list.\n"));
+		success = 1;
+		goto cleanup;
+	}
+	qsort(sched.jobs, sched.job_count, sizeof(struct sched_job*), compare_sched_jobs);
+
+	/* Use -d device if drive list not specified */
+	drive_count = (cmd_line->drive_count != 0) ? cmd_line->drive_count : 1;
+	if( (drives = malloc(drive_count * sizeof(struct sched_drive))) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Not enough memory.\n"));
+		goto cleanup;
+	}
+	memset(drives, 0, drive_count * sizeof(struct sched_drive));
+
+	/* Open drives */
+	settings = *cmd_line;
+	open_count = 0;
+	for(i = 0; i < drive_count; i++)
+	{
+		struct sched_drive *drive = drives + i;
+
+		if(cmd_line->drive_count != 0)
+			_stprintf(settings.tape_device, _T("\\\\.\\Tape%u"), cmd_line->drive_numbers[i]);
+		_tcscpy(drive->name, settings.tape_device + 4);
+		_stprintf(drive->prefix, _T("%s: "), drive->name);
+
+		drive->sched = &sched;
+		msg_init(&(drive->mf));
+		drive->mf.report_level = MSG_WARNING;
+		drive->mf.prefix = drive->prefix;
+
+		tape_session_init(&(drive->session), &(drive->mf), &settings);
+		if(tape_session_open(&(drive->session)) && tape_session_query_info(&(drive->session))) {
+			drive->is_open = 1;
+			open_count++;
+		} else {
+			tape_session_close(&(drive->session));
+		}
+	}
+	if(open_count == 0) {
+		msg_print(mf, MSG_ERROR, _T("No drives available.\n"));
+		goto cleanup;
+	}
+
+	/* Share memory budget between drives which will get jobs (buffers are sized from
+	 * budget of each drive), otherwise share -G buffer */
+	active_count = (open_count < sched.job_count) ? open_count : sched.job_count;
+	drive_mem_budget = 0;
+	drive_buffer_size = 0;
+	if(cmd_line->mem_budget != 0)
+	{
+		drive_mem_budget = (cmd_line->mem_budget == MEM_BUDGET_AUTO) ?
+			tape_io_auto_mem_budget() : cmd_line->mem_budget;
+		drive_mem_budget /= active_count;
+
+		msg_print(mf, MSG_INFO,
+			_T("Running %u jobs on %u drives (%s memory budget per drive)...\n"),
+			sched.job_count, active_count, fmt_block_size(size_buf, drive_mem_budget, 1));
+	}
+	else
+	{
+		drive_buffer_size = cmd_line->buffer_size / active_count;
+		drive_buffer_size -= drive_buffer_size % cmd_line->io_block_size;
+		if( (drive_buffer_size < MIN_BUFFER_SIZE) ||
+			(drive_buffer_size < MIN_BUFFER_BLOCKS * cmd_line->io_block_size) )
+		{
+			msg_print(mf, MSG_ERROR, _T("Buffer size too small for %u drives.\n"), active_count);
+			goto cleanup;
+		}
+
+		msg_print(mf, MSG_INFO, _T("Running %u jobs on %u drives (%s buffer per drive)...\n"),
+			sched.job_count, active_count, fmt_block_size(size_buf, drive_buffer_size, 1));
+	}
+
+	/* Start drive threads */
+	start_tick = GetTickCount();
+	thread_count = 0;
+	for(i = 0; (i < drive_count) && (thread_count < active_count); i++)
+	{
+		struct sched_drive *drive = drives + i;
+
+		if(!drive->is_open)
+			continue;
+
+		drive->session.buffer_size = drive_buffer_size;
+		drive->session.mem_budget = drive_mem_budget;
+		drive->h_thread = (HANDLE)_beginthreadex(NULL, 0, sched_drive_thread, drive, 0, NULL);
+		if(drive->h_thread == NULL) {
+			msg_print(mf, MSG_ERROR, _T("%s: can't create drive thread.\n"), drive->name);
+			continue;
+		}
+		threads[thread_count++] = drive->h_thread;
+	}
+
+	/* Wait for drives to finish */
+	if(thread_count != 0)
+		WaitForMultipleObjects(thread_count, threads, TRUE, INFINITE);
+
+	/* Display summary */
+	msg_print(mf, MSG_INFO, _T("%u jobs completed, %u failed, %u not started in %s.\n"),
+		sched.completed_count, sched.failed_count, sched.job_count - sched.next_job,
+		fmt_elapsed_time(time_buf, (GetTickCount() - start_tick) / 1000UL, 1));
+	success = (sched.completed_count == sched.job_count);
+
+cleanup:
+	if(drives != NULL)
+	{
+		for(i = 0; i < drive_count; i++)
+		{
+			if(drives[i].h_thread != NULL)
+				CloseHandle(drives[i].h_thread);
+			if(drives[i].is_open)
+				tape_session_close(&(drives[i].session));
+			msg_free(&(drives[i].mf));
+		}
+		free(drives);
+	}
+	for(i = 0; i < sched.job_count; i++)
+		free_sched_job(sched.jobs[i]);
+	free(sched.jobs);
+	DeleteCriticalSection(&(sched.lock));
+
+	return success;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,22 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include "util/msgfilt.h"
+#include "cmdline.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Run job list on several drives (tapectl --schedule <file> --drives <list>).
+ *
+ * Each line of job list file contains job priority followed by operations in command line
+ * syntax (e.g. "10 -W backup1.bak"). Jobs are ordered by priority, then by size of written
+ * data (longest processing time first), and each drive takes next job from the list when
+ * it finishes previous one. Buffer size (-G) is total memory shared between drives. */
+
+int run_job_schedule(
+	struct msg_filter *mf,				/* message buffer */
+	struct cmd_line_args *cmd_line		/* job list file, drives, buffer and I/O settings */
+	);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -7,6 +7,7 @@
 #define VERSION						_T("0.92b")
 
 #define DEFAULT_TAPE_NAME			_T("\\\\.\\Tape0")
+#define MAX_SCHEDULE_DRIVES			16
 
 #define DEFAULT_IO_BLOCK_SIZE		(   1UL << 20)
 #define MIN_IO_BLOCK_SIZE			  512UL
@@ -21,13 +22,27 @@
 #define MAX_HEAP_BUFFER_SIZE		( 512UL << 20)
 #define PAGE_MAPPING_WINDOW_SIZE	(  64UL << 20)
 
+#define MEM_BUDGET_AUTO				((unsigned __int64)-1)
+#define MEM_BUDGET_AUTO_DIVISOR		2		/* Automatic budget: half of available RAM */
+#define MEM_BUDGET_IO_DIVISOR		4		/* I/O queues of both threads: up to 1/4 of budget */
+#define MEM_BUDGET_CRC_DIVISOR		16		/* Each CRC buffer: up to 1/16 of budget */
+
 #define CRC_BLOCK_SIZE				(  64UL << 10)
 #define MIN_CRC_BUFFER				(   1UL << 20)
 #define MAX_CRC_BUFFER				( 2 * MAX_IO_BLOCK_SIZE )
+#define DIGEST_CHUNK_SIZE			(   1UL << 20)	/* SHA-256 manifest chunk */
+
+#define BENCH_RING_SIZE				( 256UL << 20)	/* tapectl --bench */
+#define BENCH_BLOCK_SIZE			(   1UL << 20)
+#define BENCH_CRC_SIZE				( 256UL << 10)
+#define BENCH_PASSES				4
 
 /* Give warning if less than ~3.6% of media capacity remaining after writing file */
 #define CAP_THRES(full_cap)			((full_cap) - (full_cap) / 28UL)
 
+#define CHECK_MAX_THREADS			16		/* Files queried in parallel by pre-flight check */
+#define CHECK_PARALLEL_MIN			4		/* Shorter file lists are queried serially */
+
 #define STATS_REFRESH_INTERVAL		250
 #define RATE_COUNT_POINTS			8
 
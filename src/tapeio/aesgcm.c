@@ -0,0 +1,354 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* AES-256 (FIPS 197) in Galois/Counter Mode (NIST SP 800-38D), table based implementation */
+
+#include <string.h>
+#include "aesgcm.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+static unsigned char aes_sbox[256];
+static unsigned int aes_ft[4][256];
+static unsigned int aes_rcon[10];
+static int aes_tables_ready = 0;
+
+#define XTIME(x)		((((x) << 1) ^ (((x) & 0x80) ? 0x1B : 0x00)) & 0xFF)
+#define ROTL8(x)		(((x) << 8) | ((x) >> 24))
+
+#define GET_LE32(p)		( (unsigned int)(p)[0] | ((unsigned int)(p)[1] << 8) | \
+						((unsigned int)(p)[2] << 16) | ((unsigned int)(p)[3] << 24) )
+#define PUT_LE32(p, v)	{ (p)[0] = (unsigned char)(v); (p)[1] = (unsigned char)((v) >> 8); \
+						(p)[2] = (unsigned char)((v) >> 16); (p)[3] = (unsigned char)((v) >> 24); }
+
+/* Generate S-box and round tables */
+static void aes_gen_tables(void)
+{
+	unsigned int pow[256], log[256];
+	unsigned int i, x, y, z;
+
+	if(aes_tables_ready)
+		return;
+
+	/* Powers and logarithms of generator 3 in GF(2^8) */
+	for(i = 0, x = 1; i < 256; i++) {
+		pow[i] = x;
+		log[x] = i;
+		x = (x ^ XTIME(x)) & 0xFF;
+	}
+
+	for(i = 0, x = 1; i < 10; i++) {
+		aes_rcon[i] = x;
+		x = XTIME(x);
+	}
+
+	/* S-box: affine transform of multiplicative inverse */
+	aes_sbox[0] = 0x63;
+	for(i = 1; i < 256; i++) {
+		x = pow[255 - log[i]];
+		y = x; y = ((y << 1) | (y >> 7)) & 0xFF;
+		x ^= y; y = ((y << 1) | (y >> 7)) & 0xFF;
+		x ^= y; y = ((y << 1) | (y >> 7)) & 0xFF;
+		x ^= y; y = ((y << 1) | (y >> 7)) & 0xFF;
+		x ^= y ^ 0x63;
+		aes_sbox[i] = (unsigned char)x;
+	}
+
+	/* SubBytes + MixColumns tables */
+	for(i = 0; i < 256; i++) {
+		x = aes_sbox[i];
+		y = XTIME(x);
+		z = y ^ x;
+		aes_ft[0][i] = y ^ (x << 8) ^ (x << 16) ^ (z << 24);
+		aes_ft[1][i] = ROTL8(aes_ft[0][i]);
+		aes_ft[2][i] = ROTL8(aes_ft[1][i]);
+		aes_ft[3][i] = ROTL8(aes_ft[2][i]);
+	}
+
+	aes_tables_ready = 1;
+}
+
+/* Encrypt one block */
+static void aes_encrypt_block(const unsigned int *rk, const unsigned char *in, unsigned char *out)
+{
+	unsigned int x0, x1, x2, x3, y0, y1, y2, y3;
+	int r;
+
+	x0 = GET_LE32(in     ) ^ rk[0];
+	x1 = GET_LE32(in +  4) ^ rk[1];
+	x2 = GET_LE32(in +  8) ^ rk[2];
+	x3 = GET_LE32(in + 12) ^ rk[3];
+	rk += 4;
+
+#define AES_FROUND(X0, X1, X2, X3, Y0, Y1, Y2, Y3)										\
+	X0 = rk[0] ^ aes_ft[0][Y0 & 0xFF] ^ aes_ft[1][(Y1 >> 8) & 0xFF] ^					\
+		aes_ft[2][(Y2 >> 16) & 0xFF] ^ aes_ft[3][Y3 >> 24];								\
+	X1 = rk[1] ^ aes_ft[0][Y1 & 0xFF] ^ aes_ft[1][(Y2 >> 8) & 0xFF] ^					\
+		aes_ft[2][(Y3 >> 16) & 0xFF] ^ aes_ft[3][Y0 >> 24];								\
+	X2 = rk[2] ^ aes_ft[0][Y2 & 0xFF] ^ aes_ft[1][(Y3 >> 8) & 0xFF] ^					\
+		aes_ft[2][(Y0 >> 16) & 0xFF] ^ aes_ft[3][Y1 >> 24];								\
+	X3 = rk[3] ^ aes_ft[0][Y3 & 0xFF] ^ aes_ft[1][(Y0 >> 8) & 0xFF] ^					\
+		aes_ft[2][(Y1 >> 16) & 0xFF] ^ aes_ft[3][Y2 >> 24];								\
+	rk += 4;
+
+	/* 13 full rounds */
+	for(r = 0; r < 6; r++) {
+		AES_FROUND(y0, y1, y2, y3, x0, x1, x2, x3)
+		AES_FROUND(x0, x1, x2, x3, y0, y1, y2, y3)
+	}
+	AES_FROUND(y0, y1, y2, y3, x0, x1, x2, x3)
+
+#undef AES_FROUND
+
+	/* Last round without MixColumns */
+	x0 = rk[0] ^ (unsigned int)aes_sbox[y0 & 0xFF] ^ ((unsigned int)aes_sbox[(y1 >> 8) & 0xFF] << 8) ^
+		((unsigned int)aes_sbox[(y2 >> 16) & 0xFF] << 16) ^ ((unsigned int)aes_sbox[y3 >> 24] << 24);
+	x1 = rk[1] ^ (unsigned int)aes_sbox[y1 & 0xFF] ^ ((unsigned int)aes_sbox[(y2 >> 8) & 0xFF] << 8) ^
+		((unsigned int)aes_sbox[(y3 >> 16) & 0xFF] << 16) ^ ((unsigned int)aes_sbox[y0 >> 24] << 24);
+	x2 = rk[2] ^ (unsigned int)aes_sbox[y2 & 0xFF] ^ ((unsigned int)aes_sbox[(y3 >> 8) & 0xFF] << 8) ^
+		((unsigned int)aes_sbox[(y0 >> 16) & 0xFF] << 16) ^ ((unsigned int)aes_sbox[y1 >> 24] << 24);
+	x3 = rk[3] ^ (unsigned int)aes_sbox[y3 & 0xFF] ^ ((unsigned int)aes_sbox[(y0 >> 8) & 0xFF] << 8) ^
+		((unsigned int)aes_sbox[(y1 >> 16) & 0xFF] << 16) ^ ((unsigned int)aes_sbox[y2 >> 24] << 24);
+
+	PUT_LE32(out     , x0);
+	PUT_LE32(out +  4, x1);
+	PUT_LE32(out +  8, x2);
+	PUT_LE32(out + 12, x3);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* GHASH multiplication by H using 4-bit tables (Shoup's method) */
+
+static const unsigned __int64 ghash_last4[16] =
+{
+	0x0000, 0x1C20, 0x3840, 0x2460, 0x7080, 0x6CA0, 0x48C0, 0x54E0,
+	0xE100, 0xFD20, 0xD940, 0xC560, 0x9180, 0x8DA0, 0xA9C0, 0xB5E0
+};
+
+static unsigned __int64 get_be64(const unsigned char *p)
+{
+	unsigned __int64 v = 0;
+	int i;
+
+	for(i = 0; i < 8; i++)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static void put_be64(unsigned char *p, unsigned __int64 v)
+{
+	int i;
+
+	for(i = 7; i >= 0; i--) {
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+static void ghash_gen_table(struct aes_gcm_key *key, const unsigned char *h)
+{
+	unsigned __int64 vh, vl;
+	unsigned int i, j, t;
+
+	vh = get_be64(h);
+	vl = get_be64(h + 8);
+
+	key->hl[8] = vl;
+	key->hh[8] = vh;
+	key->hl[0] = 0;
+	key->hh[0] = 0;
+
+	for(i = 4; i > 0; i >>= 1) {
+		t = (unsigned int)(vl & 1) * 0xE1000000U;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ ((unsigned __int64)t << 32);
+		key->hl[i] = vl;
+		key->hh[i] = vh;
+	}
+
+	for(i = 2; i <= 8; i *= 2) {
+		for(j = 1; j < i; j++) {
+			key->hh[i + j] = key->hh[i] ^ key->hh[j];
+			key->hl[i + j] = key->hl[i] ^ key->hl[j];
+		}
+	}
+}
+
+/* x = x * H */
+static void ghash_mult(const struct aes_gcm_key *key, unsigned char *x)
+{
+	unsigned __int64 zh, zl;
+	unsigned int lo, hi, rem;
+	int i;
+
+	lo = x[15] & 0x0F;
+	zh = key->hh[lo];
+	zl = key->hl[lo];
+
+	for(i = 15; i >= 0; i--)
+	{
+		lo = x[i] & 0x0F;
+		hi = (x[i] >> 4) & 0x0F;
+
+		if(i != 15) {
+			rem = (unsigned int)(zl & 0x0F);
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (ghash_last4[rem] << 48);
+			zh ^= key->hh[lo];
+			zl ^= key->hl[lo];
+		}
+
+		rem = (unsigned int)(zl & 0x0F);
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4) ^ (ghash_last4[rem] << 48);
+		zh ^= key->hh[hi];
+		zl ^= key->hl[hi];
+	}
+
+	put_be64(x, zh);
+	put_be64(x + 8, zl);
+}
+
+/* Absorb data into GHASH state (zero padded to block) */
+static void ghash_update(const struct aes_gcm_key *key, unsigned char *s,
+	const unsigned char *data, size_t len)
+{
+	size_t i, n;
+
+	while(len != 0) {
+		n = (len < AES_BLOCK_SIZE) ? len : AES_BLOCK_SIZE;
+		for(i = 0; i < n; i++)
+			s[i] ^= data[i];
+		ghash_mult(key, s);
+		data += n;
+		len -= n;
+	}
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Expand AES-256 key */
+void aes_gcm_init(struct aes_gcm_key *key, const unsigned char *key_bytes)
+{
+	unsigned char h[AES_BLOCK_SIZE];
+	unsigned int *rk = key->rk;
+	int i;
+
+	aes_gen_tables();
+
+	for(i = 0; i < 8; i++)
+		rk[i] = GET_LE32(key_bytes + i * 4);
+
+	for(i = 0; i < 7; i++, rk += 8)
+	{
+		rk[8] = rk[0] ^ aes_rcon[i] ^
+			((unsigned int)aes_sbox[(rk[7] >> 8) & 0xFF]) ^
+			((unsigned int)aes_sbox[(rk[7] >> 16) & 0xFF] << 8) ^
+			((unsigned int)aes_sbox[rk[7] >> 24] << 16) ^
+			((unsigned int)aes_sbox[rk[7] & 0xFF] << 24);
+		rk[9] = rk[1] ^ rk[8];
+		rk[10] = rk[2] ^ rk[9];
+		rk[11] = rk[3] ^ rk[10];
+
+		if(i == 6)
+			break;
+
+		rk[12] = rk[4] ^
+			((unsigned int)aes_sbox[rk[11] & 0xFF]) ^
+			((unsigned int)aes_sbox[(rk[11] >> 8) & 0xFF] << 8) ^
+			((unsigned int)aes_sbox[(rk[11] >> 16) & 0xFF] << 16) ^
+			((unsigned int)aes_sbox[rk[11] >> 24] << 24);
+		rk[13] = rk[5] ^ rk[12];
+		rk[14] = rk[6] ^ rk[13];
+		rk[15] = rk[7] ^ rk[14];
+	}
+
+	/* Hash subkey H = E(K, 0) */
+	memset(h, 0, sizeof(h));
+	aes_encrypt_block(key->rk, h, h);
+	ghash_gen_table(key, h);
+}
+
+/* Counter mode encryption and GHASH of ciphertext */
+static void gcm_crypt(const struct aes_gcm_key *key, const unsigned char *nonce,
+	const unsigned char *aad, size_t aad_len, unsigned char *data, size_t len,
+	int decrypt, unsigned char *tag)
+{
+	unsigned char ctr[AES_BLOCK_SIZE], ks[AES_BLOCK_SIZE], s[AES_BLOCK_SIZE];
+	unsigned int counter;
+	size_t i, n, remaining;
+
+	memset(s, 0, sizeof(s));
+	ghash_update(key, s, aad, aad_len);
+
+	/* J0 = nonce || 1, data counters start from J0 + 1 */
+	memcpy(ctr, nonce, GCM_NONCE_SIZE);
+	counter = 1;
+
+	for(remaining = len; remaining != 0; remaining -= n, data += n)
+	{
+		n = (remaining < AES_BLOCK_SIZE) ? remaining : AES_BLOCK_SIZE;
+
+		counter++;
+		ctr[12] = (unsigned char)(counter >> 24);
+		ctr[13] = (unsigned char)(counter >> 16);
+		ctr[14] = (unsigned char)(counter >> 8);
+		ctr[15] = (unsigned char)counter;
+		aes_encrypt_block(key->rk, ctr, ks);
+
+		if(decrypt) {
+			for(i = 0; i < n; i++) {
+				s[i] ^= data[i];
+				data[i] ^= ks[i];
+			}
+		} else {
+			for(i = 0; i < n; i++) {
+				data[i] ^= ks[i];
+				s[i] ^= data[i];
+			}
+		}
+		ghash_mult(key, s);
+	}
+
+	/* Hash bit lengths of AAD and ciphertext */
+	put_be64(ks, (unsigned __int64)aad_len * 8);
+	put_be64(ks + 8, (unsigned __int64)len * 8);
+	for(i = 0; i < AES_BLOCK_SIZE; i++)
+		s[i] ^= ks[i];
+	ghash_mult(key, s);
+
+	/* Tag = E(K, J0) ^ S */
+	ctr[12] = 0;
+	ctr[13] = 0;
+	ctr[14] = 0;
+	ctr[15] = 1;
+	aes_encrypt_block(key->rk, ctr, ks);
+	for(i = 0; i < GCM_TAG_SIZE; i++)
+		tag[i] = ks[i] ^ s[i];
+}
+
+/* Encrypt data in place and compute tag */
+void aes_gcm_encrypt(const struct aes_gcm_key *key, const unsigned char *nonce,
+	const unsigned char *aad, size_t aad_len, unsigned char *data, size_t len,
+	unsigned char *tag)
+{
+	gcm_crypt(key, nonce, aad, aad_len, data, len, 0, tag);
+}
+
+/* Check tag and decrypt data in place (returns 0 if tag doesn't match) */
+int aes_gcm_decrypt(const struct aes_gcm_key *key, const unsigned char *nonce,
+	const unsigned char *aad, size_t aad_len, unsigned char *data, size_t len,
+	const unsigned char *tag)
+{
+	unsigned char computed[GCM_TAG_SIZE];
+	unsigned char diff = 0;
+	int i;
+
+	gcm_crypt(key, nonce, aad, aad_len, data, len, 1, computed);
+
+	for(i = 0; i < GCM_TAG_SIZE; i++)
+		diff |= computed[i] ^ tag[i];
+
+	return (diff == 0);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
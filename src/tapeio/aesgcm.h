@@ -0,0 +1,36 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <stddef.h>
+
+/* ---------------------------------------------------------------------------------------------- */
+
+#define AES256_KEY_SIZE			32
+#define AES_BLOCK_SIZE			16
+#define GCM_NONCE_SIZE			12
+#define GCM_TAG_SIZE			16
+
+/* Expanded key (read only after init, can be shared between threads) */
+struct aes_gcm_key
+{
+	unsigned int rk[60];				/* AES-256 round keys */
+	unsigned __int64 hl[16], hh[16];	/* GHASH multiplication table for H */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Expand AES-256 key */
+void aes_gcm_init(struct aes_gcm_key *key, const unsigned char *key_bytes);
+
+/* Encrypt data in place and compute tag */
+void aes_gcm_encrypt(const struct aes_gcm_key *key, const unsigned char *nonce,
+	const unsigned char *aad, size_t aad_len, unsigned char *data, size_t len,
+	unsigned char *tag);
+
+/* Check tag and decrypt data in place (returns 0 if tag doesn't match) */
+int aes_gcm_decrypt(const struct aes_gcm_key *key, const unsigned char *nonce,
+	const unsigned char *aad, size_t aad_len, unsigned char *data, size_t len,
+	const unsigned char *tag);
+
+/* ---------------------------------------------------------------------------------------------- */
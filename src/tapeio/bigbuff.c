@@ -4,11 +4,132 @@
 #include <stdlib.h>
 #include <string.h>
 #include <crtdbg.h>
+#include <process.h>
 #include "../util/fmt.h"
+#include "fastcopy.h"
 #include "bigbuff.h"
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Commit virtual memory buffer up to end offset */
+static int bigbuf_commit(struct big_buffer *ctx, unsigned __int64 end, DWORD *p_err)
+{
+	LONG chunks, cur_chunks;
+	unsigned __int64 begin;
+
+	/* Mirror view shares pages with buffer, commit only first pass */
+	if(end > ctx->buf_size)
+		end = ctx->buf_size;
+
+	/* Check if already committed */
+	chunks = (LONG)((end + BIGBUF_COMMIT_CHUNK - 1) / BIGBUF_COMMIT_CHUNK);
+	cur_chunks = InterlockedCompareExchange(&(ctx->commit_chunks), 0, 0);
+	if(chunks <= cur_chunks)
+		return 1;
+
+	/* Commit next chunks (committing pages twice is harmless) */
+	begin = (unsigned __int64)cur_chunks * BIGBUF_COMMIT_CHUNK;
+	end = (unsigned __int64)chunks * BIGBUF_COMMIT_CHUNK;
+	if(end > ctx->buf_size)
+		end = ctx->buf_size;
+	if(VirtualAlloc(ctx->buf_addr + begin, (SIZE_T)(end - begin), MEM_COMMIT, PAGE_READWRITE) == NULL) {
+		*p_err = GetLastError();
+		return 0;
+	}
+
+	/* Raise committed chunk count (writer and prefault thread can commit concurrently) */
+	while( (cur_chunks = InterlockedCompareExchange(&(ctx->commit_chunks), 0, 0)) < chunks )
+		InterlockedCompareExchange(&(ctx->commit_chunks), chunks, cur_chunks);
+
+	return 1;
+}
+
+/* Commit buffer chunks and read their pages, so writer doesn't wait for page faults */
+static unsigned int __stdcall bigbuf_prefault_thread(void *arg)
+{
+	struct big_buffer *ctx = arg;
+	volatile BYTE *buf = ctx->buf_addr;
+	unsigned __int64 begin, end, pos;
+	DWORD error;
+	BYTE sum = 0;
+
+	for(begin = 0; begin < ctx->buf_size; begin = end)
+	{
+		if(InterlockedCompareExchange(&(ctx->prefault_stop), 0, 0))
+			break;
+
+		end = begin + BIGBUF_COMMIT_CHUNK;
+		if(end > ctx->buf_size)
+			end = ctx->buf_size;
+
+		/* Writer commits memory itself when prefaulting fails */
+		if(!bigbuf_commit(ctx, end, &error))
+			break;
+
+		/* Demand-zero pages are allocated on first access, reading is enough */
+		for(pos = begin; pos < end; pos += ctx->page_size)
+			sum += buf[(size_t)pos];
+	}
+
+	return sum;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Add written data to buffer and update thresholds */
+static void bigbuf_add_data(struct big_buffer *ctx, size_t length)
+{
+	EnterCriticalSection(&(ctx->buf_ptr_lock));
+	
+	ctx->buf_data_length += length;
+
+	if( (ctx->buf_size - ctx->buf_data_length < ctx->thres_wr_free) && 
+		(ctx->thres_flags & BIGBUF_WR_THRES_FLAG) )
+	{
+		ResetEvent(ctx->thres_wr_ev);
+		ctx->thres_flags &= ~BIGBUF_WR_THRES_FLAG;
+	}
+
+	if( (ctx->buf_data_length - ctx->buf_data_held >= ctx->thres_rd_avail) &&
+		!(ctx->thres_flags & BIGBUF_RD_THRES_FLAG) )
+	{
+		SetEvent(ctx->thres_rd_ev);
+		ctx->thres_flags |= BIGBUF_RD_THRES_FLAG;
+	}
+
+	LeaveCriticalSection(&(ctx->buf_ptr_lock));
+}
+
+/* Remove read data (held_length of it held by bigbuf_read_ptr) from buffer and update thresholds */
+static void bigbuf_remove_data(struct big_buffer *ctx, size_t length, size_t held_length)
+{
+	EnterCriticalSection(&(ctx->buf_ptr_lock));
+	
+	ctx->buf_data_offset += length;
+	if(ctx->buf_data_offset >= ctx->buf_size)
+		ctx->buf_data_offset -= ctx->buf_size;
+	
+	ctx->buf_data_length -= length;
+	ctx->buf_data_held -= held_length;
+
+	if( (ctx->buf_size - ctx->buf_data_length >= ctx->thres_wr_free) && 
+		!(ctx->thres_flags & BIGBUF_WR_THRES_FLAG) )
+	{
+		SetEvent(ctx->thres_wr_ev);
+		ctx->thres_flags |= BIGBUF_WR_THRES_FLAG;
+	}
+
+	if( (ctx->buf_data_length - ctx->buf_data_held < ctx->thres_rd_avail) &&
+		(ctx->thres_flags & BIGBUF_RD_THRES_FLAG) )
+	{
+		ResetEvent(ctx->thres_rd_ev);
+		ctx->thres_flags &= ~BIGBUF_RD_THRES_FLAG;
+	}
+	LeaveCriticalSection(&(ctx->buf_ptr_lock));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
 /* Write data to buffer. Buffer must have enough free space. */
 int bigbuf_write(struct big_buffer *ctx, const void *src, size_t length, DWORD *p_err)
 {
@@ -42,13 +163,17 @@ int bigbuf_write(struct big_buffer *ctx, const void *src, size_t length, DWORD *
 	{
 		if(ctx->buf_addr != NULL)
 		{
-			/* Calculate size of block to write */
+			/* Calculate size of block to write (mirror view continues past the end) */
 			block_size = (size_t)(ctx->buf_size - wr_pos);
-			if(remain < block_size)
+			if((remain < block_size) || (ctx->buf_mirror != NULL))
 				block_size = remain;
 
-			/* Write data to buffer */
-			memcpy(ctx->buf_addr + wr_pos, src_ptr, block_size);
+			/* Commit memory on first pass through buffer */
+			if(!bigbuf_commit(ctx, wr_pos + block_size, p_err))
+				return 0;
+
+			/* Write data to buffer bypassing cache (it is read back much later) */
+			copy_stream(ctx->buf_addr + wr_pos, src_ptr, block_size);
 		}
 		else
 		{
@@ -73,7 +198,7 @@ int bigbuf_write(struct big_buffer *ctx, const void *src, size_t length, DWORD *
 				if(win_map_pos == ctx->win_a_map_pos)
 				{
 					SetEvent(ctx->win_b_wr_ev);
-					memcpy(ctx->win_a_addr + win_offset, src_ptr, block_size);
+					copy_stream(ctx->win_a_addr + win_offset, src_ptr, block_size);
 					SetEvent(ctx->win_a_wr_ev);
 					break;
 				}
@@ -81,7 +206,7 @@ int bigbuf_write(struct big_buffer *ctx, const void *src, size_t length, DWORD *
 				if(win_map_pos == ctx->win_b_map_pos)
 				{
 					SetEvent(ctx->win_a_wr_ev);
-					memcpy(ctx->win_b_addr + win_offset, src_ptr, block_size);
+					copy_stream(ctx->win_b_addr + win_offset, src_ptr, block_size);
 					SetEvent(ctx->win_b_wr_ev);
 					break;
 				}
@@ -122,26 +247,7 @@ int bigbuf_write(struct big_buffer *ctx, const void *src, size_t length, DWORD *
 		src_ptr += block_size;
 	}
 
-	/* Update buffer state */
-	EnterCriticalSection(&(ctx->buf_ptr_lock));
-	
-	ctx->buf_data_length += length;
-
-	if( (ctx->buf_size - ctx->buf_data_length < ctx->thres_wr_free) && 
-		(ctx->thres_flags & BIGBUF_WR_THRES_FLAG) )
-	{
-		ResetEvent(ctx->thres_wr_ev);
-		ctx->thres_flags &= ~BIGBUF_WR_THRES_FLAG;
-	}
-
-	if( (ctx->buf_data_length >= ctx->thres_rd_avail) &&
-		!(ctx->thres_flags & BIGBUF_RD_THRES_FLAG) )
-	{
-		SetEvent(ctx->thres_rd_ev);
-		ctx->thres_flags |= BIGBUF_RD_THRES_FLAG;
-	}
-
-	LeaveCriticalSection(&(ctx->buf_ptr_lock));
+	bigbuf_add_data(ctx, length);
 
 	*p_err = NO_ERROR;
 	return 1;
@@ -181,9 +287,9 @@ int bigbuf_read(struct big_buffer *ctx, void *dst, size_t length, DWORD *p_err)
 	{
 		if(ctx->buf_addr != NULL)
 		{
-			/* Calculate size of block to read */
+			/* Calculate size of block to read (mirror view continues past the end) */
 			block_size = (size_t)(ctx->buf_size - rd_pos);
-			if(remain < block_size)
+			if((remain < block_size) || (ctx->buf_mirror != NULL))
 				block_size = remain;
 
 			/* Read data from buffer */
@@ -260,23 +366,72 @@ int bigbuf_read(struct big_buffer *ctx, void *dst, size_t length, DWORD *p_err)
 		dst_ptr += block_size;
 	}
 
-	/* Update buffer state */
+	bigbuf_remove_data(ctx, length, 0);
+
+	*p_err = NO_ERROR;
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Get pointer for writing directly to mirrored buffer. */
+void *bigbuf_write_ptr(struct big_buffer *ctx, size_t length, DWORD *p_err)
+{
+	unsigned __int64 wr_pos;
+
+	if(ctx->buf_mirror == NULL) {
+		*p_err = ERROR_NOT_SUPPORTED;
+		return NULL;
+	}
+
+	/* Get buffer pointers */
 	EnterCriticalSection(&(ctx->buf_ptr_lock));
-	
-	ctx->buf_data_offset += length;
-	if(ctx->buf_data_offset >= ctx->buf_size)
-		ctx->buf_data_offset -= ctx->buf_size;
-	
-	ctx->buf_data_length -= length;
+	if(length > ctx->buf_size - ctx->buf_data_length) {
+		LeaveCriticalSection(&(ctx->buf_ptr_lock));
+		*p_err = ERROR_INVALID_PARAMETER;
+		return NULL;
+	}
+	wr_pos = ctx->buf_data_offset + ctx->buf_data_length;
+	if(wr_pos >= ctx->buf_size)
+		wr_pos -= ctx->buf_size;
+	LeaveCriticalSection(&(ctx->buf_ptr_lock));
 
-	if( (ctx->buf_size - ctx->buf_data_length >= ctx->thres_wr_free) && 
-		!(ctx->thres_flags & BIGBUF_WR_THRES_FLAG) )
-	{
-		SetEvent(ctx->thres_wr_ev);
-		ctx->thres_flags |= BIGBUF_WR_THRES_FLAG;
+	/* Commit memory on first pass through buffer */
+	if(!bigbuf_commit(ctx, wr_pos + length, p_err))
+		return NULL;
+
+	*p_err = NO_ERROR;
+	return ctx->buf_addr + wr_pos;
+}
+
+/* Add data written through bigbuf_write_ptr. */
+void bigbuf_write_done(struct big_buffer *ctx, size_t length)
+{
+	if(length != 0)
+		bigbuf_add_data(ctx, length);
+}
+
+/* Get pointer for reading directly from mirrored buffer, hold data until bigbuf_read_done. */
+const void *bigbuf_read_ptr(struct big_buffer *ctx, size_t length)
+{
+	unsigned __int64 rd_pos;
+
+	if(ctx->buf_mirror == NULL)
+		return NULL;
+
+	EnterCriticalSection(&(ctx->buf_ptr_lock));
+	if(length > ctx->buf_data_length - ctx->buf_data_held) {
+		LeaveCriticalSection(&(ctx->buf_ptr_lock));
+		return NULL;
 	}
 
-	if( (ctx->buf_data_length < ctx->thres_rd_avail) &&
+	/* Data follows blocks held by previous calls */
+	rd_pos = ctx->buf_data_offset + ctx->buf_data_held;
+	if(rd_pos >= ctx->buf_size)
+		rd_pos -= ctx->buf_size;
+	ctx->buf_data_held += length;
+
+	if( (ctx->buf_data_length - ctx->buf_data_held < ctx->thres_rd_avail) &&
 		(ctx->thres_flags & BIGBUF_RD_THRES_FLAG) )
 	{
 		ResetEvent(ctx->thres_rd_ev);
@@ -284,8 +439,14 @@ int bigbuf_read(struct big_buffer *ctx, void *dst, size_t length, DWORD *p_err)
 	}
 	LeaveCriticalSection(&(ctx->buf_ptr_lock));
 
-	*p_err = NO_ERROR;
-	return 1;
+	return ctx->buf_addr + rd_pos;
+}
+
+/* Remove oldest held data read through bigbuf_read_ptr. */
+void bigbuf_read_done(struct big_buffer *ctx, size_t length)
+{
+	if(length != 0)
+		bigbuf_remove_data(ctx, length, length);
 }
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -318,7 +479,7 @@ void bigbuf_set_thres_read(struct big_buffer *ctx, unsigned __int64 thres_rd_ava
 	if(thres_rd_avail != ctx->thres_rd_avail)
 	{
 		EnterCriticalSection(&(ctx->buf_ptr_lock));
-		if(ctx->buf_data_length >= thres_rd_avail) {
+		if(ctx->buf_data_length - ctx->buf_data_held >= thres_rd_avail) {
 			if(!(ctx->thres_flags & BIGBUF_RD_THRES_FLAG)) {
 				SetEvent(ctx->thres_rd_ev);
 				ctx->thres_flags |= BIGBUF_RD_THRES_FLAG;
@@ -336,13 +497,13 @@ void bigbuf_set_thres_read(struct big_buffer *ctx, unsigned __int64 thres_rd_ava
 
 /* ---------------------------------------------------------------------------------------------- */
 
-/* Get number of bytes available. */
+/* Get number of bytes available (not held by bigbuf_read_ptr). */
 unsigned __int64 bigbuf_data_avail(struct big_buffer *ctx)
 {
 	unsigned __int64 buf_used;
 
 	EnterCriticalSection(&(ctx->buf_ptr_lock));
-	buf_used = ctx->buf_data_length;
+	buf_used = ctx->buf_data_length - ctx->buf_data_held;
 	LeaveCriticalSection(&(ctx->buf_ptr_lock));
 	return buf_used;
 }
@@ -389,6 +550,7 @@ void bigbuf_reset(struct big_buffer *ctx)
 	/* Remove all remaining data from buffer */
 	ctx->buf_data_offset = 0;
 	ctx->buf_data_length = 0;
+	ctx->buf_data_held = 0;
 
 	/* Disable thresholds */
 	ctx->thres_wr_free = 0;
@@ -405,11 +567,57 @@ void bigbuf_reset(struct big_buffer *ctx)
 		SetEvent(events[i]);
 }
 
+/* Map pagefile section twice back-to-back, so data wrapping around buffer end is contiguous */
+static int bigbuf_map_mirrored(struct big_buffer *ctx, DWORD *p_err)
+{
+	BYTE *addr;
+	unsigned int attempt;
+
+	ctx->buf_section = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE|SEC_RESERVE,
+		(DWORD)(ctx->buf_size >> 32), (DWORD)(ctx->buf_size), NULL);
+	if(ctx->buf_section == NULL) {
+		*p_err = GetLastError();
+		return 0;
+	}
+
+	/* Find free address range and map both views there (other threads can take it meanwhile) */
+	*p_err = ERROR_NOT_ENOUGH_MEMORY;
+	for(attempt = 0; attempt < BIGBUF_MIRROR_ATTEMPTS; attempt++)
+	{
+		addr = VirtualAlloc(NULL, (SIZE_T)(ctx->buf_size * 2), MEM_RESERVE, PAGE_READWRITE);
+		if(addr == NULL) {
+			*p_err = GetLastError();
+			break;
+		}
+		VirtualFree(addr, 0U, MEM_RELEASE);
+
+		ctx->buf_addr = MapViewOfFileEx(ctx->buf_section, FILE_MAP_WRITE,
+			0, 0, (SIZE_T)(ctx->buf_size), addr);
+		if(ctx->buf_addr == NULL) {
+			*p_err = GetLastError();
+			continue;
+		}
+
+		ctx->buf_mirror = MapViewOfFileEx(ctx->buf_section, FILE_MAP_WRITE,
+			0, 0, (SIZE_T)(ctx->buf_size), addr + ctx->buf_size);
+		if(ctx->buf_mirror != NULL)
+			return 1;
+
+		*p_err = GetLastError();
+		UnmapViewOfFile(ctx->buf_addr);
+		ctx->buf_addr = NULL;
+	}
+
+	CloseHandle(ctx->buf_section);
+	ctx->buf_section = NULL;
+	return 0;
+}
+
 /* ---------------------------------------------------------------------------------------------- */
 
 /* Initialize buffer */
 int bigbuf_init(struct msg_filter *mf, struct big_buffer *ctx, int use_vm_buffer,
-				 unsigned __int64 buf_size_req, unsigned __int64 win_size_req)
+				 unsigned __int64 buf_size_req, unsigned __int64 win_size_req, int prefault)
 {
 	SYSTEM_INFO si;
 
@@ -436,25 +644,47 @@ int bigbuf_init(struct msg_filter *mf, struct big_buffer *ctx, int use_vm_buffer
 	if(use_vm_buffer)
 	{
 		TCHAR fmt_buf[64];
+		DWORD error;
 
 		ctx->buf_size = ((buf_size_req + si.dwAllocationGranularity - 1U) / 
 			si.dwAllocationGranularity) * si.dwAllocationGranularity;
 
 		msg_print(mf, MSG_VERY_VERBOSE,
-			_T("Allocating virtual memory buffer (%s)...\n"),
+			_T("Reserving virtual memory buffer (%s)...\n"),
 			fmt_block_size(fmt_buf, ctx->buf_size, 1));
 
-		ctx->buf_addr = VirtualAlloc(NULL, (SIZE_T)(ctx->buf_size), MEM_COMMIT, PAGE_READWRITE);
+		/* Reserve address space, memory is committed by chunks on first write.
+		 * Buffer mapped twice when possible, otherwise accesses are split at buffer end. */
+		if(bigbuf_map_mirrored(ctx, &error)) {
+			msg_print(mf, MSG_VERY_VERBOSE, _T("Buffer mapped twice at %p.\n"), ctx->buf_addr);
+		} else {
+			msg_print(mf, MSG_VERY_VERBOSE, _T("Can't map buffer twice: %s (%u).\n"),
+				msg_winerr(mf, error), error);
+			ctx->buf_addr = VirtualAlloc(NULL, (SIZE_T)(ctx->buf_size), MEM_RESERVE, PAGE_READWRITE);
+		}
 
 		if(ctx->buf_addr == NULL)
 		{
-			DWORD error = GetLastError();
+			error = GetLastError();
 			msg_print(mf, MSG_ERROR,
-				_T("Can't allocate %s of virtual memory for buffer: %s (%u).\n"),
+				_T("Can't reserve %s of virtual memory for buffer: %s (%u).\n"),
 				fmt_block_size(fmt_buf, ctx->buf_size, 1), msg_winerr(mf, error), error);
 			bigbuf_free(ctx);
 			return 0;
 		}
+
+		/* Start faulting in pages ahead of writer */
+		if(prefault)
+		{
+			ctx->prefault_thread = (HANDLE)_beginthreadex(NULL, 0,
+				bigbuf_prefault_thread, ctx, CREATE_SUSPENDED, NULL);
+			if(ctx->prefault_thread != NULL) {
+				SetThreadPriority(ctx->prefault_thread, THREAD_PRIORITY_BELOW_NORMAL);
+				ResumeThread(ctx->prefault_thread);
+			} else {
+				msg_print(mf, MSG_WARNING, _T("Can't start buffer prefault thread.\n"));
+			}
+		}
 	}
 	else
 	{
@@ -537,13 +767,27 @@ int bigbuf_init(struct msg_filter *mf, struct big_buffer *ctx, int use_vm_buffer
 /* Free buffer */
 void bigbuf_free(struct big_buffer *ctx)
 {
+	if(ctx->prefault_thread != NULL)
+	{
+		InterlockedExchange(&(ctx->prefault_stop), 1);
+		WaitForSingleObject(ctx->prefault_thread, INFINITE);
+		CloseHandle(ctx->prefault_thread);
+	}
 	DeleteCriticalSection(&(ctx->buf_ptr_lock));
 	if(ctx->thres_wr_ev != NULL)
 		CloseHandle(ctx->thres_wr_ev);
 	if(ctx->thres_rd_ev != NULL)
 		CloseHandle(ctx->thres_rd_ev);
-	if(ctx->buf_addr != NULL)
+	if(ctx->buf_section != NULL)
+	{
+		UnmapViewOfFile(ctx->buf_mirror);
+		UnmapViewOfFile(ctx->buf_addr);
+		CloseHandle(ctx->buf_section);
+	}
+	else if(ctx->buf_addr != NULL)
+	{
 		VirtualFree(ctx->buf_addr, 0U, MEM_RELEASE);
+	}
 	if(ctx->buf_page_cnt != 0U)
 	{
 		FreeUserPhysicalPages(GetCurrentProcess(), &(ctx->buf_page_cnt), ctx->page_pfn);
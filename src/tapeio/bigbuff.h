@@ -12,6 +12,9 @@
 
 #define BIGBUF_WINDOW_NO_MAP	((ULONG_PTR)-1)
 
+#define BIGBUF_COMMIT_CHUNK		(16UL << 20)	/* Virtual memory buffer commit granularity */
+#define BIGBUF_MIRROR_ATTEMPTS	8				/* Attempts to map buffer twice back-to-back */
+
 struct big_buffer
 {
 	/* ---------------------------------- */
@@ -22,6 +25,7 @@ struct big_buffer
 	unsigned __int64 buf_size;			/* Size of buffer in bytes */
 	unsigned __int64 buf_data_offset;	/* Data offset in bytes */
 	unsigned __int64 buf_data_length;	/* Data length in bytes */
+	unsigned __int64 buf_data_held;		/* Data held by bigbuf_read_ptr (not available) */
 
 	/* ---------------------------------- */
 	/* Read/write thresholds */
@@ -35,7 +39,12 @@ struct big_buffer
 	/* ---------------------------------- */
 	/* Virtual memory buffer */
 
-	BYTE *buf_addr;						/* Allocated memory */
+	BYTE *buf_addr;						/* Reserved memory (committed by chunks on first write) */
+	HANDLE buf_section;					/* Pagefile section mapped twice (NULL if not mirrored) */
+	BYTE *buf_mirror;					/* Second view at buf_addr + buf_size */
+	LONG commit_chunks;					/* Number of committed chunks */
+	HANDLE prefault_thread;				/* Thread committing and touching pages ahead of writer */
+	LONG prefault_stop;					/* Prefault thread stop flag */
 
 	/* ---------------------------------- */
 	/* Userpage buffer  */
@@ -63,16 +72,31 @@ struct big_buffer
 /* Write data to buffer. Buffer should have enough free space. */
 int bigbuf_write(struct big_buffer *ctx, const void *src, size_t length, DWORD *p_err);
 
-/* Read data from buffer. Buffer must have enough available data. */
+/* Read data from buffer. Buffer must have enough available data and no held data. */
 int bigbuf_read(struct big_buffer *ctx, void *dst, size_t length, DWORD *p_err);
 
+/* Get pointer for writing length bytes directly to buffer (mirrored buffer only, NULL otherwise).
+ * Buffer must have enough free space. Call bigbuf_write_done after filling it. */
+void *bigbuf_write_ptr(struct big_buffer *ctx, size_t length, DWORD *p_err);
+
+/* Add length bytes written through bigbuf_write_ptr to buffer data. */
+void bigbuf_write_done(struct big_buffer *ctx, size_t length);
+
+/* Get pointer for reading length bytes directly from buffer (mirrored buffer only, NULL otherwise).
+ * Buffer must have enough available data. Data stays in buffer, but is not available anymore,
+ * so next call returns data following it. Call bigbuf_read_done in same order after using it. */
+const void *bigbuf_read_ptr(struct big_buffer *ctx, size_t length);
+
+/* Remove length bytes held by bigbuf_read_ptr from buffer data. */
+void bigbuf_read_done(struct big_buffer *ctx, size_t length);
+
 /* Set free space threshold (buffer writable event). */
 void bigbuf_set_thres_write(struct big_buffer *ctx, unsigned __int64 thres_wr_free);
 
 /* Set available data threshold (buffer readable event). */
 void bigbuf_set_thres_read(struct big_buffer *ctx, unsigned __int64 thres_rd_avail);
 
-/* Get number of bytes available. */
+/* Get number of bytes available (not held by bigbuf_read_ptr). */
 unsigned __int64 bigbuf_data_avail(struct big_buffer *ctx);
 
 /* Get number of bytes free. */
@@ -87,7 +111,8 @@ int bigbuf_init(
 	struct big_buffer *ctx,
 	int use_vm_buffer,					/* use buffer in virtual memory */
 	unsigned __int64 buf_size_req,		/* size of buffer (aligned to read/write window) */
-	unsigned __int64 win_size_req);		/* size of read/write window (aligned to page size) */
+	unsigned __int64 win_size_req,		/* size of read/write window (aligned to page size) */
+	int prefault);						/* fault in virtual memory buffer pages in background */
 
 /* Free buffer */
 void bigbuf_free(struct big_buffer *ctx);
@@ -609,3 +609,106 @@ unsigned int crc32_update(unsigned int acc, const void *src, size_t length)
 }
 
 /* ---------------------------------------------------------------------------------------------- */
+
+/* CRC32 combination (zero bytes appended to crc register is linear operator over GF(2)),
+ * see crc32_combine in zlib */
+
+#define CRC32_POLY_REFLECTED	0xEDB88320
+
+/* Multiply 32x32 GF(2) matrix by vector */
+static unsigned int gf2_matrix_times(const unsigned int *mat, unsigned int vec)
+{
+	unsigned int sum = 0;
+
+	while(vec != 0) {
+		if(vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+/* Square 32x32 GF(2) matrix */
+static void gf2_matrix_square(unsigned int *square, const unsigned int *mat)
+{
+	int n;
+
+	for(n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Prepare operator appending len2 zero bytes to crc register */
+void crc32_combine_op(unsigned int op[32], unsigned __int64 len2)
+{
+	unsigned int even[32], odd[32], row;
+	int n;
+
+	/* Identity */
+	for(n = 0; n < 32; n++)
+		op[n] = 1U << n;
+
+	/* Operator for one zero bit */
+	odd[0] = CRC32_POLY_REFLECTED;
+	row = 1;
+	for(n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	/* Operators for two and four zero bits */
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	/* Multiply by operators for 2^n zero bytes where bit n of len2 is set */
+	while(len2 != 0)
+	{
+		gf2_matrix_square(even, odd);
+		if(len2 & 1) {
+			for(n = 0; n < 32; n++)
+				op[n] = gf2_matrix_times(even, op[n]);
+		}
+		len2 >>= 1;
+		if(len2 == 0)
+			break;
+
+		gf2_matrix_square(odd, even);
+		if(len2 & 1) {
+			for(n = 0; n < 32; n++)
+				op[n] = gf2_matrix_times(odd, op[n]);
+		}
+		len2 >>= 1;
+	}
+}
+
+/* Combine crc32 using operator prepared by crc32_combine_op */
+unsigned int crc32_combine_with_op(const unsigned int op[32], unsigned int crc1, unsigned int crc2)
+{
+	return gf2_matrix_times(op, crc1) ^ crc2;
+}
+
+/* Compute crc32 of two concatenated blocks */
+unsigned int crc32_combine(unsigned int crc1, unsigned int crc2, unsigned __int64 len2)
+{
+	unsigned int op[32];
+
+	if(len2 == 0)
+		return crc1;
+
+	crc32_combine_op(op, len2);
+	return crc32_combine_with_op(op, crc1, crc2);
+}
+
+/* Update crc32 with zero bytes */
+unsigned int crc32_zeros(unsigned int acc, unsigned __int64 length)
+{
+	unsigned int op[32];
+
+	if(length == 0)
+		return acc;
+
+	crc32_combine_op(op, length);
+	return ~gf2_matrix_times(op, ~acc);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
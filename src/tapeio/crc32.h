@@ -8,4 +8,17 @@
 
 unsigned int crc32_update(unsigned int acc, const void *src, size_t length);
 
+/* Compute crc32 of two concatenated blocks from crc32 of each block */
+
+unsigned int crc32_combine(unsigned int crc1, unsigned int crc2, unsigned __int64 len2);
+
+/* Prepare operator for combining with blocks of same length (faster crc32_combine) */
+
+void crc32_combine_op(unsigned int op[32], unsigned __int64 len2);
+unsigned int crc32_combine_with_op(const unsigned int op[32], unsigned int crc1, unsigned int crc2);
+
+/* Update crc32 with length zero bytes without processing them */
+
+unsigned int crc32_zeros(unsigned int acc, unsigned __int64 length);
+
 /* ---------------------------------------------------------------------------------------------- */
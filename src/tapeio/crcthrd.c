@@ -10,80 +10,181 @@
 
 /* ---------------------------------------------------------------------------------------------- */
 
-enum {
-	EVENT_READ,
-	EVENT_FLUSH_EXIT,
+/* Update buffer events (buf_ptr_lock held) */
+static void crc32_update_events(struct crc32_thread *cs)
+{
+	size_t unclaimed = cs->buf_data_length - cs->buf_claimed;
+	int readable;
 
-	EVENT_COUNT
-};
+	/* Writable when enough free space for current block */
+	if(cs->buf_size - cs->buf_data_length >= cs->thres_write) {
+		if(!(cs->event_flag & CRC_THREAD_WRITE_EV)) {
+			SetEvent(cs->h_ev_writable);
+			cs->event_flag |= CRC_THREAD_WRITE_EV;
+		}
+	} else {
+		if(cs->event_flag & CRC_THREAD_WRITE_EV) {
+			ResetEvent(cs->h_ev_writable);
+			cs->event_flag &= ~CRC_THREAD_WRITE_EV;
+		}
+	}
 
-static unsigned int __stdcall crc32_thread_proc(struct crc32_thread *cs)
+	/* Readable when chunk can be taken by worker, or when flushing and all data taken */
+	readable = ( (cs->chunk_tail - cs->chunk_head < CRC_MAX_CHUNKS) &&
+		( (unclaimed >= cs->chunk_size) || (cs->flushing && (unclaimed > 0)) ) ) ||
+		(cs->flushing && (unclaimed == 0));
+	if(readable) {
+		if(!(cs->event_flag & CRC_THREAD_READ_EV)) {
+			SetEvent(cs->h_ev_readable);
+			cs->event_flag |= CRC_THREAD_READ_EV;
+		}
+	} else {
+		if(cs->event_flag & CRC_THREAD_READ_EV) {
+			ResetEvent(cs->h_ev_readable);
+			cs->event_flag &= ~CRC_THREAD_READ_EV;
+		}
+	}
+}
+
+/* Merge computed chunks in order of data and free their buffer space (buf_ptr_lock held) */
+static void crc32_merge_chunks(struct crc32_thread *cs)
 {
-	HANDLE events[EVENT_COUNT];
-	DWORD event_id;
+	struct crc32_chunk *chunk;
 
-	events[EVENT_READ] = cs->h_ev_readable;
-	events[EVENT_FLUSH_EXIT] = cs->h_ev_exit;
+	while(cs->chunk_head != cs->chunk_tail)
+	{
+		chunk = cs->chunks + (cs->chunk_head % CRC_MAX_CHUNKS);
+		if(!chunk->done)
+			break;
 
-	do {
-	
-		size_t data_offset, data_length;
-		
-		event_id = WaitForMultipleObjects(EVENT_COUNT, events, FALSE, INFINITE);
+		/* Append chunk crc to result */
+		if(chunk->length == cs->chunk_size)
+			cs->result = crc32_combine_with_op(cs->chunk_op, cs->result, chunk->crc);
+		else
+			cs->result = crc32_combine(cs->result, chunk->crc, chunk->length);
 
-		/* Get buffer state */
-		EnterCriticalSection(&(cs->buf_ptr_lock));
-		data_offset = cs->buf_data_offset;
-		data_length = cs->buf_data_length;
-		LeaveCriticalSection(&(cs->buf_ptr_lock));
-
-		while( (data_length >= cs->chunk_size) ||
-			((event_id == EVENT_FLUSH_EXIT) && (data_length > 0)) )
+		/* Append chunk digest */
+		if(cs->use_digests && !cs->digest_failed)
 		{
-			/* Choose size of block to process */
-			size_t block_size = cs->buf_size - data_offset;
-			if(block_size > data_length)
-				block_size = data_length;
-			if(block_size > cs->chunk_size)
-				block_size = cs->chunk_size;
-
-			/* Update CRC32 */
-			cs->result = crc32_update(cs->result, cs->buffer + data_offset, block_size);
-
-			/* Update data offset */
-			data_offset += block_size;
-			if(data_offset == cs->buf_size)
-				data_offset = 0;
-
-			/* Update buffer state */
-			EnterCriticalSection(&(cs->buf_ptr_lock));
-			cs->buf_data_offset = data_offset;
-			cs->buf_data_length -= block_size;
-			if( (cs->buf_size - cs->buf_data_length >= cs->thres_write) &&
-				!(cs->event_flag & CRC_THREAD_WRITE_EV) )
+			if(cs->digest_count == cs->digest_alloc)
 			{
-				SetEvent(cs->h_ev_writable);
-				cs->event_flag |= CRC_THREAD_WRITE_EV;
+				unsigned __int64 alloc = (cs->digest_alloc != 0) ? (cs->digest_alloc * 2) : 1024;
+				BYTE *digests = realloc(cs->digests, (size_t)alloc * SHA256_DIGEST_SIZE);
+				if(digests != NULL) {
+					cs->digests = digests;
+					cs->digest_alloc = alloc;
+				} else {
+					cs->digest_failed = 1;
+				}
 			}
-			if( (cs->buf_data_length < cs->chunk_size) &&
-				(cs->event_flag & CRC_THREAD_READ_EV) )
-			{
-				ResetEvent(cs->h_ev_readable);
-				cs->event_flag &= ~CRC_THREAD_READ_EV;
+			if(!cs->digest_failed) {
+				memcpy(cs->digests + (size_t)cs->digest_count * SHA256_DIGEST_SIZE,
+					chunk->digest, SHA256_DIGEST_SIZE);
+				cs->digest_count++;
 			}
-			data_length = cs->buf_data_length;
+		}
+
+		/* Free buffer space */
+		cs->buf_data_offset += chunk->length;
+		if(cs->buf_data_offset >= cs->buf_size)
+			cs->buf_data_offset -= cs->buf_size;
+		cs->buf_data_length -= chunk->length;
+		cs->buf_claimed -= chunk->length;
+
+		chunk->done = 0;
+		cs->chunk_head++;
+	}
+}
+
+/* Worker thread: take next chunk, compute its crc independently, merge in order */
+static unsigned int __stdcall crc32_thread_proc(struct crc32_thread *cs)
+{
+	struct crc32_chunk *chunk;
+	size_t offset, length, unclaimed;
+	unsigned int crc;
+	int flushing;
+	HANDLE events[2];
+
+	events[0] = cs->h_ev_readable;
+	events[1] = cs->h_ev_exit;
+
+	for(;;)
+	{
+		/* Take next chunk */
+		EnterCriticalSection(&(cs->buf_ptr_lock));
+		flushing = cs->flushing;
+		unclaimed = cs->buf_data_length - cs->buf_claimed;
+		if( (cs->chunk_tail - cs->chunk_head < CRC_MAX_CHUNKS) &&
+			( (unclaimed >= cs->chunk_size) || (flushing && (unclaimed > 0)) ) )
+		{
+			/* Chunk must not cross end of buffer */
+			offset = cs->buf_data_offset + cs->buf_claimed;
+			if(offset >= cs->buf_size)
+				offset -= cs->buf_size;
+			length = cs->buf_size - offset;
+			if(length > unclaimed)
+				length = unclaimed;
+			if(length > cs->chunk_size)
+				length = cs->chunk_size;
+
+			chunk = cs->chunks + (cs->chunk_tail % CRC_MAX_CHUNKS);
+			chunk->length = length;
+			chunk->done = 0;
+			cs->chunk_tail++;
+			cs->buf_claimed += length;
+			crc32_update_events(cs);
 			LeaveCriticalSection(&(cs->buf_ptr_lock));
+
+			/* Compute crc32 and digest of chunk */
+			crc = crc32_update(0, cs->buffer + offset, length);
+			if(cs->use_digests)
+				sha256(cs->buffer + offset, length, chunk->digest);
+
+			/* Merge finished chunks */
+			EnterCriticalSection(&(cs->buf_ptr_lock));
+			chunk->crc = crc;
+			chunk->done = 1;
+			crc32_merge_chunks(cs);
+			crc32_update_events(cs);
+			LeaveCriticalSection(&(cs->buf_ptr_lock));
+			continue;
 		}
-	
-	} while(event_id != EVENT_FLUSH_EXIT);
+		LeaveCriticalSection(&(cs->buf_ptr_lock));
+
+		/* Exit when flushing and all data taken (last worker merges remaining chunks) */
+		if(flushing) {
+			if(unclaimed == 0)
+				break;
+			WaitForSingleObject(cs->h_ev_readable, INFINITE);
+		} else {
+			WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		}
+	}
 
 	return 0;
 }
 
 /* ---------------------------------------------------------------------------------------------- */
 
-int crc32_thread_init(struct crc32_thread *cs, size_t buf_size, size_t block_size, int priority)
+int crc32_thread_init(struct crc32_thread *cs, size_t buf_size, size_t block_size, int priority,
+	size_t digest_chunk_size)
 {
+	SYSTEM_INFO si;
+	unsigned int i, thread_count;
+
+	memset(cs, 0, sizeof(struct crc32_thread));
+
+	/* Digest chunks must start at multiples of chunk size in data stream, so buffer holds
+	 * whole number of chunks and chunks never wrap around buffer end */
+	if(digest_chunk_size != 0)
+	{
+		cs->use_digests = 1;
+		block_size = digest_chunk_size;
+		buf_size = ((buf_size + block_size - 1) / block_size) * block_size;
+		if(buf_size < 2 * block_size)
+			buf_size = 2 * block_size;
+	}
+
 	InitializeCriticalSection(&(cs->buf_ptr_lock));
 	cs->buffer = VirtualAlloc(NULL, buf_size, MEM_COMMIT, PAGE_READWRITE);
 	cs->h_ev_writable = CreateEvent(NULL, TRUE, TRUE, NULL);
@@ -91,23 +192,33 @@ int crc32_thread_init(struct crc32_thread *cs, size_t buf_size, size_t block_siz
 	cs->h_ev_exit = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	cs->buf_size = buf_size;
-	cs->buf_data_offset = 0;
-	cs->buf_data_length = 0;
-	cs->thres_write = 0;
 	cs->chunk_size = block_size;
 	cs->event_flag = CRC_THREAD_WRITE_EV;
-	cs->result = 0;
+	crc32_combine_op(cs->chunk_op, block_size);
+
+	/* Two streams (source and destination) share processors */
+	GetSystemInfo(&si);
+	thread_count = si.dwNumberOfProcessors / 2;
+	if(thread_count < 1)
+		thread_count = 1;
+	if(thread_count > CRC_MAX_THREADS)
+		thread_count = CRC_MAX_THREADS;
 
 	if( (cs->buffer != NULL) && (cs->h_ev_writable != NULL) && (cs->h_ev_readable != NULL) &&
 		(cs->h_ev_exit != NULL))
 	{
-		unsigned int thread_id;
-		cs->h_thread = (HANDLE) _beginthreadex(NULL, 0, crc32_thread_proc, cs, 0, &thread_id);
-		if(cs->h_thread != INVALID_HANDLE_VALUE) {
+		for(i = 0; i < thread_count; i++)
+		{
+			unsigned int thread_id;
+			HANDLE h_thread = (HANDLE) _beginthreadex(NULL, 0, crc32_thread_proc, cs, 0, &thread_id);
+			if(h_thread == NULL)
+				break;
 			if(priority != THREAD_PRIORITY_NORMAL)
-				SetThreadPriority(cs->h_thread, priority);
-			return 1;
+				SetThreadPriority(h_thread, priority);
+			cs->h_threads[cs->thread_count++] = h_thread;
 		}
+		if(cs->thread_count != 0)
+			return 1;
 	}
 
 	if(cs->h_ev_exit != NULL)
@@ -139,11 +250,7 @@ void crc32_thread_write(struct crc32_thread *cs, const void *data, size_t length
 		if(wr_pos >= cs->buf_size)
 			wr_pos -= cs->buf_size;
 		cs->thres_write = length;
-		if((buf_free < length) && (cs->event_flag & CRC_THREAD_WRITE_EV))
-		{
-			ResetEvent(cs->h_ev_writable);
-			cs->event_flag &= ~CRC_THREAD_WRITE_EV;
-		}
+		crc32_update_events(cs);
 		LeaveCriticalSection(&(cs->buf_ptr_lock));
 
 		/* Check for enough free space */
@@ -166,11 +273,7 @@ void crc32_thread_write(struct crc32_thread *cs, const void *data, size_t length
 	/* Update buffer state */
 	EnterCriticalSection(&(cs->buf_ptr_lock));
 	cs->buf_data_length += length;
-	if((cs->buf_data_length >= cs->chunk_size) && !(cs->event_flag & CRC_THREAD_READ_EV))
-	{
-		SetEvent(cs->h_ev_readable);
-		cs->event_flag |= CRC_THREAD_READ_EV;
-	}
+	crc32_update_events(cs);
 	LeaveCriticalSection(&(cs->buf_ptr_lock));
 }
 
@@ -178,11 +281,19 @@ void crc32_thread_write(struct crc32_thread *cs, const void *data, size_t length
 
 unsigned int crc32_thread_finish(struct crc32_thread *cs)
 {
+	unsigned int i;
+
+	/* Let workers take partial chunks */
+	EnterCriticalSection(&(cs->buf_ptr_lock));
+	cs->flushing = 1;
+	crc32_update_events(cs);
+	LeaveCriticalSection(&(cs->buf_ptr_lock));
 	SetEvent(cs->h_ev_exit);
 	
-	WaitForSingleObject(cs->h_thread, INFINITE);
+	WaitForMultipleObjects(cs->thread_count, cs->h_threads, TRUE, INFINITE);
 	
-	CloseHandle(cs->h_thread);
+	for(i = 0; i < cs->thread_count; i++)
+		CloseHandle(cs->h_threads[i]);
 	CloseHandle(cs->h_ev_exit);
 	CloseHandle(cs->h_ev_readable);
 	CloseHandle(cs->h_ev_writable);
@@ -193,3 +304,14 @@ unsigned int crc32_thread_finish(struct crc32_thread *cs)
 }
 
 /* ---------------------------------------------------------------------------------------------- */
+
+/* Free digests array */
+void crc32_thread_free_digests(struct crc32_thread *cs)
+{
+	free(cs->digests);
+	cs->digests = NULL;
+	cs->digest_count = 0;
+	cs->digest_alloc = 0;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <windows.h>
+#include "sha256.h"
 
 /* ---------------------------------------------------------------------------------------------- */
 /* CRC32 computation thread context */
@@ -10,6 +11,18 @@
 #define CRC_THREAD_WRITE_EV		0x0001
 #define CRC_THREAD_READ_EV		0x0002
 
+#define CRC_MAX_THREADS			4		/* Max. worker threads per CRC stream */
+#define CRC_MAX_CHUNKS			16		/* Max. chunks being processed or waiting for merge */
+
+/* Chunk of data processed by one worker */
+struct crc32_chunk
+{
+	size_t length;				/* chunk length */
+	unsigned int crc;			/* crc32 of chunk alone */
+	BYTE digest[SHA256_DIGEST_SIZE];	/* SHA-256 of chunk (digest mode) */
+	int done;					/* crc computed, waiting for merge */
+};
+
 struct crc32_thread
 {
 	/* data buffer */
@@ -18,28 +31,48 @@ struct crc32_thread
 	size_t buf_size;			/* size of data buffer */
 	size_t buf_data_offset;		/* offset of data in buffer */
 	size_t buf_data_length;		/* size of data available in buffer */
+	size_t buf_claimed;			/* size of data taken by workers (from data offset) */
+
+	/* chunks in order of data (merged from head when done) */
+	struct crc32_chunk chunks[CRC_MAX_CHUNKS];
+	unsigned int chunk_head;	/* oldest chunk not merged */
+	unsigned int chunk_tail;	/* next chunk to take */
+	unsigned int chunk_op[32];	/* crc32_combine operator for full chunks */
 
 	/* read/write thresholds */
 	size_t thres_write;			/* required free space to write current block */
 	size_t chunk_size;			/* size of block to calculate crc */
 	unsigned int event_flag;	/* active event mask */
 	HANDLE h_ev_writable;		/* buffer writeable event (free space >= thres_write)  */
-	HANDLE h_ev_readable;		/* buffer readable event (avail data >= chunk_size) */
+	HANDLE h_ev_readable;		/* chunk available event (unclaimed data >= chunk_size) */
 
 	/* stop event */
-	HANDLE h_ev_exit;			/* process remaining data and exit thread */
+	int flushing;				/* process partial chunks, exit when all data taken */
+	HANDLE h_ev_exit;			/* process remaining data and exit threads */
 
-	/* thread handle */
-	HANDLE h_thread;
+	/* worker threads */
+	unsigned int thread_count;
+	HANDLE h_threads[CRC_MAX_THREADS];
 
 	/* computed crc32 */
 	unsigned int result;
+
+	/* SHA-256 of each chunk in order of data (digest mode, chunks aligned to chunk_size) */
+	int use_digests;
+	BYTE *digests;				/* SHA256_DIGEST_SIZE bytes per chunk */
+	unsigned __int64 digest_count;
+	unsigned __int64 digest_alloc;
+	int digest_failed;			/* not enough memory for digests */
 };
 
 /* ---------------------------------------------------------------------------------------------- */
 
-int crc32_thread_init(struct crc32_thread *cs, size_t buf_size, size_t block_size, int priority);
+/* Start CRC worker threads. When digest_chunk_size is not 0, it is used as chunk size and
+ * SHA-256 of each chunk is stored to digests array (freed by crc32_thread_free_digests). */
+int crc32_thread_init(struct crc32_thread *cs, size_t buf_size, size_t block_size, int priority,
+	size_t digest_chunk_size);
 void crc32_thread_write(struct crc32_thread *cs, const void *data, size_t length);
 unsigned int crc32_thread_finish(struct crc32_thread *cs);
+void crc32_thread_free_digests(struct crc32_thread *cs);
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,590 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <wincrypt.h>
+#include <process.h>
+#include <string.h>
+#include <tchar.h>
+#include "crypt.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Block buffer I/O state */
+#define CRYPT_IO_IDLE				0
+#define CRYPT_IO_PENDING			1	/* Overlapped operation in progress */
+#define CRYPT_IO_COMPLETE			2	/* Completed, result in io_done/io_error */
+
+/* Load 256-bit key from file (32 bytes or 64 hex digits) */
+int crypt_load_key(const TCHAR *filename, BYTE *key, DWORD *p_error)
+{
+	BYTE buf[128];
+	HANDLE h_file;
+	DWORD size, i;
+	BOOL ok;
+
+	h_file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if(h_file == INVALID_HANDLE_VALUE) {
+		*p_error = GetLastError();
+		return 0;
+	}
+	ok = ReadFile(h_file, buf, sizeof(buf), &size, NULL);
+	*p_error = GetLastError();
+	CloseHandle(h_file);
+	if(!ok)
+		return 0;
+
+	/* Raw key */
+	if(size == AES256_KEY_SIZE) {
+		memcpy(key, buf, AES256_KEY_SIZE);
+		memset(buf, 0, sizeof(buf));
+		return 1;
+	}
+
+	/* Hex digits followed by optional whitespace */
+	for(i = 0; i < size; i++) {
+		if((buf[i] != ' ') && (buf[i] != '\t') && (buf[i] != '\r') && (buf[i] != '\n'))
+			break;
+	}
+	for(; (i + 1 < size) && (i < AES256_KEY_SIZE * 2); i += 2) {
+		int k, v = 0;
+		for(k = 0; k < 2; k++) {
+			BYTE c = buf[i + k];
+			v <<= 4;
+			if((c >= '0') && (c <= '9')) v |= c - '0';
+			else if((c >= 'a') && (c <= 'f')) v |= c - 'a' + 10;
+			else if((c >= 'A') && (c <= 'F')) v |= c - 'A' + 10;
+			else break;
+		}
+		if(k != 2)
+			break;
+		key[i / 2] = (BYTE)v;
+	}
+	if(i == AES256_KEY_SIZE * 2) {
+		for(; i < size; i++) {
+			if((buf[i] != ' ') && (buf[i] != '\t') && (buf[i] != '\r') && (buf[i] != '\n'))
+				break;
+		}
+	}
+	memset(buf, 0, sizeof(buf));
+
+	if(i != size) {
+		memset(key, 0, AES256_KEY_SIZE);
+		*p_error = ERROR_INVALID_DATA;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Encrypt or decrypt frames of current job */
+static void crypt_run_job(struct crypt_stream *cs)
+{
+	struct crypt_block_header *hdr = (struct crypt_block_header*)(cs->job_block);
+	struct crypt_frame_entry *entries = (struct crypt_frame_entry*)(hdr + 1);
+	BYTE *payload = cs->job_block + cs->header_size;
+
+	for(;;)
+	{
+		LONG index = InterlockedIncrement((LONG*)&(cs->job_next)) - 1;
+		struct crypt_frame_entry *entry;
+		DWORD seq, offset, length;
+		BYTE *nonce;
+
+		if(index >= cs->job_frames)
+			break;
+
+		entry = entries + index;
+		nonce = entry->nonce;
+		seq = cs->frame_seq + (DWORD)index;
+		offset = (DWORD)index * CRYPT_FRAME_SIZE;
+		length = hdr->payload_length - offset;
+		if(length > CRYPT_FRAME_SIZE)
+			length = CRYPT_FRAME_SIZE;
+
+		if(!cs->job_decrypt)
+		{
+			memcpy(nonce, cs->file_id, CRYPT_FILE_ID_SIZE);
+			nonce[8] = (BYTE)(seq >> 24);
+			nonce[9] = (BYTE)(seq >> 16);
+			nonce[10] = (BYTE)(seq >> 8);
+			nonce[11] = (BYTE)seq;
+			aes_gcm_encrypt(&(cs->key), nonce, (const BYTE*)hdr, sizeof(struct crypt_block_header),
+				payload + offset, length, entry->tag);
+		}
+		else
+		{
+			/* Frames should follow in order of writing */
+			if( (memcmp(nonce, cs->file_id, CRYPT_FILE_ID_SIZE) != 0) ||
+				(nonce[8] != (BYTE)(seq >> 24)) || (nonce[9] != (BYTE)(seq >> 16)) ||
+				(nonce[10] != (BYTE)(seq >> 8)) || (nonce[11] != (BYTE)seq) ||
+				!aes_gcm_decrypt(&(cs->key), nonce, (const BYTE*)hdr,
+					sizeof(struct crypt_block_header), payload + offset, length, entry->tag) )
+			{
+				InterlockedExchange((LONG*)&(cs->job_failed), 1);
+			}
+		}
+	}
+}
+
+static unsigned int __stdcall crypt_worker_thread(struct crypt_worker *worker)
+{
+	struct crypt_stream *cs = worker->cs;
+
+	for(;;)
+	{
+		if(WaitForSingleObject(worker->h_ev_start, INFINITE) != WAIT_OBJECT_0)
+			break;
+		if(cs->quit)
+			break;
+		crypt_run_job(cs);
+		SetEvent(worker->h_ev_done);
+	}
+
+	return 0;
+}
+
+/* Process frames of block on all workers, returns 0 if decryption failed */
+static int crypt_process_block(struct crypt_stream *cs, BYTE *block, DWORD frames, int decrypt)
+{
+	HANDLE h_done[CRYPT_MAX_THREADS];
+	unsigned int i;
+
+	cs->job_block = block;
+	cs->job_frames = (LONG)frames;
+	cs->job_decrypt = decrypt;
+	cs->job_failed = 0;
+	InterlockedExchange((LONG*)&(cs->job_next), 0);
+
+	for(i = 0; i < cs->worker_count; i++) {
+		h_done[i] = cs->workers[i].h_ev_done;
+		SetEvent(cs->workers[i].h_ev_start);
+	}
+
+	crypt_run_job(cs);
+
+	if(cs->worker_count != 0)
+		WaitForMultipleObjects(cs->worker_count, h_done, TRUE, INFINITE);
+
+	cs->frame_seq += frames;
+	cs->frame_count += frames;
+	return !cs->job_failed;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Start reading or writing block buffer */
+static void crypt_start_io(struct crypt_stream *cs, unsigned int slot, int write)
+{
+	BYTE *buf = cs->blocks[slot];
+	DWORD size = (DWORD)(cs->block_size);
+	BOOL ok;
+
+	cs->io_done[slot] = 0;
+	cs->io_error[slot] = NO_ERROR;
+	cs->io_state[slot] = CRYPT_IO_COMPLETE;
+
+	/* Write through next stream */
+	if(cs->next != NULL)
+	{
+		size_t done, total = 0;
+		DWORD error = NO_ERROR;
+
+		while(total < size) {
+			if(write) {
+				ok = cs->next->write(cs->next->param, buf + total, size - total, &done, &error);
+			} else {
+				ok = cs->next->read(cs->next->param, buf + total, size - total, &done, &error);
+			}
+			total += done;
+			if(!ok || (done == 0))
+				break;
+		}
+		cs->io_done[slot] = (DWORD)total;
+		cs->io_error[slot] = ok ? NO_ERROR : error;
+		return;
+	}
+
+	/* Overlapped I/O when tape opened with FILE_FLAG_OVERLAPPED */
+	cs->ov[slot].Offset = 0;
+	cs->ov[slot].OffsetHigh = 0;
+	if(write) {
+		ok = WriteFile(cs->h_tape, buf, size, &(cs->io_done[slot]), &(cs->ov[slot]));
+	} else {
+		ok = ReadFile(cs->h_tape, buf, size, &(cs->io_done[slot]), &(cs->ov[slot]));
+	}
+
+	if(!ok) {
+		cs->io_error[slot] = GetLastError();
+		if(cs->io_error[slot] == ERROR_IO_PENDING) {
+			cs->io_error[slot] = NO_ERROR;
+			cs->io_state[slot] = CRYPT_IO_PENDING;
+		}
+	}
+}
+
+/* Wait for block buffer I/O completion */
+static int crypt_wait_io(struct crypt_stream *cs, unsigned int slot, DWORD *p_done, DWORD *p_error)
+{
+	if(cs->io_state[slot] == CRYPT_IO_PENDING) {
+		if(!GetOverlappedResult(cs->h_tape, &(cs->ov[slot]), &(cs->io_done[slot]), TRUE))
+			cs->io_error[slot] = GetLastError();
+	}
+
+	cs->io_state[slot] = CRYPT_IO_IDLE;
+	*p_done = cs->io_done[slot];
+	*p_error = cs->io_error[slot];
+	return (*p_error == NO_ERROR);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Frames used by block payload (empty block has one empty frame to authenticate header) */
+static DWORD crypt_block_frames(size_t payload_length)
+{
+	DWORD frames = (DWORD)((payload_length + CRYPT_FRAME_SIZE - 1) / CRYPT_FRAME_SIZE);
+	return (frames != 0) ? frames : 1;
+}
+
+/* Encrypt active block and start writing it */
+static int crypt_flush_block(struct crypt_stream *cs, int final, DWORD *p_error)
+{
+	BYTE *block = cs->blocks[cs->active];
+	struct crypt_block_header *hdr = (struct crypt_block_header*)block;
+	DWORD frames, done;
+
+	frames = crypt_block_frames(cs->payload_pos);
+
+	memset(block, 0, cs->header_size);
+	hdr->magic = CRYPT_BLOCK_MAGIC;
+	hdr->payload_length = (DWORD)(cs->payload_pos);
+	hdr->frame_size = CRYPT_FRAME_SIZE;
+	hdr->frame_count = frames;
+	hdr->flags = final ? CRYPT_BLOCK_FINAL : 0;
+	memset(block + cs->header_size + cs->payload_pos, 0, cs->payload_size - cs->payload_pos);
+
+	crypt_process_block(cs, block, frames, 0);
+	crypt_start_io(cs, cs->active, 1);
+
+	/* Encrypt next block while this one is written */
+	cs->active ^= 1;
+	cs->payload_pos = 0;
+	if(cs->io_state[cs->active] != CRYPT_IO_IDLE)
+		return crypt_wait_io(cs, cs->active, &done, p_error);
+
+	return 1;
+}
+
+static int crypt_write(void *param, const BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct crypt_stream *cs = param;
+	size_t n;
+
+	*p_done = 0;
+
+	while(*p_done < size)
+	{
+		/* Full block is written when more data follows, last one is flushed as final */
+		if((cs->payload_pos == cs->payload_size) && !crypt_flush_block(cs, 0, p_error))
+			return 0;
+
+		n = cs->payload_size - cs->payload_pos;
+		if(n > size - *p_done)
+			n = size - *p_done;
+		memcpy(cs->blocks[cs->active] + cs->header_size + cs->payload_pos, buf + *p_done, n);
+		cs->payload_pos += n;
+		*p_done += n;
+	}
+
+	return 1;
+}
+
+/* Write last block and wait for completion */
+static int crypt_finish(void *param, DWORD *p_error)
+{
+	struct crypt_stream *cs = param;
+	DWORD done;
+
+	if(!crypt_flush_block(cs, 1, p_error))
+		return 0;
+
+	cs->active ^= 1;
+	if( (cs->io_state[cs->active] != CRYPT_IO_IDLE) &&
+		!crypt_wait_io(cs, cs->active, &done, p_error) )
+	{
+		return 0;
+	}
+
+	if((cs->next != NULL) && (cs->next->finish != NULL))
+		return cs->next->finish(cs->next->param, p_error);
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+static int is_end_of_data(DWORD error)
+{
+	return (error == ERROR_FILEMARK_DETECTED) || (error == ERROR_SETMARK_DETECTED) ||
+		(error == ERROR_NO_DATA_DETECTED) || (error == ERROR_END_OF_MEDIA) ||
+		(error == ERROR_HANDLE_EOF);
+}
+
+/* Wait for active block, start reading next one and decrypt active */
+static int crypt_next_block(struct crypt_stream *cs, DWORD *p_error)
+{
+	BYTE *block = cs->blocks[cs->active];
+	struct crypt_block_header *hdr = (struct crypt_block_header*)block;
+	DWORD done, error;
+
+	if(!crypt_wait_io(cs, cs->active, &done, &error) || (done == 0))
+	{
+		if((done == 0) && ((error == NO_ERROR) || is_end_of_data(error)))
+		{
+			/* File truncated on block boundary */
+			if(!cs->final_read) {
+				cs->auth_failed = 1;
+				*p_error = ERROR_INVALID_DATA;
+				return 0;
+			}
+			cs->end_error = (error != NO_ERROR) ? error : ERROR_HANDLE_EOF;
+			return 1;
+		}
+		*p_error = error;
+		return 0;
+	}
+
+	/* Read ahead */
+	crypt_start_io(cs, cs->active ^ 1, 0);
+
+	/* Check block header */
+	if( (done != cs->block_size) ||
+		(hdr->magic != CRYPT_BLOCK_MAGIC) ||
+		(hdr->payload_length > cs->payload_size) ||
+		(hdr->frame_size != CRYPT_FRAME_SIZE) ||
+		(hdr->frame_count != crypt_block_frames(hdr->payload_length)) ||
+		((hdr->flags & ~CRYPT_BLOCK_FINAL) != 0) )
+	{
+		*p_error = ERROR_INVALID_DATA;
+		return 0;
+	}
+
+	/* File id is taken from first frame */
+	if(!cs->have_file_id) {
+		memcpy(cs->file_id, ((struct crypt_frame_entry*)(hdr + 1))->nonce, CRYPT_FILE_ID_SIZE);
+		cs->have_file_id = 1;
+	}
+
+	/* Data after final block */
+	if(cs->final_read || !crypt_process_block(cs, block, hdr->frame_count, 1)) {
+		cs->auth_failed = 1;
+		*p_error = ERROR_INVALID_DATA;
+		return 0;
+	}
+
+	if(hdr->flags & CRYPT_BLOCK_FINAL)
+		cs->final_read = 1;
+
+	cs->payload_length = hdr->payload_length;
+	cs->payload_pos = 0;
+	return 1;
+}
+
+static int crypt_peek(void *param, const BYTE **p_buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct crypt_stream *cs = param;
+
+	*p_done = 0;
+
+	for(;;)
+	{
+		if(cs->payload_pos < cs->payload_length) {
+			*p_buf = cs->blocks[cs->active] + cs->header_size + cs->payload_pos;
+			*p_done = cs->payload_length - cs->payload_pos;
+			if(*p_done > size)
+				*p_done = size;
+			return 1;
+		}
+
+		if(cs->end_error != NO_ERROR) {
+			/* End of regular file is reported as zero read */
+			if(cs->end_error == ERROR_HANDLE_EOF)
+				return 1;
+			*p_error = cs->end_error;
+			return 0;
+		}
+
+		/* Switch to block read ahead */
+		if(!cs->read_started) {
+			crypt_start_io(cs, 0, 0);
+			cs->active = 0;
+			cs->read_started = 1;
+		} else {
+			cs->active ^= 1;
+		}
+		cs->payload_length = 0;
+		cs->payload_pos = 0;
+
+		if(!crypt_next_block(cs, p_error))
+			return 0;
+	}
+}
+
+static void crypt_release(void *param, size_t size)
+{
+	struct crypt_stream *cs = param;
+
+	cs->payload_pos += size;
+}
+
+static int crypt_read(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	const BYTE *data;
+
+	if(!crypt_peek(param, &data, size, p_done, p_error))
+		return 0;
+
+	memcpy(buf, data, *p_done);
+	crypt_release(param, *p_done);
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Initialize encryption stream for tape block size and start worker threads */
+int crypt_stream_init(struct crypt_stream *cs, HANDLE h_tape, struct io_stream *next,
+	size_t block_size, const BYTE *key, DWORD *p_error)
+{
+	SYSTEM_INFO si;
+	HCRYPTPROV h_prov;
+	unsigned int i, count, max_frames;
+
+	memset(cs, 0, sizeof(struct crypt_stream));
+
+	if(block_size < CRYPT_MIN_BLOCK_SIZE) {
+		*p_error = ERROR_INVALID_PARAMETER;
+		return 0;
+	}
+
+	cs->h_tape = h_tape;
+	cs->next = next;
+	cs->block_size = block_size;
+
+	/* Header with entries for frames of whole block */
+	max_frames = (unsigned int)((block_size + CRYPT_FRAME_SIZE - 1) / CRYPT_FRAME_SIZE);
+	cs->header_size = sizeof(struct crypt_block_header) + max_frames * sizeof(struct crypt_frame_entry);
+	cs->header_size = ((cs->header_size + CRYPT_HEADER_ALIGN - 1) / CRYPT_HEADER_ALIGN) * CRYPT_HEADER_ALIGN;
+	cs->payload_size = block_size - cs->header_size;
+
+	aes_gcm_init(&(cs->key), key);
+
+	/* Random file id makes nonces unique between files encrypted with same key */
+	if(!CryptAcquireContext(&h_prov, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) {
+		*p_error = GetLastError();
+		return 0;
+	}
+	if(!CryptGenRandom(h_prov, CRYPT_FILE_ID_SIZE, cs->file_id)) {
+		*p_error = GetLastError();
+		CryptReleaseContext(h_prov, 0);
+		return 0;
+	}
+	CryptReleaseContext(h_prov, 0);
+
+	/* Block buffers (page aligned for unbuffered tape I/O) */
+	for(i = 0; i < 2; i++) {
+		cs->blocks[i] = VirtualAlloc(NULL, block_size, MEM_COMMIT, PAGE_READWRITE);
+		cs->ov[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if((cs->blocks[i] == NULL) || (cs->ov[i].hEvent == NULL)) {
+			*p_error = ERROR_NOT_ENOUGH_MEMORY;
+			crypt_stream_free(cs);
+			return 0;
+		}
+	}
+
+	/* One worker per processor besides calling thread */
+	GetSystemInfo(&si);
+	count = (si.dwNumberOfProcessors > 1) ? si.dwNumberOfProcessors - 1 : 0;
+	if(count > CRYPT_MAX_THREADS)
+		count = CRYPT_MAX_THREADS;
+
+	for(i = 0; i < count; i++)
+	{
+		struct crypt_worker *worker = cs->workers + i;
+
+		worker->cs = cs;
+		worker->h_ev_start = CreateEvent(NULL, FALSE, FALSE, NULL);
+		worker->h_ev_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if((worker->h_ev_start == NULL) || (worker->h_ev_done == NULL)) {
+			*p_error = GetLastError();
+			cs->worker_count = i + 1;
+			crypt_stream_free(cs);
+			return 0;
+		}
+		worker->h_thread = (HANDLE)_beginthreadex(NULL, 0, crypt_worker_thread, worker, 0, NULL);
+		cs->worker_count = i + 1;
+		if(worker->h_thread == NULL) {
+			*p_error = GetLastError();
+			crypt_stream_free(cs);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Get stream encrypting written data / decrypting read data */
+void crypt_io_stream(struct io_stream *stream, struct crypt_stream *cs)
+{
+	stream->param = cs;
+	stream->read = crypt_read;
+	stream->write = crypt_write;
+	stream->peek = crypt_peek;
+	stream->release = crypt_release;
+	stream->finish = crypt_finish;
+}
+
+/* Stop worker threads and free buffers */
+void crypt_stream_free(struct crypt_stream *cs)
+{
+	DWORD done, error;
+	unsigned int i;
+
+	/* Wait for read ahead or write */
+	for(i = 0; i < 2; i++) {
+		if(cs->io_state[i] != CRYPT_IO_IDLE)
+			crypt_wait_io(cs, i, &done, &error);
+	}
+
+	/* Stop workers */
+	cs->quit = 1;
+	for(i = 0; i < cs->worker_count; i++)
+	{
+		struct crypt_worker *worker = cs->workers + i;
+
+		if(worker->h_thread != NULL) {
+			SetEvent(worker->h_ev_start);
+			WaitForSingleObject(worker->h_thread, INFINITE);
+			CloseHandle(worker->h_thread);
+		}
+		if(worker->h_ev_start != NULL)
+			CloseHandle(worker->h_ev_start);
+		if(worker->h_ev_done != NULL)
+			CloseHandle(worker->h_ev_done);
+	}
+	cs->worker_count = 0;
+
+	for(i = 0; i < 2; i++) {
+		if(cs->blocks[i] != NULL)
+			VirtualFree(cs->blocks[i], 0, MEM_RELEASE);
+		if(cs->ov[i].hEvent != NULL)
+			CloseHandle(cs->ov[i].hEvent);
+		cs->blocks[i] = NULL;
+		cs->ov[i].hEvent = NULL;
+	}
+
+	/* Don't leave key schedule in memory */
+	memset(&(cs->key), 0, sizeof(cs->key));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
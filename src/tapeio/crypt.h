@@ -0,0 +1,121 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "aesgcm.h"
+#include "filethrd.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Tape data encryption (tapectl --encrypt <keyfile>).
+ *
+ * Each tape block starts with header followed by encrypted payload:
+ *
+ * +--------------+--------------------------------+---------+---------------------------------+
+ * | block header | frame 0 nonce, tag | frame 1 ... | padding | payload: frame 0 | frame 1 | ... |
+ * +--------------+--------------------------------+---------+---------------------------------+
+ * |<------------------ header_size (multiple of 512) ------->|<--------- payload_size ------->|
+ *
+ * Payload is split to frames of CRYPT_FRAME_SIZE encrypted with AES-256-GCM by worker threads
+ * in parallel. Frame nonce is random file id followed by frame number, block header is
+ * authenticated with each frame. Last block of file is padded, actual payload length is stored
+ * in its header, so data is read back without padding. Last block is also flagged as final (and
+ * has at least one frame, so flag is authenticated even for empty file); end of data before
+ * final block means truncated file and fails authentication. */
+
+#define CRYPT_BLOCK_MAGIC			0x59524354	/* 'TCRY' */
+#define CRYPT_FRAME_SIZE			(64UL << 10)
+#define CRYPT_HEADER_ALIGN			512
+#define CRYPT_MIN_BLOCK_SIZE		(64UL << 10)
+#define CRYPT_MAX_THREADS			8
+#define CRYPT_FILE_ID_SIZE			8
+
+#define CRYPT_BLOCK_FINAL			0x00000001	/* Last block of file */
+
+/* Header at start of each tape block */
+struct crypt_block_header
+{
+	DWORD magic;						/* CRYPT_BLOCK_MAGIC */
+	DWORD payload_length;				/* Bytes of data in block */
+	DWORD frame_size;					/* CRYPT_FRAME_SIZE */
+	DWORD frame_count;					/* Frames used by payload (at least one) */
+	DWORD flags;						/* CRYPT_BLOCK_* */
+};
+
+/* Nonce and tag of frame following block header */
+struct crypt_frame_entry
+{
+	BYTE nonce[GCM_NONCE_SIZE];
+	BYTE tag[GCM_TAG_SIZE];
+};
+
+struct crypt_worker
+{
+	struct crypt_stream *cs;
+	HANDLE h_ev_start;
+	HANDLE h_ev_done;
+	HANDLE h_thread;
+};
+
+struct crypt_stream
+{
+	/* tape access (directly or through next stream, e.g. error correction) */
+	HANDLE h_tape;
+	struct io_stream *next;
+	OVERLAPPED ov[2];
+	int io_state[2];					/* CRYPT_IO_* of each block buffer */
+	DWORD io_done[2];
+	DWORD io_error[2];
+
+	struct aes_gcm_key key;
+
+	size_t block_size;
+	size_t header_size;
+	size_t payload_size;
+
+	/* two tape blocks: one is filled/consumed while other is written/read */
+	BYTE *blocks[2];
+	unsigned int active;
+	size_t payload_length;				/* Payload of active block */
+	size_t payload_pos;					/* Bytes filled / consumed */
+	int read_started;
+	int final_read;						/* Final block was read */
+	DWORD end_error;					/* Filemark or end of data (reading) */
+
+	BYTE file_id[CRYPT_FILE_ID_SIZE];
+	int have_file_id;
+	DWORD frame_seq;					/* Number of first frame of active block */
+
+	/* worker pool (calling thread also processes frames) */
+	unsigned int worker_count;
+	struct crypt_worker workers[CRYPT_MAX_THREADS];
+	BYTE *job_block;
+	LONG job_frames;
+	int job_decrypt;
+	volatile LONG job_next;
+	volatile LONG job_failed;
+	int quit;
+
+	/* stats */
+	unsigned __int64 frame_count;
+	int auth_failed;					/* Frame authentication failed on reading */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Load 256-bit key from file (32 bytes or 64 hex digits) */
+int crypt_load_key(const TCHAR *filename, BYTE *key, DWORD *p_error);
+
+/* Initialize encryption stream for tape block size and start worker threads.
+ * When next stream is not NULL, tape blocks are written/read through it. */
+int crypt_stream_init(struct crypt_stream *cs, HANDLE h_tape, struct io_stream *next,
+	size_t block_size, const BYTE *key, DWORD *p_error);
+
+/* Get stream encrypting written data / decrypting read data */
+void crypt_io_stream(struct io_stream *stream, struct crypt_stream *cs);
+
+/* Stop worker threads and free buffers */
+void crypt_stream_free(struct crypt_stream *cs);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,192 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <tchar.h>
+#include <string.h>
+#include <stdlib.h>
+#include "../util/fmt.h"
+#include "datagen.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check if name is generator specification */
+int is_datagen_name(const TCHAR *name)
+{
+	return (_tcsnicmp(name, DATAGEN_PREFIX, 4) == 0);
+}
+
+/* Check if name is null sink */
+int is_null_sink_name(const TCHAR *name)
+{
+	return (_tcsicmp(name, NULL_SINK_NAME) == 0);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Parse generator specification (gen:<pattern>:<size>) */
+int datagen_parse(struct data_gen *gen, const TCHAR *spec)
+{
+	const TCHAR *pattern, *size_str;
+	size_t pattern_len;
+	TCHAR *ep;
+
+	if(!is_datagen_name(spec))
+		return 0;
+
+	/* Split pattern and size */
+	pattern = spec + 4;
+	if( (size_str = _tcschr(pattern, _T(':'))) == NULL )
+		return 0;
+	pattern_len = size_str - pattern;
+	size_str++;
+
+	memset(gen, 0, sizeof(struct data_gen));
+
+	/* Parse pattern */
+	if((pattern_len == 4) && (_tcsnicmp(pattern, _T("zero"), 4) == 0)) {
+		gen->pattern = DATAGEN_ZERO;
+	} else if((pattern_len == 6) && (_tcsnicmp(pattern, _T("random"), 6) == 0)) {
+		gen->pattern = DATAGEN_RANDOM;
+	} else if((pattern_len > 4) && (_tcsnicmp(pattern, _T("comp"), 4) == 0)) {
+		gen->pattern = DATAGEN_COMPRESSIBLE;
+		gen->zero_percent = _tcstoul(pattern + 4, &ep, 10);
+		if((ep != size_str - 1) || (gen->zero_percent > 100))
+			return 0;
+	} else {
+		return 0;
+	}
+
+	/* Parse size */
+	if(!parse_block_size(size_str, &(gen->size)) || (gen->size == 0))
+		return 0;
+
+	/* Use fixed seed to make generated data reproducible */
+	gen->rng_state[0] = 0x9E3779B97F4A7C15ULL;
+	gen->rng_state[1] = 0xD1B54A32D192ED03ULL;
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* xorshift128+ pseudo-random generator */
+static __inline unsigned __int64 rng_next(unsigned __int64 *s)
+{
+	unsigned __int64 x = s[0];
+	unsigned __int64 y = s[1];
+
+	s[0] = y;
+	x ^= x << 23;
+	s[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+
+	return s[1] + y;
+}
+
+/* Fill buffer with random data */
+static void fill_random(unsigned __int64 *s, BYTE *buf, size_t length)
+{
+	unsigned __int64 value;
+	size_t i, n;
+
+	/* Fill by 64-bit words */
+	n = length / sizeof(unsigned __int64);
+	for(i = 0; i < n; i++) {
+		value = rng_next(s);
+		memcpy(buf, &value, sizeof(unsigned __int64));
+		buf += sizeof(unsigned __int64);
+	}
+
+	/* Fill tail */
+	if((n = length % sizeof(unsigned __int64)) != 0) {
+		value = rng_next(s);
+		memcpy(buf, &value, n);
+	}
+}
+
+/* Generate data to buffer */
+static void datagen_fill(struct data_gen *gen, BYTE *buf, size_t length)
+{
+	size_t chunk_pos, chunk_rand, n;
+
+	switch(gen->pattern)
+	{
+	case DATAGEN_ZERO:
+		memset(buf, 0, length);
+		break;
+
+	case DATAGEN_RANDOM:
+		fill_random(gen->rng_state, buf, length);
+		break;
+
+	case DATAGEN_COMPRESSIBLE:
+		/* Each chunk starts with random bytes followed by zeroes */
+		chunk_rand = DATAGEN_CHUNK_SIZE - DATAGEN_CHUNK_SIZE * gen->zero_percent / 100;
+		chunk_pos = (size_t)(gen->position % DATAGEN_CHUNK_SIZE);
+		while(length != 0)
+		{
+			if(chunk_pos < chunk_rand) {
+				n = chunk_rand - chunk_pos;
+				if(n > length) n = length;
+				fill_random(gen->rng_state, buf, n);
+			} else {
+				n = DATAGEN_CHUNK_SIZE - chunk_pos;
+				if(n > length) n = length;
+				memset(buf, 0, n);
+			}
+			buf += n;
+			length -= n;
+			chunk_pos += n;
+			if(chunk_pos == DATAGEN_CHUNK_SIZE)
+				chunk_pos = 0;
+		}
+		break;
+	}
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Read from generator stream */
+static int datagen_read(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct data_gen *gen = param;
+
+	if(size > gen->size - gen->position)
+		size = (size_t)(gen->size - gen->position);
+
+	datagen_fill(gen, buf, size);
+	gen->position += size;
+
+	*p_done = size;
+	return 1;
+}
+
+/* Write to null stream */
+static int null_sink_write(void *param, const BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	*p_done = size;
+	return 1;
+}
+
+/* Initialize stream reading from generator */
+void datagen_stream(struct io_stream *stream, struct data_gen *gen)
+{
+	stream->param = gen;
+	stream->read = datagen_read;
+	stream->write = NULL;
+	stream->peek = NULL;
+	stream->release = NULL;
+	stream->finish = NULL;
+}
+
+/* Initialize stream discarding written data */
+void null_sink_stream(struct io_stream *stream)
+{
+	stream->param = NULL;
+	stream->read = NULL;
+	stream->write = null_sink_write;
+	stream->peek = NULL;
+	stream->release = NULL;
+	stream->finish = NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
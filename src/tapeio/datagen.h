@@ -0,0 +1,49 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "filethrd.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Synthetic data source (gen:<pattern>:<size>) and null sink (null:) endpoints.
+ * Used instead of files for drive and pipeline benchmarking. */
+
+#define DATAGEN_PREFIX				_T("gen:")
+#define NULL_SINK_NAME				_T("null:")
+
+/* Data patterns */
+#define DATAGEN_ZERO				0	/* zero-filled data */
+#define DATAGEN_RANDOM				1	/* incompressible pseudo-random data */
+#define DATAGEN_COMPRESSIBLE		2	/* random data with given percent of zero bytes */
+
+#define DATAGEN_CHUNK_SIZE			4096
+
+struct data_gen
+{
+	unsigned int pattern;
+	unsigned int zero_percent;			/* DATAGEN_COMPRESSIBLE: percent of zeroes per chunk */
+	unsigned __int64 size;				/* Total size of generated data */
+	unsigned __int64 position;			/* Bytes generated */
+	unsigned __int64 rng_state[2];		/* xorshift128+ state */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check if name is generator specification */
+int is_datagen_name(const TCHAR *name);
+
+/* Check if name is null sink */
+int is_null_sink_name(const TCHAR *name);
+
+/* Parse generator specification (gen:<pattern>:<size>) */
+int datagen_parse(struct data_gen *gen, const TCHAR *spec);
+
+/* Initialize stream reading from generator */
+void datagen_stream(struct io_stream *stream, struct data_gen *gen);
+
+/* Initialize stream discarding written data */
+void null_sink_stream(struct io_stream *stream);
+
+/* ---------------------------------------------------------------------------------------------- */
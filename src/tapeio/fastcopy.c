@@ -0,0 +1,119 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <string.h>
+#include <emmintrin.h>
+#include "fastcopy.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* SSE2 support: -1 = not checked yet, 0 = not supported, 1 = supported */
+static volatile LONG stream_copy_sse2 = -1;
+
+/* Check if non-temporal copy is used by copy_stream */
+int copy_stream_supported(void)
+{
+	LONG sse2 = stream_copy_sse2;
+
+	if(sse2 < 0) {
+		sse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? 1 : 0;
+		InterlockedExchange((LONG*)&stream_copy_sse2, sse2);
+	}
+	return (int)sse2;
+}
+
+/* Copy 64-byte blocks with non-temporal stores (dst must be 16-byte aligned) */
+static void copy_stream_sse2(BYTE *dst, const BYTE *src, size_t block_count)
+{
+	__m128i x0, x1, x2, x3;
+
+	while(block_count-- != 0)
+	{
+		x0 = _mm_loadu_si128((const __m128i*)(src +  0));
+		x1 = _mm_loadu_si128((const __m128i*)(src + 16));
+		x2 = _mm_loadu_si128((const __m128i*)(src + 32));
+		x3 = _mm_loadu_si128((const __m128i*)(src + 48));
+		_mm_stream_si128((__m128i*)(dst +  0), x0);
+		_mm_stream_si128((__m128i*)(dst + 16), x1);
+		_mm_stream_si128((__m128i*)(dst + 32), x2);
+		_mm_stream_si128((__m128i*)(dst + 48), x3);
+		src += 64;
+		dst += 64;
+	}
+
+	/* Make streamed data visible to other threads */
+	_mm_sfence();
+}
+
+/* Copy data which won't be read again soon */
+void copy_stream(void *dst, const void *src, size_t length)
+{
+	BYTE *dst_ptr = dst;
+	const BYTE *src_ptr = src;
+	size_t head, blocks;
+
+	if((length < STREAM_COPY_MIN_SIZE) || !copy_stream_supported()) {
+		memcpy(dst, src, length);
+		return;
+	}
+
+	/* Align destination to 16 bytes */
+	head = (16 - ((ULONG_PTR)dst_ptr & 15)) & 15;
+	memcpy(dst_ptr, src_ptr, head);
+	dst_ptr += head;
+	src_ptr += head;
+	length -= head;
+
+	/* Stream 64-byte blocks */
+	blocks = length / 64;
+	copy_stream_sse2(dst_ptr, src_ptr, blocks);
+	dst_ptr += blocks * 64;
+	src_ptr += blocks * 64;
+
+	/* Copy tail */
+	memcpy(dst_ptr, src_ptr, length - blocks * 64);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check 64-byte blocks for non-zero bytes */
+static int is_zero_sse2(const BYTE *buf, size_t block_count)
+{
+	__m128i acc, zero = _mm_setzero_si128();
+
+	while(block_count-- != 0)
+	{
+		acc = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)(buf +  0)),
+				_mm_loadu_si128((const __m128i*)(buf + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)(buf + 32)),
+				_mm_loadu_si128((const __m128i*)(buf + 48))));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+			return 0;
+		buf += 64;
+	}
+
+	return 1;
+}
+
+/* Check if all bytes of buffer are zero */
+int is_zero_block(const void *buf, size_t length)
+{
+	const BYTE *ptr = buf;
+	size_t blocks = 0, i;
+
+	if(copy_stream_supported()) {
+		blocks = length / 64;
+		if(!is_zero_sse2(ptr, blocks))
+			return 0;
+	}
+
+	for(i = blocks * 64; i < length; i++) {
+		if(ptr[i] != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,25 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <stddef.h>
+
+/* ---------------------------------------------------------------------------------------------- */
+
+#define STREAM_COPY_MIN_SIZE	0x10000		/* Smaller copies done by memcpy */
+
+/* Copy data which won't be read again soon (ring buffer input/output).
+ * Uses SSE2 non-temporal stores when available, so copied data doesn't evict
+ * CRC tables and buffers from cache. */
+
+void copy_stream(void *dst, const void *src, size_t length);
+
+/* Check if non-temporal copy is used by copy_stream */
+
+int copy_stream_supported(void);
+
+/* Check if all bytes of buffer are zero (SSE2 when available) */
+
+int is_zero_block(const void *buf, size_t length);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,583 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <string.h>
+#include <malloc.h>
+#include "fec.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* GF(2^8) arithmetic (polynomial x^8 + x^4 + x^3 + x^2 + 1).
+ * Blocks are multiplied by constant using 256-byte row of full multiplication table. */
+
+static BYTE gf_exp[512];
+static BYTE gf_log[256];
+static BYTE gf_mul_table[256][256];
+static int gf_initialized = 0;
+
+static void gf_init(void)
+{
+	unsigned int i, j, x;
+
+	if(gf_initialized)
+		return;
+
+	x = 1;
+	for(i = 0; i < 255; i++) {
+		gf_exp[i] = (BYTE)x;
+		gf_exp[i + 255] = (BYTE)x;
+		gf_log[x] = (BYTE)i;
+		x <<= 1;
+		if(x & 0x100)
+			x ^= 0x11D;
+	}
+	gf_exp[510] = gf_exp[0];
+	gf_exp[511] = gf_exp[1];
+	gf_log[0] = 0;
+
+	for(i = 0; i < 256; i++) {
+		gf_mul_table[0][i] = 0;
+		gf_mul_table[i][0] = 0;
+	}
+	for(i = 1; i < 256; i++) {
+		for(j = 1; j < 256; j++)
+			gf_mul_table[i][j] = gf_exp[gf_log[i] + gf_log[j]];
+	}
+
+	gf_initialized = 1;
+}
+
+static BYTE gf_inv(BYTE a)
+{
+	return gf_exp[255 - gf_log[a]];
+}
+
+/* dst ^= c * src */
+static void gf_mul_add(BYTE *dst, const BYTE *src, BYTE c, size_t len)
+{
+	const BYTE *row;
+	size_t i;
+
+	if(c == 0)
+		return;
+
+	if(c == 1) {
+		const DWORD *s = (const DWORD*)src;
+		DWORD *d = (DWORD*)dst;
+		for(i = 0; i < len / 4; i++)
+			d[i] ^= s[i];
+		for(i = len & ~3; i < len; i++)
+			dst[i] ^= src[i];
+		return;
+	}
+
+	row = gf_mul_table[c];
+	for(i = 0; i + 4 <= len; i += 4) {
+		dst[i    ] ^= row[src[i    ]];
+		dst[i + 1] ^= row[src[i + 1]];
+		dst[i + 2] ^= row[src[i + 2]];
+		dst[i + 3] ^= row[src[i + 3]];
+	}
+	for(; i < len; i++)
+		dst[i] ^= row[src[i]];
+}
+
+/* Cauchy generator matrix: coefficient of data block i in parity block j */
+static BYTE fec_coef(struct fec_stream *fs, unsigned int j, unsigned int i)
+{
+	return gf_inv((BYTE)((fs->data_blocks + j) ^ i));
+}
+
+/* Invert e*e matrix in place (Gauss-Jordan elimination, tmp is e*e bytes) */
+static int gf_invert_matrix(BYTE *a, BYTE *tmp, unsigned int e)
+{
+	unsigned int r, c, k;
+	BYTE *inv = tmp;
+
+	memset(inv, 0, e * e);
+	for(r = 0; r < e; r++)
+		inv[r * e + r] = 1;
+
+	for(c = 0; c < e; c++)
+	{
+		BYTE f;
+
+		/* Find pivot */
+		for(r = c; r < e; r++) {
+			if(a[r * e + c] != 0)
+				break;
+		}
+		if(r == e)
+			return 0;
+		if(r != c) {
+			for(k = 0; k < e; k++) {
+				BYTE t;
+				t = a[r * e + k]; a[r * e + k] = a[c * e + k]; a[c * e + k] = t;
+				t = inv[r * e + k]; inv[r * e + k] = inv[c * e + k]; inv[c * e + k] = t;
+			}
+		}
+
+		/* Normalize pivot row */
+		f = gf_inv(a[c * e + c]);
+		for(k = 0; k < e; k++) {
+			a[c * e + k] = gf_mul_table[f][a[c * e + k]];
+			inv[c * e + k] = gf_mul_table[f][inv[c * e + k]];
+		}
+
+		/* Eliminate column from other rows */
+		for(r = 0; r < e; r++) {
+			if((r == c) || ((f = a[r * e + c]) == 0))
+				continue;
+			for(k = 0; k < e; k++) {
+				a[r * e + k] ^= gf_mul_table[f][a[c * e + k]];
+				inv[r * e + k] ^= gf_mul_table[f][inv[c * e + k]];
+			}
+		}
+	}
+
+	memcpy(a, inv, e * e);
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Read or write one block (handle can be opened with FILE_FLAG_OVERLAPPED) */
+static int fec_tape_io(struct fec_stream *fs, int write, BYTE *buf, DWORD *p_done, DWORD *p_error)
+{
+	BOOL ok;
+
+	fs->ov.Offset = 0;
+	fs->ov.OffsetHigh = 0;
+	*p_done = 0;
+
+	if(write) {
+		ok = WriteFile(fs->h_tape, buf, (DWORD)(fs->block_size), p_done, &(fs->ov));
+	} else {
+		ok = ReadFile(fs->h_tape, buf, (DWORD)(fs->block_size), p_done, &(fs->ov));
+	}
+
+	if(!ok) {
+		*p_error = GetLastError();
+		if(*p_error != ERROR_IO_PENDING)
+			return 0;
+		if(!GetOverlappedResult(fs->h_tape, &(fs->ov), p_done, TRUE)) {
+			*p_error = GetLastError();
+			return 0;
+		}
+	}
+
+	/* Short write leaves group incomplete */
+	if(write && (*p_done != fs->block_size)) {
+		*p_error = ERROR_WRITE_FAULT;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Writing: parity accumulators at blocks 0..K-1 of buffer, data block being filled at K */
+
+/* Write parity blocks of current group */
+static int fec_write_parity(struct fec_stream *fs, DWORD *p_error)
+{
+	unsigned int j;
+	DWORD done;
+
+	for(j = 0; j < fs->parity_blocks; j++)
+	{
+		BYTE *parity = fs->buf + j * fs->block_size;
+
+		if(!fec_tape_io(fs, 1, parity, &done, p_error))
+			return 0;
+		fs->parity_bytes += done;
+		memset(parity, 0, fs->block_size);
+	}
+
+	fs->group_count = 0;
+	return 1;
+}
+
+/* Write filled data block (last one is padded to full size) */
+static int fec_write_block(struct fec_stream *fs, DWORD *p_error)
+{
+	BYTE *data = fs->buf + fs->parity_blocks * fs->block_size;
+	struct fec_block_header *hdr = (struct fec_block_header*)data;
+	unsigned int j;
+	DWORD done;
+
+	hdr->magic = FEC_BLOCK_MAGIC;
+	hdr->data_length = (DWORD)(fs->fill);
+	memset(data + sizeof(struct fec_block_header) + fs->fill, 0, fs->data_size - fs->fill);
+	fs->fill = 0;
+
+	if(!fec_tape_io(fs, 1, data, &done, p_error))
+		return 0;
+
+	/* Update parity */
+	for(j = 0; j < fs->parity_blocks; j++) {
+		gf_mul_add(fs->buf + j * fs->block_size, data,
+			fec_coef(fs, j, fs->group_count), fs->block_size);
+	}
+
+	if(++(fs->group_count) == fs->data_blocks)
+		return fec_write_parity(fs, p_error);
+
+	return 1;
+}
+
+static int fec_write(void *param, const BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct fec_stream *fs = param;
+	BYTE *data = fs->buf + fs->parity_blocks * fs->block_size + sizeof(struct fec_block_header);
+	size_t n;
+
+	*p_done = 0;
+
+	while(*p_done < size)
+	{
+		n = fs->data_size - fs->fill;
+		if(n > size - *p_done)
+			n = size - *p_done;
+		memcpy(data + fs->fill, buf + *p_done, n);
+		fs->fill += n;
+		*p_done += n;
+
+		if((fs->fill == fs->data_size) && !fec_write_block(fs, p_error))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Write last data block and parity of last incomplete group */
+static int fec_finish(void *param, DWORD *p_error)
+{
+	struct fec_stream *fs = param;
+
+	if((fs->fill != 0) && !fec_write_block(fs, p_error))
+		return 0;
+
+	if(fs->group_count == 0)
+		return 1;
+
+	return fec_write_parity(fs, p_error);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Reading: group blocks in order they are stored on tape, parity of last group
+ * follows its data blocks */
+
+static int is_media_error(DWORD error)
+{
+	return (error == ERROR_CRC) || (error == ERROR_READ_FAULT) || (error == ERROR_IO_DEVICE);
+}
+
+static int is_end_of_data(DWORD error)
+{
+	return (error == ERROR_FILEMARK_DETECTED) || (error == ERROR_SETMARK_DETECTED) ||
+		(error == ERROR_NO_DATA_DETECTED) || (error == ERROR_END_OF_MEDIA) ||
+		(error == ERROR_HANDLE_EOF);
+}
+
+/* Rebuild missing data blocks of complete group */
+static int fec_rebuild(struct fec_stream *fs, DWORD *p_error)
+{
+	unsigned int missing[FEC_MAX_BLOCKS], rows[FEC_MAX_BLOCKS];
+	unsigned int n = fs->group_data, e = 0, nrows = 0;
+	unsigned int i, j, r, m;
+	BYTE *mat;
+
+	/* Get missing data blocks and available parity blocks */
+	for(i = 0; i < n; i++) {
+		if(fs->erased[i])
+			missing[e++] = i;
+	}
+	if(e == 0)
+		return 1;
+	for(j = 0; (j < fs->parity_blocks) && (nrows < e); j++) {
+		if(!fs->erased[n + j])
+			rows[nrows++] = j;
+	}
+	if(nrows < e) {
+		*p_error = ERROR_CRC;
+		return 0;
+	}
+
+	/* Invert generator submatrix of missing blocks */
+	if((mat = malloc(e * e * 2)) == NULL) {
+		*p_error = ERROR_NOT_ENOUGH_MEMORY;
+		return 0;
+	}
+	for(r = 0; r < e; r++) {
+		for(m = 0; m < e; m++)
+			mat[r * e + m] = fec_coef(fs, rows[r], missing[m]);
+	}
+	if(!gf_invert_matrix(mat, mat + e * e, e)) {
+		free(mat);
+		*p_error = ERROR_CRC;
+		return 0;
+	}
+
+	/* Remove known data blocks from parity blocks */
+	for(r = 0; r < e; r++) {
+		BYTE *parity = fs->buf + (n + rows[r]) * fs->block_size;
+		for(i = 0; i < n; i++) {
+			if(!fs->erased[i])
+				gf_mul_add(parity, fs->buf + i * fs->block_size, fec_coef(fs, rows[r], i), fs->block_size);
+		}
+	}
+
+	/* Solve for missing blocks */
+	for(m = 0; m < e; m++) {
+		BYTE *data = fs->buf + missing[m] * fs->block_size;
+		memset(data, 0, fs->block_size);
+		for(r = 0; r < e; r++)
+			gf_mul_add(data, fs->buf + (n + rows[r]) * fs->block_size, mat[m * e + r], fs->block_size);
+		fs->erased[missing[m]] = 0;
+	}
+
+	free(mat);
+	fs->rebuilt_blocks += e;
+	return 1;
+}
+
+/* Mark group complete and rebuild missing blocks */
+static int fec_complete_group(struct fec_stream *fs, DWORD *p_error)
+{
+	if(fs->group_count > fs->parity_blocks) {
+		fs->group_data = fs->group_count - fs->parity_blocks;
+	} else if(fs->group_count == 0) {
+		fs->group_data = 0;
+	} else {
+		/* Parity without data */
+		*p_error = ERROR_INVALID_DATA;
+		return 0;
+	}
+
+	fs->group_complete = 1;
+	return fec_rebuild(fs, p_error);
+}
+
+/* Read next block of group */
+static int fec_read_block(struct fec_stream *fs, DWORD *p_error)
+{
+	unsigned int index = fs->group_count;
+	BYTE *buf = fs->buf + index * fs->block_size;
+	DWORD done, error, low, high;
+
+	/* Remember position of group to skip unreadable blocks */
+	if(index == 0) {
+		if(GetTapePosition(fs->h_tape, TAPE_LOGICAL_POSITION,
+			&(fs->group_partition), &low, &high) == NO_ERROR)
+		{
+			fs->group_offset = ((unsigned __int64)high << 32) | low;
+		} else {
+			fs->group_offset = (unsigned __int64)-1;
+		}
+	}
+
+	if(fec_tape_io(fs, 0, buf, &done, &error))
+	{
+		if(done < fs->block_size)
+			memset(buf + done, 0, fs->block_size - done);
+		fs->erased[index] = 0;
+		fs->group_count++;
+	}
+	else if(is_end_of_data(error))
+	{
+		fs->end_error = error;
+		return fec_complete_group(fs, p_error);
+	}
+	else if(is_media_error(error) && (fs->group_offset != (unsigned __int64)-1))
+	{
+		unsigned __int64 next;
+
+		/* Skip bad block */
+		fs->erased[index] = 1;
+		fs->group_count++;
+		if(fs->first_erased > index)
+			fs->first_erased = index;
+
+		next = fs->group_offset + (unsigned __int64)(fs->group_count) * fs->blocks_per_unit;
+		error = SetTapePosition(fs->h_tape, TAPE_LOGICAL_BLOCK, fs->group_partition,
+			(DWORD)next, (DWORD)(next >> 32), FALSE);
+		if(error != NO_ERROR) {
+			*p_error = error;
+			return 0;
+		}
+	}
+	else
+	{
+		*p_error = error;
+		return 0;
+	}
+
+	if(fs->group_count == fs->data_blocks + fs->parity_blocks)
+		return fec_complete_group(fs, p_error);
+
+	return 1;
+}
+
+static int fec_peek(void *param, const BYTE **p_buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct fec_stream *fs = param;
+
+	*p_done = 0;
+
+	for(;;)
+	{
+		unsigned int avail;
+
+		/* Block is known to be data when K more blocks follow it */
+		if(fs->group_complete) {
+			avail = fs->group_data;
+		} else {
+			avail = (fs->group_count > fs->parity_blocks) ?
+				(fs->group_count - fs->parity_blocks) : 0;
+			if(avail > fs->first_erased)
+				avail = fs->first_erased;
+		}
+
+		if(fs->deliver_index < avail)
+		{
+			BYTE *data = fs->buf + fs->deliver_index * fs->block_size;
+			struct fec_block_header *hdr = (struct fec_block_header*)data;
+
+			if((hdr->magic != FEC_BLOCK_MAGIC) || (hdr->data_length > fs->data_size)) {
+				*p_error = ERROR_INVALID_DATA;
+				return 0;
+			}
+
+			if(fs->deliver_offset < hdr->data_length) {
+				*p_buf = data + sizeof(struct fec_block_header) + fs->deliver_offset;
+				*p_done = hdr->data_length - fs->deliver_offset;
+				if(*p_done > size)
+					*p_done = size;
+				return 1;
+			}
+
+			/* Block delivered up to its data length */
+			fs->deliver_index++;
+			fs->deliver_offset = 0;
+			continue;
+		}
+
+		if(fs->group_complete)
+		{
+			/* Filemark or end of data after last group */
+			if(fs->end_error != NO_ERROR) {
+				*p_error = fs->end_error;
+				return 0;
+			}
+
+			/* Start next group */
+			fs->group_count = 0;
+			fs->group_complete = 0;
+			fs->first_erased = FEC_MAX_BLOCKS;
+			fs->deliver_index = 0;
+			fs->deliver_offset = 0;
+		}
+
+		if(!fec_read_block(fs, p_error))
+			return 0;
+	}
+}
+
+static void fec_release(void *param, size_t size)
+{
+	struct fec_stream *fs = param;
+
+	fs->deliver_offset += size;
+}
+
+static int fec_read(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	const BYTE *data;
+
+	if(!fec_peek(param, &data, size, p_done, p_error))
+		return 0;
+
+	memcpy(buf, data, *p_done);
+	fec_release(param, *p_done);
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Initialize FEC stream for tape (block_size is FEC block size, multiple of tape block) */
+int fec_stream_init(struct fec_stream *fs, HANDLE h_tape,
+	size_t block_size, size_t tape_block_size,
+	unsigned int data_blocks, unsigned int parity_blocks, DWORD *p_error)
+{
+	size_t buf_size;
+
+	memset(fs, 0, sizeof(struct fec_stream));
+
+	if( (data_blocks == 0) || (parity_blocks == 0) ||
+		(data_blocks + parity_blocks > FEC_MAX_BLOCKS) ||
+		(block_size <= sizeof(struct fec_block_header)) )
+	{
+		*p_error = ERROR_INVALID_PARAMETER;
+		return 0;
+	}
+
+	gf_init();
+
+	fs->h_tape = h_tape;
+	fs->block_size = block_size;
+	fs->data_size = block_size - sizeof(struct fec_block_header);
+	fs->blocks_per_unit = (tape_block_size != 0) ? (DWORD)(block_size / tape_block_size) : 1;
+	fs->data_blocks = data_blocks;
+	fs->parity_blocks = parity_blocks;
+	fs->first_erased = FEC_MAX_BLOCKS;
+
+	/* Event for overlapped tape I/O */
+	if((fs->ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL) {
+		*p_error = GetLastError();
+		return 0;
+	}
+
+	/* Group buffer (page aligned for unbuffered tape I/O) */
+	buf_size = (data_blocks + parity_blocks) * block_size;
+	fs->buf = VirtualAlloc(NULL, buf_size, MEM_COMMIT, PAGE_READWRITE);
+	fs->erased = malloc(data_blocks + parity_blocks);
+	if((fs->buf == NULL) || (fs->erased == NULL)) {
+		*p_error = ERROR_NOT_ENOUGH_MEMORY;
+		fec_stream_free(fs);
+		return 0;
+	}
+	memset(fs->erased, 0, data_blocks + parity_blocks);
+
+	return 1;
+}
+
+/* Get stream writing data blocks with parity / reading data blocks with recovery */
+void fec_io_stream(struct io_stream *stream, struct fec_stream *fs)
+{
+	stream->param = fs;
+	stream->read = fec_read;
+	stream->write = fec_write;
+	stream->peek = fec_peek;
+	stream->release = fec_release;
+	stream->finish = fec_finish;
+}
+
+/* Free FEC stream buffers */
+void fec_stream_free(struct fec_stream *fs)
+{
+	if(fs->buf != NULL)
+		VirtualFree(fs->buf, 0, MEM_RELEASE);
+	if(fs->erased != NULL)
+		free(fs->erased);
+	if(fs->ov.hEvent != NULL)
+		CloseHandle(fs->ov.hEvent);
+
+	fs->buf = NULL;
+	fs->erased = NULL;
+	fs->ov.hEvent = NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,79 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "filethrd.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Tape-level forward error correction (tapectl --fec <N>,<K>).
+ *
+ * Each group of N data blocks written to tape is followed by K parity blocks of the same size
+ * (Reed-Solomon code over GF(2^8) with Cauchy generator matrix). Data block starts with header
+ * holding length of data in it, so last block is padded on tape but read back without padding,
+ * even when it was rebuilt. Last group may have less than N data blocks, its parity blocks are
+ * followed by filemark or end of data. When drive returns
+ * media error on reading, block is skipped and rebuilt from the rest of its group if no more
+ * than K blocks of the group are missing. Same N and K must be used for writing and reading. */
+
+#define FEC_MAX_BLOCKS				255		/* N + K */
+
+#define FEC_BLOCK_MAGIC				0x43454654	/* 'TFEC' */
+
+/* Header of data block (covered by parity) */
+struct fec_block_header
+{
+	DWORD magic;						/* FEC_BLOCK_MAGIC */
+	DWORD data_length;					/* Bytes of data following header */
+};
+
+struct fec_stream
+{
+	HANDLE h_tape;
+	OVERLAPPED ov;						/* Tape can be opened for overlapped I/O */
+
+	size_t block_size;
+	DWORD blocks_per_unit;				/* Tape blocks per FEC block (fixed block mode) */
+	unsigned int data_blocks;			/* N */
+	unsigned int parity_blocks;			/* K */
+
+	size_t data_size;					/* Data bytes per block (block size less header) */
+
+	BYTE *buf;							/* (N + K) blocks */
+	BYTE *erased;						/* Erasure flags of group blocks */
+
+	unsigned int group_count;			/* Blocks read / data blocks written in group */
+
+	/* writing */
+	size_t fill;						/* Data bytes in block being filled */
+
+	/* reading */
+	DWORD group_partition;				/* Tape position of first block of group */
+	unsigned __int64 group_offset;
+	unsigned int group_data;			/* Data blocks in group (when complete) */
+	int group_complete;
+	unsigned int first_erased;			/* Index of first missing block in group */
+	unsigned int deliver_index;			/* Next data block to return */
+	size_t deliver_offset;
+	DWORD end_error;					/* Filemark or end of data after last group */
+
+	/* stats */
+	unsigned __int64 parity_bytes;		/* Parity written */
+	unsigned int rebuilt_blocks;		/* Data blocks recovered on reading */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Initialize FEC stream for tape (block_size is FEC block size, multiple of tape block) */
+int fec_stream_init(struct fec_stream *fs, HANDLE h_tape,
+	size_t block_size, size_t tape_block_size,
+	unsigned int data_blocks, unsigned int parity_blocks, DWORD *p_error);
+
+/* Get stream writing data blocks with parity / reading data blocks with recovery */
+void fec_io_stream(struct io_stream *stream, struct fec_stream *fs);
+
+/* Free FEC stream buffers */
+void fec_stream_free(struct fec_stream *fs);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -8,6 +8,7 @@
 #include "../util/fmt.h"
 #include "ratectr.h"
 #include "filethrd.h"
+#include "statshm.h"
 #include "filecopy.h"
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -19,40 +20,94 @@ struct file_copy_ctx
 	struct rate_counter write_rate_ctr;
 	struct rate_counter read_rate_ctr;
 	unsigned int flags;
+
+	/* Current statistics */
+	unsigned int write_flags, read_flags;
+	unsigned __int64 write_total, read_total;
+	unsigned __int64 write_rate, read_rate;
+
 	TCHAR msg_buf[256];
 };
 
 /* ---------------------------------------------------------------------------------------------- */
 
-/* Show transfer statistics */
+/* Update transfer statistics */
 
-static void display_copy_progress(struct msg_filter *mf, struct file_copy_ctx *ctx,
-	unsigned __int64 src_data_size, unsigned int msecs_cur)
+static void update_copy_stats(struct file_copy_ctx *ctx, unsigned int msecs_cur)
 {
-	unsigned int write_flags, read_flags;
-	unsigned __int64 write_total, read_total;
-	unsigned __int64 write_rate, read_rate;
-	TCHAR fmt_buf1[64], fmt_buf2[64], *msg_ptr;
-
 	/* Acquire data from I/O threads */
-	write_flags = ctx->write_thread.flags;
-	read_flags = ctx->read_thread.flags;
-	file_thread_get_total_bytes(&(ctx->write_thread), &write_total, NULL);
-	file_thread_get_total_bytes(&(ctx->read_thread), &read_total, NULL);
+	ctx->write_flags = ctx->write_thread.flags;
+	ctx->read_flags = ctx->read_thread.flags;
+	file_thread_get_total_bytes(&(ctx->write_thread), &(ctx->write_total), NULL);
+	file_thread_get_total_bytes(&(ctx->read_thread), &(ctx->read_total), NULL);
 
 	/* Calculate current read/write speed */
-	if(!(write_flags & WRITE_THREAD_BUFFERING)) {
-		write_rate = rate_update(&(ctx->write_rate_ctr), msecs_cur, write_total);
+	if(!(ctx->write_flags & WRITE_THREAD_BUFFERING)) {
+		ctx->write_rate = rate_update(&(ctx->write_rate_ctr), msecs_cur, ctx->write_total);
 	} else {
 		rate_reset(&(ctx->write_rate_ctr));
-		write_rate = 0;
+		ctx->write_rate = 0;
 	}
-	if(!(read_flags & READ_THREAD_DEBUFFERING)) {
-		read_rate = rate_update(&(ctx->read_rate_ctr), msecs_cur, read_total);
+	if(!(ctx->read_flags & READ_THREAD_DEBUFFERING)) {
+		ctx->read_rate = rate_update(&(ctx->read_rate_ctr), msecs_cur, ctx->read_total);
 	} else {
 		rate_reset(&(ctx->read_rate_ctr));
-		read_rate = 0;
+		ctx->read_rate = 0;
 	}
+}
+
+/* Publish transfer statistics to shared memory slot */
+
+static void publish_copy_stats(struct stats_slot *stats, struct file_copy_ctx *ctx,
+	struct big_buffer *cb)
+{
+	stats_slot_lock(stats);
+	stats->write_flags = ctx->write_flags;
+	stats->read_flags = ctx->read_flags;
+	stats->read_bytes = ctx->read_total;
+	stats->written_bytes = ctx->write_total;
+	stats->read_rate = ctx->read_rate;
+	stats->write_rate = ctx->write_rate;
+	stats->buf_data = bigbuf_data_avail(cb);
+	stats->buf_size = cb->buf_size;
+	stats_slot_unlock(stats);
+}
+
+/* Pass transfer statistics to progress callback */
+
+static void report_copy_progress(copy_progress_cb progress_cb, void *progress_param,
+	struct file_copy_ctx *ctx, struct big_buffer *cb, unsigned __int64 src_data_size)
+{
+	struct copy_progress progress;
+
+	progress.write_flags = ctx->write_flags;
+	progress.read_flags = ctx->read_flags;
+	progress.total_size = src_data_size;
+	progress.read_bytes = ctx->read_total;
+	progress.written_bytes = ctx->write_total;
+	progress.read_rate = ctx->read_rate;
+	progress.write_rate = ctx->write_rate;
+	progress.buf_data = bigbuf_data_avail(cb);
+	progress.buf_size = cb->buf_size;
+
+	progress_cb(progress_param, &progress);
+}
+
+/* Show transfer statistics */
+
+static void display_copy_progress(struct msg_filter *mf, struct file_copy_ctx *ctx,
+	unsigned __int64 src_data_size)
+{
+	unsigned int write_flags, read_flags;
+	unsigned __int64 write_total;
+	unsigned __int64 write_rate, read_rate;
+	TCHAR fmt_buf1[64], fmt_buf2[64], *msg_ptr;
+
+	write_flags = ctx->write_flags;
+	read_flags = ctx->read_flags;
+	write_total = ctx->write_total;
+	write_rate = ctx->write_rate;
+	read_rate = ctx->read_rate;
 
 	msg_ptr = ctx->msg_buf;
 
@@ -236,28 +291,74 @@ enum {
 	EVENT_COUNT
 };
 
-static HANDLE copy_abort_event;
+/* Abort events of transfers running in this process (Ctrl+C cancels all of them) */
+#define MAX_ACTIVE_COPIES		64
+
+static HANDLE copy_abort_events[MAX_ACTIVE_COPIES];
+static LONG copy_abort_lock;
+
+static void copy_abort_list_lock(void)
+{
+	while(InterlockedExchange(&copy_abort_lock, 1) != 0)
+		Sleep(0);
+}
+
+static void copy_abort_list_unlock(void)
+{
+	InterlockedExchange(&copy_abort_lock, 0);
+}
 
 static BOOL WINAPI copy_abort_handler(DWORD code)
 {
-	if( ((code == CTRL_C_EVENT) || (code == CTRL_CLOSE_EVENT)) &&
-		(WaitForSingleObject(copy_abort_event, 0) == WAIT_TIMEOUT) )
+	BOOL handled = FALSE;
+	unsigned int i;
+
+	if((code == CTRL_C_EVENT) || (code == CTRL_CLOSE_EVENT))
 	{
-		SetEvent(copy_abort_event);
-		return TRUE;
+		copy_abort_list_lock();
+		for(i = 0; i < MAX_ACTIVE_COPIES; i++)
+		{
+			if( (copy_abort_events[i] != NULL) &&
+				(WaitForSingleObject(copy_abort_events[i], 0) == WAIT_TIMEOUT) )
+			{
+				SetEvent(copy_abort_events[i]);
+				handled = TRUE;
+			}
+		}
+		copy_abort_list_unlock();
 	}
 
-	return FALSE;
+	return handled;
+}
+
+/* Add/remove transfer abort event */
+static void copy_abort_register(HANDLE h_event, int add)
+{
+	unsigned int i;
+
+	copy_abort_list_lock();
+	for(i = 0; i < MAX_ACTIVE_COPIES; i++)
+	{
+		if(copy_abort_events[i] == (add ? NULL : h_event)) {
+			copy_abort_events[i] = add ? h_event : NULL;
+			break;
+		}
+	}
+	copy_abort_list_unlock();
 }
 
 int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
-	HANDLE h_dst, size_t dst_queue_size, size_t dst_block_size, size_t dst_block_align,
-	HANDLE h_src, size_t src_queue_size, size_t src_block_size, unsigned __int64 src_data_size,
-	size_t crc_buffer_size, size_t crc_block_size,
+	HANDLE h_dst, struct io_stream *dst_stream,
+	size_t dst_queue_size, size_t dst_block_size, size_t dst_block_align, HANDLE h_dst_tail,
+	HANDLE h_src, struct io_stream *src_stream,
+	size_t src_queue_size, size_t src_block_size, unsigned __int64 src_data_size,
+	size_t crc_buffer_size, size_t crc_block_size, struct chunk_manifest *manifest,
+	struct stats_slot *stats, copy_progress_cb progress_cb, void *progress_param,
 	unsigned __int64 *p_data_size, unsigned __int64 *p_padded_size)
 {
 	struct file_copy_ctx *ctx;
 	unsigned int write_flags, read_flags;
+	unsigned __int64 held_max = 0;
 	HANDLE events[EVENT_COUNT];
 	DWORD msecs_begin, seconds_elapsed;
 	int flushing = 0, success = 0;
@@ -296,21 +397,42 @@ int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
 
 	ctx->flags = flags;
 
+	/* Publish transfer size */
+	if(stats != NULL) {
+		stats_slot_lock(stats);
+		stats->total_size = src_data_size;
+		stats->buf_size = cb->buf_size;
+		stats_slot_unlock(stats);
+	}
+
+	/* Write full blocks in place from mirrored buffer instead of copying them to queue.
+	 * Data stays in buffer until written, so reading resumes earlier by size of queue. */
+	if((cb->buf_mirror != NULL) && (dst_stream == NULL) && (dst_queue_size != 0)) {
+		held_max = (unsigned __int64)dst_queue_size * dst_block_size;
+		if(cb->buf_size < 4 * (held_max + src_block_size + dst_block_size))
+			held_max = 0;
+	}
+
 	/* Spawn writing thread */
 	write_flags = IO_THREAD_MODE_WRITE;
 	if(flags & COPY_SUSTAIN_WRITE)
 		write_flags |= IO_THREAD_SUSTAIN;
+	if(held_max != 0)
+		write_flags |= IO_THREAD_ZERO_COPY;
 	if( ! file_thread_start(
 		&(ctx->write_thread),
 		cb,
 		h_dst,
+		h_dst_tail,
+		dst_stream,
 		write_flags,
 		cb->buf_size - (src_block_size - 1),
 		dst_block_size,
 		dst_block_align,
 		dst_queue_size,
 		crc_buffer_size,
-		crc_block_size) )
+		crc_block_size,
+		(flags & COPY_MANIFEST_DST) ? DIGEST_CHUNK_SIZE : 0) )
 	{
 		msg_print(mf, MSG_ERROR, _T("Can't spawn data writing thread (out of memory?)"));
 		goto cleanup;
@@ -324,16 +446,20 @@ int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
 		&(ctx->read_thread),
 		cb,
 		h_src,
+		INVALID_HANDLE_VALUE,
+		src_stream,
 		read_flags,
-		cb->buf_size - (dst_block_size - 1),
+		cb->buf_size - (dst_block_size - 1) - held_max,
 		src_block_size,
 		0,
 		src_queue_size,
 		crc_buffer_size,
-		crc_block_size) )
+		crc_block_size,
+		(flags & COPY_MANIFEST_SRC) ? DIGEST_CHUNK_SIZE : 0) )
 	{
 		file_thread_abort(&(ctx->write_thread));
 		file_thread_finish(&(ctx->write_thread));
+		crc32_thread_free_digests(&(ctx->write_thread.crc_thrd));
 
 		msg_print(mf, MSG_ERROR, _T("Can't spawn data reading thread (out of memory?)"));
 		goto cleanup;
@@ -346,7 +472,7 @@ int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
 	rate_reset(&(ctx->read_rate_ctr));
 
 	/* Set abort handler */
-	copy_abort_event = events[EVENT_ID_ABORT];
+	copy_abort_register(events[EVENT_ID_ABORT], 1);
 	SetConsoleCtrlHandler(copy_abort_handler, TRUE);
 
 	/* Select events */
@@ -390,13 +516,19 @@ int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
 			break;
 		}
 
-		/* Show transfer statistics */
+		/* Update, publish and show transfer statistics */
+		update_copy_stats(ctx, GetTickCount());
+		if(stats != NULL)
+			publish_copy_stats(stats, ctx, cb);
+		if(progress_cb != NULL)
+			report_copy_progress(progress_cb, progress_param, ctx, cb, src_data_size);
 		if(mf->report_level >= MSG_INFO)
-			display_copy_progress(mf, ctx, src_data_size, GetTickCount());
+			display_copy_progress(mf, ctx, src_data_size);
 	}
 
 	/* Remove abort handler */
 	SetConsoleCtrlHandler(copy_abort_handler, FALSE);
+	copy_abort_register(events[EVENT_ID_ABORT], 0);
 
 	/* Calculate elapsed time */
 	seconds_elapsed = (GetTickCount() - msecs_begin) / 1000UL;
@@ -406,6 +538,15 @@ int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
 	file_thread_finish(&(ctx->write_thread));
 	bigbuf_reset(cb);
 
+	/* Publish final byte counts */
+	if((stats != NULL) || (progress_cb != NULL)) {
+		update_copy_stats(ctx, GetTickCount());
+		if(stats != NULL)
+			publish_copy_stats(stats, ctx, cb);
+		if(progress_cb != NULL)
+			report_copy_progress(progress_cb, progress_param, ctx, cb, src_data_size);
+	}
+
 	/* Wipe stats string, check result and show stats */
 	msg_print(mf, MSG_INFO, _T("%-79s\r"), _T(""));
 	success = check_copy_result(mf, ctx, seconds_elapsed);
@@ -417,6 +558,30 @@ int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
 			*p_padded_size = ctx->write_thread.padded_io_bytes;
 	}
 
+	/* Take chunk digests */
+	if(success && (manifest != NULL))
+	{
+		struct file_thread_ctx *digest_thread = (flags & COPY_MANIFEST_SRC) ?
+			&(ctx->read_thread) : &(ctx->write_thread);
+
+		if(digest_thread->crc_thrd.digest_failed) {
+			msg_print(mf, MSG_ERROR, _T("Not enough memory for chunk digests.\n"));
+			success = 0;
+		} else {
+			manifest->data_size = digest_thread->data_io_bytes;
+			manifest->chunk_size = DIGEST_CHUNK_SIZE;
+			manifest->chunk_count = digest_thread->crc_thrd.digest_count;
+			manifest->digests = digest_thread->crc_thrd.digests;
+			digest_thread->crc_thrd.digests = NULL;
+			if(!manifest_compute_root(manifest)) {
+				msg_print(mf, MSG_ERROR, _T("Not enough memory for digest tree.\n"));
+				success = 0;
+			}
+		}
+	}
+	crc32_thread_free_digests(&(ctx->read_thread.crc_thrd));
+	crc32_thread_free_digests(&(ctx->write_thread.crc_thrd));
+
 	/* Free memory */
 cleanup:
 	if(events[EVENT_ID_ABORT] != NULL)
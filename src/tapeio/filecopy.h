@@ -5,17 +5,38 @@
 #include <windows.h>
 #include "../util/msgfilt.h"
 #include "bigbuff.h"
+#include "filethrd.h"
+#include "manifest.h"
+#include "statshm.h"
 
 /* ---------------------------------------------------------------------------------------------- */
 
 #define COPY_SUSTAIN_WRITE				0x0001
 #define COPY_SUSTAIN_READ				0x0002
 #define COPY_NO_PADDING_INFO			0x0004
+#define COPY_MANIFEST_SRC				0x0008	/* Digest chunks of source data */
+#define COPY_MANIFEST_DST				0x0010	/* Digest chunks of destination data */
+
+/* Transfer progress passed to callback on each statistics refresh */
+struct copy_progress
+{
+	unsigned int write_flags, read_flags;
+	unsigned __int64 total_size;		/* Source data size (0 if unknown) */
+	unsigned __int64 read_bytes, written_bytes;
+	unsigned __int64 read_rate, write_rate;
+	unsigned __int64 buf_data, buf_size;
+};
+
+typedef void (*copy_progress_cb)(void *param, const struct copy_progress *progress);
 
 int copy_file(struct msg_filter *mf, struct big_buffer *cb, unsigned int flags,
-	HANDLE h_dst, size_t dst_queue_size, size_t dst_block_size, size_t dst_block_align,
-	HANDLE h_src, size_t src_queue_size, size_t src_block_size, unsigned __int64 src_data_size,
-	size_t crc_buffer_size, size_t crc_block_size,
+	HANDLE h_dst, struct io_stream *dst_stream,
+	size_t dst_queue_size, size_t dst_block_size, size_t dst_block_align, HANDLE h_dst_tail,
+	HANDLE h_src, struct io_stream *src_stream,
+	size_t src_queue_size, size_t src_block_size, unsigned __int64 src_data_size,
+	size_t crc_buffer_size, size_t crc_block_size, struct chunk_manifest *manifest,
+	struct stats_slot *stats,
+	copy_progress_cb progress_cb, void *progress_param,
 	unsigned __int64 *p_data_size, unsigned __int64 *p_padded_size);
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -76,6 +76,84 @@ static unsigned int __stdcall read_thread_sync_nullbuf(struct file_thread_ctx *c
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Write block to file or stream */
+static BOOL sync_write(struct file_thread_ctx *ctx, const BYTE *buf, size_t size, DWORD *p_done)
+{
+	size_t done;
+	DWORD error;
+
+	if(ctx->stream == NULL)
+		return WriteFile(ctx->h_file, buf, (DWORD)size, p_done, NULL);
+
+	if(!ctx->stream->write(ctx->stream->param, buf, size, &done, &error)) {
+		*p_done = (DWORD)done;
+		SetLastError(error);
+		return FALSE;
+	}
+
+	*p_done = (DWORD)done;
+	return TRUE;
+}
+
+/* Write unaligned end of data at offset through buffered handle */
+static BOOL tail_write(struct file_thread_ctx *ctx, const BYTE *buf, size_t size,
+	unsigned __int64 offset, DWORD *p_done)
+{
+	OVERLAPPED ov;
+
+	memset(&ov, 0, sizeof(ov));
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	return WriteFile(ctx->h_file_tail, buf, (DWORD)size, p_done, &ov);
+}
+
+/* Read block from file or stream */
+static BOOL sync_read(struct file_thread_ctx *ctx, BYTE *buf, size_t size, DWORD *p_done)
+{
+	size_t done;
+	DWORD error;
+
+	if(ctx->stream == NULL)
+		return ReadFile(ctx->h_file, buf, (DWORD)size, p_done, NULL);
+
+	if(!ctx->stream->read(ctx->stream->param, buf, size, &done, &error)) {
+		*p_done = (DWORD)done;
+		SetLastError(error);
+		return FALSE;
+	}
+
+	*p_done = (DWORD)done;
+	return TRUE;
+}
+
+/* Get next block from file or stream (stream with peek function is read in place) */
+static BOOL sync_read_block(struct file_thread_ctx *ctx, const BYTE **p_buf, DWORD *p_done)
+{
+	size_t done;
+	DWORD error;
+
+	if((ctx->stream == NULL) || (ctx->stream->peek == NULL)) {
+		*p_buf = ctx->io_buf;
+		return sync_read(ctx, ctx->io_buf, ctx->io_block_size, p_done);
+	}
+
+	if(!ctx->stream->peek(ctx->stream->param, p_buf, ctx->io_block_size, &done, &error)) {
+		*p_done = 0;
+		SetLastError(error);
+		return FALSE;
+	}
+
+	*p_done = (DWORD)done;
+	return TRUE;
+}
+
+/* Release block returned by sync_read_block */
+static void sync_read_release(struct file_thread_ctx *ctx, DWORD size)
+{
+	if((ctx->stream != NULL) && (ctx->stream->release != NULL) && (size != 0))
+		ctx->stream->release(ctx->stream->param, size);
+}
+
 enum {
 	SYNC_EV_ID_ABORT,
 	SYNC_EV_ID_FLUSH,
@@ -163,8 +241,8 @@ static unsigned int __stdcall write_thread_sync(struct file_thread_ctx *ctx)
 			/* Check for data available */
 			if(data_size != 0)
 			{
-				DWORD cb_wr, error;
-				size_t padded_size;
+				DWORD cb_wr, cb_tail = 0, error;
+				size_t padded_size, tail_size = 0;
 
 				/* Read data from buffer */
 				if(!bigbuf_read(ctx->cb, ctx->io_buf, data_size, &error)) {
@@ -172,17 +250,30 @@ static unsigned int __stdcall write_thread_sync(struct file_thread_ctx *ctx)
 					break;
 				}
 
-				/* Add padding */
+				/* Add padding or write unaligned end through tail handle */
 				padded_size = data_size;
 				if((ctx->io_block_align > 1) && (data_size < ctx->io_block_size)) {
-					padded_size = ((data_size + ctx->io_block_align - 1) / 
-						ctx->io_block_align) * ctx->io_block_align;
-					memset(ctx->io_buf + data_size, 0, padded_size - data_size);
+					if(ctx->h_file_tail != INVALID_HANDLE_VALUE) {
+						padded_size = (data_size / ctx->io_block_align) * ctx->io_block_align;
+						tail_size = data_size - padded_size;
+					} else {
+						padded_size = ((data_size + ctx->io_block_align - 1) / 
+							ctx->io_block_align) * ctx->io_block_align;
+						memset(ctx->io_buf + data_size, 0, padded_size - data_size);
+					}
 				}
 
 				/* Write to file */
-				if(!WriteFile(ctx->h_file, ctx->io_buf, (DWORD)padded_size, &cb_wr, NULL))
+				if(!sync_write(ctx, ctx->io_buf, padded_size, &cb_wr))
 					ctx->error = GetLastError();
+				if((ctx->error == NO_ERROR) && (tail_size != 0)) {
+					if(!tail_write(ctx, ctx->io_buf + padded_size, tail_size,
+						ctx->padded_io_bytes + padded_size, &cb_tail))
+					{
+						ctx->error = GetLastError();
+					}
+					cb_wr += cb_tail;
+				}
 
 				if(cb_wr < data_size)
 					data_size = cb_wr;
@@ -203,6 +294,14 @@ static unsigned int __stdcall write_thread_sync(struct file_thread_ctx *ctx)
 			}
 		}
 	}
+
+	/* Complete stream after last block */
+	if( (ctx->error == NO_ERROR) && (ctx->stream != NULL) && (ctx->stream->finish != NULL) &&
+		!ctx->stream->finish(ctx->stream->param, &(ctx->error)) )
+	{
+		if(ctx->error == NO_ERROR)
+			ctx->error = ERROR_GEN_FAILURE;
+	}
 	
 	return ctx->error;
 }
@@ -269,10 +368,11 @@ static unsigned int __stdcall read_thread_sync(struct file_thread_ctx *ctx)
 
 			if(can_read)
 			{
+				const BYTE *data;
 				DWORD cb_rd;
 
 				/* Read data from file */
-				if(!ReadFile(ctx->h_file, ctx->io_buf, (DWORD)(ctx->io_block_size), &cb_rd, NULL))
+				if(!sync_read_block(ctx, &data, &cb_rd))
 					ctx->error = GetLastError();
 
 				if(cb_rd > 0)
@@ -284,13 +384,14 @@ static unsigned int __stdcall read_thread_sync(struct file_thread_ctx *ctx)
 					ctx->data_io_bytes += cb_rd;
 					ctx->padded_io_bytes += cb_rd;
 					LeaveCriticalSection(&(ctx->total_bytes_lock));
-					crc32_thread_write(&(ctx->crc_thrd), ctx->io_buf, cb_rd);
+					crc32_thread_write(&(ctx->crc_thrd), data, cb_rd);
 
 					/* Write data to buffer */
-					if(!bigbuf_write(ctx->cb, ctx->io_buf, cb_rd, &error)) {
+					if(!bigbuf_write(ctx->cb, data, cb_rd, &error)) {
 						ctx->error = error;
 						break;
 					}
+					sync_read_release(ctx, cb_rd);
 				}
 
 				/* Check for end of file */
@@ -442,7 +543,8 @@ static unsigned int __stdcall write_thread_async(struct file_thread_ctx *ctx)
 			/* Check for buffering completion */
 			if((ctx->flags & WRITE_THREAD_BUFFERING) && (ctx->queue_nused == ctx->queue_size)) {
 				/* In buffering state with queue full, threshold must be set to full buffer */
-				assert((buf_avail >= ctx->thres_buf_debuf) && !(ctx->flags & WRITE_THREAD_FLUSHING));
+				assert((buf_avail + ctx->queue_held >= ctx->thres_buf_debuf) &&
+					!(ctx->flags & WRITE_THREAD_FLUSHING));
 				/* Exit buffering state and reset threshold to full block */
 				ctx->flags &= ~WRITE_THREAD_BUFFERING;
 				bigbuf_set_thres_read(ctx->cb, ctx->io_block_size);
@@ -466,22 +568,60 @@ static unsigned int __stdcall write_thread_async(struct file_thread_ctx *ctx)
 					DWORD error;
 					size_t padded_size;
 					struct io_queue_entry *entry;
+					const BYTE *data = NULL;
 
 					/* Get first unused entry from queue */
 					entry = get_entry(ctx, ctx->queue_nused);
-
-					/* Fill entry from buffer */
-					if(!bigbuf_read(ctx->cb, entry->buf, data_size, &error)) {
-						ctx->error = error;
-						break;
+					entry->io_ptr = entry->buf;
+					entry->held_size = 0;
+					entry->tail_size = 0;
+
+					/* Hold data in buffer until written */
+					if(ctx->flags & IO_THREAD_ZERO_COPY)
+						data = bigbuf_read_ptr(ctx->cb, data_size);
+
+					if(data != NULL)
+					{
+						entry->held_size = data_size;
+						ctx->queue_held += data_size;
+
+						/* Write full page aligned block in place, copy partial block */
+						if((data_size == ctx->io_block_size) && (((ULONG_PTR)data & 0x0FFF) == 0))
+							entry->io_ptr = (BYTE*)data;
+						else
+							memcpy(entry->buf, data, data_size);
+					}
+					else
+					{
+						/* Fill entry from buffer */
+						if(!bigbuf_read(ctx->cb, entry->buf, data_size, &error)) {
+							ctx->error = error;
+							break;
+						}
 					}
 
-					/* Pad last block with zeroes */
+					/* Pad last block with zeroes or write its unaligned end through tail handle */
 					padded_size = data_size;
 					if((ctx->io_block_align > 1) && (data_size < ctx->io_block_size)) {
-						padded_size = ((data_size + ctx->io_block_align - 1) / 
-							ctx->io_block_align) * ctx->io_block_align;
-						memset(entry->buf + data_size, 0, padded_size - data_size);
+						if(ctx->h_file_tail != INVALID_HANDLE_VALUE) {
+							DWORD cb_tail = 0;
+							padded_size = (data_size / ctx->io_block_align) * ctx->io_block_align;
+							entry->tail_size = data_size - padded_size;
+							if(!tail_write(ctx, entry->io_ptr + padded_size, entry->tail_size,
+								ctx->queue_data_pos + padded_size, &cb_tail))
+							{
+								ctx->error = GetLastError();
+								break;
+							}
+							if(cb_tail < entry->tail_size) {
+								ctx->error = ERROR_HANDLE_DISK_FULL;
+								break;
+							}
+						} else {
+							padded_size = ((data_size + ctx->io_block_align - 1) / 
+								ctx->io_block_align) * ctx->io_block_align;
+							memset(entry->buf + data_size, 0, padded_size - data_size);
+						}
 					}
 
 					/* Initialize entry fields and mark entry as ready to write */
@@ -492,12 +632,13 @@ static unsigned int __stdcall write_thread_async(struct file_thread_ctx *ctx)
 					ctx->queue_nused++;
 
 					/* Move queue data counter */
-					ctx->queue_data_pos += padded_size;
+					ctx->queue_data_pos += padded_size + entry->tail_size;
 				}
 
-				/* Set buffering threshold after queue full (buffering state) */
+				/* Set buffering threshold after queue full (buffering state),
+				 * data held by queue entries is still in buffer */
 				if((ctx->flags & WRITE_THREAD_BUFFERING) && (ctx->queue_nused == ctx->queue_size))
-					bigbuf_set_thres_read(ctx->cb, ctx->thres_buf_debuf);
+					bigbuf_set_thres_read(ctx->cb, ctx->thres_buf_debuf - ctx->queue_held);
 
 				/* Check for end of data (should be in flushing state) */
 				if(data_size < ctx->io_block_size)
@@ -532,6 +673,10 @@ static unsigned int __stdcall write_thread_async(struct file_thread_ctx *ctx)
 				cb_written = (DWORD) entry->ov.InternalHigh;
 			}
 
+			/* Add unaligned end written before */
+			if(cb_written == entry->padded_size)
+				cb_written += (DWORD)(entry->tail_size);
+
 			/* Check for incomplete written data (not padded data) */
 			cb_data = entry->data_size;
 			if(cb_written < cb_data)
@@ -543,7 +688,13 @@ static unsigned int __stdcall write_thread_async(struct file_thread_ctx *ctx)
 				ctx->data_io_bytes += cb_data;
 				ctx->padded_io_bytes += cb_written;
 				LeaveCriticalSection(&(ctx->total_bytes_lock));
-				crc32_thread_write(&(ctx->crc_thrd), entry->buf, cb_data);
+				crc32_thread_write(&(ctx->crc_thrd), entry->io_ptr, cb_data);
+			}
+
+			/* Release data written from buffer */
+			if(entry->held_size != 0) {
+				bigbuf_read_done(ctx->cb, entry->held_size);
+				ctx->queue_held -= entry->held_size;
 			}
 
 			/* Check for write error (kill unpending entries and handle as end of data) */
@@ -590,7 +741,7 @@ static unsigned int __stdcall write_thread_async(struct file_thread_ctx *ctx)
 
 				/* Start writing to file */
 				error = NO_ERROR;
-				if(!WriteFile(ctx->h_file, entry->buf,
+				if(!WriteFile(ctx->h_file, entry->io_ptr,
 					(DWORD)(entry->padded_size), &cb_written, &(entry->ov)))
 				{
 					error = GetLastError();
@@ -946,10 +1097,12 @@ void file_thread_get_total_bytes(
 
 /* spawn file I/O thread */
 int file_thread_start(struct file_thread_ctx *ctx, struct big_buffer *cb,
-	HANDLE h_file, unsigned int flags, unsigned __int64 thres_buf_debuf,
+	HANDLE h_file, HANDLE h_file_tail, struct io_stream *stream, unsigned int flags, unsigned __int64 thres_buf_debuf,
 	size_t io_block_size, size_t io_block_align, size_t queue_size,
-	size_t crc_buffer_size, size_t crc_block_size)
+	size_t crc_buffer_size, size_t crc_block_size, size_t digest_chunk_size)
 {
+	size_t slab_stride;
+
 	if( ! ((flags & IO_THREAD_MODE_READ) && !(flags & IO_THREAD_MODE_WRITE)) &&
 		! ((flags & IO_THREAD_MODE_WRITE) && !(flags & IO_THREAD_MODE_READ)) )
 	{
@@ -964,10 +1117,16 @@ int file_thread_start(struct file_thread_ctx *ctx, struct big_buffer *cb,
 	if((flags & IO_THREAD_SUSTAIN) && (thres_buf_debuf < io_block_size))
 		return 0;
 
+	/* Streams are accessed synchronously */
+	if(stream != NULL)
+		queue_size = 0;
+
 	/* Initialize context */
 
 	ctx->cb = cb;
 	ctx->h_file = h_file;
+	ctx->h_file_tail = h_file_tail;
+	ctx->stream = stream;
 	
 	ctx->flags = flags;
 	ctx->thres_buf_debuf = thres_buf_debuf;
@@ -980,8 +1139,10 @@ int file_thread_start(struct file_thread_ctx *ctx, struct big_buffer *cb,
 	ctx->queue_npend = 0;
 	ctx->queue_entry = NULL;
 	ctx->queue_data_pos = 0;
+	ctx->queue_held = 0;
 
 	ctx->io_buf = NULL;
+	ctx->io_slab = NULL;
 
 	ctx->data_io_bytes = 0;
 	ctx->padded_io_bytes = 0;
@@ -991,7 +1152,8 @@ int file_thread_start(struct file_thread_ctx *ctx, struct big_buffer *cb,
 
 	/* Spawn CRC thread */
 	if( ! crc32_thread_init(&(ctx->crc_thrd), crc_buffer_size, crc_block_size,
-		(flags & IO_THREAD_SUSTAIN) ? THREAD_PRIORITY_ABOVE_NORMAL : THREAD_PRIORITY_NORMAL) )
+		(flags & IO_THREAD_SUSTAIN) ? THREAD_PRIORITY_ABOVE_NORMAL : THREAD_PRIORITY_NORMAL,
+		digest_chunk_size) )
 	{
 		return 0;
 	}
@@ -1006,14 +1168,19 @@ int file_thread_start(struct file_thread_ctx *ctx, struct big_buffer *cb,
 	if((ctx->h_ev_abort == NULL) || (ctx->h_ev_flush == NULL))
 		goto error_cleanup;
 
+	/* Allocate I/O buffers from single slab */
+	slab_stride = (io_block_size + 0x0FFF) & ~((size_t)0x0FFF);
+	ctx->io_slab = VirtualAlloc(NULL, slab_stride * ((queue_size != 0) ? queue_size : 1),
+		MEM_COMMIT, PAGE_READWRITE);
+	if(ctx->io_slab == NULL)
+		goto error_cleanup;
+
 	if(queue_size == 0)
 	{
 		unsigned int thread_id;
 
-		/* Allocate data buffer */
-		ctx->io_buf = _aligned_malloc(io_block_size, 4096);
-		if(ctx->io_buf == NULL)
-			goto error_cleanup;
+		/* Use slab as data buffer */
+		ctx->io_buf = ctx->io_slab;
 
 		/* Spawn thread */
 		if(flags & IO_THREAD_MODE_WRITE)
@@ -1038,8 +1205,8 @@ int file_thread_start(struct file_thread_ctx *ctx, struct big_buffer *cb,
 		for(i = 0; i < queue_size; i++)
 		{
 			ctx->queue_entry[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-			ctx->queue_entry[i].buf = _aligned_malloc(io_block_size, 4096);
-			if((ctx->queue_entry[i].ov.hEvent == NULL) || (ctx->queue_entry[i].buf == NULL))
+			ctx->queue_entry[i].buf = ctx->io_slab + i * slab_stride;
+			if(ctx->queue_entry[i].ov.hEvent == NULL)
 				goto error_cleanup;
 		}
 
@@ -1074,15 +1241,13 @@ error_cleanup:
 		{
 			if(ctx->queue_entry[i].ov.hEvent != NULL)
 				CloseHandle(ctx->queue_entry[i].ov.hEvent);
-			if(ctx->queue_entry[i].buf != NULL)
-				_aligned_free(ctx->queue_entry[i].buf);
 		}
 		free(ctx->queue_entry);
 	}
 
-	/* Free data buffer */
-	if(ctx->io_buf != NULL)
-		_aligned_free(ctx->io_buf);
+	/* Free I/O buffers */
+	if(ctx->io_slab != NULL)
+		VirtualFree(ctx->io_slab, 0, MEM_RELEASE);
 
 	/* Delete events */
 	if(ctx->h_ev_flush != NULL)
@@ -1108,16 +1273,14 @@ void file_thread_finish(struct file_thread_ctx *ctx)
 	if(ctx->queue_entry != NULL)
 	{
 		unsigned int i;
-		for(i = 0; i < ctx->queue_size; i++) {
+		for(i = 0; i < ctx->queue_size; i++)
 			CloseHandle(ctx->queue_entry[i].ov.hEvent);
-			_aligned_free(ctx->queue_entry[i].buf);
-		}
 		free(ctx->queue_entry);
 	}
 
-	/* Free I/O buffer */
-	if(ctx->io_buf != NULL)
-		_aligned_free(ctx->io_buf);
+	/* Free I/O buffers */
+	if(ctx->io_slab != NULL)
+		VirtualFree(ctx->io_slab, 0, MEM_RELEASE);
 
 	/* Close events and thread */
 	CloseHandle(ctx->h_ev_flush);
@@ -1128,16 +1291,11 @@ void file_thread_finish(struct file_thread_ctx *ctx)
 	ctx->padded_crc = ctx->data_crc = 
 		crc32_thread_finish(&(ctx->crc_thrd));
 
-	/* Update CRC of padded data */
+	/* Update CRC of padded data (append zero bytes without processing them) */
 	if(ctx->padded_io_bytes > ctx->data_io_bytes)
 	{
-		size_t bs, rem;
-		unsigned char zero[256];
-		memset(zero, 0, sizeof(zero));
-		for(rem = (size_t)(ctx->padded_io_bytes - ctx->data_io_bytes); rem != 0; rem -= bs) {
-			bs = (rem <= 256) ? rem : 256;
-			ctx->padded_crc = crc32_update(ctx->padded_crc, zero, bs);
-		}
+		ctx->padded_crc = crc32_zeros(ctx->padded_crc,
+			ctx->padded_io_bytes - ctx->data_io_bytes);
 	}
 
 	DeleteCriticalSection(&(ctx->total_bytes_lock));
@@ -12,6 +12,7 @@
 #define IO_THREAD_MODE_WRITE			0x0001	/* Start writing thread */
 #define IO_THREAD_MODE_READ				0x0002	/* Start reading thread */
 #define IO_THREAD_SUSTAIN				0x0004	/* Use buffering (write) / debuffering (read) */
+#define IO_THREAD_ZERO_COPY				0x0008	/* Write blocks directly from mirrored buffer */
 
 /* Writing thread internal state */
 #define WRITE_THREAD_BUFFERING			0x0100	/* In buffering state (sustain mode) */
@@ -26,11 +27,29 @@
 
 #define IO_THREAD_ABORT_TIMEOUT			5000
 
+/* Virtual stream used by sync I/O thread instead of file handle.
+ * Functions return 0 and set error code on failure, reading 0 bytes means end of stream.
+ * Source stream with peek/release functions is read in place without copying to I/O buffer:
+ * peek returns pointer to up to size bytes of data, release consumes them.
+ * Optional finish function is called by writing thread after last block of data. */
+struct io_stream
+{
+	void *param;
+	int (*read)(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error);
+	int (*write)(void *param, const BYTE *buf, size_t size, size_t *p_done, DWORD *p_error);
+	int (*peek)(void *param, const BYTE **p_buf, size_t size, size_t *p_done, DWORD *p_error);
+	void (*release)(void *param, size_t size);
+	int (*finish)(void *param, DWORD *p_error);
+};
+
 /* Async operaton queue entry */
 struct io_queue_entry
 {
 	OVERLAPPED ov;
 	BYTE *buf;
+	BYTE *io_ptr;						/* Data being written (buf or buffer memory) */
+	size_t held_size;					/* Buffer data released after completion */
+	size_t tail_size;					/* Unaligned end of data written through tail handle */
 
 	int is_async;
 	size_t data_size;
@@ -43,6 +62,8 @@ struct file_thread_ctx
 	/* stream */
 	struct big_buffer *cb;
 	HANDLE h_file;
+	HANDLE h_file_tail;
+	struct io_stream *stream;
 
 	/* parameters */
 	unsigned __int64 thres_buf_debuf;
@@ -59,10 +80,14 @@ struct file_thread_ctx
 	size_t queue_npend;
 	struct io_queue_entry *queue_entry;
 	unsigned __int64 queue_data_pos;
+	unsigned __int64 queue_held;		/* Buffer data held by queue entries (zero copy) */
 
 	/* Sync IO buffer */
 	BYTE *io_buf;
 
+	/* Memory for I/O buffers (one block per queue entry, page aligned) */
+	BYTE *io_slab;
+
 	/* i/o stats */
 	CRITICAL_SECTION total_bytes_lock;
 	unsigned __int64 data_io_bytes;
@@ -95,13 +120,16 @@ int file_thread_start(
 	struct file_thread_ctx *ctx,
 	struct big_buffer *cb,		/* buffer to read from / write to */
 	HANDLE h_file,				/* file handle to write to / read from */
+	HANDLE h_file_tail,			/* buffered handle writing unaligned end of data (can be invalid) */
+	struct io_stream *stream,	/* stream used instead of file handle (can be NULL) */
 	unsigned int flags,			/* flags */
 	unsigned __int64 thres_buf_debuf,	/* full buffer / free buffer threshold */
 	size_t io_block_size,		/* I/O block size for file access */
 	size_t io_block_align,		/* I/O block alignment for file access */
 	size_t queue_size,			/* size of I/O queue (0 = sync) */
 	size_t crc_buffer_size,		/* size of buffer for crc thread */
-	size_t crc_block_size);		/* size of block to calculate crc */
+	size_t crc_block_size,		/* size of block to calculate crc */
+	size_t digest_chunk_size);	/* size of chunk for SHA-256 digests (0 = no digests) */
 
 /* wait for I/O thread exit and cleanup */
 void file_thread_finish(struct file_thread_ctx *ctx);
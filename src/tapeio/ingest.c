@@ -0,0 +1,439 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <tchar.h>
+#include <string.h>
+#include "ingest.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Read value updated by other process */
+static __inline LONG ring_load(LONG *p)
+{
+	return *(volatile LONG *)p;
+}
+
+/* Get bytes available to this side (data for consumer, free space for producer) */
+static DWORD ring_avail(struct ingest_ring *ring)
+{
+	DWORD used;
+
+	used = (DWORD)ring_load(&(ring->hdr->write_pos)) - (DWORD)ring_load(&(ring->hdr->read_pos));
+	return ring->is_producer ? (ring->hdr->ring_size - used) : used;
+}
+
+/* Build kernel object name from ring name and suffix */
+static int make_object_name(TCHAR *buf, const TCHAR *name, const TCHAR *suffix)
+{
+	size_t len = _tcslen(name);
+
+	if((len == 0) || (len > INGEST_NAME_MAX) || (_tcschr(name, _T('\\')) != NULL))
+		return 0;
+
+	_tcscpy(buf, INGEST_OBJECT_PREFIX);
+	_tcscat(buf, name);
+	_tcscat(buf, suffix);
+	return 1;
+}
+
+/* Check if peer process still running */
+static int is_peer_running(struct ingest_ring *ring)
+{
+	DWORD pid;
+
+	/* Consumer may attach later, producer pid known from start */
+	if(ring->h_peer == NULL)
+	{
+		pid = ring->is_producer ? (DWORD)ring_load(&(ring->hdr->consumer_pid)) :
+			ring->hdr->producer_pid;
+		if(pid == 0)
+			return 1;
+		if( (ring->h_peer = OpenProcess(SYNCHRONIZE, FALSE, pid)) == NULL )
+			return 1;
+	}
+
+	return (WaitForSingleObject(ring->h_peer, 0) == WAIT_TIMEOUT);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Wait until at least 'need' bytes of data/space available or peer finished.
+ * Need shouldn't exceed half of ring: this way one side always can proceed. */
+static int ring_wait(struct ingest_ring *ring, DWORD need, DWORD *p_avail, DWORD *p_error)
+{
+	struct ingest_ring_header *hdr = ring->hdr;
+	LONG *p_wait;
+	HANDLE h_event;
+	DWORD avail, wait_result;
+
+	if(ring->is_producer) {
+		p_wait = &(hdr->space_wait);
+		h_event = ring->h_space_ev;
+	} else {
+		p_wait = &(hdr->data_wait);
+		h_event = ring->h_data_ev;
+	}
+
+	for(;;)
+	{
+		/* Check for peer abort */
+		if(ring->is_producer && ring_load(&(hdr->consumer_abort))) {
+			*p_error = ERROR_OPERATION_ABORTED;
+			return 0;
+		}
+		if(!ring->is_producer && ring_load(&(hdr->producer_abort))) {
+			*p_error = ERROR_BROKEN_PIPE;
+			return 0;
+		}
+
+		/* Check for data/space available (all remaining data at end of stream) */
+		if(!ring->is_producer && ring_load(&(hdr->producer_eof))) {
+			avail = ring_avail(ring);
+			break;
+		}
+		if( (avail = ring_avail(ring)) >= need )
+			break;
+
+		/* Announce wait and check again to not miss update made meanwhile */
+		InterlockedExchange(p_wait, (LONG)need);
+		if(ring_avail(ring) < need)
+		{
+			wait_result = WaitForSingleObject(h_event, INGEST_POLL_INTERVAL);
+			if(wait_result == WAIT_FAILED) {
+				*p_error = GetLastError();
+				InterlockedExchange(p_wait, 0);
+				return 0;
+			}
+			if((wait_result == WAIT_TIMEOUT) && !is_peer_running(ring)) {
+				*p_error = ERROR_BROKEN_PIPE;
+				InterlockedExchange(p_wait, 0);
+				return 0;
+			}
+		}
+		InterlockedExchange(p_wait, 0);
+	}
+
+	*p_avail = avail;
+	return 1;
+}
+
+/* Advance position and wake up peer if its wait satisfied */
+static void ring_advance(struct ingest_ring *ring, DWORD size)
+{
+	struct ingest_ring_header *hdr = ring->hdr;
+	DWORD used, wait;
+
+	if(ring->is_producer)
+	{
+		InterlockedExchangeAdd(&(hdr->write_pos), (LONG)size);
+		used = (DWORD)ring_load(&(hdr->write_pos)) - (DWORD)ring_load(&(hdr->read_pos));
+		wait = (DWORD)ring_load(&(hdr->data_wait));
+		if((wait != 0) && (used >= wait))
+			SetEvent(ring->h_data_ev);
+	}
+	else
+	{
+		InterlockedExchangeAdd(&(hdr->read_pos), (LONG)size);
+		used = (DWORD)ring_load(&(hdr->write_pos)) - (DWORD)ring_load(&(hdr->read_pos));
+		wait = (DWORD)ring_load(&(hdr->space_wait));
+		if((wait != 0) && (hdr->ring_size - used >= wait))
+			SetEvent(ring->h_space_ev);
+	}
+}
+
+/* Get contiguous part of ring at position limited by size and half of ring */
+static DWORD ring_span(struct ingest_ring *ring, LONG pos, size_t size, DWORD *p_offset)
+{
+	DWORD ring_size, span;
+
+	ring_size = ring->hdr->ring_size;
+	*p_offset = (DWORD)pos & (ring_size - 1);
+
+	span = ring_size - *p_offset;
+	if(span > ring_size / 2)
+		span = ring_size / 2;
+	if(size < span)
+		span = (DWORD)size;
+
+	return span;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Open section and map its view, check header */
+static int open_ring_view(const TCHAR *spec, DWORD access,
+	HANDLE *p_mapping, struct ingest_ring_header **p_hdr, DWORD *p_error)
+{
+	TCHAR obj_name[64 + INGEST_NAME_MAX];
+	struct ingest_ring_header *hdr;
+	MEMORY_BASIC_INFORMATION mbi;
+	HANDLE h_mapping;
+
+	if(!is_ingest_name(spec) || !make_object_name(obj_name, spec + 4, _T(""))) {
+		*p_error = ERROR_INVALID_NAME;
+		return 0;
+	}
+
+	if( (h_mapping = OpenFileMapping(access, FALSE, obj_name)) == NULL ) {
+		*p_error = GetLastError();
+		return 0;
+	}
+
+	if( (hdr = MapViewOfFile(h_mapping, access, 0, 0, 0)) == NULL ) {
+		*p_error = GetLastError();
+		CloseHandle(h_mapping);
+		return 0;
+	}
+
+	/* Check layout and that section covers whole ring */
+	if( (ring_load(&(hdr->magic)) != INGEST_RING_MAGIC) ||
+		(hdr->version != INGEST_RING_VERSION) ||
+		(hdr->ring_size < INGEST_RING_SIZE_MIN) || (hdr->ring_size > INGEST_RING_SIZE_MAX) ||
+		((hdr->ring_size & (hdr->ring_size - 1)) != 0) ||
+		(VirtualQuery(hdr, &mbi, sizeof(mbi)) == 0) ||
+		(mbi.RegionSize < INGEST_HEADER_SIZE + (SIZE_T)(hdr->ring_size)) )
+	{
+		*p_error = ERROR_INVALID_DATA;
+		UnmapViewOfFile(hdr);
+		CloseHandle(h_mapping);
+		return 0;
+	}
+
+	*p_mapping = h_mapping;
+	*p_hdr = hdr;
+	return 1;
+}
+
+/* Check if name is ingest ring specification */
+int is_ingest_name(const TCHAR *name)
+{
+	return (_tcsnicmp(name, INGEST_PREFIX, 4) == 0);
+}
+
+/* Get total data size announced by producer (0 if unknown). */
+int ingest_ring_query(const TCHAR *spec, unsigned __int64 *p_total_size, DWORD *p_error)
+{
+	struct ingest_ring_header *hdr;
+	HANDLE h_mapping;
+
+	if(!open_ring_view(spec, FILE_MAP_READ, &h_mapping, &hdr, p_error))
+		return 0;
+
+	*p_total_size = hdr->total_size;
+
+	UnmapViewOfFile(hdr);
+	CloseHandle(h_mapping);
+	return 1;
+}
+
+/* Attach to ring created by producer (consumer side). */
+int ingest_ring_attach(struct ingest_ring *ring, const TCHAR *spec, DWORD *p_error)
+{
+	TCHAR obj_name[64 + INGEST_NAME_MAX];
+
+	memset(ring, 0, sizeof(struct ingest_ring));
+
+	if(!open_ring_view(spec, FILE_MAP_WRITE, &(ring->h_mapping), &(ring->hdr), p_error))
+		return 0;
+	ring->data = (BYTE*)(ring->hdr) + INGEST_HEADER_SIZE;
+
+	/* Only one consumer allowed */
+	if(InterlockedCompareExchange(&(ring->hdr->consumer_pid),
+		(LONG)GetCurrentProcessId(), 0) != 0)
+	{
+		*p_error = ERROR_BUSY;
+		UnmapViewOfFile(ring->hdr);
+		CloseHandle(ring->h_mapping);
+		memset(ring, 0, sizeof(struct ingest_ring));
+		return 0;
+	}
+
+	/* Open wakeup events */
+	make_object_name(obj_name, spec + 4, _T("-data"));
+	ring->h_data_ev = OpenEvent(EVENT_MODIFY_STATE|SYNCHRONIZE, FALSE, obj_name);
+	make_object_name(obj_name, spec + 4, _T("-space"));
+	ring->h_space_ev = OpenEvent(EVENT_MODIFY_STATE|SYNCHRONIZE, FALSE, obj_name);
+	if((ring->h_data_ev == NULL) || (ring->h_space_ev == NULL)) {
+		*p_error = GetLastError();
+		ingest_ring_close(ring);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Get pointer to data in ring (waits for full block unless end of data) */
+static int ingest_peek(void *param, const BYTE **p_buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct ingest_ring *ring = param;
+	DWORD offset, need, avail;
+
+	need = ring_span(ring, ring_load(&(ring->hdr->read_pos)), size, &offset);
+
+	if(!ring_wait(ring, need, &avail, p_error)) {
+		*p_done = 0;
+		return 0;
+	}
+
+	*p_buf = ring->data + offset;
+	*p_done = (avail < need) ? avail : need;
+	return 1;
+}
+
+/* Consume data returned by ingest_peek */
+static void ingest_release(void *param, size_t size)
+{
+	ring_advance(param, (DWORD)size);
+}
+
+/* Initialize stream reading data in place from ring */
+void ingest_stream(struct io_stream *stream, struct ingest_ring *ring)
+{
+	stream->param = ring;
+	stream->read = NULL;
+	stream->write = NULL;
+	stream->peek = ingest_peek;
+	stream->release = ingest_release;
+	stream->finish = NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Create ring (producer side). */
+int ingest_ring_create(struct ingest_ring *ring, const TCHAR *name,
+	DWORD ring_size, unsigned __int64 total_size, DWORD *p_error)
+{
+	TCHAR obj_name[64 + INGEST_NAME_MAX];
+
+	memset(ring, 0, sizeof(struct ingest_ring));
+	ring->is_producer = 1;
+
+	if( (ring_size < INGEST_RING_SIZE_MIN) || (ring_size > INGEST_RING_SIZE_MAX) ||
+		((ring_size & (ring_size - 1)) != 0) )
+	{
+		*p_error = ERROR_INVALID_PARAMETER;
+		return 0;
+	}
+
+	if(!make_object_name(obj_name, name, _T(""))) {
+		*p_error = ERROR_INVALID_NAME;
+		return 0;
+	}
+
+	/* Create pagefile-backed section */
+	ring->h_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		0, INGEST_HEADER_SIZE + ring_size, obj_name);
+	if(ring->h_mapping == NULL) {
+		*p_error = GetLastError();
+		return 0;
+	}
+	if(GetLastError() == ERROR_ALREADY_EXISTS) {
+		*p_error = ERROR_ALREADY_EXISTS;
+		ingest_ring_close(ring);
+		return 0;
+	}
+
+	ring->hdr = MapViewOfFile(ring->h_mapping, FILE_MAP_WRITE, 0, 0, 0);
+	if(ring->hdr == NULL) {
+		*p_error = GetLastError();
+		ingest_ring_close(ring);
+		return 0;
+	}
+	ring->data = (BYTE*)(ring->hdr) + INGEST_HEADER_SIZE;
+
+	/* Create wakeup events */
+	make_object_name(obj_name, name, _T("-data"));
+	ring->h_data_ev = CreateEvent(NULL, FALSE, FALSE, obj_name);
+	make_object_name(obj_name, name, _T("-space"));
+	ring->h_space_ev = CreateEvent(NULL, FALSE, FALSE, obj_name);
+	if((ring->h_data_ev == NULL) || (ring->h_space_ev == NULL)) {
+		*p_error = GetLastError();
+		ingest_ring_close(ring);
+		return 0;
+	}
+
+	/* Initialize header (section memory is zeroed by system) */
+	ring->hdr->version = INGEST_RING_VERSION;
+	ring->hdr->ring_size = ring_size;
+	ring->hdr->producer_pid = GetCurrentProcessId();
+	ring->hdr->total_size = total_size;
+	InterlockedExchange(&(ring->hdr->magic), INGEST_RING_MAGIC);
+
+	return 1;
+}
+
+/* Wait for free space and get pointer to it (producer side).
+ * Returns contiguous free space up to size bytes. */
+int ingest_ring_reserve(struct ingest_ring *ring, size_t size,
+	BYTE **p_buf, size_t *p_avail, DWORD *p_error)
+{
+	DWORD offset, need, avail;
+
+	need = ring_span(ring, ring_load(&(ring->hdr->write_pos)), size, &offset);
+
+	if(!ring_wait(ring, need, &avail, p_error))
+		return 0;
+
+	/* Return all contiguous free space */
+	if(avail > ring->hdr->ring_size - offset)
+		avail = ring->hdr->ring_size - offset;
+	if(avail > size)
+		avail = (DWORD)size;
+
+	*p_buf = ring->data + offset;
+	*p_avail = avail;
+	return 1;
+}
+
+/* Publish data written to reserved space (producer side). */
+void ingest_ring_commit(struct ingest_ring *ring, size_t size)
+{
+	ring_advance(ring, (DWORD)size);
+}
+
+/* Mark end of data (producer side). */
+void ingest_ring_finish(struct ingest_ring *ring)
+{
+	InterlockedExchange(&(ring->hdr->producer_eof), 1);
+	SetEvent(ring->h_data_ev);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Close ring (consumer closing before end of data aborts producer). */
+void ingest_ring_close(struct ingest_ring *ring)
+{
+	if(ring->hdr != NULL)
+	{
+		/* Tell peer that transfer canceled */
+		if(ring->is_producer) {
+			if(!ring_load(&(ring->hdr->producer_eof))) {
+				InterlockedExchange(&(ring->hdr->producer_abort), 1);
+				if(ring->h_data_ev != NULL)
+					SetEvent(ring->h_data_ev);
+			}
+		} else {
+			if(!ring_load(&(ring->hdr->producer_eof)) || (ring_avail(ring) != 0)) {
+				InterlockedExchange(&(ring->hdr->consumer_abort), 1);
+				if(ring->h_space_ev != NULL)
+					SetEvent(ring->h_space_ev);
+			}
+		}
+		UnmapViewOfFile(ring->hdr);
+	}
+
+	if(ring->h_peer != NULL)
+		CloseHandle(ring->h_peer);
+	if(ring->h_space_ev != NULL)
+		CloseHandle(ring->h_space_ev);
+	if(ring->h_data_ev != NULL)
+		CloseHandle(ring->h_data_ev);
+	if(ring->h_mapping != NULL)
+		CloseHandle(ring->h_mapping);
+
+	memset(ring, 0, sizeof(struct ingest_ring));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
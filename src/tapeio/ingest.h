@@ -0,0 +1,112 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "filethrd.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Shared memory ingest ring (shm:<name>).
+ *
+ * Producer process creates pagefile-backed section "Local\tapectl-ingest-<name>" and two
+ * auto-reset events "Local\tapectl-ingest-<name>-data" and "Local\tapectl-ingest-<name>-space",
+ * then starts "tapectl -w shm:<name>". Section starts with ingest_ring_header, ring data
+ * begins at INGEST_HEADER_SIZE offset. Ring size is power of two, so positions are free
+ * running 32-bit byte counters and offset in ring is (position & (ring_size - 1)).
+ *
+ * Producer writes data directly to ring pages between write_pos and read_pos + ring_size
+ * and advances write_pos; tapectl reads data in place between read_pos and write_pos and
+ * advances read_pos. Side waiting for data/space stores number of bytes it needs into
+ * data_wait/space_wait, checks positions again and waits for its event. Other side sets
+ * the event when position update satisfies the wait. Each side waits for at most half of
+ * the ring, so one of them always can proceed. Positions, wait counters and flags
+ * are updated with interlocked operations.
+ *
+ * Producer sets producer_eof after last data or producer_abort when it can't complete data,
+ * tapectl sets consumer_abort when transfer is canceled. Both sides check that peer process
+ * is still running while waiting.
+ *
+ * Producer side of protocol is implemented by ingest_ring_create/reserve/commit/finish
+ * functions below, which can be linked into producer program. */
+
+#define INGEST_PREFIX				_T("shm:")
+#define INGEST_OBJECT_PREFIX		_T("Local\\tapectl-ingest-")
+#define INGEST_NAME_MAX				64
+
+#define INGEST_RING_MAGIC			0x52495054	/* 'TPIR' */
+#define INGEST_RING_VERSION			1
+
+#define INGEST_HEADER_SIZE			4096
+#define INGEST_RING_SIZE_MIN		0x10000
+#define INGEST_RING_SIZE_MAX		0x40000000
+
+#define INGEST_POLL_INTERVAL		500		/* Peer process check interval (ms) */
+
+struct ingest_ring_header
+{
+	LONG magic;							/* INGEST_RING_MAGIC, set last by producer */
+	LONG version;						/* INGEST_RING_VERSION */
+	DWORD ring_size;					/* Size of ring data in bytes (power of two) */
+	DWORD producer_pid;					/* Process creating the ring */
+	LONG consumer_pid;					/* Process reading the ring (0 = not attached) */
+	unsigned __int64 total_size;		/* Total size of data if known, otherwise 0 */
+
+	LONG write_pos;						/* Bytes produced (modulo 2^32) */
+	LONG read_pos;						/* Bytes consumed (modulo 2^32) */
+	LONG data_wait;						/* Bytes of data consumer waits for (0 = not waiting) */
+	LONG space_wait;					/* Bytes of space producer waits for (0 = not waiting) */
+
+	LONG producer_eof;					/* Producer finished writing */
+	LONG producer_abort;				/* Producer canceled transfer */
+	LONG consumer_abort;				/* Consumer canceled transfer */
+};
+
+struct ingest_ring
+{
+	HANDLE h_mapping;
+	HANDLE h_data_ev;
+	HANDLE h_space_ev;
+	HANDLE h_peer;						/* Peer process handle (can be NULL) */
+	struct ingest_ring_header *hdr;
+	BYTE *data;
+	int is_producer;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check if name is ingest ring specification */
+int is_ingest_name(const TCHAR *name);
+
+/* Get total data size announced by producer (0 if unknown). */
+int ingest_ring_query(const TCHAR *spec, unsigned __int64 *p_total_size, DWORD *p_error);
+
+/* Attach to ring created by producer (consumer side). */
+int ingest_ring_attach(struct ingest_ring *ring, const TCHAR *spec, DWORD *p_error);
+
+/* Initialize stream reading data in place from ring */
+void ingest_stream(struct io_stream *stream, struct ingest_ring *ring);
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Create ring (producer side). */
+int ingest_ring_create(struct ingest_ring *ring, const TCHAR *name,
+	DWORD ring_size, unsigned __int64 total_size, DWORD *p_error);
+
+/* Wait for free space and get pointer to it (producer side).
+ * Returns contiguous free space up to size bytes. */
+int ingest_ring_reserve(struct ingest_ring *ring, size_t size,
+	BYTE **p_buf, size_t *p_avail, DWORD *p_error);
+
+/* Publish data written to reserved space (producer side). */
+void ingest_ring_commit(struct ingest_ring *ring, size_t size);
+
+/* Mark end of data (producer side). */
+void ingest_ring_finish(struct ingest_ring *ring);
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Close ring (consumer closing before end of data aborts producer). */
+void ingest_ring_close(struct ingest_ring *ring);
+
+/* ---------------------------------------------------------------------------------------------- */
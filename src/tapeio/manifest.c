@@ -0,0 +1,339 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tchar.h>
+#include "../config.h"
+#include "../util/fmt.h"
+#include "crcthrd.h"
+#include "manifest.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Compute tree root from chunk digests */
+int manifest_compute_root(struct chunk_manifest *m)
+{
+	BYTE *level, node[1 + 2 * SHA256_DIGEST_SIZE];
+	unsigned __int64 count, i;
+
+	if(m->chunk_count == 0) {
+		sha256("", 0, m->root);
+		return 1;
+	}
+
+	level = malloc((size_t)m->chunk_count * SHA256_DIGEST_SIZE);
+	if(level == NULL)
+		return 0;
+	memcpy(level, m->digests, (size_t)m->chunk_count * SHA256_DIGEST_SIZE);
+
+	/* Hash pairs of nodes until single node left */
+	node[0] = 0x01;
+	for(count = m->chunk_count; count > 1; count = (count + 1) / 2)
+	{
+		for(i = 0; i < count / 2; i++) {
+			memcpy(node + 1, level + (size_t)(i * 2) * SHA256_DIGEST_SIZE, 2 * SHA256_DIGEST_SIZE);
+			sha256(node, sizeof(node), level + (size_t)i * SHA256_DIGEST_SIZE);
+		}
+		if(count & 1) {
+			memmove(level + (size_t)(count / 2) * SHA256_DIGEST_SIZE,
+				level + (size_t)(count - 1) * SHA256_DIGEST_SIZE, SHA256_DIGEST_SIZE);
+		}
+	}
+
+	memcpy(m->root, level, SHA256_DIGEST_SIZE);
+	free(level);
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Format digest as hex string */
+static void format_digest(char *buf, const BYTE *digest)
+{
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	for(i = 0; i < SHA256_DIGEST_SIZE; i++) {
+		buf[i * 2] = hex[digest[i] >> 4];
+		buf[i * 2 + 1] = hex[digest[i] & 15];
+	}
+	buf[SHA256_DIGEST_SIZE * 2] = 0;
+}
+
+/* Parse hex digest */
+static int parse_digest(BYTE *digest, const char *str)
+{
+	int i, hi, lo;
+
+	for(i = 0; i < SHA256_DIGEST_SIZE * 2; i++)
+	{
+		char c = str[i];
+		int v = ((c >= '0') && (c <= '9')) ? (c - '0') :
+			((c >= 'a') && (c <= 'f')) ? (c - 'a' + 10) :
+			((c >= 'A') && (c <= 'F')) ? (c - 'A' + 10) : -1;
+		if(v < 0)
+			return 0;
+		if(i & 1) {
+			lo = v;
+			digest[i / 2] = (BYTE)((hi << 4) | lo);
+		} else {
+			hi = v;
+		}
+	}
+	return 1;
+}
+
+/* Get manifest file name */
+static TCHAR *manifest_filename(const TCHAR *filename)
+{
+	TCHAR *name;
+
+	name = malloc((_tcslen(filename) + _tcslen(MANIFEST_SUFFIX) + 1) * sizeof(TCHAR));
+	if(name != NULL) {
+		_tcscpy(name, filename);
+		_tcscat(name, MANIFEST_SUFFIX);
+	}
+	return name;
+}
+
+/* Write manifest for data file */
+int manifest_save(struct msg_filter *mf, const struct chunk_manifest *m, const TCHAR *filename)
+{
+	char hex_buf[SHA256_DIGEST_SIZE * 2 + 1];
+	unsigned __int64 i;
+	TCHAR *name;
+	FILE *fp;
+	int success;
+
+	if( (name = manifest_filename(filename)) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Not enough memory.\n"));
+		return 0;
+	}
+
+	msg_print(mf, MSG_VERBOSE, _T("Writing manifest \"%s\"...\n"), name);
+	if( (fp = _tfopen(name, _T("wt"))) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Can't create manifest \"%s\".\n"), name);
+		free(name);
+		return 0;
+	}
+
+	fprintf(fp, "%s\n", MANIFEST_SIGNATURE);
+	fprintf(fp, "size %I64u\n", m->data_size);
+	fprintf(fp, "chunk %I64u\n", m->chunk_size);
+	format_digest(hex_buf, m->root);
+	fprintf(fp, "root %s\n", hex_buf);
+	for(i = 0; i < m->chunk_count; i++) {
+		format_digest(hex_buf, m->digests + (size_t)i * SHA256_DIGEST_SIZE);
+		fprintf(fp, "%I64u %s\n", i, hex_buf);
+	}
+
+	success = !ferror(fp);
+	if(fclose(fp) != 0)
+		success = 0;
+	if(!success)
+		msg_print(mf, MSG_ERROR, _T("Can't write manifest \"%s\".\n"), name);
+
+	free(name);
+	return success;
+}
+
+/* Read manifest of data file */
+int manifest_load(struct msg_filter *mf, struct chunk_manifest *m, const TCHAR *filename)
+{
+	char line[256], hex_buf[SHA256_DIGEST_SIZE * 2 + 1];
+	unsigned __int64 index, count;
+	TCHAR *name;
+	FILE *fp;
+	int success = 0;
+
+	memset(m, 0, sizeof(struct chunk_manifest));
+
+	if( (name = manifest_filename(filename)) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Not enough memory.\n"));
+		return 0;
+	}
+
+	if( (fp = _tfopen(name, _T("rt"))) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Can't open manifest \"%s\".\n"), name);
+		free(name);
+		return 0;
+	}
+
+	/* Read header */
+	if( (fgets(line, sizeof(line), fp) == NULL) ||
+		(strncmp(line, MANIFEST_SIGNATURE, strlen(MANIFEST_SIGNATURE)) != 0) ||
+		(fgets(line, sizeof(line), fp) == NULL) ||
+		(sscanf(line, "size %I64u", &(m->data_size)) != 1) ||
+		(fgets(line, sizeof(line), fp) == NULL) ||
+		(sscanf(line, "chunk %I64u", &(m->chunk_size)) != 1) ||
+		(m->chunk_size == 0) || (m->chunk_size > MANIFEST_MAX_CHUNK) ||
+		(fgets(line, sizeof(line), fp) == NULL) ||
+		(sscanf(line, "root %64s", hex_buf) != 1) || !parse_digest(m->root, hex_buf) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Invalid manifest header in \"%s\".\n"), name);
+		goto cleanup;
+	}
+
+	/* Read chunk digests */
+	count = (m->data_size + m->chunk_size - 1) / m->chunk_size;
+	if( (count != 0) && ((m->digests = malloc((size_t)count * SHA256_DIGEST_SIZE)) == NULL) ) {
+		msg_print(mf, MSG_ERROR, _T("Not enough memory for manifest.\n"));
+		goto cleanup;
+	}
+	for(m->chunk_count = 0; m->chunk_count < count; m->chunk_count++)
+	{
+		if( (fgets(line, sizeof(line), fp) == NULL) ||
+			(sscanf(line, "%I64u %64s", &index, hex_buf) != 2) || (index != m->chunk_count) ||
+			!parse_digest(m->digests + (size_t)index * SHA256_DIGEST_SIZE, hex_buf) )
+		{
+			msg_print(mf, MSG_ERROR, _T("Invalid digest of chunk %I64u in \"%s\".\n"),
+				m->chunk_count, name);
+			goto cleanup;
+		}
+	}
+
+	success = 1;
+
+cleanup:
+	fclose(fp);
+	free(name);
+	if(!success)
+		manifest_free(m);
+	return success;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Report damaged chunks as byte ranges */
+static unsigned __int64 report_damaged_ranges(struct msg_filter *mf,
+	const struct chunk_manifest *expected, const struct chunk_manifest *actual)
+{
+	unsigned __int64 i, first, damaged = 0, end;
+	int in_range = 0;
+
+	first = 0;
+	for(i = 0; i <= expected->chunk_count; i++)
+	{
+		int bad = (i < expected->chunk_count) && ( (i >= actual->chunk_count) ||
+			(memcmp(expected->digests + (size_t)i * SHA256_DIGEST_SIZE,
+				actual->digests + (size_t)i * SHA256_DIGEST_SIZE, SHA256_DIGEST_SIZE) != 0) );
+
+		if(bad) {
+			if(!in_range)
+				first = i;
+			in_range = 1;
+			damaged++;
+		} else if(in_range) {
+			end = i * expected->chunk_size;
+			if(end > expected->data_size)
+				end = expected->data_size;
+			msg_print(mf, MSG_MESSAGE, _T("Damaged data: bytes %I64u-%I64u (chunks %I64u-%I64u).\n"),
+				first * expected->chunk_size, end - 1, first, i - 1);
+			in_range = 0;
+		}
+	}
+
+	return damaged;
+}
+
+/* Check data file against its manifest */
+int manifest_check_file(struct msg_filter *mf, const TCHAR *filename)
+{
+	struct chunk_manifest expected, actual;
+	struct crc32_thread crc_thrd;
+	unsigned __int64 damaged;
+	HANDLE h_file;
+	BYTE *buf = NULL;
+	DWORD cb_read, error;
+	TCHAR fmt_buf[64];
+	int crc_started = 0, success = 0;
+
+	memset(&actual, 0, sizeof(actual));
+	if(!manifest_load(mf, &expected, filename))
+		return 0;
+
+	h_file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(h_file == INVALID_HANDLE_VALUE) {
+		error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't open \"%s\": %s (%u).\n"),
+			filename, msg_winerr(mf, error), error);
+		goto cleanup;
+	}
+
+	/* Digest chunks on CRC worker threads while reading file */
+	if( ((buf = malloc((size_t)expected.chunk_size)) == NULL) ||
+		!crc32_thread_init(&crc_thrd, (size_t)expected.chunk_size * CRC_MAX_THREADS,
+			(size_t)expected.chunk_size, THREAD_PRIORITY_NORMAL, (size_t)expected.chunk_size) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Not enough memory for checking \"%s\".\n"), filename);
+		goto cleanup;
+	}
+	crc_started = 1;
+
+	msg_print(mf, MSG_INFO, _T("Checking \"%s\" (%s)...\n"),
+		filename, fmt_block_size(fmt_buf, expected.data_size, 1));
+	for(;;)
+	{
+		if(!ReadFile(h_file, buf, (DWORD)expected.chunk_size, &cb_read, NULL)) {
+			error = GetLastError();
+			msg_print(mf, MSG_ERROR, _T("Can't read \"%s\": %s (%u).\n"),
+				filename, msg_winerr(mf, error), error);
+			goto cleanup;
+		}
+		if(cb_read == 0)
+			break;
+		crc32_thread_write(&crc_thrd, buf, cb_read);
+		actual.data_size += cb_read;
+	}
+
+	crc32_thread_finish(&crc_thrd);
+	crc_started = 0;
+	if(crc_thrd.digest_failed) {
+		msg_print(mf, MSG_ERROR, _T("Not enough memory for digests.\n"));
+		crc32_thread_free_digests(&crc_thrd);
+		goto cleanup;
+	}
+	actual.chunk_size = expected.chunk_size;
+	actual.chunk_count = crc_thrd.digest_count;
+	actual.digests = crc_thrd.digests;
+
+	/* Compare digests */
+	if(actual.data_size != expected.data_size) {
+		msg_print(mf, MSG_MESSAGE, _T("File size %I64u bytes, expected %I64u bytes.\n"),
+			actual.data_size, expected.data_size);
+	}
+	damaged = report_damaged_ranges(mf, &expected, &actual);
+	if((damaged == 0) && (actual.data_size == expected.data_size)) {
+		msg_print(mf, MSG_INFO, _T("All %I64u chunks match manifest.\n"), expected.chunk_count);
+		success = 1;
+	} else {
+		msg_print(mf, MSG_ERROR, _T("\"%s\" is damaged (%I64u of %I64u chunks mismatch).\n"),
+			filename, damaged, expected.chunk_count);
+	}
+
+cleanup:
+	if(crc_started) {
+		crc32_thread_finish(&crc_thrd);
+		crc32_thread_free_digests(&crc_thrd);
+	}
+	if(h_file != INVALID_HANDLE_VALUE)
+		CloseHandle(h_file);
+	free(buf);
+	manifest_free(&actual);
+	manifest_free(&expected);
+	return success;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Free digests */
+void manifest_free(struct chunk_manifest *m)
+{
+	free(m->digests);
+	m->digests = NULL;
+	m->chunk_count = 0;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,52 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "../util/msgfilt.h"
+#include "sha256.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Chunk digest manifest stored next to data file ("<file>.manifest").
+ *
+ * Text file with header lines followed by SHA-256 of each chunk of data in order:
+ *   tapectl-manifest 1
+ *   size <data size>
+ *   chunk <chunk size>
+ *   root <tree root>
+ *   <chunk index> <digest>
+ * Tree root is SHA-256 of 0x01 and digests of two child nodes, node without pair
+ * goes to next level unchanged. */
+
+#define MANIFEST_SUFFIX			_T(".manifest")
+#define MANIFEST_SIGNATURE		"tapectl-manifest 1"
+#define MANIFEST_MAX_CHUNK		(64UL << 20)
+
+struct chunk_manifest
+{
+	unsigned __int64 data_size;			/* Size of data */
+	unsigned __int64 chunk_size;		/* Size of chunk (last one can be shorter) */
+	unsigned __int64 chunk_count;		/* Number of digests */
+	BYTE *digests;						/* SHA256_DIGEST_SIZE bytes per chunk */
+	BYTE root[SHA256_DIGEST_SIZE];		/* Tree root */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Compute tree root from chunk digests */
+int manifest_compute_root(struct chunk_manifest *m);
+
+/* Write manifest for data file */
+int manifest_save(struct msg_filter *mf, const struct chunk_manifest *m, const TCHAR *filename);
+
+/* Read manifest of data file */
+int manifest_load(struct msg_filter *mf, struct chunk_manifest *m, const TCHAR *filename);
+
+/* Check data file against its manifest and report damaged byte ranges (tapectl --check-manifest) */
+int manifest_check_file(struct msg_filter *mf, const TCHAR *filename);
+
+/* Free digests */
+void manifest_free(struct chunk_manifest *m);
+
+/* ---------------------------------------------------------------------------------------------- */
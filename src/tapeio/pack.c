@@ -0,0 +1,874 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <tchar.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../util/fmt.h"
+#include "pack.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+#define PACK_LINE_SIZE				(PACK_MAX_NAME + 128)
+#define PACK_NAME_BYTES				(PACK_MAX_NAME * sizeof(WCHAR))
+
+/* Check if name is container specification */
+int is_pack_name(const TCHAR *name)
+{
+	return (_tcsnicmp(name, PACK_PREFIX, 5) == 0);
+}
+
+/* Convert name to UTF-16, get length in bytes (0 if too long) */
+static DWORD pack_name_to_wide(const TCHAR *name, WCHAR *buf)
+{
+	size_t length;
+
+#ifdef _UNICODE
+	length = wcslen(name);
+	if((length == 0) || (length > PACK_MAX_NAME))
+		return 0;
+	memcpy(buf, name, length * sizeof(WCHAR));
+#else
+	length = (size_t)MultiByteToWideChar(CP_ACP, 0, name, -1, buf, PACK_MAX_NAME + 1);
+	if(length <= 1)
+		return 0;
+	length--;
+#endif
+
+	return (DWORD)(length * sizeof(WCHAR));
+}
+
+/* Convert stored name to TCHAR string (buffer of PACK_MAX_NAME + 1 characters) */
+static void pack_name_from_wide(const WCHAR *name, DWORD name_length, TCHAR *buf)
+{
+	size_t length = name_length / sizeof(WCHAR);
+
+#ifdef _UNICODE
+	memcpy(buf, name, length * sizeof(WCHAR));
+	buf[length] = 0;
+#else
+	length = (size_t)WideCharToMultiByte(CP_ACP, 0, name, (int)length,
+		buf, PACK_MAX_NAME, NULL, NULL);
+	buf[length] = 0;
+#endif
+}
+
+/* Get name stored in container: path without drive, leading slashes and "." components
+ * (buffer of PACK_MAX_NAME + 1 characters). Names with ".." or ":" are not accepted, they
+ * can't be extracted inside output directory. */
+static int pack_stored_name(const TCHAR *path, TCHAR *buf)
+{
+	size_t length = 0, n;
+	const TCHAR *p;
+
+	if((path[0] != 0) && (path[1] == _T(':')))
+		path += 2;
+
+	while(*path != 0)
+	{
+		/* Get next component */
+		for(p = path; (*p != 0) && (*p != _T('\\')) && (*p != _T('/')); p++) {
+			if(*p == _T(':'))
+				return 0;
+		}
+		n = (size_t)(p - path);
+
+		if((n == 2) && (path[0] == _T('.')) && (path[1] == _T('.')))
+			return 0;
+
+		if((n != 0) && !((n == 1) && (path[0] == _T('.'))))
+		{
+			if(length + (length != 0) + n > PACK_MAX_NAME)
+				return 0;
+			if(length != 0)
+				buf[length++] = _T('\\');
+			memcpy(buf + length, path, n * sizeof(TCHAR));
+			length += n;
+		}
+
+		path = (*p != 0) ? (p + 1) : p;
+	}
+
+	buf[length] = 0;
+	return (length != 0);
+}
+
+/* Compare member names (case and slash direction ignored) */
+static int pack_name_equal(const TCHAR *name1, const TCHAR *name2)
+{
+	TCHAR c1, c2;
+
+	do {
+		c1 = (*name1 == _T('/')) ? _T('\\') : (TCHAR)_totupper(*name1);
+		c2 = (*name2 == _T('/')) ? _T('\\') : (TCHAR)_totupper(*name2);
+		if(c1 != c2)
+			return 0;
+		name1++;
+		name2++;
+	} while(c1 != 0);
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Add file from list */
+static int pack_add_member(struct pack_stream *ps, const TCHAR *path)
+{
+	struct msg_filter *mf = ps->mf;
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	WCHAR name_buf[PACK_MAX_NAME + 1];
+	TCHAR stored_name[PACK_MAX_NAME + 1];
+	struct pack_member *member;
+	DWORD name_length, error, i;
+
+	if(!GetFileAttributesEx(path, GetFileExInfoStandard, &info)) {
+		error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't add \"%s\" to container: %s (%u).\n"),
+			path, msg_winerr(mf, error), error);
+		return 0;
+	}
+	if(info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+		msg_print(mf, MSG_ERROR, _T("Can't add \"%s\" to container: it's a directory.\n"), path);
+		return 0;
+	}
+	if( !pack_stored_name(path, stored_name) ||
+		((name_length = pack_name_to_wide(stored_name, name_buf)) == 0) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Can't add \"%s\" to container: invalid name.\n"), path);
+		return 0;
+	}
+
+	if(ps->member_count == ps->member_cap) {
+		member = realloc(ps->members, (ps->member_cap + 64) * sizeof(struct pack_member));
+		if(member == NULL) {
+			mf->out_of_memory = 1;
+			return 0;
+		}
+		ps->members = member;
+		ps->member_cap += 64;
+	}
+
+	member = &(ps->members[ps->member_count]);
+	memset(member, 0, sizeof(struct pack_member));
+	member->path = _tcsdup(path);
+	member->name = malloc(name_length);
+	if((member->path == NULL) || (member->name == NULL)) {
+		free(member->path);
+		free(member->name);
+		mf->out_of_memory = 1;
+		return 0;
+	}
+	for(i = 0; i < name_length / sizeof(WCHAR); i++)
+		member->name[i] = (name_buf[i] == L'/') ? L'\\' : name_buf[i];
+	member->name_length = name_length;
+	member->file_size = ((unsigned __int64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	ps->member_count++;
+
+	return 1;
+}
+
+/* Load list file (one file name per line) */
+static int pack_load_list(struct pack_stream *ps, const TCHAR *list_file)
+{
+	struct msg_filter *mf = ps->mf;
+	TCHAR *buf;
+	char *mb_buf, *str, *p;
+	size_t bufsize;
+	FILE *fp;
+	int success = 1;
+
+	if( (fp = _tfopen(list_file, _T("rt"))) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Can't open file list \"%s\".\n"), list_file);
+		return 0;
+	}
+
+	bufsize = PACK_LINE_SIZE;
+	buf = malloc(bufsize * sizeof(TCHAR));
+	mb_buf = malloc(bufsize);
+
+	if((buf != NULL) && (mb_buf != NULL))
+	{
+		while(success && (fgets(mb_buf, (int)bufsize, fp) != NULL))
+		{
+			for(str = mb_buf; (*str == ' ') || (*str == '\t'); str++)
+				;
+			if((p = strchr(str, '\n')) != NULL)
+				*p = 0;
+			if((*str == ';') || (*str == '#') || (*str == 0))
+				continue;
+#ifdef _UNICODE
+			if((int)mbstowcs(buf, str, bufsize - 1) <= 0)
+				continue;
+			buf[bufsize - 1] = 0;
+#else
+			strcpy(buf, str);
+#endif
+			success = pack_add_member(ps, buf);
+		}
+	}
+	else
+	{
+		mf->out_of_memory = 1;
+		success = 0;
+	}
+
+	fclose(fp);
+	free(mb_buf);
+	free(buf);
+
+	if(success && (ps->member_count == 0)) {
+		msg_print(mf, MSG_ERROR, _T("No files in list \"%s\".\n"), list_file);
+		success = 0;
+	}
+
+	return success;
+}
+
+/* Get size of index with trailer */
+static size_t pack_index_size(struct pack_stream *ps)
+{
+	size_t size = sizeof(struct pack_index_header) + sizeof(struct pack_trailer);
+	unsigned int i;
+
+	for(i = 0; i < ps->member_count; i++)
+		size += sizeof(struct pack_index_entry) + ps->members[i].name_length;
+
+	return size;
+}
+
+/* Open next member file and store its header */
+static int pack_open_member(struct pack_stream *ps, DWORD *p_error)
+{
+	struct msg_filter *mf = ps->mf;
+	struct pack_member *member = &(ps->members[ps->current]);
+	struct pack_member_header *hdr = &(ps->file_hdr);
+	BY_HANDLE_FILE_INFORMATION info;
+	TCHAR fmt_buf[64];
+
+	ps->h_file = CreateFile(member->path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(ps->h_file == INVALID_HANDLE_VALUE) {
+		*p_error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't open \"%s\": %s (%u).\n"),
+			member->path, msg_winerr(mf, *p_error), *p_error);
+		return 0;
+	}
+	if(!GetFileInformationByHandle(ps->h_file, &info)) {
+		*p_error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't get size of \"%s\": %s (%u).\n"),
+			member->path, msg_winerr(mf, *p_error), *p_error);
+		return 0;
+	}
+
+	/* Size could change since list was loaded */
+	member->file_size = ((unsigned __int64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	member->offset = ps->position;
+
+	memset(hdr, 0, sizeof(struct pack_member_header));
+	hdr->magic = PACK_MEMBER_MAGIC;
+	hdr->name_length = member->name_length;
+	hdr->attributes = info.dwFileAttributes;
+	hdr->file_size = member->file_size;
+	hdr->write_time = ((unsigned __int64)info.ftLastWriteTime.dwHighDateTime << 32) |
+		info.ftLastWriteTime.dwLowDateTime;
+
+	memcpy(ps->rec_buf, hdr, sizeof(struct pack_member_header));
+	memcpy(ps->rec_buf + sizeof(struct pack_member_header), member->name, member->name_length);
+	ps->rec_pos = 0;
+	ps->rec_len = sizeof(struct pack_member_header) + member->name_length;
+	ps->file_left = member->file_size;
+
+	msg_print(mf, MSG_VERBOSE, _T("Adding \"%s\" (%s)...\n"),
+		member->path, fmt_block_size(fmt_buf, member->file_size, 1));
+
+	return 1;
+}
+
+/* Store index and trailer */
+static void pack_build_index(struct pack_stream *ps)
+{
+	struct pack_index_header hdr;
+	struct pack_index_entry entry;
+	struct pack_trailer trailer;
+	BYTE *p = ps->rec_buf;
+	unsigned int i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PACK_INDEX_MAGIC;
+	hdr.member_count = ps->member_count;
+	hdr.index_size = pack_index_size(ps) - sizeof(hdr) - sizeof(trailer);
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+
+	for(i = 0; i < ps->member_count; i++) {
+		memset(&entry, 0, sizeof(entry));
+		entry.offset = ps->members[i].offset;
+		entry.file_size = ps->members[i].file_size;
+		entry.name_length = ps->members[i].name_length;
+		memcpy(p, &entry, sizeof(entry));
+		p += sizeof(entry);
+		memcpy(p, ps->members[i].name, entry.name_length);
+		p += entry.name_length;
+	}
+
+	trailer.magic = PACK_TRAILER_MAGIC;
+	trailer.member_count = ps->member_count;
+	trailer.index_offset = ps->position;
+	memcpy(p, &trailer, sizeof(trailer));
+	p += sizeof(trailer);
+
+	ps->rec_pos = 0;
+	ps->rec_len = p - ps->rec_buf;
+}
+
+/* Read container */
+static int pack_read(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct pack_stream *ps = param;
+	size_t done = 0, count;
+	DWORD cb_read;
+
+	while((done < size) && !ps->done)
+	{
+		/* Header, name or index */
+		if(ps->rec_pos < ps->rec_len) {
+			count = ps->rec_len - ps->rec_pos;
+			if(count > size - done)
+				count = size - done;
+			memcpy(buf + done, ps->rec_buf + ps->rec_pos, count);
+			ps->rec_pos += count;
+			ps->position += count;
+			done += count;
+			continue;
+		}
+
+		/* Member data */
+		if(ps->h_file != INVALID_HANDLE_VALUE)
+		{
+			if(ps->file_left == 0) {
+				CloseHandle(ps->h_file);
+				ps->h_file = INVALID_HANDLE_VALUE;
+				ps->current++;
+				continue;
+			}
+			count = size - done;
+			if(count > ps->file_left)
+				count = (size_t)ps->file_left;
+			if(!ReadFile(ps->h_file, buf + done, (DWORD)count, &cb_read, NULL)) {
+				*p_error = GetLastError();
+				*p_done = done;
+				return 0;
+			}
+			/* File truncated while reading */
+			if(cb_read == 0) {
+				*p_error = ERROR_HANDLE_EOF;
+				*p_done = done;
+				return 0;
+			}
+			ps->file_left -= cb_read;
+			ps->position += cb_read;
+			done += cb_read;
+			continue;
+		}
+
+		if(ps->current < ps->member_count) {
+			if(!pack_open_member(ps, p_error)) {
+				*p_done = done;
+				return 0;
+			}
+		} else if(!ps->in_index) {
+			pack_build_index(ps);
+			ps->in_index = 1;
+		} else {
+			ps->done = 1;
+		}
+	}
+
+	*p_done = done;
+	return 1;
+}
+
+/* Load list of files and initialize stream reading container */
+int pack_writer_init(struct msg_filter *mf, struct pack_stream *ps, const TCHAR *list_file)
+{
+	size_t rec_size;
+	unsigned int i;
+
+	memset(ps, 0, sizeof(struct pack_stream));
+	ps->mf = mf;
+	ps->h_file = INVALID_HANDLE_VALUE;
+
+	if(!pack_load_list(ps, list_file)) {
+		pack_stream_free(ps);
+		return 0;
+	}
+
+	/* Container size (for progress) */
+	for(i = 0; i < ps->member_count; i++) {
+		ps->total_size += sizeof(struct pack_member_header) +
+			ps->members[i].name_length + ps->members[i].file_size;
+	}
+	ps->total_size += pack_index_size(ps);
+
+	/* Record buffer holds member header or whole index */
+	rec_size = sizeof(struct pack_member_header) + PACK_NAME_BYTES;
+	if(rec_size < pack_index_size(ps))
+		rec_size = pack_index_size(ps);
+	if((ps->rec_buf = malloc(rec_size)) == NULL) {
+		msg_print(mf, MSG_ERROR, _T("Not enough memory for container index.\n"));
+		pack_stream_free(ps);
+		return 0;
+	}
+	ps->rec_size = rec_size;
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check that extracted name stays inside output directory */
+static int pack_check_name(TCHAR *name)
+{
+	TCHAR *p;
+
+	if((name[0] == 0) || (name[0] == _T('\\')) || (name[0] == _T('/')))
+		return 0;
+
+	for(p = name; *p != 0; p++) {
+		if(*p == _T('/'))
+			*p = _T('\\');
+		if(*p == _T(':'))
+			return 0;
+	}
+
+	for(p = name; p != NULL; p = _tcschr(p, _T('\\'))) {
+		if(*p == _T('\\'))
+			p++;
+		if( (p[0] == _T('.')) && (p[1] == _T('.')) &&
+			((p[2] == 0) || (p[2] == _T('\\'))) )
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Create member file (and its directories) in output directory */
+static int pack_create_member(struct pack_stream *ps, const TCHAR *name, DWORD *p_error)
+{
+	struct msg_filter *mf = ps->mf;
+	TCHAR *path, *p;
+	size_t dir_length;
+
+	dir_length = _tcslen(ps->out_dir);
+	if((path = malloc((dir_length + _tcslen(name) + 2) * sizeof(TCHAR))) == NULL) {
+		*p_error = ERROR_NOT_ENOUGH_MEMORY;
+		return 0;
+	}
+	_tcscpy(path, ps->out_dir);
+	if((dir_length != 0) && (path[dir_length - 1] != _T('\\')) && (path[dir_length - 1] != _T('/')))
+		path[dir_length++] = _T('\\');
+	_tcscpy(path + dir_length, name);
+
+	/* Create output directory and subdirectories */
+	for(p = _tcschr(path, _T('\\')); p != NULL; p = _tcschr(p + 1, _T('\\'))) {
+		*p = 0;
+		CreateDirectory(path, NULL);
+		*p = _T('\\');
+	}
+
+	msg_print(mf, MSG_VERBOSE, _T("Extracting \"%s\"...\n"), path);
+	ps->h_file = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(ps->h_file == INVALID_HANDLE_VALUE) {
+		*p_error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't create \"%s\": %s (%u).\n"),
+			path, msg_winerr(mf, *p_error), *p_error);
+		free(path);
+		return 0;
+	}
+
+	ps->file_path = path;
+	return 1;
+}
+
+/* Complete extracted member (restore time and attributes) */
+static void pack_close_member(struct pack_stream *ps)
+{
+	FILETIME ft;
+	DWORD attr;
+
+	if(ps->h_file != INVALID_HANDLE_VALUE)
+	{
+		ft.dwLowDateTime = (DWORD)ps->file_hdr.write_time;
+		ft.dwHighDateTime = (DWORD)(ps->file_hdr.write_time >> 32);
+		SetFileTime(ps->h_file, NULL, NULL, &ft);
+		CloseHandle(ps->h_file);
+		ps->h_file = INVALID_HANDLE_VALUE;
+
+		attr = ps->file_hdr.attributes & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN |
+			FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE);
+		if(attr != 0)
+			SetFileAttributes(ps->file_path, attr);
+		free(ps->file_path);
+		ps->file_path = NULL;
+
+		ps->extracted++;
+		if(ps->select != NULL)
+			ps->done = 1;
+	}
+
+	ps->current++;
+}
+
+/* Process member header with name */
+static int pack_start_member(struct pack_stream *ps, DWORD *p_error)
+{
+	TCHAR name[PACK_MAX_NAME + 1];
+
+	pack_name_from_wide((const WCHAR*)(ps->rec_buf + sizeof(struct pack_member_header)),
+		ps->file_hdr.name_length, name);
+
+	ps->file_left = ps->file_hdr.file_size;
+	ps->position += ps->rec_len;
+	ps->rec_len = 0;
+
+	if((ps->select == NULL) || pack_name_equal(name, ps->select))
+	{
+		/* Member with invalid name is skipped, container fails after other members */
+		if(!pack_check_name(name)) {
+			msg_print(ps->mf, MSG_ERROR, _T("Invalid member name \"%s\", skipped.\n"), name);
+			ps->invalid_names++;
+		} else if(!pack_create_member(ps, name, p_error)) {
+			return 0;
+		}
+	}
+
+	if(ps->file_left == 0)
+		pack_close_member(ps);
+
+	return 1;
+}
+
+/* Process record header */
+static int pack_parse_record(struct pack_stream *ps, DWORD *p_error)
+{
+	struct pack_index_header index;
+
+	/* Name of member */
+	if(ps->rec_len > sizeof(struct pack_member_header))
+		return pack_start_member(ps, p_error);
+
+	switch(*(DWORD*)ps->rec_buf)
+	{
+	case PACK_MEMBER_MAGIC:
+		memcpy(&(ps->file_hdr), ps->rec_buf, sizeof(struct pack_member_header));
+		if( (ps->file_hdr.name_length == 0) || (ps->file_hdr.name_length % sizeof(WCHAR) != 0) ||
+			(ps->file_hdr.name_length > PACK_NAME_BYTES) )
+		{
+			break;
+		}
+		ps->rec_len += ps->file_hdr.name_length;
+		return 1;
+
+	case PACK_INDEX_MAGIC:
+		/* All members read */
+		memcpy(&index, ps->rec_buf, sizeof(index));
+		if(index.member_count != ps->current)
+			break;
+		ps->in_index = 1;
+		ps->done = 1;
+		return 1;
+	}
+
+	*p_error = ERROR_INVALID_DATA;
+	return 0;
+}
+
+/* Extract container */
+static int pack_write(void *param, const BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct pack_stream *ps = param;
+	size_t done = 0, count;
+	DWORD written;
+
+	while((done < size) && !ps->done)
+	{
+		/* Data before member (reading from its tape block) */
+		if(ps->skip != 0) {
+			count = size - done;
+			if(count > ps->skip)
+				count = (size_t)ps->skip;
+			ps->skip -= count;
+			done += count;
+			continue;
+		}
+
+		/* Member data */
+		if(ps->file_left != 0)
+		{
+			count = size - done;
+			if(count > ps->file_left)
+				count = (size_t)ps->file_left;
+			if( (ps->h_file != INVALID_HANDLE_VALUE) &&
+				!WriteFile(ps->h_file, buf + done, (DWORD)count, &written, NULL) )
+			{
+				*p_error = GetLastError();
+				*p_done = done;
+				return 0;
+			}
+			ps->file_left -= count;
+			ps->position += count;
+			done += count;
+			if(ps->file_left == 0)
+				pack_close_member(ps);
+			continue;
+		}
+
+		/* Record header (can be split between blocks) */
+		if(ps->rec_len == 0) {
+			ps->rec_pos = 0;
+			ps->rec_len = sizeof(struct pack_member_header);
+		}
+		count = ps->rec_len - ps->rec_pos;
+		if(count > size - done)
+			count = size - done;
+		memcpy(ps->rec_buf + ps->rec_pos, buf + done, count);
+		ps->rec_pos += count;
+		done += count;
+
+		if((ps->rec_pos == ps->rec_len) && !pack_parse_record(ps, p_error)) {
+			*p_done = done;
+			return 0;
+		}
+	}
+
+	/* Rest of container (index) and tape block padding */
+	*p_done = size;
+	return 1;
+}
+
+/* Check that container was read up to index / selected member found */
+static int pack_finish(void *param, DWORD *p_error)
+{
+	struct pack_stream *ps = param;
+
+	if(!ps->done) {
+		*p_error = ((ps->select != NULL) && (ps->invalid_names == 0) &&
+			(ps->file_left == 0) && (ps->rec_len == 0)) ? ERROR_FILE_NOT_FOUND : ERROR_INVALID_DATA;
+		return 0;
+	}
+
+	if(ps->invalid_names != 0) {
+		*p_error = ERROR_INVALID_DATA;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Initialize stream extracting container members to directory */
+int pack_reader_init(struct msg_filter *mf, struct pack_stream *ps, const TCHAR *out_dir,
+	const TCHAR *select)
+{
+	memset(ps, 0, sizeof(struct pack_stream));
+	ps->mf = mf;
+	ps->h_file = INVALID_HANDLE_VALUE;
+	ps->out_dir = out_dir;
+	ps->select = select;
+
+	ps->rec_size = sizeof(struct pack_member_header) + PACK_NAME_BYTES;
+	if((ps->rec_buf = malloc(ps->rec_size)) == NULL) {
+		msg_print(mf, MSG_ERROR, _T("Not enough memory.\n"));
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Get stream reading / extracting container */
+void pack_io_stream(struct io_stream *stream, struct pack_stream *ps)
+{
+	stream->param = ps;
+	stream->read = pack_read;
+	stream->write = pack_write;
+	stream->peek = NULL;
+	stream->release = NULL;
+	stream->finish = pack_finish;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Save text index mapping members to tape blocks */
+int pack_save_index(struct pack_stream *ps, const TCHAR *filename,
+	DWORD partition, unsigned __int64 start_block, unsigned __int64 block_bytes)
+{
+	struct msg_filter *mf = ps->mf;
+	TCHAR name[PACK_MAX_NAME + 1];
+	struct pack_member *member;
+	unsigned int i;
+	FILE *fp;
+	int success;
+
+	msg_print(mf, MSG_VERBOSE, _T("Writing container index \"%s\"...\n"), filename);
+	if( (fp = _tfopen(filename, _T("wt"))) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Can't create container index \"%s\".\n"), filename);
+		return 0;
+	}
+
+	/* <block> <offset in block> <size> <name> */
+	_ftprintf(fp, _T("%s\n"), PACK_INDEX_SIGNATURE);
+	_ftprintf(fp, _T("partition %u\n"), partition);
+	for(i = 0; i < ps->member_count; i++) {
+		member = &(ps->members[i]);
+		pack_name_from_wide(member->name, member->name_length, name);
+		_ftprintf(fp, _T("%I64u %I64u %I64u %s\n"),
+			start_block + member->offset / block_bytes, member->offset % block_bytes,
+			member->file_size, name);
+	}
+
+	success = !ferror(fp);
+	if(fclose(fp) != 0)
+		success = 0;
+	if(!success)
+		msg_print(mf, MSG_ERROR, _T("Can't write container index \"%s\".\n"), filename);
+
+	return success;
+}
+
+/* Find member in text index, get its tape block and offset in block */
+int pack_find_member(struct pack_stream *ps, const TCHAR *filename, const TCHAR *name,
+	DWORD *p_partition, unsigned __int64 *p_block, unsigned __int64 *p_skip)
+{
+	struct msg_filter *mf = ps->mf;
+	TCHAR *line, *p;
+	WCHAR name_buf[PACK_MAX_NAME + 1];
+	unsigned __int64 block, skip, size;
+	DWORD name_length;
+	int pos, found = 0;
+	FILE *fp;
+
+	if( (fp = _tfopen(filename, _T("rt"))) == NULL ) {
+		msg_print(mf, MSG_ERROR, _T("Can't open container index \"%s\".\n"), filename);
+		return 0;
+	}
+	if((line = malloc(PACK_LINE_SIZE * sizeof(TCHAR))) == NULL) {
+		mf->out_of_memory = 1;
+		fclose(fp);
+		return 0;
+	}
+
+	if( (_fgetts(line, PACK_LINE_SIZE, fp) == NULL) ||
+		(_tcsncmp(line, PACK_INDEX_SIGNATURE, _tcslen(PACK_INDEX_SIGNATURE)) != 0) ||
+		(_fgetts(line, PACK_LINE_SIZE, fp) == NULL) ||
+		(_stscanf(line, _T("partition %u"), p_partition) != 1) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Invalid container index \"%s\".\n"), filename);
+		free(line);
+		fclose(fp);
+		return 0;
+	}
+
+	while(!found && (_fgetts(line, PACK_LINE_SIZE, fp) != NULL))
+	{
+		if((p = _tcschr(line, _T('\n'))) != NULL)
+			*p = 0;
+		if( (_stscanf(line, _T("%I64u %I64u %I64u %n"), &block, &skip, &size, &pos) >= 3) &&
+			pack_name_equal(line + pos, name) &&
+			((name_length = pack_name_to_wide(line + pos, name_buf)) != 0) )
+		{
+			*p_block = block;
+			*p_skip = skip;
+			ps->tape_left = skip + sizeof(struct pack_member_header) + name_length + size;
+			found = 1;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	if(!found)
+		msg_print(mf, MSG_ERROR, _T("\"%s\" not found in container index \"%s\".\n"), name, filename);
+	return found;
+}
+
+/* Read tape blocks up to end of selected member */
+static int pack_tape_read(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct pack_stream *ps = param;
+	DWORD done = 0;
+
+	*p_done = 0;
+	if(ps->tape_left == 0)
+		return 1;
+
+	/* Handle can be opened for overlapped I/O */
+	ps->ov.Offset = 0;
+	ps->ov.OffsetHigh = 0;
+	if(!ReadFile(ps->h_tape, buf, (DWORD)size, &done, &(ps->ov))) {
+		*p_error = GetLastError();
+		if(*p_error != ERROR_IO_PENDING)
+			return 0;
+		if(!GetOverlappedResult(ps->h_tape, &(ps->ov), &done, TRUE)) {
+			*p_error = GetLastError();
+			return 0;
+		}
+	}
+
+	ps->tape_left = (done < ps->tape_left) ? (ps->tape_left - done) : 0;
+	*p_done = done;
+	return 1;
+}
+
+/* Get stream reading tape blocks up to end of selected member */
+int pack_tape_stream(struct io_stream *stream, struct pack_stream *ps, HANDLE h_tape,
+	DWORD *p_error)
+{
+	if((ps->ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL) {
+		*p_error = GetLastError();
+		return 0;
+	}
+	ps->h_tape = h_tape;
+
+	stream->param = ps;
+	stream->read = pack_tape_read;
+	stream->write = NULL;
+	stream->peek = NULL;
+	stream->release = NULL;
+	stream->finish = NULL;
+
+	return 1;
+}
+
+/* Close member file and free stream */
+void pack_stream_free(struct pack_stream *ps)
+{
+	unsigned int i;
+
+	if(ps->h_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(ps->h_file);
+		ps->h_file = INVALID_HANDLE_VALUE;
+	}
+	if(ps->ov.hEvent != NULL) {
+		CloseHandle(ps->ov.hEvent);
+		ps->ov.hEvent = NULL;
+	}
+
+	for(i = 0; i < ps->member_count; i++) {
+		free(ps->members[i].path);
+		free(ps->members[i].name);
+	}
+	free(ps->members);
+	free(ps->rec_buf);
+	free(ps->file_path);
+
+	ps->members = NULL;
+	ps->member_count = 0;
+	ps->rec_buf = NULL;
+	ps->file_path = NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,143 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "../util/msgfilt.h"
+#include "filethrd.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* File container (pack:<list file> / pack:<directory>).
+ *
+ * Files named in list file are written as one continuous stream, so only the last tape block
+ * is padded and no filemarks are needed between files:
+ *
+ *   member header, name, data    for each file (32-byte header, name in UTF-16)
+ *   index header                 offset, size and name of each member follows
+ *   trailer                      offset of index header
+ *
+ * Reading extracts members to directory. Text index saved with --pack-index maps member
+ * offsets to tape blocks, so single member can be read (--member) after seeking to its
+ * block instead of reading the whole container. */
+
+#define PACK_PREFIX					_T("pack:")
+#define PACK_INDEX_SIGNATURE		_T("tapectl-pack 1")
+
+#define PACK_MEMBER_MAGIC			0x4D4B5054	/* 'TPKM' */
+#define PACK_INDEX_MAGIC			0x494B5054	/* 'TPKI' */
+#define PACK_TRAILER_MAGIC			0x454B5054	/* 'TPKE' */
+
+#define PACK_MAX_NAME				1024		/* Characters of member name */
+
+struct pack_member_header
+{
+	DWORD magic;						/* PACK_MEMBER_MAGIC */
+	DWORD name_length;					/* Bytes of name following header */
+	DWORD attributes;
+	DWORD reserved;
+	unsigned __int64 file_size;
+	unsigned __int64 write_time;		/* FILETIME */
+};
+
+struct pack_index_header
+{
+	DWORD magic;						/* PACK_INDEX_MAGIC */
+	DWORD member_count;
+	unsigned __int64 index_size;		/* Bytes of entries following header */
+	unsigned __int64 reserved[2];
+};
+
+struct pack_index_entry
+{
+	unsigned __int64 offset;			/* Member header offset in container */
+	unsigned __int64 file_size;
+	DWORD name_length;					/* Bytes of name following entry */
+	DWORD reserved;
+};
+
+struct pack_trailer
+{
+	DWORD magic;						/* PACK_TRAILER_MAGIC */
+	DWORD member_count;
+	unsigned __int64 index_offset;
+};
+
+struct pack_member
+{
+	TCHAR *path;						/* Source file (writing) */
+	WCHAR *name;						/* Name stored in container */
+	DWORD name_length;					/* Bytes of name */
+	unsigned __int64 file_size;
+	unsigned __int64 offset;			/* Member header offset in container */
+};
+
+struct pack_stream
+{
+	struct msg_filter *mf;
+
+	struct pack_member *members;
+	unsigned int member_count;
+	unsigned int member_cap;
+	unsigned int current;				/* Member being written / read */
+	unsigned __int64 position;			/* Offset in container */
+	unsigned __int64 total_size;		/* Container size (writing) */
+
+	/* header, name or index being written / parsed */
+	BYTE *rec_buf;
+	size_t rec_size;
+	size_t rec_pos;
+	size_t rec_len;
+	int in_index;						/* Reading index, members done */
+	int done;
+
+	/* member file */
+	HANDLE h_file;
+	unsigned __int64 file_left;
+	struct pack_member_header file_hdr;
+	TCHAR *file_path;
+
+	/* reading */
+	const TCHAR *out_dir;
+	const TCHAR *select;				/* Extract only this member (NULL = all) */
+	unsigned __int64 skip;				/* Bytes before first member header */
+	unsigned int extracted;
+	unsigned int invalid_names;			/* Members skipped because of invalid name */
+
+	/* tape range (reading single member) */
+	HANDLE h_tape;
+	OVERLAPPED ov;
+	unsigned __int64 tape_left;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check if name is container specification */
+int is_pack_name(const TCHAR *name);
+
+/* Load list of files and initialize stream reading container */
+int pack_writer_init(struct msg_filter *mf, struct pack_stream *ps, const TCHAR *list_file);
+
+/* Initialize stream extracting container members to directory */
+int pack_reader_init(struct msg_filter *mf, struct pack_stream *ps, const TCHAR *out_dir,
+	const TCHAR *select);
+
+/* Get stream reading / extracting container */
+void pack_io_stream(struct io_stream *stream, struct pack_stream *ps);
+
+/* Save text index mapping members to tape blocks (block_bytes per tape address) */
+int pack_save_index(struct pack_stream *ps, const TCHAR *filename,
+	DWORD partition, unsigned __int64 start_block, unsigned __int64 block_bytes);
+
+/* Find member in text index, get its tape block and offset in block */
+int pack_find_member(struct pack_stream *ps, const TCHAR *filename, const TCHAR *name,
+	DWORD *p_partition, unsigned __int64 *p_block, unsigned __int64 *p_skip);
+
+/* Get stream reading tape blocks up to end of selected member */
+int pack_tape_stream(struct io_stream *stream, struct pack_stream *ps, HANDLE h_tape,
+	DWORD *p_error);
+
+/* Close member file and free stream */
+void pack_stream_free(struct pack_stream *ps);
+
+/* ---------------------------------------------------------------------------------------------- */
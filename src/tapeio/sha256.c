@@ -0,0 +1,144 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* SHA-256 (FIPS 180-4) */
+
+#include <string.h>
+#include "sha256.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+static const unsigned int sha256_k[64] =
+{
+	0x428A2F98,0x71374491,0xB5C0FBCF,0xE9B5DBA5,0x3956C25B,0x59F111F1,0x923F82A4,0xAB1C5ED5,
+	0xD807AA98,0x12835B01,0x243185BE,0x550C7DC3,0x72BE5D74,0x80DEB1FE,0x9BDC06A7,0xC19BF174,
+	0xE49B69C1,0xEFBE4786,0x0FC19DC6,0x240CA1CC,0x2DE92C6F,0x4A7484AA,0x5CB0A9DC,0x76F988DA,
+	0x983E5152,0xA831C66D,0xB00327C8,0xBF597FC7,0xC6E00BF3,0xD5A79147,0x06CA6351,0x14292967,
+	0x27B70A85,0x2E1B2138,0x4D2C6DFC,0x53380D13,0x650A7354,0x766A0ABB,0x81C2C92E,0x92722C85,
+	0xA2BFE8A1,0xA81A664B,0xC24B8B70,0xC76C51A3,0xD192E819,0xD6990624,0xF40E3585,0x106AA070,
+	0x19A4C116,0x1E376C08,0x2748774C,0x34B0BCB5,0x391C0CB3,0x4ED8AA4A,0x5B9CCA4F,0x682E6FF3,
+	0x748F82EE,0x78A5636F,0x84C87814,0x8CC70208,0x90BEFFFA,0xA4506CEB,0xBEF9A3F7,0xC67178F2
+};
+
+#define ROTR(x, n)		(((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)		(((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x)			(ROTR(x,  2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define EP1(x)			(ROTR(x,  6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SIG0(x)			(ROTR(x,  7) ^ ROTR(x, 18) ^ ((x) >>  3))
+#define SIG1(x)			(ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+/* Process 64-byte blocks */
+static void sha256_transform(unsigned int *state, const unsigned char *data, size_t block_count)
+{
+	unsigned int a, b, c, d, e, f, g, h, t1, t2, w[64];
+	int i;
+
+	for(; block_count != 0; block_count--, data += SHA256_BLOCK_SIZE)
+	{
+		for(i = 0; i < 16; i++) {
+			w[i] = ((unsigned int)data[i * 4] << 24) | ((unsigned int)data[i * 4 + 1] << 16) |
+				((unsigned int)data[i * 4 + 2] << 8) | (unsigned int)data[i * 4 + 3];
+		}
+		for(i = 16; i < 64; i++)
+			w[i] = SIG1(w[i - 2]) + w[i - 7] + SIG0(w[i - 15]) + w[i - 16];
+
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+		for(i = 0; i < 64; i++)
+		{
+			t1 = h + EP1(e) + CH(e, f, g) + sha256_k[i] + w[i];
+			t2 = EP0(a) + MAJ(a, b, c);
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	ctx->state[0] = 0x6A09E667;
+	ctx->state[1] = 0xBB67AE85;
+	ctx->state[2] = 0x3C6EF372;
+	ctx->state[3] = 0xA54FF53A;
+	ctx->state[4] = 0x510E527F;
+	ctx->state[5] = 0x9B05688C;
+	ctx->state[6] = 0x1F83D9AB;
+	ctx->state[7] = 0x5BE0CD19;
+	ctx->length = 0;
+	ctx->block_used = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const void *src, size_t length)
+{
+	const unsigned char *src_byte = src;
+	size_t part;
+
+	ctx->length += length;
+
+	/* Complete buffered block */
+	if(ctx->block_used != 0)
+	{
+		part = SHA256_BLOCK_SIZE - ctx->block_used;
+		if(part > length)
+			part = length;
+		memcpy(ctx->block + ctx->block_used, src_byte, part);
+		ctx->block_used += part;
+		src_byte += part;
+		length -= part;
+		if(ctx->block_used < SHA256_BLOCK_SIZE)
+			return;
+		sha256_transform(ctx->state, ctx->block, 1);
+		ctx->block_used = 0;
+	}
+
+	/* Process whole blocks in place */
+	sha256_transform(ctx->state, src_byte, length / SHA256_BLOCK_SIZE);
+	src_byte += length - length % SHA256_BLOCK_SIZE;
+	length %= SHA256_BLOCK_SIZE;
+
+	/* Buffer remaining data */
+	memcpy(ctx->block, src_byte, length);
+	ctx->block_used = length;
+}
+
+void sha256_final(struct sha256_ctx *ctx, unsigned char *digest)
+{
+	unsigned __int64 bits = ctx->length * 8;
+	int i;
+
+	/* Append 0x80, zero padding and length in bits */
+	ctx->block[ctx->block_used++] = 0x80;
+	if(ctx->block_used > SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->block + ctx->block_used, 0, SHA256_BLOCK_SIZE - ctx->block_used);
+		sha256_transform(ctx->state, ctx->block, 1);
+		ctx->block_used = 0;
+	}
+	memset(ctx->block + ctx->block_used, 0, SHA256_BLOCK_SIZE - 8 - ctx->block_used);
+	for(i = 0; i < 8; i++)
+		ctx->block[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(bits >> (i * 8));
+	sha256_transform(ctx->state, ctx->block, 1);
+
+	/* Output big-endian state */
+	for(i = 0; i < 8; i++) {
+		digest[i * 4    ] = (unsigned char)(ctx->state[i] >> 24);
+		digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+		digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >>  8);
+		digest[i * 4 + 3] = (unsigned char)(ctx->state[i]);
+	}
+}
+
+void sha256(const void *src, size_t length, unsigned char *digest)
+{
+	struct sha256_ctx ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, src, length);
+	sha256_final(&ctx, digest);
+}
+
+/* ---------------------------------------------------------------------------------------------- */
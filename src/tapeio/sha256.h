@@ -0,0 +1,32 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <stddef.h>
+
+/* ---------------------------------------------------------------------------------------------- */
+
+#define SHA256_DIGEST_SIZE		32
+#define SHA256_BLOCK_SIZE		64
+
+struct sha256_ctx
+{
+	unsigned int state[8];
+	unsigned __int64 length;
+	unsigned char block[SHA256_BLOCK_SIZE];
+	size_t block_used;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Compute SHA-256 digest */
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *src, size_t length);
+void sha256_final(struct sha256_ctx *ctx, unsigned char *digest);
+
+/* Compute SHA-256 digest of data buffer */
+
+void sha256(const void *src, size_t length, unsigned char *digest);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,414 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <winioctl.h>
+#include <string.h>
+#include <malloc.h>
+#include "fastcopy.h"
+#include "sparse.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+#define SPARSE_REC_SIZE				sizeof(struct sparse_record)
+
+/* Store record header */
+static void sparse_put_record(BYTE *buf, DWORD type, unsigned __int64 length)
+{
+	struct sparse_record rec;
+
+	rec.type = type;
+	rec.reserved = 0;
+	rec.length = length;
+	memcpy(buf, &rec, SPARSE_REC_SIZE);
+}
+
+/* Query next batch of allocated ranges starting at file position */
+static int sparse_query_ranges(struct sparse_stream *ss, DWORD *p_error)
+{
+	FILE_ALLOCATED_RANGE_BUFFER query;
+	DWORD done, error;
+
+	query.FileOffset.QuadPart = (LONGLONG)ss->file_pos;
+	query.Length.QuadPart = (LONGLONG)(ss->file_size - ss->file_pos);
+
+	ss->range_index = 0;
+	ss->range_count = 0;
+
+	if(DeviceIoControl(ss->h_file, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+		ss->ranges, sizeof(ss->ranges), &done, NULL))
+	{
+		ss->range_count = done / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+		ss->ranges_complete = 1;
+		return 1;
+	}
+
+	error = GetLastError();
+	if(error == ERROR_MORE_DATA) {
+		ss->range_count = done / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+		ss->ranges_complete = (ss->range_count == 0);
+		return 1;
+	}
+
+	/* File system without sparse files: whole file is allocated */
+	if( (error == ERROR_INVALID_FUNCTION) || (error == ERROR_INVALID_PARAMETER) ||
+		(error == ERROR_NOT_SUPPORTED) )
+	{
+		ss->ranges[0].FileOffset.QuadPart = (LONGLONG)ss->file_pos;
+		ss->ranges[0].Length.QuadPart = (LONGLONG)(ss->file_size - ss->file_pos);
+		ss->range_count = 1;
+		ss->ranges_complete = 1;
+		return 1;
+	}
+
+	*p_error = error;
+	return 0;
+}
+
+/* Find allocated range at or after file position (data_start = file_size if none) */
+static int sparse_find_data(struct sparse_stream *ss,
+	unsigned __int64 *p_data_start, unsigned __int64 *p_data_end, DWORD *p_error)
+{
+	FILE_ALLOCATED_RANGE_BUFFER *range;
+	unsigned __int64 range_end;
+
+	for(;;)
+	{
+		/* Skip ranges before position */
+		while(ss->range_index < ss->range_count) {
+			range = &(ss->ranges[ss->range_index]);
+			range_end = (unsigned __int64)(range->FileOffset.QuadPart + range->Length.QuadPart);
+			if(range_end > ss->file_pos) {
+				*p_data_start = (unsigned __int64)range->FileOffset.QuadPart;
+				if(*p_data_start < ss->file_pos)
+					*p_data_start = ss->file_pos;
+				*p_data_end = (range_end < ss->file_size) ? range_end : ss->file_size;
+				if(*p_data_start > ss->file_size)
+					*p_data_start = ss->file_size;
+				return 1;
+			}
+			ss->range_index++;
+		}
+
+		if(ss->ranges_complete) {
+			*p_data_start = ss->file_size;
+			*p_data_end = ss->file_size;
+			return 1;
+		}
+
+		if(!sparse_query_ranges(ss, p_error))
+			return 0;
+	}
+}
+
+/* Read file data at position */
+static int sparse_read_data(struct sparse_stream *ss, BYTE *buf, size_t size, DWORD *p_error)
+{
+	LARGE_INTEGER position;
+	DWORD done;
+
+	if(ss->read_pos != ss->file_pos) {
+		position.QuadPart = (LONGLONG)ss->file_pos;
+		if(!SetFilePointerEx(ss->h_file, position, NULL, FILE_BEGIN)) {
+			*p_error = GetLastError();
+			return 0;
+		}
+		ss->read_pos = ss->file_pos;
+	}
+
+	if(!ReadFile(ss->h_file, buf, (DWORD)size, &done, NULL)) {
+		*p_error = GetLastError();
+		return 0;
+	}
+	ss->read_pos += done;
+
+	/* File truncated while reading */
+	if(done != size) {
+		*p_error = ERROR_HANDLE_EOF;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Fill output buffer with next records (out_len = 0 at end of stream) */
+static int sparse_encode_next(struct sparse_stream *ss, DWORD *p_error)
+{
+	BYTE *data = ss->out_buf + 2 * SPARSE_REC_SIZE;
+	unsigned __int64 data_start, data_end;
+	size_t size;
+
+	ss->out_pos = 0;
+	ss->out_len = 0;
+
+	while(ss->file_pos < ss->file_size)
+	{
+		if(!sparse_find_data(ss, &data_start, &data_end, p_error))
+			return 0;
+
+		/* Unallocated range */
+		if(data_start > ss->file_pos) {
+			ss->hole_run += data_start - ss->file_pos;
+			ss->file_pos = data_start;
+			continue;
+		}
+
+		/* Up to end of granule within allocated range */
+		size = (size_t)(SPARSE_GRANULE - (ss->file_pos % SPARSE_GRANULE));
+		if(size > data_end - ss->file_pos)
+			size = (size_t)(data_end - ss->file_pos);
+
+		if(!sparse_read_data(ss, data, size, p_error))
+			return 0;
+		ss->file_pos += size;
+
+		/* Allocated zeroes */
+		if(is_zero_block(data, size)) {
+			ss->hole_run += size;
+			continue;
+		}
+
+		/* Data record preceded by pending hole */
+		ss->out_pos = SPARSE_REC_SIZE;
+		if(ss->hole_run != 0) {
+			ss->out_pos = 0;
+			sparse_put_record(ss->out_buf, SPARSE_REC_HOLE, ss->hole_run);
+			ss->hole_bytes += ss->hole_run;
+			ss->hole_run = 0;
+		}
+		sparse_put_record(ss->out_buf + SPARSE_REC_SIZE, SPARSE_REC_DATA, size);
+		ss->out_len = 2 * SPARSE_REC_SIZE + size;
+		ss->data_bytes += size;
+		return 1;
+	}
+
+	/* Hole at end of file */
+	if(ss->hole_run != 0) {
+		sparse_put_record(ss->out_buf, SPARSE_REC_HOLE, ss->hole_run);
+		ss->hole_bytes += ss->hole_run;
+		ss->hole_run = 0;
+		ss->out_len = SPARSE_REC_SIZE;
+		return 1;
+	}
+
+	if(!ss->end_sent) {
+		sparse_put_record(ss->out_buf, SPARSE_REC_END, 0);
+		ss->end_sent = 1;
+		ss->out_len = SPARSE_REC_SIZE;
+	}
+
+	return 1;
+}
+
+/* Read encoded file */
+static int sparse_read(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct sparse_stream *ss = param;
+	size_t done = 0, count;
+
+	while(done < size)
+	{
+		if(ss->out_pos == ss->out_len) {
+			if(!sparse_encode_next(ss, p_error)) {
+				*p_done = done;
+				return 0;
+			}
+			if(ss->out_len == 0)
+				break;
+		}
+
+		count = ss->out_len - ss->out_pos;
+		if(count > size - done)
+			count = size - done;
+		memcpy(buf + done, ss->out_buf + ss->out_pos, count);
+		ss->out_pos += count;
+		done += count;
+	}
+
+	*p_done = done;
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Process record header */
+static int sparse_decode_record(struct sparse_stream *ss, DWORD *p_error)
+{
+	struct sparse_record rec;
+	LARGE_INTEGER position;
+	DWORD done;
+
+	memcpy(&rec, ss->rec_buf, SPARSE_REC_SIZE);
+	ss->rec_fill = 0;
+
+	/* Stream header */
+	if(!ss->got_header) {
+		if(rec.type != SPARSE_MAGIC) {
+			*p_error = ERROR_INVALID_DATA;
+			return 0;
+		}
+		ss->file_size = rec.length;
+		ss->got_header = 1;
+
+		/* Holes are left unallocated on file systems supporting sparse files */
+		ss->is_sparse = DeviceIoControl(ss->h_file, FSCTL_SET_SPARSE,
+			NULL, 0, NULL, 0, &done, NULL) ? 1 : 0;
+		return 1;
+	}
+
+	switch(rec.type)
+	{
+	case SPARSE_REC_DATA:
+		if(rec.length > ss->file_size - ss->file_pos) {
+			*p_error = ERROR_INVALID_DATA;
+			return 0;
+		}
+		ss->data_left = rec.length;
+		return 1;
+
+	case SPARSE_REC_HOLE:
+		if(rec.length > ss->file_size - ss->file_pos) {
+			*p_error = ERROR_INVALID_DATA;
+			return 0;
+		}
+		/* Skip hole (zero-filled by file system when not sparse) */
+		position.QuadPart = (LONGLONG)rec.length;
+		if(!SetFilePointerEx(ss->h_file, position, NULL, FILE_CURRENT)) {
+			*p_error = GetLastError();
+			return 0;
+		}
+		ss->file_pos += rec.length;
+		ss->hole_bytes += rec.length;
+		return 1;
+
+	case SPARSE_REC_END:
+		/* Set size of file ending with hole */
+		if(ss->file_pos != ss->file_size) {
+			*p_error = ERROR_INVALID_DATA;
+			return 0;
+		}
+		position.QuadPart = (LONGLONG)ss->file_size;
+		if( ! SetFilePointerEx(ss->h_file, position, NULL, FILE_BEGIN) ||
+			! SetEndOfFile(ss->h_file) )
+		{
+			*p_error = GetLastError();
+			return 0;
+		}
+		ss->got_end = 1;
+		return 1;
+	}
+
+	*p_error = ERROR_INVALID_DATA;
+	return 0;
+}
+
+/* Write encoded file */
+static int sparse_write(void *param, const BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	struct sparse_stream *ss = param;
+	size_t done = 0, count;
+	DWORD written;
+
+	while((done < size) && !ss->got_end)
+	{
+		/* File data */
+		if(ss->data_left != 0)
+		{
+			count = size - done;
+			if(count > ss->data_left)
+				count = (size_t)ss->data_left;
+			if(!WriteFile(ss->h_file, buf + done, (DWORD)count, &written, NULL)) {
+				*p_error = GetLastError();
+				*p_done = done;
+				return 0;
+			}
+			ss->data_left -= count;
+			ss->file_pos += count;
+			ss->data_bytes += count;
+			done += count;
+			continue;
+		}
+
+		/* Record header (can be split between blocks) */
+		count = SPARSE_REC_SIZE - ss->rec_fill;
+		if(count > size - done)
+			count = size - done;
+		memcpy(ss->rec_buf + ss->rec_fill, buf + done, count);
+		ss->rec_fill += count;
+		done += count;
+
+		if((ss->rec_fill == SPARSE_REC_SIZE) && !sparse_decode_record(ss, p_error)) {
+			*p_done = done;
+			return 0;
+		}
+	}
+
+	/* Tape block padding after end record */
+	*p_done = size;
+	return 1;
+}
+
+/* Check that whole file was restored */
+static int sparse_finish(void *param, DWORD *p_error)
+{
+	struct sparse_stream *ss = param;
+
+	if(!ss->got_end) {
+		*p_error = ERROR_INVALID_DATA;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Initialize stream encoding file */
+int sparse_reader_init(struct sparse_stream *ss, HANDLE h_file, unsigned __int64 file_size,
+	DWORD *p_error)
+{
+	memset(ss, 0, sizeof(struct sparse_stream));
+
+	ss->h_file = h_file;
+	ss->file_size = file_size;
+
+	if((ss->out_buf = malloc(2 * SPARSE_REC_SIZE + SPARSE_GRANULE)) == NULL) {
+		*p_error = ERROR_NOT_ENOUGH_MEMORY;
+		return 0;
+	}
+
+	/* Stream header */
+	sparse_put_record(ss->out_buf, SPARSE_MAGIC, file_size);
+	ss->out_len = SPARSE_REC_SIZE;
+
+	return 1;
+}
+
+/* Initialize stream restoring file */
+void sparse_writer_init(struct sparse_stream *ss, HANDLE h_file)
+{
+	memset(ss, 0, sizeof(struct sparse_stream));
+
+	ss->h_file = h_file;
+}
+
+/* Get stream reading encoded file / writing decoded file */
+void sparse_io_stream(struct io_stream *stream, struct sparse_stream *ss)
+{
+	stream->param = ss;
+	stream->read = sparse_read;
+	stream->write = sparse_write;
+	stream->peek = NULL;
+	stream->release = NULL;
+	stream->finish = sparse_finish;
+}
+
+/* Free stream buffers */
+void sparse_stream_free(struct sparse_stream *ss)
+{
+	if(ss->out_buf != NULL) {
+		free(ss->out_buf);
+		ss->out_buf = NULL;
+	}
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,86 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "filethrd.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Sparse file encoding (tapectl --sparse).
+ *
+ * File is written to tape as sequence of records. Each record starts with 16-byte header
+ * (type, reserved, 64-bit length):
+ *
+ *   SPARSE_MAGIC     length is file size, first record of stream
+ *   SPARSE_REC_DATA  header is followed by length bytes of file data
+ *   SPARSE_REC_HOLE  length bytes of zeroes (not stored)
+ *   SPARSE_REC_END   last record of stream
+ *
+ * Unallocated ranges of source file (FSCTL_QUERY_ALLOCATED_RANGES) and allocated granules
+ * containing only zeroes are stored as holes. On restore output file is marked sparse and holes
+ * are skipped, so they are not allocated on disk. Data after END record (tape block padding)
+ * is ignored. */
+
+#define SPARSE_MAGIC				0x41505354	/* 'TSPA' */
+#define SPARSE_REC_DATA				1
+#define SPARSE_REC_HOLE				2
+#define SPARSE_REC_END				3
+
+#define SPARSE_GRANULE				(64UL << 10)	/* Zero detection unit */
+#define SPARSE_MAX_RANGES			64				/* Allocated ranges queried at once */
+
+struct sparse_record
+{
+	DWORD type;							/* SPARSE_MAGIC or SPARSE_REC_* */
+	DWORD reserved;
+	unsigned __int64 length;
+};
+
+struct sparse_stream
+{
+	HANDLE h_file;
+	unsigned __int64 file_size;
+	unsigned __int64 file_pos;			/* Position in file being encoded / restored */
+
+	/* encoding */
+	FILE_ALLOCATED_RANGE_BUFFER ranges[SPARSE_MAX_RANGES];
+	unsigned int range_count;
+	unsigned int range_index;
+	int ranges_complete;				/* No more ranges after cached ones */
+	unsigned __int64 read_pos;			/* File pointer position */
+	unsigned __int64 hole_run;			/* Pending hole before next data record */
+	int end_sent;
+	BYTE *out_buf;						/* Records with data of one granule */
+	size_t out_pos;
+	size_t out_len;
+
+	/* restoring */
+	BYTE rec_buf[sizeof(struct sparse_record)];
+	size_t rec_fill;
+	unsigned __int64 data_left;			/* Bytes left of current data record */
+	int got_header;
+	int got_end;
+	int is_sparse;						/* Output file marked sparse */
+
+	/* stats */
+	unsigned __int64 data_bytes;
+	unsigned __int64 hole_bytes;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Initialize stream encoding file (opened for sequential synchronous reading) */
+int sparse_reader_init(struct sparse_stream *ss, HANDLE h_file, unsigned __int64 file_size,
+	DWORD *p_error);
+
+/* Initialize stream restoring file (opened for synchronous writing) */
+void sparse_writer_init(struct sparse_stream *ss, HANDLE h_file);
+
+/* Get stream reading encoded file / writing decoded file */
+void sparse_io_stream(struct io_stream *stream, struct sparse_stream *ss);
+
+/* Free stream buffers */
+void sparse_stream_free(struct sparse_stream *ss);
+
+/* ---------------------------------------------------------------------------------------------- */
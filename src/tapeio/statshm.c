@@ -0,0 +1,258 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <tchar.h>
+#include <string.h>
+#include "statshm.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+#define STATS_SHM_SIZE \
+	(sizeof(struct stats_shm_header) + STATS_SHM_SLOTS * sizeof(struct stats_slot))
+
+/* Check if process owning the slot still running */
+static int is_process_running(DWORD pid)
+{
+	HANDLE h_process;
+	DWORD wait_result;
+
+	if( (h_process = OpenProcess(SYNCHRONIZE, FALSE, pid)) == NULL )
+		return (GetLastError() == ERROR_ACCESS_DENIED);
+
+	wait_result = WaitForSingleObject(h_process, 0);
+	CloseHandle(h_process);
+
+	return (wait_result == WAIT_TIMEOUT);
+}
+
+/* Wait for header initialization by creator and check layout version */
+static int check_header(struct stats_shm_header *hdr, DWORD *p_error)
+{
+	unsigned int retry;
+
+	for(retry = 0; hdr->magic != STATS_SHM_MAGIC; retry++)
+	{
+		if(retry == 100) {
+			*p_error = ERROR_INVALID_DATA;
+			return 0;
+		}
+		Sleep(10);
+	}
+
+	if( (hdr->version != STATS_SHM_VERSION) ||
+		(hdr->slot_size != sizeof(struct stats_slot)) ||
+		(hdr->slot_count == 0) )
+	{
+		*p_error = ERROR_REVISION_MISMATCH;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Create or open statistics segment and claim free slot. */
+int stats_shm_open(struct stats_shm *shm, const TCHAR *device, DWORD *p_error)
+{
+	struct stats_slot *slots;
+	LONG pid;
+	DWORD i, n;
+	int created;
+
+	memset(shm, 0, sizeof(struct stats_shm));
+
+	/* Create pagefile-backed segment */
+	shm->h_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		0, (DWORD)STATS_SHM_SIZE, STATS_SHM_NAME);
+	if(shm->h_mapping == NULL) {
+		*p_error = GetLastError();
+		return 0;
+	}
+	created = (GetLastError() != ERROR_ALREADY_EXISTS);
+
+	shm->hdr = MapViewOfFile(shm->h_mapping, FILE_MAP_WRITE, 0, 0, 0);
+	if(shm->hdr == NULL) {
+		*p_error = GetLastError();
+		CloseHandle(shm->h_mapping);
+		return 0;
+	}
+
+	/* Initialize header (segment memory is zeroed by system) */
+	if(created) {
+		shm->hdr->version = STATS_SHM_VERSION;
+		shm->hdr->slot_count = STATS_SHM_SLOTS;
+		shm->hdr->slot_size = sizeof(struct stats_slot);
+		InterlockedExchange(&(shm->hdr->magic), STATS_SHM_MAGIC);
+	} else if(!check_header(shm->hdr, p_error)) {
+		stats_shm_close(shm);
+		return 0;
+	}
+
+	slots = (struct stats_slot *)(shm->hdr + 1);
+	n = shm->hdr->slot_count;
+	pid = (LONG)GetCurrentProcessId();
+
+	/* Claim free slot */
+	for(i = 0; i < n; i++) {
+		if(InterlockedCompareExchange(&(slots[i].owner_pid), pid, 0) == 0)
+			break;
+	}
+
+	/* Reclaim slot of terminated process if no free slots */
+	if(i == n) {
+		for(i = 0; i < n; i++) {
+			LONG owner = slots[i].owner_pid;
+			if( !is_process_running((DWORD)owner) &&
+				(InterlockedCompareExchange(&(slots[i].owner_pid), pid, owner) == owner) )
+			{
+				break;
+			}
+		}
+	}
+
+	if(i == n) {
+		*p_error = ERROR_NO_MORE_ITEMS;
+		stats_shm_close(shm);
+		return 0;
+	}
+
+	/* Reset slot contents (except owner and sequence counter). Previous owner could
+	 * terminate while updating slot, leaving sequence odd */
+	shm->slot = slots + i;
+	if(shm->slot->seq & 1)
+		InterlockedIncrement(&(shm->slot->seq));
+	stats_slot_lock(shm->slot);
+	memset((BYTE*)shm->slot + 2 * sizeof(LONG), 0, sizeof(struct stats_slot) - 2 * sizeof(LONG));
+	_tcsncpy(shm->slot->device, device, 15);
+	shm->slot->update_tick = GetTickCount();
+	shm->slot->start_tick = shm->slot->update_tick;
+	stats_slot_unlock(shm->slot);
+
+	return 1;
+}
+
+/* Open existing statistics segment for reading. */
+int stats_shm_attach(struct stats_shm *shm, DWORD *p_error)
+{
+	memset(shm, 0, sizeof(struct stats_shm));
+
+	shm->h_mapping = OpenFileMapping(FILE_MAP_READ, FALSE, STATS_SHM_NAME);
+	if(shm->h_mapping == NULL) {
+		*p_error = GetLastError();
+		return 0;
+	}
+
+	shm->hdr = MapViewOfFile(shm->h_mapping, FILE_MAP_READ, 0, 0, 0);
+	if(shm->hdr == NULL) {
+		*p_error = GetLastError();
+		CloseHandle(shm->h_mapping);
+		return 0;
+	}
+
+	if(!check_header(shm->hdr, p_error)) {
+		stats_shm_close(shm);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Release slot and close segment. */
+void stats_shm_close(struct stats_shm *shm)
+{
+	if(shm->slot != NULL)
+		InterlockedExchange(&(shm->slot->owner_pid), 0);
+	if(shm->hdr != NULL)
+		UnmapViewOfFile(shm->hdr);
+	if(shm->h_mapping != NULL)
+		CloseHandle(shm->h_mapping);
+
+	memset(shm, 0, sizeof(struct stats_shm));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Begin slot update (owner only). */
+void stats_slot_lock(struct stats_slot *slot)
+{
+	InterlockedIncrement(&(slot->seq));
+}
+
+/* End slot update (owner only). */
+void stats_slot_unlock(struct stats_slot *slot)
+{
+	slot->update_tick = GetTickCount();
+	InterlockedIncrement(&(slot->seq));
+}
+
+/* Set current operation (slot can be NULL). */
+void stats_slot_set_operation(struct stats_slot *slot, unsigned int state,
+	unsigned int op_index, unsigned int op_count, const TCHAR *filename)
+{
+	if(slot == NULL)
+		return;
+
+	stats_slot_lock(slot);
+
+	slot->state = state;
+	slot->op_index = op_index;
+	slot->op_count = op_count;
+	slot->start_tick = GetTickCount();
+	slot->write_flags = 0;
+	slot->read_flags = 0;
+	slot->total_size = 0;
+	slot->read_bytes = 0;
+	slot->written_bytes = 0;
+	slot->read_rate = 0;
+	slot->write_rate = 0;
+	slot->buf_data = 0;
+	slot->buf_size = 0;
+
+	if(filename != NULL) {
+		_tcsncpy(slot->filename, filename, MAX_PATH - 1);
+		slot->filename[MAX_PATH - 1] = 0;
+	} else {
+		slot->filename[0] = 0;
+	}
+
+	stats_slot_unlock(slot);
+}
+
+/* Copy consistent snapshot of slot. Returns 0 if slot free or owner not running. */
+int stats_slot_snapshot(const struct stats_slot *slot, struct stats_slot *snapshot)
+{
+	LONG seq_begin, seq_end;
+	unsigned int retry;
+
+	for(retry = 0; ; retry++)
+	{
+		/* Wait for writer to complete update */
+		seq_begin = slot->seq;
+		if(seq_begin & 1) {
+			if(retry == 1000)
+				return 0;
+			Sleep(0);
+			continue;
+		}
+
+		memcpy(snapshot, (const void *)slot, sizeof(struct stats_slot));
+
+		/* Retry if slot was updated while copying */
+		seq_end = slot->seq;
+		if(seq_begin == seq_end)
+			break;
+		if(retry == 1000)
+			return 0;
+	}
+
+	if(snapshot->owner_pid == 0)
+		return 0;
+
+	snapshot->device[15] = 0;
+	snapshot->filename[MAX_PATH - 1] = 0;
+
+	return is_process_running((DWORD)(snapshot->owner_pid));
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,88 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Shared memory segment with live transfer statistics. Segment consists of header followed by
+ * fixed number of slots, each slot owned by one running tapectl process. Slot updated by
+ * its owner only, readers use sequence counter to get consistent snapshot (seq is odd while
+ * slot is being updated). Layout is versioned, change STATS_SHM_VERSION if anything changed. */
+
+#define STATS_SHM_NAME				_T("Local\\tapectl-stats")
+#define STATS_SHM_MAGIC				0x53504154	/* 'TAPS' */
+#define STATS_SHM_VERSION			1
+#define STATS_SHM_SLOTS				64
+
+/* Slot state */
+#define STATS_STATE_IDLE			0	/* Slot claimed, no operation running */
+#define STATS_STATE_EXECUTING		1	/* Executing non-transfer operation */
+#define STATS_STATE_WRITING			2	/* Writing file to media */
+#define STATS_STATE_READING			3	/* Reading file from media */
+
+struct stats_shm_header
+{
+	volatile LONG magic;				/* STATS_SHM_MAGIC when initialized */
+	DWORD version;						/* STATS_SHM_VERSION */
+	DWORD slot_count;					/* Number of slots following header */
+	DWORD slot_size;					/* Size of slot in bytes */
+};
+
+struct stats_slot
+{
+	volatile LONG owner_pid;			/* Owner process id or 0 if slot free */
+	volatile LONG seq;					/* Update sequence counter */
+
+	DWORD update_tick;					/* GetTickCount() of last update */
+	DWORD start_tick;					/* GetTickCount() when operation started */
+
+	unsigned int state;					/* STATS_STATE_xxx */
+	unsigned int op_index;				/* Current operation index (zero based) */
+	unsigned int op_count;				/* Total number of operations */
+	unsigned int write_flags;			/* Writing thread state flags */
+	unsigned int read_flags;			/* Reading thread state flags */
+
+	unsigned __int64 total_size;		/* Size of data to transfer (0 if unknown) */
+	unsigned __int64 read_bytes;		/* Bytes read from source */
+	unsigned __int64 written_bytes;		/* Bytes written to destination */
+	unsigned __int64 read_rate;			/* Current read speed (bytes/sec) */
+	unsigned __int64 write_rate;		/* Current write speed (bytes/sec) */
+	unsigned __int64 buf_data;			/* Bytes buffered */
+	unsigned __int64 buf_size;			/* Buffer size */
+
+	TCHAR device[16];					/* Tape device name */
+	TCHAR filename[MAX_PATH];			/* Name of file being transferred */
+};
+
+struct stats_shm
+{
+	HANDLE h_mapping;
+	struct stats_shm_header *hdr;
+	struct stats_slot *slot;			/* Own slot (NULL if attached as reader) */
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Create or open statistics segment and claim free slot. */
+int stats_shm_open(struct stats_shm *shm, const TCHAR *device, DWORD *p_error);
+
+/* Open existing statistics segment for reading. */
+int stats_shm_attach(struct stats_shm *shm, DWORD *p_error);
+
+/* Release slot and close segment. */
+void stats_shm_close(struct stats_shm *shm);
+
+/* Begin/end slot update (owner only). */
+void stats_slot_lock(struct stats_slot *slot);
+void stats_slot_unlock(struct stats_slot *slot);
+
+/* Set current operation (slot can be NULL). */
+void stats_slot_set_operation(struct stats_slot *slot, unsigned int state,
+	unsigned int op_index, unsigned int op_count, const TCHAR *filename);
+
+/* Copy consistent snapshot of slot. Returns 0 if slot free or owner not running. */
+int stats_slot_snapshot(const struct stats_slot *slot, struct stats_slot *snapshot);
+
+/* ---------------------------------------------------------------------------------------------- */
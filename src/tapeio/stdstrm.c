@@ -0,0 +1,94 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <tchar.h>
+#include "stdstrm.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check if name is standard input/output */
+int is_std_stream_name(const TCHAR *name)
+{
+	return (_tcscmp(name, STD_STREAM_NAME) == 0);
+}
+
+/* Get number of bytes remaining if handle refers to disk file (redirected input) */
+int get_std_stream_size(HANDLE h_std, unsigned __int64 *p_size)
+{
+	LARGE_INTEGER size, position, zero;
+
+	if(GetFileType(h_std) != FILE_TYPE_DISK)
+		return 0;
+
+	zero.QuadPart = 0;
+	if( !GetFileSizeEx(h_std, &size) ||
+		!SetFilePointerEx(h_std, zero, &position, FILE_CURRENT) ||
+		(position.QuadPart > size.QuadPart) )
+	{
+		return 0;
+	}
+
+	*p_size = size.QuadPart - position.QuadPart;
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Read from pipe (may return less data than requested) */
+static int pipe_read(void *param, BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	HANDLE h_pipe = (HANDLE)param;
+	DWORD cb_rd;
+
+	if(!ReadFile(h_pipe, buf, (DWORD)size, &cb_rd, NULL))
+	{
+		DWORD error = GetLastError();
+
+		/* Writing end closed: end of stream */
+		if((error == ERROR_BROKEN_PIPE) || (error == ERROR_HANDLE_EOF)) {
+			*p_done = 0;
+			return 1;
+		}
+
+		*p_done = cb_rd;
+		*p_error = error;
+		return 0;
+	}
+
+	*p_done = cb_rd;
+	return 1;
+}
+
+/* Write whole block to pipe */
+static int pipe_write(void *param, const BYTE *buf, size_t size, size_t *p_done, DWORD *p_error)
+{
+	HANDLE h_pipe = (HANDLE)param;
+	size_t done = 0;
+	DWORD cb_wr;
+
+	while(done < size)
+	{
+		if(!WriteFile(h_pipe, buf + done, (DWORD)(size - done), &cb_wr, NULL)) {
+			*p_done = done + cb_wr;
+			*p_error = GetLastError();
+			return 0;
+		}
+		done += cb_wr;
+	}
+
+	*p_done = done;
+	return 1;
+}
+
+/* Initialize stream reading from / writing to pipe or console handle */
+void pipe_stream(struct io_stream *stream, HANDLE h_pipe)
+{
+	stream->param = h_pipe;
+	stream->read = pipe_read;
+	stream->write = pipe_write;
+	stream->peek = NULL;
+	stream->release = NULL;
+	stream->finish = NULL;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -0,0 +1,24 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "filethrd.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Standard input/output endpoint ("-"). Data length isn't known in advance,
+ * reading finishes when writing end of pipe is closed. */
+
+#define STD_STREAM_NAME				_T("-")
+
+/* Check if name is standard input/output */
+int is_std_stream_name(const TCHAR *name);
+
+/* Get number of bytes remaining if handle refers to disk file (redirected input) */
+int get_std_stream_size(HANDLE h_std, unsigned __int64 *p_size);
+
+/* Initialize stream reading from / writing to pipe or console handle */
+void pipe_stream(struct io_stream *stream, HANDLE h_pipe);
+
+/* ---------------------------------------------------------------------------------------------- */
@@ -1,21 +1,35 @@
 /* ---------------------------------------------------------------------------------------------- */
 
 #include <windows.h>
+#include <string.h>
 #include "../config.h"
 #include "../util/fmt.h"
 #include "../util/prompt.h"
+#include "crypt.h"
+#include "datagen.h"
+#include "fec.h"
 #include "filecopy.h"
+#include "ingest.h"
+#include "pack.h"
+#include "stdstrm.h"
 #include "setpriv.h"
+#include "sparse.h"
 #include "tapeio.h"
 
 /* ---------------------------------------------------------------------------------------------- */
 
-/* Query actual tape and drive info before starting operation */
-static int get_tape_info(struct msg_filter *mf, HANDLE h_tape,
+/* Get tape and drive info before starting operation (from cache if valid) */
+static int get_tape_info(struct msg_filter *mf, struct tape_state *state, HANDLE h_tape,
 	TAPE_GET_DRIVE_PARAMETERS *p_tgdp, TAPE_GET_MEDIA_PARAMETERS *p_tgmp)
 {
 	DWORD error, size;
 
+	if((state != NULL) && state->have_info) {
+		*p_tgdp = state->drive;
+		*p_tgmp = state->media;
+		return 1;
+	}
+
 	msg_print(mf, MSG_VERY_VERBOSE, _T("Querying drive information...\n"));
 	size = sizeof(TAPE_GET_DRIVE_PARAMETERS);
 	if((error = GetTapeParameters(h_tape, GET_TAPE_DRIVE_INFORMATION, &size, p_tgdp)) != NO_ERROR)
@@ -34,6 +48,221 @@ static int get_tape_info(struct msg_filter *mf, HANDLE h_tape,
 		return 0;
 	}
 
+	if(state != NULL) {
+		state->drive = *p_tgdp;
+		state->media = *p_tgmp;
+		state->have_info = 1;
+	}
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Start encryption stream writing/reading tape blocks directly or through next stream */
+static int init_crypt_stream(struct msg_filter *mf, struct tape_io_ctx *ctx,
+	struct crypt_stream *crypt, HANDLE h_tape, struct io_stream *next, size_t tape_block_size)
+{
+	TCHAR fmt_buf[64];
+	DWORD error;
+
+	if(tape_block_size < CRYPT_MIN_BLOCK_SIZE) {
+		msg_print(mf, MSG_ERROR, _T("Can't use encryption with I/O block smaller than %s.\n"),
+			fmt_block_size(fmt_buf, CRYPT_MIN_BLOCK_SIZE, 1));
+		return 0;
+	}
+
+	if(!crypt_stream_init(crypt, h_tape, next, tape_block_size, ctx->crypt_key, &error)) {
+		msg_print(mf, MSG_ERROR, _T("Can't initialize encryption: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Seek to tape block of container member from index, read tape only up to end of member */
+static int seek_pack_member(struct msg_filter *mf, struct tape_io_ctx *ctx,
+	struct pack_stream *pack, HANDLE h_tape, struct io_stream *stream)
+{
+	unsigned __int64 block;
+	DWORD partition, error;
+
+	if((ctx->pack_index_file == NULL) || (ctx->fec_parity_blocks != 0) || ctx->use_encryption) {
+		msg_print(mf, MSG_ERROR,
+			_T("Reading container member requires --pack-index (without --fec and --encrypt).\n"));
+		return 0;
+	}
+
+	if(!pack_find_member(pack, ctx->pack_index_file, ctx->pack_member,
+		&partition, &block, &(pack->skip)))
+	{
+		return 0;
+	}
+
+	msg_print(mf, MSG_VERBOSE, _T("Seeking to \"%s\" (partition %u, block %I64u)...\n"),
+		ctx->pack_member, partition, block);
+	error = SetTapePosition(h_tape, TAPE_LOGICAL_BLOCK, partition,
+		(DWORD)block, (DWORD)(block >> 32), FALSE);
+	if(error != NO_ERROR) {
+		msg_print(mf, MSG_ERROR, _T("Can't seek to container member: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		return 0;
+	}
+
+	if(!pack_tape_stream(stream, pack, h_tape, &error)) {
+		msg_print(mf, MSG_ERROR, _T("Can't read container member: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Check drive feature flag (high features have bit 31 set) */
+static int has_drive_feature(TAPE_GET_DRIVE_PARAMETERS *p_tgdp, DWORD value)
+{
+	return ((value & 0x80000000) ? 
+		(p_tgdp->FeaturesHigh & value) : 
+		(p_tgdp->FeaturesLow & value)) != 0;
+}
+
+/* Set media block size (0 = variable) */
+static int set_media_block_size(struct msg_filter *mf, HANDLE h_tape, DWORD block_size)
+{
+	TAPE_SET_MEDIA_PARAMETERS tsmp;
+	DWORD error;
+
+	tsmp.BlockSize = block_size;
+	if((error = SetTapeParameters(h_tape, SET_TAPE_MEDIA_INFORMATION, &tsmp)) != NO_ERROR) {
+		msg_print(mf, MSG_ERROR, _T("Can't set block size: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		return 0;
+	}
+	return 1;
+}
+
+/* Read one block in variable block mode to learn its length, move back before it and set
+ * matching fixed block size. Block larger than drive allows in fixed mode is read in
+ * variable mode with I/O block of at least its size. */
+static int probe_block_size(struct msg_filter *mf, struct tape_io_ctx *ctx, HANDLE h_tape,
+	TAPE_GET_DRIVE_PARAMETERS *p_tgdp, TAPE_GET_MEDIA_PARAMETERS *p_tgmp,
+	unsigned int *p_min_io_size)
+{
+	OVERLAPPED ov;
+	BYTE *buf;
+	DWORD buf_size, done = 0, error = NO_ERROR, space_type;
+	int move_back = 1;
+	TCHAR fmt_buf[64];
+	int success;
+
+	*p_min_io_size = 0;
+
+	if( !has_drive_feature(p_tgdp, TAPE_DRIVE_VARIABLE_BLOCK) ||
+		!has_drive_feature(p_tgdp, TAPE_DRIVE_SET_BLOCK_SIZE) ||
+		!has_drive_feature(p_tgdp, TAPE_DRIVE_REVERSE_POSITION) )
+	{
+		msg_print(mf, MSG_WARNING,
+			_T("Drive can't switch to variable block mode and back, block size not probed.\n"));
+		return 1;
+	}
+
+	buf_size = (p_tgdp->MaximumBlockSize != 0) ? p_tgdp->MaximumBlockSize : ctx->io_block_size;
+	if((buf = VirtualAlloc(NULL, buf_size, MEM_COMMIT, PAGE_READWRITE)) == NULL) {
+		error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't allocate probe buffer: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		return 0;
+	}
+
+	memset(&ov, 0, sizeof(ov));
+	if((ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL) {
+		error = GetLastError();
+		msg_print(mf, MSG_ERROR, _T("Can't create event: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		VirtualFree(buf, 0, MEM_RELEASE);
+		return 0;
+	}
+
+	msg_print(mf, MSG_VERBOSE, _T("Probing block size...\n"));
+	success = set_media_block_size(mf, h_tape, 0);
+
+	/* Read single block (handle can be opened for overlapped I/O) */
+	if(success && !ReadFile(h_tape, buf, buf_size, &done, &ov)) {
+		error = GetLastError();
+		if((error == ERROR_IO_PENDING) && GetOverlappedResult(h_tape, &ov, &done, TRUE))
+			error = NO_ERROR;
+		else if(error == ERROR_IO_PENDING)
+			error = GetLastError();
+	}
+
+	CloseHandle(ov.hEvent);
+	VirtualFree(buf, 0, MEM_RELEASE);
+
+	if(!success)
+		return 0;
+
+	/* Move back before block or mark */
+	space_type = TAPE_SPACE_RELATIVE_BLOCKS;
+	switch(error)
+	{
+	case NO_ERROR:
+		break;
+	case ERROR_FILEMARK_DETECTED:
+		space_type = TAPE_SPACE_FILEMARKS;
+		break;
+	case ERROR_SETMARK_DETECTED:
+		space_type = TAPE_SPACE_SETMARKS;
+		break;
+	case ERROR_NO_DATA_DETECTED:
+	case ERROR_END_OF_MEDIA:
+		move_back = 0;
+		break;
+	default:
+		msg_print(mf, MSG_ERROR, _T("Can't read block: %s (%u).\n"),
+			msg_winerr(mf, error), error);
+		set_media_block_size(mf, h_tape, p_tgmp->BlockSize);
+		return 0;
+	}
+
+	if(move_back) {
+		error = SetTapePosition(h_tape, space_type, 0, (DWORD)-1, (DWORD)-1, FALSE);
+		if(error != NO_ERROR) {
+			msg_print(mf, MSG_ERROR, _T("Can't move back after probe: %s (%u).\n"),
+				msg_winerr(mf, error), error);
+			set_media_block_size(mf, h_tape, p_tgmp->BlockSize);
+			return 0;
+		}
+	}
+
+	/* No data before mark, keep block size */
+	if((error != NO_ERROR) || (done == 0)) {
+		msg_print(mf, MSG_VERBOSE, _T("No data block found, block size not changed.\n"));
+		return set_media_block_size(mf, h_tape, p_tgmp->BlockSize);
+	}
+
+	/* Set fixed block size if drive allows it, otherwise stay in variable mode. Record of
+	 * I/O block size or larger than drive default (if reported) is likely written in variable block mode
+	 * (last record can be short), so it is read in variable mode too */
+	if( (done >= p_tgdp->MinimumBlockSize) &&
+		((p_tgdp->MaximumBlockSize == 0) || (done <= p_tgdp->MaximumBlockSize)) &&
+		(done < ctx->io_block_size) &&
+		((p_tgdp->DefaultBlockSize == 0) || (done <= p_tgdp->DefaultBlockSize)) )
+	{
+		if(!set_media_block_size(mf, h_tape, done))
+			return 0;
+		p_tgmp->BlockSize = done;
+		msg_print(mf, MSG_VERBOSE, _T("Probed block size: %s, fixed block mode.\n"),
+			fmt_block_size(fmt_buf, done, 1));
+	}
+	else
+	{
+		p_tgmp->BlockSize = 0;
+		*p_min_io_size = done;
+		msg_print(mf, MSG_VERBOSE, _T("Probed block size: %s, variable block mode.\n"),
+			fmt_block_size(fmt_buf, done, 1));
+	}
+
 	return 1;
 }
 
@@ -43,16 +272,36 @@ static int get_tape_info(struct msg_filter *mf, HANDLE h_tape,
 int tape_file_write(struct msg_filter *mf, struct tape_io_ctx *ctx,
 	HANDLE h_tape, const TCHAR *filename)
 {
-	HANDLE h_file;
+	HANDLE h_file = INVALID_HANDLE_VALUE;
+	struct data_gen gen;
+	struct ingest_ring ring;
+	int ring_attached = 0;
+	struct io_stream virt_stream, *src_stream = NULL;
 	unsigned int tape_block_align, tape_block_size;
 	ULARGE_INTEGER file_size;
+	unsigned __int64 padded_size = 0;
+	struct sparse_stream sparse;
+	int use_sparse = 0;
+	DWORD open_flags;
+	struct pack_stream pack;
+	int have_pack = 0;
+	DWORD start_partition, start_low, start_high;
 	TAPE_GET_DRIVE_PARAMETERS drive_info;
 	TAPE_GET_MEDIA_PARAMETERS media_info;
+	struct chunk_manifest manifest;
+	int use_manifest;
+	struct fec_stream fec;
+	struct io_stream fec_io, *dst_stream = NULL;
+	int use_fec = (ctx->fec_parity_blocks != 0);
+	struct crypt_stream crypt;
+	struct io_stream crypt_io;
+	int have_crypt = 0;
+	TCHAR fmt_buf[64], hole_buf[64];
 	DWORD error;
-	int success;
+	int success = 1;
 
 	/* Get tape info */
-	if(!get_tape_info(mf, h_tape, &drive_info, &media_info))
+	if(!get_tape_info(mf, ctx->state, h_tape, &drive_info, &media_info))
 		return 0;
 
 	/* Check for write protection */
@@ -73,56 +322,254 @@ int tape_file_write(struct msg_filter *mf, struct tape_io_ctx *ctx,
 		tape_block_size = ctx->io_block_size;
 	}
 
-	/* Open source file */
-	msg_print(mf, MSG_VERY_VERBOSE,
-		_T("Opening file (\"%s\", GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, 0x%08X)...\n"),
-		filename, ctx->file_open_flags);
-	h_file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ,
-		NULL, OPEN_EXISTING, ctx->file_open_flags, NULL);
-	if(h_file == INVALID_HANDLE_VALUE) {
-		DWORD error = GetLastError();
-		msg_print(mf, MSG_ERROR, _T("Can't open \"%s\": %s (%u).\n"),
-			filename, msg_winerr(mf, error), error);
-		return 0;
+	if(is_datagen_name(filename))
+	{
+		/* Use synthetic data source */
+		if(!datagen_parse(&gen, filename)) {
+			msg_print(mf, MSG_ERROR, _T("Invalid data generator \"%s\". ")
+				_T("Required: gen:<zero/random/comp<N>>:<size>.\n"), filename);
+			return 0;
+		}
+		datagen_stream(&virt_stream, &gen);
+		src_stream = &virt_stream;
+		file_size.QuadPart = gen.size;
 	}
+	else if(is_std_stream_name(filename))
+	{
+		HANDLE h_stdin = GetStdHandle(STD_INPUT_HANDLE);
 
-	/* Get size of file */
-	file_size.LowPart = GetFileSize(h_file, &(file_size.HighPart));
-	if((file_size.LowPart == INVALID_FILE_SIZE) && ((error = GetLastError()) != NO_ERROR))
+		/* Read standard input until end of pipe (size unknown unless redirected from file) */
+		msg_print(mf, MSG_VERY_VERBOSE, _T("Reading data from standard input...\n"));
+		if(!get_std_stream_size(h_stdin, &(file_size.QuadPart)))
+			file_size.QuadPart = 0;
+		pipe_stream(&virt_stream, h_stdin);
+		src_stream = &virt_stream;
+	}
+	else if(is_ingest_name(filename))
 	{
-		msg_print(mf, MSG_ERROR, _T("Can't get size of \"%s\": %s (%u).\n"),
-			filename, msg_winerr(mf, error), error);
-		CloseHandle(h_file);
-		return 0;
+		/* Read data in place from producer's shared memory ring */
+		msg_print(mf, MSG_VERY_VERBOSE, _T("Attaching to ingest ring (\"%s\")...\n"), filename);
+		if(!ingest_ring_attach(&ring, filename, &error)) {
+			msg_print(mf, MSG_ERROR, _T("Can't attach to \"%s\": %s (%u).\n"),
+				filename, msg_winerr(mf, error), error);
+			return 0;
+		}
+		ring_attached = 1;
+		file_size.QuadPart = ring.hdr->total_size;
+		ingest_stream(&virt_stream, &ring);
+		src_stream = &virt_stream;
+	}
+	else if(is_pack_name(filename))
+	{
+		/* Read files named in list as one continuous stream */
+		if(!pack_writer_init(mf, &pack, filename + _tcslen(PACK_PREFIX)))
+			return 0;
+		have_pack = 1;
+		pack_io_stream(&virt_stream, &pack);
+		src_stream = &virt_stream;
+		file_size.QuadPart = pack.total_size;
+	}
+	else
+	{
+		/* Sparse encoder reads granules at arbitrary positions */
+		open_flags = ctx->use_sparse ? FILE_FLAG_SEQUENTIAL_SCAN : ctx->file_open_flags;
+
+		/* Open source file */
+		msg_print(mf, MSG_VERY_VERBOSE,
+			_T("Opening file (\"%s\", GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, 0x%08X)...\n"),
+			filename, open_flags);
+		h_file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ,
+			NULL, OPEN_EXISTING, open_flags, NULL);
+		if(h_file == INVALID_HANDLE_VALUE) {
+			DWORD error = GetLastError();
+			msg_print(mf, MSG_ERROR, _T("Can't open \"%s\": %s (%u).\n"),
+				filename, msg_winerr(mf, error), error);
+			return 0;
+		}
+
+		/* Get size of file */
+		file_size.LowPart = GetFileSize(h_file, &(file_size.HighPart));
+		if((file_size.LowPart == INVALID_FILE_SIZE) && ((error = GetLastError()) != NO_ERROR))
+		{
+			msg_print(mf, MSG_ERROR, _T("Can't get size of \"%s\": %s (%u).\n"),
+				filename, msg_winerr(mf, error), error);
+			CloseHandle(h_file);
+			return 0;
+		}
+
+		/* Encode holes and zero ranges as records (stream size is not known) */
+		if(ctx->use_sparse)
+		{
+			if(!sparse_reader_init(&sparse, h_file, file_size.QuadPart, &error)) {
+				msg_print(mf, MSG_ERROR, _T("Can't initialize sparse encoding: %s (%u).\n"),
+					msg_winerr(mf, error), error);
+				CloseHandle(h_file);
+				return 0;
+			}
+			sparse_io_stream(&virt_stream, &sparse);
+			src_stream = &virt_stream;
+			file_size.QuadPart = 0;
+			use_sparse = 1;
+		}
+	}
+
+	/* Digest chunks of regular files for manifest */
+	use_manifest = ctx->write_manifest && (h_file != INVALID_HANDLE_VALUE) && !use_sparse;
+	memset(&manifest, 0, sizeof(manifest));
+
+	/* Write parity blocks after each group of data blocks, length of last block is stored in its header */
+	if(use_fec)
+	{
+		if(fec_stream_init(&fec, h_tape, tape_block_size, media_info.BlockSize,
+			ctx->fec_data_blocks, ctx->fec_parity_blocks, &error))
+		{
+			fec_io_stream(&fec_io, &fec);
+			dst_stream = &fec_io;
+			tape_block_align = 0;
+		} else {
+			msg_print(mf, MSG_ERROR, _T("Can't initialize error correction: %s (%u).\n"),
+				msg_winerr(mf, error), error);
+			success = 0;
+		}
+	}
+
+	/* Encrypt data in full tape blocks, length of last block is stored in its header */
+	if(success && ctx->use_encryption)
+	{
+		have_crypt = init_crypt_stream(mf, ctx, &crypt, h_tape, dst_stream, tape_block_size);
+		if(have_crypt) {
+			crypt_io_stream(&crypt_io, &crypt);
+			dst_stream = &crypt_io;
+			tape_block_align = 0;
+		} else {
+			success = 0;
+		}
+	}
+
+	/* Remember start of container for mapping members to tape blocks */
+	if(success && have_pack && (ctx->pack_index_file != NULL))
+	{
+		if(use_fec || ctx->use_encryption) {
+			msg_print(mf, MSG_ERROR,
+				_T("Container index can't be written with --fec or --encrypt.\n"));
+			success = 0;
+		} else if((ctx->state != NULL) && ctx->state->have_position) {
+			start_partition = ctx->state->partition;
+			start_low = (DWORD)(ctx->state->block);
+			start_high = (DWORD)(ctx->state->block >> 32);
+		} else if( (error = GetTapePosition(h_tape, TAPE_LOGICAL_POSITION,
+			&start_partition, &start_low, &start_high)) != NO_ERROR )
+		{
+			msg_print(mf, MSG_ERROR, _T("Can't get tape position: %s (%u).\n"),
+				msg_winerr(mf, error), error);
+			success = 0;
+		}
 	}
 
 	/* Write data to tape */
-	success = copy_file(
-		mf,
-		&(ctx->cb), 
-		COPY_SUSTAIN_WRITE,
-		h_tape,
-		ctx->io_queue_size,
-		tape_block_size,
-		tape_block_align,
-		h_file,
-		ctx->io_queue_size,
-		ctx->file_block_size,
-		file_size.QuadPart,
-		ctx->crc_buffer_size,
-		ctx->crc_block_size,
-		NULL,
-		NULL);
-
-	/* Close source file */
-	msg_print(mf, MSG_VERY_VERBOSE, _T("Closing file (\"%s\")...\n"), filename);
-	CloseHandle(h_file);
-
-	/* Clear archive attribute */
 	if(success) {
-		DWORD attr = GetFileAttributes(filename);
-		if((attr != INVALID_FILE_ATTRIBUTES) && (attr & FILE_ATTRIBUTE_ARCHIVE))
-			SetFileAttributes(filename, attr & ~FILE_ATTRIBUTE_ARCHIVE);
+		success = copy_file(
+			mf,
+			&(ctx->cb), 
+			COPY_SUSTAIN_WRITE | (use_manifest ? COPY_MANIFEST_SRC : 0),
+			h_tape,
+			dst_stream,
+			ctx->io_queue_size,
+			tape_block_size,
+			tape_block_align,
+			INVALID_HANDLE_VALUE,
+			h_file,
+			src_stream,
+			ctx->io_queue_size,
+			ctx->file_block_size,
+			file_size.QuadPart,
+			ctx->crc_buffer_size,
+			ctx->crc_block_size,
+			use_manifest ? &manifest : NULL,
+			ctx->stats,
+			ctx->progress_cb,
+			ctx->progress_param,
+			NULL,
+			&padded_size);
+	}
+
+	/* Track position: each write is one record in variable block mode (last one short) */
+	if(ctx->state != NULL)
+	{
+		if(success && ctx->state->have_position && (dst_stream == NULL)) {
+			ctx->state->block += (media_info.BlockSize != 0) ?
+				(padded_size / media_info.BlockSize) :
+				((padded_size + tape_block_size - 1) / tape_block_size);
+			msg_print(mf, MSG_VERBOSE, _T("At block %u.%I64u.\n"),
+				ctx->state->partition, ctx->state->block);
+		} else {
+			ctx->state->have_position = 0;
+		}
+	}
+
+	if(have_crypt)
+	{
+		if(success) {
+			msg_print(mf, MSG_VERBOSE, _T("Encryption: AES-256-GCM, %I64u frames.\n"),
+				crypt.frame_count);
+		}
+		crypt_stream_free(&crypt);
+	}
+
+	if(use_fec)
+	{
+		if(success) {
+			msg_print(mf, MSG_VERBOSE, _T("Error correction: %u+%u blocks per group, %s of parity.\n"),
+				ctx->fec_data_blocks, ctx->fec_parity_blocks,
+				fmt_block_size(fmt_buf, fec.parity_bytes, 1));
+		}
+		fec_stream_free(&fec);
+	}
+
+	if(use_sparse)
+	{
+		if(success) {
+			msg_print(mf, MSG_VERBOSE, _T("Sparse file: %s of data, %s of holes.\n"),
+				fmt_block_size(fmt_buf, sparse.data_bytes, 1),
+				fmt_block_size(hole_buf, sparse.hole_bytes, 1));
+		}
+		sparse_stream_free(&sparse);
+	}
+
+	/* Detach from ingest ring (aborts producer if data not consumed) */
+	if(ring_attached)
+		ingest_ring_close(&ring);
+
+	if(have_pack)
+	{
+		/* Blocks are counted in media block size (fixed) or I/O block size (variable) */
+		if(success && (ctx->pack_index_file != NULL)) {
+			success = pack_save_index(&pack, ctx->pack_index_file, start_partition,
+				((unsigned __int64)start_high << 32) | start_low,
+				(media_info.BlockSize != 0) ? media_info.BlockSize : tape_block_size);
+		}
+		if(success)
+			msg_print(mf, MSG_VERBOSE, _T("Container: %u files.\n"), pack.member_count);
+		pack_stream_free(&pack);
+	}
+
+	if(h_file != INVALID_HANDLE_VALUE)
+	{
+		/* Close source file */
+		msg_print(mf, MSG_VERY_VERBOSE, _T("Closing file (\"%s\")...\n"), filename);
+		CloseHandle(h_file);
+
+		/* Write manifest next to source file */
+		if(success && use_manifest)
+			success = manifest_save(mf, &manifest, filename);
+		manifest_free(&manifest);
+
+		/* Clear archive attribute */
+		if(success) {
+			DWORD attr = GetFileAttributes(filename);
+			if((attr != INVALID_FILE_ATTRIBUTES) && (attr & FILE_ATTRIBUTE_ARCHIVE))
+				SetFileAttributes(filename, attr & ~FILE_ATTRIBUTE_ARCHIVE);
+		}
 	}
 
 	return success;
@@ -132,17 +579,47 @@ int tape_file_write(struct msg_filter *mf, struct tape_io_ctx *ctx,
 int tape_file_read(struct msg_filter *mf, struct tape_io_ctx *ctx,
 	HANDLE h_tape, const TCHAR *filename)
 {
-	HANDLE h_file;
+	HANDLE h_file = INVALID_HANDLE_VALUE, h_tail = INVALID_HANDLE_VALUE;
+	struct io_stream virt_stream, *dst_stream = NULL;
 	unsigned int tape_block_size;
 	TAPE_GET_DRIVE_PARAMETERS drive_info;
 	TAPE_GET_MEDIA_PARAMETERS media_info;
 	unsigned __int64 data_size, padded_size;
-	int success;
+	struct sparse_stream sparse;
+	int use_sparse = 0;
+	DWORD open_flags;
+	TCHAR fmt_buf[64], hole_buf[64];
+	struct pack_stream pack;
+	struct io_stream pack_io;
+	int have_pack = 0;
+	struct chunk_manifest manifest;
+	int use_manifest;
+	struct fec_stream fec;
+	struct io_stream fec_io, *src_stream = NULL;
+	int use_fec = (ctx->fec_parity_blocks != 0);
+	struct crypt_stream crypt;
+	struct io_stream crypt_io;
+	int have_crypt = 0;
+	DWORD error;
+	unsigned int min_io_size = 0;
+	int success = 1;
 
 	/* Get tape info */
-	if(!get_tape_info(mf, h_tape, &drive_info, &media_info))
+	if(!get_tape_info(mf, ctx->state, h_tape, &drive_info, &media_info))
 		return 0;
 
+	/* Learn block size from first block */
+	if(ctx->probe_block_size)
+	{
+		if(!probe_block_size(mf, ctx, h_tape, &drive_info, &media_info, &min_io_size)) {
+			if(ctx->state != NULL)
+				ctx->state->have_info = ctx->state->have_position = 0;
+			return 0;
+		}
+		if(ctx->state != NULL)
+			ctx->state->media.BlockSize = media_info.BlockSize;
+	}
+
 	/* Set I/O block size */
 	if(media_info.BlockSize > 0) {
 		tape_block_size = ((ctx->io_block_size + media_info.BlockSize - 1) / 
@@ -153,37 +630,174 @@ int tape_file_read(struct msg_filter *mf, struct tape_io_ctx *ctx,
 	} else {
 		tape_block_size = ctx->io_block_size;
 	}
+	if(tape_block_size < min_io_size)
+		tape_block_size = min_io_size;
 
-	/* Create output file */
-	msg_print(mf, MSG_VERY_VERBOSE,
-		_T("Creating file (\"%s\", GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS, 0x%08X)...\n"),
-		filename, ctx->file_open_flags);
-	h_file = CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ,
-		NULL, CREATE_ALWAYS, ctx->file_open_flags, NULL);
-	if(h_file == INVALID_HANDLE_VALUE) {
-		DWORD error = GetLastError();
-		msg_print(mf, MSG_ERROR, _T("Can't create \"%s\": %s (%u).\n"),
-			filename, msg_winerr(mf, error), error);
-		return 0;
+	if(is_null_sink_name(filename))
+	{
+		/* Discard data */
+		null_sink_stream(&virt_stream);
+		dst_stream = &virt_stream;
+	}
+	else if(is_std_stream_name(filename))
+	{
+		/* Write data to standard output */
+		msg_print(mf, MSG_VERY_VERBOSE, _T("Writing data to standard output...\n"));
+		pipe_stream(&virt_stream, GetStdHandle(STD_OUTPUT_HANDLE));
+		dst_stream = &virt_stream;
+	}
+	else if(is_pack_name(filename))
+	{
+		/* Extract container members to directory */
+		if(!pack_reader_init(mf, &pack, filename + _tcslen(PACK_PREFIX), ctx->pack_member))
+			return 0;
+		have_pack = 1;
+		pack_io_stream(&virt_stream, &pack);
+		dst_stream = &virt_stream;
+
+		/* Read single member */
+		if(ctx->pack_member != NULL) {
+			success = seek_pack_member(mf, ctx, &pack, h_tape, &pack_io);
+			src_stream = &pack_io;
+		}
+	}
+	else
+	{
+		/* Sparse decoder writes unaligned data records and skips holes */
+		open_flags = ctx->use_sparse ? 0 : ctx->file_open_flags;
+
+		/* Create output file */
+		msg_print(mf, MSG_VERY_VERBOSE,
+			_T("Creating file (\"%s\", GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, CREATE_ALWAYS, 0x%08X)...\n"),
+			filename, open_flags);
+		h_file = CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE,
+			NULL, CREATE_ALWAYS, open_flags, NULL);
+		if(h_file == INVALID_HANDLE_VALUE) {
+			DWORD error = GetLastError();
+			msg_print(mf, MSG_ERROR, _T("Can't create \"%s\": %s (%u).\n"),
+				filename, msg_winerr(mf, error), error);
+			return 0;
+		}
+
+		/* Write unaligned end of data through buffered handle, so file isn't padded and
+		 * doesn't need to be reopened for trimming (tail of short last tape record) */
+		if(!ctx->use_sparse && (ctx->file_block_align > 1))
+		{
+			msg_print(mf, MSG_VERY_VERBOSE,
+				_T("Opening file (\"%s\", GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, OPEN_EXISTING, 0)...\n"),
+				filename);
+			h_tail = CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE,
+				NULL, OPEN_EXISTING, 0, NULL);
+		}
+
+		/* Restore holes from records */
+		if(ctx->use_sparse) {
+			sparse_writer_init(&sparse, h_file);
+			sparse_io_stream(&virt_stream, &sparse);
+			dst_stream = &virt_stream;
+			use_sparse = 1;
+		}
+	}
+
+	/* Digest chunks of output file for manifest */
+	use_manifest = ctx->write_manifest && (dst_stream == NULL);
+	memset(&manifest, 0, sizeof(manifest));
+
+	/* Rebuild blocks with media errors from parity */
+	if(use_fec)
+	{
+		if(fec_stream_init(&fec, h_tape, tape_block_size, media_info.BlockSize,
+			ctx->fec_data_blocks, ctx->fec_parity_blocks, &error))
+		{
+			fec_io_stream(&fec_io, &fec);
+			src_stream = &fec_io;
+		} else {
+			msg_print(mf, MSG_ERROR, _T("Can't initialize error correction: %s (%u).\n"),
+				msg_winerr(mf, error), error);
+			success = 0;
+		}
+	}
+
+	/* Decrypt and authenticate data */
+	if(success && ctx->use_encryption)
+	{
+		have_crypt = init_crypt_stream(mf, ctx, &crypt, h_tape, src_stream, tape_block_size);
+		if(have_crypt) {
+			crypt_io_stream(&crypt_io, &crypt);
+			src_stream = &crypt_io;
+		} else {
+			success = 0;
+		}
 	}
 
 	/* Read data from file */
-	success = copy_file(
-		mf,
-		&(ctx->cb),
-		COPY_SUSTAIN_READ|COPY_NO_PADDING_INFO,
-		h_file,
-		ctx->io_queue_size,
-		ctx->file_block_size,
-		ctx->file_block_align,
-		h_tape,
-		ctx->io_queue_size,
-		tape_block_size,
-		0,
-		ctx->crc_buffer_size,
-		ctx->crc_block_size,
-		&data_size,
-		&padded_size);
+	if(success) {
+		success = copy_file(
+			mf,
+			&(ctx->cb),
+			COPY_SUSTAIN_READ|COPY_NO_PADDING_INFO | (use_manifest ? COPY_MANIFEST_DST : 0),
+			h_file,
+			dst_stream,
+			ctx->io_queue_size,
+			ctx->file_block_size,
+			(dst_stream != NULL) ? 0 : ctx->file_block_align,
+			h_tail,
+			h_tape,
+			src_stream,
+			ctx->io_queue_size,
+			tape_block_size,
+			0,
+			ctx->crc_buffer_size,
+			ctx->crc_block_size,
+			use_manifest ? &manifest : NULL,
+			ctx->stats,
+			ctx->progress_cb,
+			ctx->progress_param,
+			&data_size,
+			&padded_size);
+	}
+
+	if(have_crypt)
+	{
+		if(crypt.auth_failed) {
+			msg_print(mf, MSG_ERROR,
+				_T("Encrypted data authentication failed: wrong key or damaged data.\n"));
+		}
+		crypt_stream_free(&crypt);
+	}
+
+	if(use_fec)
+	{
+		if(fec.rebuilt_blocks != 0) {
+			msg_print(mf, MSG_WARNING, _T("Error correction: %u unreadable block%s rebuilt.\n"),
+				fec.rebuilt_blocks, (fec.rebuilt_blocks == 1) ? _T("") : _T("s"));
+		}
+		fec_stream_free(&fec);
+	}
+
+	if(use_sparse)
+	{
+		if(success) {
+			msg_print(mf, MSG_VERBOSE, _T("Sparse file: %s of data, %s of holes.\n"),
+				fmt_block_size(fmt_buf, sparse.data_bytes, 1),
+				fmt_block_size(hole_buf, sparse.hole_bytes, 1));
+		}
+		sparse_stream_free(&sparse);
+	}
+
+	if(have_pack)
+	{
+		if(success)
+			msg_print(mf, MSG_VERBOSE, _T("Container: %u files extracted.\n"), pack.extracted);
+		pack_stream_free(&pack);
+	}
+
+	/* Nothing to trim or delete when writing to stream */
+	if(h_file == INVALID_HANDLE_VALUE)
+		return success;
+
+	if(h_tail != INVALID_HANDLE_VALUE)
+		CloseHandle(h_tail);
 
 	/* Truncated padded output file */
 	if(success && (data_size < padded_size))
@@ -228,6 +842,15 @@ int tape_file_read(struct msg_filter *mf, struct tape_io_ctx *ctx,
 		CloseHandle(h_file);
 	}
 
+	/* Write manifest next to output file */
+	if(success && use_manifest)
+		success = manifest_save(mf, &manifest, filename);
+	manifest_free(&manifest);
+
+	/* Reading stops after filemark or at end of data, blocks passed are not counted */
+	if(ctx->state != NULL)
+		ctx->state->have_position = 0;
+
 	/* Ask to delete invalid output file */
 	if(!success && !prompt(_T("Would you like to keep the output file?"), 0)) {
 		msg_print(mf, MSG_VERY_VERBOSE, _T("Deleting the file (\"%s\")...\n"), filename);
@@ -239,11 +862,107 @@ int tape_file_read(struct msg_filter *mf, struct tape_io_ctx *ctx,
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Get automatic memory budget from available physical memory */
+unsigned __int64 tape_io_auto_mem_budget(void)
+{
+	MEMORYSTATUSEX ms;
+
+	ms.dwLength = sizeof(ms);
+	if(!GlobalMemoryStatusEx(&ms))
+		return DEFAULT_BUFFER_SIZE;
+
+	return ms.ullAvailPhys / MEM_BUDGET_AUTO_DIVISOR;
+}
+
+/* Divide memory budget between data buffer, I/O queues and CRC buffers */
+static int plan_mem_budget(struct msg_filter *mf, unsigned __int64 mem_budget,
+	unsigned int io_block_size, unsigned __int64 *p_buffer_size,
+	unsigned int *p_io_queue_size, unsigned int *p_crc_buffer_size)
+{
+	unsigned __int64 budget, io_size, max_queue, max_crc, buffer_size;
+	unsigned int slab_stride;
+	TCHAR fmt_buf1[64], fmt_buf2[64], fmt_buf3[64], fmt_buf4[64];
+	int is_auto;
+
+	is_auto = (mem_budget == MEM_BUDGET_AUTO);
+	budget = is_auto ? tape_io_auto_mem_budget() : mem_budget;
+
+	/* Limit in-flight I/O of source and destination threads (async mode kept) */
+	slab_stride = (io_block_size + 0x0FFF) & ~0x0FFF;
+	if(*p_io_queue_size != 0)
+	{
+		max_queue = budget / MEM_BUDGET_IO_DIVISOR / (2 * (unsigned __int64)slab_stride);
+		if(max_queue == 0)
+			max_queue = 1;
+		if(*p_io_queue_size > max_queue)
+			*p_io_queue_size = (unsigned int)max_queue;
+	}
+	io_size = 2 * (unsigned __int64)slab_stride * ((*p_io_queue_size != 0) ? *p_io_queue_size : 1);
+
+	/* Limit CRC buffers (must hold at least two blocks) */
+	max_crc = budget / MEM_BUDGET_CRC_DIVISOR;
+	if(max_crc < 2 * (unsigned __int64)io_block_size)
+		max_crc = 2 * (unsigned __int64)io_block_size;
+	if(max_crc < MIN_CRC_BUFFER)
+		max_crc = MIN_CRC_BUFFER;
+	if(*p_crc_buffer_size > max_crc)
+		*p_crc_buffer_size = (unsigned int)max_crc;
+
+	/* Give the rest to data buffer */
+	buffer_size = 0;
+	if(budget > io_size + 2 * (unsigned __int64)(*p_crc_buffer_size))
+		buffer_size = budget - io_size - 2 * (unsigned __int64)(*p_crc_buffer_size);
+	if(is_auto && (buffer_size > MAX_HEAP_BUFFER_SIZE))
+		buffer_size = MAX_HEAP_BUFFER_SIZE;
+	buffer_size -= buffer_size % io_block_size;
+
+	if( (buffer_size < MIN_BUFFER_SIZE) ||
+		(buffer_size < MIN_BUFFER_BLOCKS * (unsigned __int64)io_block_size) )
+	{
+		msg_print(mf, MSG_ERROR, _T("Memory budget of %s is too small for %s I/O blocks.\n"),
+			fmt_block_size(fmt_buf1, budget, 1), fmt_block_size(fmt_buf2, io_block_size, 1));
+		return 0;
+	}
+
+	msg_print(mf, MSG_VERBOSE,
+		_T("Memory budget %s: buffer %s, I/O queues 2x%u blocks (%s), CRC buffers 2x%s.\n"),
+		fmt_block_size(fmt_buf1, budget, 1), fmt_block_size(fmt_buf2, buffer_size, 1),
+		*p_io_queue_size, fmt_block_size(fmt_buf3, io_size, 1),
+		fmt_block_size(fmt_buf4, *p_crc_buffer_size, 1));
+
+	*p_buffer_size = buffer_size;
+	return 1;
+}
+
 /* Initialize buffer for reading/writing to tape */
 int tape_io_init_buffer(struct msg_filter *mf, struct tape_io_ctx *ctx,
 	unsigned __int64 buffer_size, unsigned int io_block_size, unsigned int io_queue_size,
-	int use_windows_buffering)
+	int use_windows_buffering, int prefault, unsigned __int64 mem_budget)
 {
+	unsigned int crc_buffer_size;
+
+	/* Choose crc buffer size about 1/4 I/O queue */
+	if(io_queue_size == 0) {
+		crc_buffer_size = io_block_size * 4;
+	} else {
+		unsigned int crc_blocks = io_queue_size / 4;
+		if(crc_blocks < 4) crc_blocks = 4;
+		if(crc_blocks > 64) crc_blocks = 64;
+		crc_buffer_size = crc_blocks * io_block_size;
+	}
+	if(crc_buffer_size < MIN_CRC_BUFFER)
+		crc_buffer_size = MIN_CRC_BUFFER;
+	if(crc_buffer_size > MAX_CRC_BUFFER)
+		crc_buffer_size = MAX_CRC_BUFFER;
+
+	/* Size buffers from memory budget */
+	if( (mem_budget != 0) &&
+		!plan_mem_budget(mf, mem_budget, io_block_size,
+			&buffer_size, &io_queue_size, &crc_buffer_size) )
+	{
+		return 0;
+	}
+
 	/* Allocate buffer */
 	if(buffer_size <= MAX_HEAP_BUFFER_SIZE)
 	{
@@ -252,7 +971,7 @@ int tape_io_init_buffer(struct msg_filter *mf, struct tape_io_ctx *ctx,
 		ctx->lock_pages_prev_state = 0;
 
 		/* Allocate buffer in virutal memory */
-		if(!bigbuf_init(mf, &(ctx->cb), 1, buffer_size, 0))
+		if(!bigbuf_init(mf, &(ctx->cb), 1, buffer_size, 0, prefault))
 			return 0;
 	}
 	else
@@ -271,7 +990,7 @@ int tape_io_init_buffer(struct msg_filter *mf, struct tape_io_ctx *ctx,
 		}
 
 		/* Allocate buffer in userpages */
-		if(!bigbuf_init(mf, &(ctx->cb), 0, buffer_size, PAGE_MAPPING_WINDOW_SIZE))
+		if(!bigbuf_init(mf, &(ctx->cb), 0, buffer_size, PAGE_MAPPING_WINDOW_SIZE, 0))
 		{
 			if(!ctx->lock_pages_prev_state)
 				set_privilegy(SE_LOCK_MEMORY_NAME, 0, NULL, &error);
@@ -292,20 +1011,15 @@ int tape_io_init_buffer(struct msg_filter *mf, struct tape_io_ctx *ctx,
 	if(io_queue_size != 0)
 		ctx->file_open_flags |= FILE_FLAG_OVERLAPPED;
 
-	/* Choose crc buffer size about 1/4 I/O queue */
+	/* CRC buffering */
 	ctx->crc_block_size = CRC_BLOCK_SIZE;
-	if(ctx->io_queue_size == 0) {
-		ctx->crc_buffer_size = io_block_size * 4;
-	} else {
-		unsigned int crc_blocks = io_queue_size / 4;
-		if(crc_blocks < 4) crc_blocks = 4;
-		if(crc_blocks > 64) crc_blocks = 64;
-		ctx->crc_buffer_size = crc_blocks * io_block_size;
-	}
-	if(ctx->crc_buffer_size < MIN_CRC_BUFFER)
-		ctx->crc_buffer_size = MIN_CRC_BUFFER;
-	if(ctx->crc_buffer_size > MAX_CRC_BUFFER)
-		ctx->crc_buffer_size = MAX_CRC_BUFFER;
+	ctx->crc_buffer_size = crc_buffer_size;
+
+	/* Statistics slot and state cache set by caller */
+	ctx->state = NULL;
+	ctx->stats = NULL;
+	ctx->progress_cb = NULL;
+	ctx->progress_param = NULL;
 
 	return 1;
 }
@@ -316,6 +1030,7 @@ int tape_io_init_buffer(struct msg_filter *mf, struct tape_io_ctx *ctx,
 void tape_io_cleanup(struct tape_io_ctx *ctx)
 {
 	bigbuf_free(&(ctx->cb));
+	memset(ctx->crypt_key, 0, sizeof(ctx->crypt_key));
 
 	if(ctx->lock_pages_changed && !ctx->lock_pages_prev_state)
 	{
@@ -2,11 +2,28 @@
 
 #pragma once
 
+#include "aesgcm.h"
 #include "bigbuff.h"
+#include "filecopy.h"
+#include "statshm.h"
 #include "../util/msgfilt.h"
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Drive state cached between operations. Parameters are taken from drive and media information
+ * queried when drive opened, position is tracked from results of completed operations. Both are
+ * invalidated on errors and on operations with unknown effect, and queried again when needed. */
+struct tape_state
+{
+	int have_info;						/* drive and media parameters are valid */
+	TAPE_GET_DRIVE_PARAMETERS drive;
+	TAPE_GET_MEDIA_PARAMETERS media;
+
+	int have_position;					/* partition and block are valid */
+	DWORD partition;					/* 0 if drive supports single partition */
+	unsigned __int64 block;				/* Logical block (tape marks count as blocks) */
+};
+
 struct tape_io_ctx
 {
 	int lock_pages_changed;
@@ -24,6 +41,21 @@ struct tape_io_ctx
 
 	unsigned int crc_block_size;
 	unsigned int crc_buffer_size;
+
+	int write_manifest;					/* Write chunk digest manifest next to files */
+	int use_sparse;						/* Encode holes of files as sparse records */
+	int probe_block_size;				/* Learn block size from first block on read */
+	const TCHAR *pack_index_file;		/* Container member to tape block index */
+	const TCHAR *pack_member;			/* Read single container member */
+	unsigned int fec_data_blocks;		/* FEC group layout (0 = no parity blocks) */
+	unsigned int fec_parity_blocks;
+	int use_encryption;					/* Encrypt tape data with crypt_key */
+	BYTE crypt_key[AES256_KEY_SIZE];
+
+	struct tape_state *state;			/* Cached drive state (NULL = query for each file) */
+	struct stats_slot *stats;			/* Shared statistics slot (can be NULL) */
+	copy_progress_cb progress_cb;		/* Transfer progress callback (can be NULL) */
+	void *progress_param;
 };
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -39,7 +71,11 @@ int tape_file_read(struct msg_filter *mf, struct tape_io_ctx *ctx,
 /* Initialize buffer for reading/writing to tape */
 int tape_io_init_buffer(struct msg_filter *mf, struct tape_io_ctx *ctx,
 	unsigned __int64 buffer_size, unsigned int io_block_size, unsigned int io_queue_size,
-	int use_windows_buffering);
+	int use_windows_buffering, int prefault,
+	unsigned __int64 mem_budget);		/* total memory for buffers (0 = use sizes above) */
+
+/* Get automatic memory budget from available physical memory */
+unsigned __int64 tape_io_auto_mem_budget(void);
 
 /* Free buffer */
 void tape_io_cleanup(struct tape_io_ctx *ctx);
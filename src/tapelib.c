@@ -0,0 +1,513 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#include <windows.h>
+#include <process.h>
+#include <string.h>
+#include <tchar.h>
+#include "cmdcheck.h"
+#include "cmdexec.h"
+#include "cmdplan.h"
+#include "drvinfo.h"
+#include "tapelib.h"
+#include "tapeio/crypt.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Initialize session with device and buffer settings (device not opened yet) */
+void tape_session_init(struct tape_session *s, struct msg_filter *mf,
+	const struct cmd_line_args *settings)
+{
+	memset(s, 0, sizeof(struct tape_session));
+
+	s->mf = mf;
+	_tcscpy(s->tape_device, settings->tape_device);
+	s->h_tape = INVALID_HANDLE_VALUE;
+	s->use_windows_buffering = (settings->flags & MODE_WINDOWS_BUFFERING) ? 1 : 0;
+
+	s->buffer_size = settings->buffer_size;
+	s->io_block_size = settings->io_block_size;
+	s->io_queue_size = settings->io_queue_size;
+	s->mem_budget = settings->mem_budget;
+	s->prefault = (settings->flags & MODE_PREFAULT) ? 1 : 0;
+}
+
+/* Open tape device */
+int tape_session_open(struct tape_session *s)
+{
+	unsigned int open_flags = 0;
+
+	/* Open device */
+	if(!s->use_windows_buffering)
+		open_flags |= FILE_FLAG_NO_BUFFERING;
+	if(s->io_queue_size != 0)
+		open_flags |= FILE_FLAG_OVERLAPPED;
+	msg_print(s->mf, MSG_VERY_VERBOSE,
+		_T("Opening device (\"%s\", GENERIC_READ|GENERIC_WRITE, 0, OPEN_EXISTING, 0x%08X)\n"),
+		s->tape_device, open_flags);
+	s->h_tape = CreateFile(s->tape_device, GENERIC_READ|GENERIC_WRITE,
+		0, NULL, OPEN_EXISTING, open_flags, NULL);
+
+	/* Check for errors */
+	if(s->h_tape == INVALID_HANDLE_VALUE)
+	{
+		DWORD error = GetLastError();
+		switch(error)
+		{
+		case ERROR_FILE_NOT_FOUND:
+			msg_print(s->mf, MSG_ERROR, _T("Can't open \"%s\": device not found!\n"),
+				s->tape_device);
+			break;
+		case ERROR_ACCESS_DENIED:
+			msg_print(s->mf, MSG_ERROR, _T("Can't open \"%s\": access denied!\n"),
+				s->tape_device);
+			break;
+		case ERROR_SHARING_VIOLATION:
+			msg_print(s->mf, MSG_ERROR, _T("Can't open \"%s\": locked by another program!\n"),
+				s->tape_device);
+			break;
+		default:
+			msg_print(s->mf, MSG_ERROR, _T("Can't open \"%s\": %s (%u).\n"),
+				s->tape_device, msg_winerr(s->mf, error), error);
+			break;
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Query drive and media information (missing media is not an error) */
+int tape_session_query_info(struct tape_session *s)
+{
+	DWORD size, error;
+	int success = 1;
+
+	s->have_drive_info = 0;
+
+	/* Get drive information */
+	msg_print(s->mf, MSG_VERY_VERBOSE, _T("Querying drive information...\n"));
+	size = sizeof(s->drive);
+	error = GetTapeParameters(s->h_tape, GET_TAPE_DRIVE_INFORMATION, &size, &(s->drive));
+	if(error == 0) {
+		s->have_drive_info = 1;
+	} else {
+		msg_print(s->mf, MSG_ERROR, _T("Can't get drive information: %s (%u).\n"),
+			msg_winerr(s->mf, error), error);
+		success = 0;
+	}
+
+	if(!tape_session_query_media(s))
+		success = 0;
+
+	return success;
+}
+
+/* Wait until rewind or load started in immediate mode completes */
+static void session_wait_ready(struct tape_session *s)
+{
+	DWORD begin, error;
+
+	if(!s->motion_pending)
+		return;
+	s->motion_pending = 0;
+
+	msg_print(s->mf, MSG_VERY_VERBOSE, _T("Waiting for drive to become ready...\n"));
+	begin = GetTickCount();
+	for(;;)
+	{
+		error = GetTapeStatus(s->h_tape);
+		if( ((error != ERROR_BUSY) && (error != ERROR_NOT_READY)) ||
+			(GetTickCount() - begin >= SESSION_READY_TIMEOUT) )
+		{
+			break;
+		}
+		Sleep(SESSION_READY_POLL_INTERVAL);
+	}
+}
+
+/* Query media information only (media can be changed between jobs) */
+int tape_session_query_media(struct tape_session *s)
+{
+	DWORD size, error;
+
+	session_wait_ready(s);
+
+	s->have_media_info = 0;
+	s->media_queried = 1;
+
+	/* Get media information */
+	msg_print(s->mf, MSG_VERY_VERBOSE, _T("Querying media information...\n"));
+	size = sizeof(s->media);
+	error = GetTapeParameters(s->h_tape, GET_TAPE_MEDIA_INFORMATION, &size, &(s->media));
+	if(error == 0) {
+		s->have_media_info = 1;
+	} else if(error != ERROR_NO_MEDIA_IN_DRIVE) {
+		msg_print(s->mf, MSG_ERROR, _T("Can't get media information: %s (%u).\n"),
+			msg_winerr(s->mf, error), error);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* List drive and media information (-i) */
+void tape_session_list_info(struct tape_session *s, struct cmd_line_args *job)
+{
+	if(!s->have_drive_info)
+		return;
+
+	msg_print(s->mf, MSG_VERBOSE, _T("\n"));
+	list_drive_info(s->mf, &(s->drive),
+		job->flags & MODE_VERBOSE,
+		job->flags & MODE_VERY_VERBOSE);
+
+	if(s->have_media_info) {
+		msg_print(s->mf, MSG_MESSAGE, _T("\n"));
+		list_media_info(s->mf, &(s->drive), &(s->media));
+	} else {
+		msg_print(s->mf, MSG_MESSAGE, _T("\nNo media loaded.\n"));
+	}
+	if((job->op_count != 0) && !(job->flags & MODE_SHOW_OPERATIONS))
+		msg_print(s->mf, MSG_MESSAGE, _T("\n"));
+}
+
+/* Set output for messages of next jobs */
+void tape_session_set_output(struct tape_session *s, struct msg_filter *mf)
+{
+	s->mf = mf;
+}
+
+/* Set transfer progress callback for next jobs (can be NULL) */
+void tape_session_set_progress(struct tape_session *s, copy_progress_cb progress_cb, void *param)
+{
+	s->progress_cb = progress_cb;
+	s->progress_param = param;
+
+	if(s->have_io_buffer) {
+		s->io_ctx.progress_cb = progress_cb;
+		s->io_ctx.progress_param = param;
+	}
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Check job operations list and get confirmation if needed */
+int tape_session_check(struct tape_session *s, struct cmd_line_args *job)
+{
+	if(job->flags & MODE_OPTIMIZE)
+		plan_tape_operations(s->mf, job, s->have_drive_info ? &(s->drive) : NULL);
+
+	return check_tape_operations(s->mf, job, s->h_tape,
+		s->have_drive_info ? &(s->drive) : NULL,
+		s->have_media_info ? &(s->media) : NULL);
+}
+
+/* Allocate data buffer and attach statistics and progress callback */
+static int session_alloc_buffer(struct tape_session *s, struct msg_filter *mf)
+{
+	if(!tape_io_init_buffer(mf, &(s->io_ctx), s->buffer_size,
+		s->io_block_size, s->io_queue_size, s->use_windows_buffering, s->prefault,
+		s->mem_budget))
+	{
+		return 0;
+	}
+
+	s->io_ctx.state = &(s->state);
+	s->io_ctx.stats = s->use_stats ? s->stats.slot : NULL;
+	s->io_ctx.progress_cb = s->progress_cb;
+	s->io_ctx.progress_param = s->progress_param;
+
+	return 1;
+}
+
+/* Allocate data buffer on first use */
+static int session_init_buffer(struct tape_session *s)
+{
+	if(s->have_io_buffer)
+		return 1;
+
+	if(!session_alloc_buffer(s, s->mf))
+		return 0;
+	s->have_io_buffer = 1;
+
+	return 1;
+}
+
+/* Buffer allocation running in background */
+struct buffer_alloc
+{
+	struct tape_session *s;
+	struct msg_filter mf;				/* Messages shown after join */
+	HANDLE h_thread;
+	int success;
+};
+
+static unsigned int __stdcall buffer_alloc_thread(struct buffer_alloc *alloc)
+{
+	alloc->success = session_alloc_buffer(alloc->s, &(alloc->mf));
+	return 0;
+}
+
+/* Start allocating data buffer while tape is positioned (0 if thread not started) */
+static int session_start_buffer(struct tape_session *s, struct buffer_alloc *alloc)
+{
+	unsigned int thread_id;
+
+	alloc->s = s;
+	alloc->success = 0;
+
+	msg_init(&(alloc->mf));
+	alloc->mf.stream = s->mf->stream;
+	alloc->mf.report_level = s->mf->report_level;
+	alloc->mf.prefix = s->mf->prefix;
+	alloc->mf.defer = 1;
+
+	alloc->h_thread = (HANDLE) _beginthreadex(NULL, 0,
+		buffer_alloc_thread, alloc, 0, &thread_id);
+	if(alloc->h_thread == NULL) {
+		msg_free(&(alloc->mf));
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Wait for background allocation and show its messages */
+static int session_join_buffer(struct tape_session *s, struct buffer_alloc *alloc)
+{
+	WaitForSingleObject(alloc->h_thread, INFINITE);
+	CloseHandle(alloc->h_thread);
+	alloc->h_thread = NULL;
+
+	alloc->mf.defer = 0;
+	msg_flush(&(alloc->mf));
+	msg_free(&(alloc->mf));
+
+	if(!alloc->success)
+		return 0;
+	s->have_io_buffer = 1;
+
+	return 1;
+}
+
+/* Load encryption key of job */
+static int session_load_key(struct tape_session *s, struct cmd_line_args *job)
+{
+	DWORD error;
+
+	memset(s->io_ctx.crypt_key, 0, sizeof(s->io_ctx.crypt_key));
+	s->io_ctx.use_encryption = 0;
+
+	if(job->key_file == NULL)
+		return 1;
+
+	if(!crypt_load_key(job->key_file, s->io_ctx.crypt_key, &error)) {
+		msg_print(s->mf, MSG_ERROR, _T("Can't load encryption key from \"%s\": %s (%u).\n"),
+			job->key_file, msg_winerr(s->mf, error), error);
+		return 0;
+	}
+	s->io_ctx.use_encryption = 1;
+
+	return 1;
+}
+
+/* Execute job operations list */
+int tape_session_run(struct tape_session *s, struct cmd_line_args *job)
+{
+	struct msg_filter *mf = s->mf;
+	unsigned int op_index, op_remaining;
+	struct tape_operation *op, *data_op;
+	struct buffer_alloc alloc;
+	DWORD error;
+	int success = 1;
+
+	/* Publish progress for tapectl --monitor */
+	if(!s->use_stats)
+	{
+		if(stats_shm_open(&(s->stats), s->tape_device, &error)) {
+			s->use_stats = 1;
+		} else {
+			msg_print(mf, MSG_VERY_VERBOSE, _T("Can't publish statistics: %s (%u).\n"),
+				msg_winerr(mf, error), error);
+		}
+	}
+
+	/* Drive and media information is already known when media was queried for this job
+	 * (otherwise it is queried on first use), position is learned during job */
+	s->state.have_info = s->have_drive_info && s->have_media_info && s->media_queried;
+	s->state.drive = s->drive;
+	s->state.media = s->media;
+	s->state.have_position = 0;
+	s->media_queried = 0;
+
+	/* Allocate data buffer for read/write operations. When operations before first
+	 * transfer position tape, buffer is allocated by thread meanwhile */
+	alloc.h_thread = NULL;
+	data_op = NULL;
+	for(op = job->op_list; op != NULL; op = op->next)
+	{
+		if( (op->code == OP_READ_DATA) ||
+			(op->code == OP_WRITE_DATA) ||
+			(op->code == OP_WRITE_DATA_AND_FMK) )
+		{
+			if( (s->have_io_buffer) ||
+				(op == job->op_list) ||
+				(!session_start_buffer(s, &alloc)) )
+			{
+				if(!session_init_buffer(s))
+					return 0;
+			}
+			s->io_ctx.write_manifest = (job->flags & MODE_MANIFEST) ? 1 : 0;
+			s->io_ctx.use_sparse = (job->flags & MODE_SPARSE) ? 1 : 0;
+			s->io_ctx.probe_block_size = (job->flags & MODE_PROBE_BLOCK) ? 1 : 0;
+			s->io_ctx.pack_index_file = job->pack_index_file;
+			s->io_ctx.pack_member = job->pack_member;
+			s->io_ctx.fec_data_blocks = job->fec_data_blocks;
+			s->io_ctx.fec_parity_blocks = job->fec_parity_blocks;
+			if(!session_load_key(s, job)) {
+				if(alloc.h_thread != NULL)
+					session_join_buffer(s, &alloc);
+				return 0;
+			}
+			data_op = op;
+			break;
+		}
+	}
+
+	/* Execute operations */
+	if(job->op_count > 1) {
+		msg_print(mf,
+			(job->flags & MODE_SHOW_OPERATIONS) ? MSG_MESSAGE : MSG_VERBOSE,
+			_T("\nExecuting %u operations...\n"), job->op_count);
+	}
+
+	op_index = 0;
+	for(op = job->op_list; op != NULL; op = op->next)
+	{
+		/* Buffer must be ready before first transfer */
+		if( (op == data_op) && (alloc.h_thread != NULL) &&
+			(!session_join_buffer(s, &alloc)) )
+		{
+			success = 0;
+			break;
+		}
+
+		/* Drive may be still moving after previous operation */
+		session_wait_ready(s);
+
+		/* Print operation number */
+		if(job->op_count >= 10) {
+			msg_print(mf, MSG_INFO, _T("[%2u/%2u] "), op_index + 1, job->op_count);
+		} else if(job->op_count >= 2) {
+			msg_print(mf, MSG_INFO, _T("[%u/%u] "), op_index + 1, job->op_count);
+		}
+
+		/* Publish current operation */
+		if(s->use_stats) {
+			stats_slot_set_operation(s->stats.slot,
+				(op->code == OP_READ_DATA) ? STATS_STATE_READING :
+				((op->code == OP_WRITE_DATA) || (op->code == OP_WRITE_DATA_AND_FMK)) ?
+					STATS_STATE_WRITING : STATS_STATE_EXECUTING,
+				op_index, job->op_count, op->filename);
+		}
+
+		/* Execute operation */
+		if( ! tape_operation_execute(
+			mf,
+			s->have_io_buffer ? &(s->io_ctx) : NULL,
+			op,
+			s->h_tape,
+			s->have_drive_info ? &(s->drive) : NULL,
+			&(s->state),
+			(job->flags & MODE_IMMEDIATE) ? 1 : 0) )
+		{
+			success = 0;
+			break;
+		}
+
+		/* Track marks and motion left to drive in immediate mode. Rewind and unload
+		 * write buffered data before moving */
+		if(job->flags & MODE_IMMEDIATE)
+		{
+			if( (op->code == OP_WRITE_DATA_AND_FMK) ||
+				(op->code == OP_WRITE_FILEMARK) ||
+				(op->code == OP_WRITE_SETMARK) )
+			{
+				s->sync_pending = 1;
+			}
+			if( (op->code == OP_MOVE_TO_ORIGIN) ||
+				(op->code == OP_LOAD_MEDIA) ||
+				(op->code == OP_UNLOAD_MEDIA) )
+			{
+				s->motion_pending = 1;
+			}
+		}
+		if( (op->code == OP_FLUSH_BUFFER) ||
+			(op->code == OP_MOVE_TO_ORIGIN) ||
+			(op->code == OP_UNLOAD_MEDIA) )
+		{
+			s->sync_pending = 0;
+		}
+
+		op_index++;
+	}
+
+	/* Wait for allocation if positioning failed */
+	if(alloc.h_thread != NULL)
+		session_join_buffer(s, &alloc);
+
+	/* Flush marks written in immediate mode, so write errors are reported by this job */
+	if(s->sync_pending)
+	{
+		struct tape_operation flush_op;
+
+		memset(&flush_op, 0, sizeof(flush_op));
+		flush_op.code = OP_FLUSH_BUFFER;
+
+		session_wait_ready(s);
+		if(!tape_operation_execute(mf, NULL, &flush_op, s->h_tape,
+			s->have_drive_info ? &(s->drive) : NULL, &(s->state), 0))
+		{
+			success = 0;
+		}
+		s->sync_pending = 0;
+	}
+
+	/* Display number of cancelled operations */
+	op_remaining = job->op_count - op_index;
+	if(op_remaining >= 2) {
+		msg_print(mf, MSG_INFO,
+			_T("Execution of %u subsequent operation%s was cancelled.\n"),
+			op_remaining - 1, (op_remaining == 2) ? _T("") : _T("s"));
+	}
+
+	/* Mark session idle */
+	if(s->use_stats)
+		stats_slot_set_operation(s->stats.slot, STATS_STATE_IDLE, 0, 0, NULL);
+
+	return success;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Free buffer and close device */
+void tape_session_close(struct tape_session *s)
+{
+	/* Free data buffer */
+	if(s->have_io_buffer)
+		tape_io_cleanup(&(s->io_ctx));
+
+	/* Release statistics slot */
+	if(s->use_stats)
+		stats_shm_close(&(s->stats));
+
+	/* Close device */
+	if(s->h_tape != INVALID_HANDLE_VALUE)
+		CloseHandle(s->h_tape);
+
+	s->have_io_buffer = 0;
+	s->use_stats = 0;
+	s->h_tape = INVALID_HANDLE_VALUE;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
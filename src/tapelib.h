@@ -0,0 +1,99 @@
+/* ---------------------------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <windows.h>
+#include "util/msgfilt.h"
+#include "tapeio/tapeio.h"
+#include "tapeio/statshm.h"
+#include "cmdline.h"
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Wait for rewind or load started in immediate mode (polling drive status) */
+#define SESSION_READY_POLL_INTERVAL	500
+#define SESSION_READY_TIMEOUT		(15UL * 60 * 1000)
+
+/* Tape session: drive opened once and used by sequence of jobs. Drive and media information,
+ * data buffer and statistics slot are kept between jobs. Job is operation list in
+ * cmd_line_args (filled by parse_job_arguments or command line parser). */
+
+struct tape_session
+{
+	struct msg_filter *mf;				/* Message output */
+
+	/* Device */
+	TCHAR tape_device[16];
+	HANDLE h_tape;
+	int use_windows_buffering;
+
+	/* Drive and media information */
+	int have_drive_info;
+	int have_media_info;
+	TAPE_GET_DRIVE_PARAMETERS drive;
+	TAPE_GET_MEDIA_PARAMETERS media;
+	int media_queried;					/* Media information queried for next job */
+
+	/* Parameters and position cached during job (seeded from information above
+	 * only when media was queried for this job, it can be changed between jobs) */
+	struct tape_state state;
+
+	/* Immediate mode (--immediate) */
+	int sync_pending;					/* Marks written without flushing drive buffer */
+	int motion_pending;					/* Rewind or load can be in progress */
+
+	/* Data buffer (allocated by first job reading or writing data) */
+	unsigned __int64 buffer_size;
+	unsigned int io_block_size;
+	unsigned int io_queue_size;
+	unsigned __int64 mem_budget;
+	int prefault;
+	int have_io_buffer;
+	struct tape_io_ctx io_ctx;
+
+	/* Statistics for tapectl --monitor */
+	int use_stats;
+	struct stats_shm stats;
+
+	/* Transfer progress callback */
+	copy_progress_cb progress_cb;
+	void *progress_param;
+};
+
+/* ---------------------------------------------------------------------------------------------- */
+
+/* Initialize session with device and buffer settings (device not opened yet) */
+void tape_session_init(
+	struct tape_session *s,
+	struct msg_filter *mf,				/* message buffer */
+	const struct cmd_line_args *settings	/* device name, buffer and I/O settings */
+	);
+
+/* Open tape device */
+int tape_session_open(struct tape_session *s);
+
+/* Query drive and media information (missing media is not an error) */
+int tape_session_query_info(struct tape_session *s);
+
+/* Query media information only (media can be changed between jobs) */
+int tape_session_query_media(struct tape_session *s);
+
+/* List drive and media information (-i) */
+void tape_session_list_info(struct tape_session *s, struct cmd_line_args *job);
+
+/* Set output for messages of next jobs */
+void tape_session_set_output(struct tape_session *s, struct msg_filter *mf);
+
+/* Set transfer progress callback for next jobs (can be NULL) */
+void tape_session_set_progress(struct tape_session *s, copy_progress_cb progress_cb, void *param);
+
+/* Check job operations list and get confirmation if needed */
+int tape_session_check(struct tape_session *s, struct cmd_line_args *job);
+
+/* Execute job operations list */
+int tape_session_run(struct tape_session *s, struct cmd_line_args *job);
+
+/* Free buffer and close device */
+void tape_session_close(struct tape_session *s);
+
+/* ---------------------------------------------------------------------------------------------- */
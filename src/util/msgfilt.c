@@ -171,18 +171,26 @@ static int msg_append_v(struct msg_filter *mf, int level, const TCHAR *fmt, va_l
 
 /* ---------------------------------------------------------------------------------------------- */
 
-/* Print title before message */
-static void print_msg_title(struct msg_filter *mf, int level)
+/* Print message with prefix and title in single write (messages from different
+ * threads are not mixed within line) */
+static void print_msg(struct msg_filter *mf, int level, const TCHAR *str)
 {
+	const TCHAR *title;
+
 	switch(level)
 	{
 	case MSG_ERROR:
-		_fputts(_T("ERROR: "), mf->stream);
+		title = _T("ERROR: ");
 		break;
 	case MSG_WARNING:
-		_fputts(_T("Warning: "), mf->stream);
+		title = _T("Warning: ");
+		break;
+	default:
+		title = _T("");
 		break;
 	}
+
+	_ftprintf(mf->stream, _T("%s%s%s"), (mf->prefix != NULL) ? mf->prefix : _T(""), title, str);
 }
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -193,6 +201,14 @@ int msg_print(struct msg_filter *mf, int level, const TCHAR *fmt, ...)
 	va_list ap;
 	int success;
 
+	/* Keep messages of worker thread until owner flushes them */
+	if(mf->defer) {
+		va_start(ap, fmt);
+		success = msg_append_v(mf, level, fmt, ap);
+		va_end(ap);
+		return 0;
+	}
+
 	msg_flush(mf);
 
 	if(level > mf->report_level)
@@ -203,8 +219,7 @@ int msg_print(struct msg_filter *mf, int level, const TCHAR *fmt, ...)
 	va_end(ap);
 
 	if(success) {
-		print_msg_title(mf, level);
-		_fputts(mf->tmpbuf, mf->stream);
+		print_msg(mf, level, mf->tmpbuf);
 	} else {
 		_fputts(_T("Not enough memory to format message?"), mf->stream);
 	}
@@ -240,8 +255,7 @@ int msg_flush(struct msg_filter *mf)
 		if(mf->items[i].level <= mf->report_level)
 		{
 			/* Write message text */
-			print_msg_title(mf, mf->items[i].level);
-			_fputts(mf->items[i].str, mf->stream);
+			print_msg(mf, mf->items[i].level, mf->items[i].str);
 		}
 		free(mf->items[i].str); /* free messages */
 	}
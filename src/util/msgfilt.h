@@ -30,6 +30,7 @@ struct msg_filter
 {
 	FILE *stream;
 	int report_level;
+	const TCHAR *prefix;		/* printed before each message (can be NULL) */
 
 	TCHAR *winerrbuf;
 	size_t winerrcap;
@@ -43,6 +44,7 @@ struct msg_filter
 	size_t itemcap;
 
 	int out_of_memory;
+	int defer;					/* msg_print buffers messages until msg_flush */
 };
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -6,12 +6,28 @@
 
 /* ---------------------------------------------------------------------------------------------- */
 
+/* Stream for prompt messages (stdout if not set) */
+static FILE *prompt_stream;
+
+/* Set stream for prompt messages (when standard output carries data) */
+void prompt_set_output(FILE *stream)
+{
+	prompt_stream = stream;
+}
+
+static FILE *prompt_output(void)
+{
+	return (prompt_stream != NULL) ? prompt_stream : stdout;
+}
+
+/* ---------------------------------------------------------------------------------------------- */
+
 /* Ask user to confirm something */
 int prompt(const TCHAR *title, int yes_default)
 {
 	TCHAR answer[16];
 
-	_tprintf(yes_default ? _T("%s [Y/n] ") : _T("%s [y/N] "), title);
+	_ftprintf(prompt_output(), yes_default ? _T("%s [Y/n] ") : _T("%s [y/N] "), title);
 	_fgetts(answer, 16, stdin);
 	return ( (answer[0] == 'y') || (answer[0] == _T('Y')) || 
 		((answer[0] == _T('\n')) && yes_default) );
@@ -43,7 +59,7 @@ int prompt_with_countdown(const TCHAR *title)
 	SetConsoleCtrlHandler(prompt_abort_handler, TRUE);
 	for(count = 10; count >= 0; count--)
 	{
-		_tprintf(_T("\r%s Press Ctrl+C to abort [%u]... "), title, count);
+		_ftprintf(prompt_output(), _T("\r%s Press Ctrl+C to abort [%u]... "), title, count);
 		Sleep(1000);
 		if(!confirm_prompt)
 			break;
@@ -51,9 +67,9 @@ int prompt_with_countdown(const TCHAR *title)
 	SetConsoleCtrlHandler(prompt_abort_handler, FALSE);
 
 	if(!confirm_prompt) {
-		_putts(_T("Aborted."));
+		_fputts(_T("Aborted.\n"), prompt_output());
 	} else {
-		_putts(_T("Continuing.\n"));
+		_fputts(_T("Continuing.\n\n"), prompt_output());
 	}
 
 	return confirm_prompt;
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <stdio.h>
 #include <tchar.h>
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -12,4 +13,7 @@ int prompt(const TCHAR *title, int yes_default);
 /* Wait few seconds before continuing to allow user to cancel */
 int prompt_with_countdown(const TCHAR *title);
 
+/* Set stream for prompt messages (when standard output carries data) */
+void prompt_set_output(FILE *stream);
+
 /* ---------------------------------------------------------------------------------------------- */